@@ -7,6 +7,7 @@ SCLOrkConfab {
 	classvar assetErrorFunc;
 	classvar assetFoundFunc;
 	classvar assetLoadedFunc;
+	classvar assetUpstreamFunc;
 	classvar listFoundFunc;
 	classvar listErrorFunc;
 	classvar listItemsFunc;
@@ -15,6 +16,7 @@ SCLOrkConfab {
 	classvar findCallbackMap;
 	classvar loadCallbackMap;
 	classvar listCallbackMap;
+	classvar upstreamCallback;
 
 	*start { |
 		confabBindPort = 4248,
@@ -44,6 +46,12 @@ SCLOrkConfab {
 		addSerial = addSerial + 1;
 	}
 
+	// Added Assets are stored locally and sent upstream in the background. The callback is called with the Asset key,
+	// one of \queued, \sending, \retrying, \done, or \failed, and the number of chunks sent so far out of the total.
+	*setUpstreamCallback { |callback|
+		upstreamCallback = callback;
+	}
+
 	*findAssetById { |id, callback|
 		findCallbackMap.put(id, callback);
 		confab.sendMsg('/assetFind', id);
@@ -155,6 +163,19 @@ SCLOrkConfab {
 		'/assetLoaded',
 		recvPort: recvPort);
 
+		assetUpstreamFunc = OSCFunc.new({ |msg, time, addr|
+			var key = msg[1];
+			var state = msg[2];
+			var chunksSent = msg[3];
+			var chunks = msg[4];
+
+			if (upstreamCallback.notNil, {
+				upstreamCallback.value(key.asSymbol, state.asSymbol, chunksSent, chunks);
+			});
+		},
+		'/assetUpstream',
+		recvPort: recvPort);
+
 		listFoundFunc = OSCFunc.new({ |msg, time, addr|
 			var listName = msg[1];
 			var listKey = msg[2];
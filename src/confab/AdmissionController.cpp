@@ -0,0 +1,93 @@
+#include "AdmissionController.hpp"
+
+#include <algorithm>
+
+namespace Confab {
+
+AdmissionController::Ticket::Ticket(AdmissionController* controller, RequestClass requestClass,
+    const std::string& peer) :
+    m_controller(controller),
+    m_requestClass(requestClass),
+    m_peer(peer),
+    m_started(false) {
+}
+
+AdmissionController::Ticket::~Ticket() {
+    m_controller->release(m_requestClass, m_peer, m_started);
+}
+
+void AdmissionController::Ticket::start() {
+    if (!m_started) {
+        m_started = true;
+        m_controller->start(m_requestClass);
+    }
+}
+
+AdmissionController::AdmissionController(const Limits& limits) :
+    m_limits(limits),
+    m_stats() {
+    for (size_t i = 0; i < kNumClasses; ++i) {
+        m_limits.global[i] = std::max<size_t>(m_limits.global[i], 1);
+        m_limits.perPeer[i] = std::max<size_t>(m_limits.perPeer[i], 1);
+    }
+}
+
+std::shared_ptr<AdmissionController::Ticket> AdmissionController::admit(RequestClass requestClass,
+    const std::string& peer) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ClassStats& stats = m_stats[requestClass];
+    size_t& peerCount = m_peerCounts[requestClass][peer];
+    if (stats.queued + stats.running >= m_limits.global[requestClass] ||
+        peerCount >= m_limits.perPeer[requestClass]) {
+        if (peerCount == 0) {
+            m_peerCounts[requestClass].erase(peer);
+        }
+        ++stats.rejected;
+        return nullptr;
+    }
+
+    ++peerCount;
+    ++stats.queued;
+    ++stats.admitted;
+    return std::shared_ptr<Ticket>(new Ticket(this, requestClass, peer));
+}
+
+AdmissionController::ClassStats AdmissionController::stats(RequestClass requestClass) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats[requestClass];
+}
+
+// static
+const char* AdmissionController::className(RequestClass requestClass) {
+    switch (requestClass) {
+        case kMetadata:
+            return "metadata";
+        case kList:
+            return "list";
+        case kBulk:
+            return "bulk";
+        default:
+            return "unknown";
+    }
+}
+
+void AdmissionController::start(RequestClass requestClass) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_stats[requestClass].queued;
+    ++m_stats[requestClass].running;
+}
+
+void AdmissionController::release(RequestClass requestClass, const std::string& peer, bool started) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (started) {
+        --m_stats[requestClass].running;
+    } else {
+        --m_stats[requestClass].queued;
+    }
+    auto peerCount = m_peerCounts[requestClass].find(peer);
+    if (peerCount != m_peerCounts[requestClass].end() && --peerCount->second == 0) {
+        m_peerCounts[requestClass].erase(peerCount);
+    }
+}
+
+}  // namespace Confab
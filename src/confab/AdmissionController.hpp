@@ -0,0 +1,118 @@
+#ifndef SRC_CONFAB_ADMISSION_CONTROLLER_HPP_
+#define SRC_CONFAB_ADMISSION_CONTROLLER_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Confab {
+
+/*! Bounds the number of requests of each class the server will accept at once, both in total and from any one peer,
+ * so that overload is answered quickly with a rejection instead of growing the worker queues without limit.
+ */
+class AdmissionController {
+public:
+    /*! The priority classes requests are sorted into by route, in descending order of priority.
+     */
+    enum RequestClass : size_t {
+        kMetadata = 0,  //!< Asset and name lookups and stores.
+        kList = 1,      //!< List reads and updates.
+        kBulk = 2,      //!< AssetData chunk transfers.
+        kNumClasses = 3
+    };
+
+    /*! Concurrency limits for each request class. A request counts against its limits from admission until its
+     * response is sent. The defaults match those of the confab-server command line flags.
+     */
+    struct Limits {
+        //! Maximum requests of each class from all peers combined.
+        std::array<size_t, kNumClasses> global = { { 256, 256, 32 } };
+        //! Maximum requests of each class from a single peer.
+        std::array<size_t, kNumClasses> perPeer = { { 64, 64, 8 } };
+    };
+
+    /*! A point-in-time copy of the counters for one request class.
+     */
+    struct ClassStats {
+        size_t queued;       //!< Admitted requests waiting for a worker thread.
+        size_t running;      //!< Admitted requests running on a worker thread.
+        uint64_t admitted;   //!< Total requests admitted.
+        uint64_t rejected;   //!< Total requests rejected for exceeding a limit.
+    };
+
+    /*! Holds one admitted request's place against the limits, releasing it when destroyed.
+     */
+    class Ticket {
+    public:
+        /*! Marks the request as having left the queue and started running on a worker thread.
+         */
+        void start();
+
+        ~Ticket();
+
+        /// @cond UNDOCUMENTED
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+        /// @endcond UNDOCUMENTED
+
+    private:
+        friend class AdmissionController;
+        Ticket(AdmissionController* controller, RequestClass requestClass, const std::string& peer);
+
+        AdmissionController* m_controller;
+        RequestClass m_requestClass;
+        std::string m_peer;
+        bool m_started;
+    };
+
+    /*! Constructs a controller with nothing admitted.
+     *
+     * \param limits The concurrency limits to enforce. A limit of zero is treated as one.
+     */
+    explicit AdmissionController(const Limits& limits);
+
+    /*! Admits a request if doing so keeps it within both the global and per-peer limits for its class.
+     *
+     * \param requestClass The class of the request.
+     * \param peer Identifies the client, typically the remote host address.
+     * \return A ticket to hold until the response is sent, or nullptr if the request should be rejected.
+     */
+    std::shared_ptr<Ticket> admit(RequestClass requestClass, const std::string& peer);
+
+    /*! Copies the current counters for a request class.
+     *
+     * \param requestClass The class to report on.
+     * \return The counters.
+     */
+    ClassStats stats(RequestClass requestClass);
+
+    /*! A short lower-case name for a request class, for logging and metrics.
+     *
+     * \param requestClass The class to name.
+     * \return The class name.
+     */
+    static const char* className(RequestClass requestClass);
+
+    /// @cond UNDOCUMENTED
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator=(const AdmissionController&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    void start(RequestClass requestClass);
+    void release(RequestClass requestClass, const std::string& peer, bool started);
+
+    Limits m_limits;
+
+    std::mutex m_mutex;
+    std::array<ClassStats, kNumClasses> m_stats;
+    std::array<std::unordered_map<std::string, size_t>, kNumClasses> m_peerCounts;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_ADMISSION_CONTROLLER_HPP_
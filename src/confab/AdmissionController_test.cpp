@@ -0,0 +1,168 @@
+#include "AdmissionController.hpp"
+
+#include "Asset.hpp"
+#include "AssetDatabase.hpp"
+#include "Constants.hpp"
+#include "SizedPointer.hpp"
+#include "TestServer.hpp"
+#include "schemas/FlatList_generated.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace fs = std::experimental::filesystem;
+
+using Confab::AdmissionController;
+
+namespace {
+
+// Loopback port for the test server.
+const int kServerPort = 19170;
+
+AdmissionController::Limits limits(size_t global, size_t perPeer) {
+    AdmissionController::Limits limits;
+    limits.global = { { global, global, global } };
+    limits.perPeer = { { perPeer, perPeer, perPeer } };
+    return limits;
+}
+
+// Sends a GET request on a new connection to the test server, returning the connection, or -1 on error.
+int sendGet(const std::string& path) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(kServerPort);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        return -1;
+    }
+    timeval timeout = { 5, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    if (::send(fd, request.data(), request.size(), 0) != static_cast<ssize_t>(request.size())) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads the status line and headers of a response.
+std::string readHeaders(int fd) {
+    std::string response;
+    char buffer[1024];
+    while (response.find("\r\n\r\n") == std::string::npos) {
+        ssize_t bytesRead = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (bytesRead <= 0) {
+            break;
+        }
+        response.append(buffer, bytesRead);
+    }
+    return response;
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, EnforcesGlobalLimit) {
+    AdmissionController controller(limits(2, 2));
+    auto first = controller.admit(AdmissionController::kBulk, "a");
+    auto second = controller.admit(AdmissionController::kBulk, "b");
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(second);
+    EXPECT_FALSE(controller.admit(AdmissionController::kBulk, "c"));
+
+    // Each class has its own limits.
+    EXPECT_TRUE(controller.admit(AdmissionController::kMetadata, "c"));
+
+    AdmissionController::ClassStats stats = controller.stats(AdmissionController::kBulk);
+    EXPECT_EQ(2u, stats.queued);
+    EXPECT_EQ(0u, stats.running);
+    EXPECT_EQ(2u, stats.admitted);
+    EXPECT_EQ(1u, stats.rejected);
+}
+
+TEST(AdmissionControllerTest, EnforcesPerPeerLimit) {
+    AdmissionController controller(limits(8, 2));
+    auto first = controller.admit(AdmissionController::kList, "a");
+    auto second = controller.admit(AdmissionController::kList, "a");
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(second);
+    EXPECT_FALSE(controller.admit(AdmissionController::kList, "a"));
+    EXPECT_TRUE(controller.admit(AdmissionController::kList, "b"));
+}
+
+TEST(AdmissionControllerTest, ReleasingTicketFreesItsPlace) {
+    AdmissionController controller(limits(1, 1));
+    {
+        auto ticket = controller.admit(AdmissionController::kBulk, "a");
+        ASSERT_TRUE(ticket);
+        ticket->start();
+        ticket->start();
+        AdmissionController::ClassStats stats = controller.stats(AdmissionController::kBulk);
+        EXPECT_EQ(0u, stats.queued);
+        EXPECT_EQ(1u, stats.running);
+        EXPECT_FALSE(controller.admit(AdmissionController::kBulk, "b"));
+    }
+    AdmissionController::ClassStats stats = controller.stats(AdmissionController::kBulk);
+    EXPECT_EQ(0u, stats.queued);
+    EXPECT_EQ(0u, stats.running);
+
+    // Released before starting, the ticket comes off the queue instead.
+    controller.admit(AdmissionController::kBulk, "b");
+    EXPECT_EQ(0u, controller.stats(AdmissionController::kBulk).queued);
+    EXPECT_TRUE(controller.admit(AdmissionController::kBulk, "a"));
+}
+
+TEST(AdmissionControllerTest, ZeroLimitAdmitsOne) {
+    AdmissionController controller(limits(0, 0));
+    auto ticket = controller.admit(AdmissionController::kMetadata, "a");
+    EXPECT_TRUE(ticket);
+    EXPECT_FALSE(controller.admit(AdmissionController::kMetadata, "a"));
+}
+
+TEST(AdmissionControllerTest, ServerRejectsWithRetryAfter) {
+    fs::path path = fs::temp_directory_path() / "confab-admission-controller-test";
+    fs::remove_all(path);
+    Confab::HttpEndpoint::Options options = Confab::TestServer::options(kServerPort);
+    options.maxListWatchers = 1;
+    options.listWatchTimeout = std::chrono::seconds(3);
+    Confab::TestServer server;
+    ASSERT_TRUE(server.start(path, options));
+
+    uint64_t listKey = 0x5151;
+    flatbuffers::FlatBufferBuilder builder;
+    Confab::Data::FlatListBuilder listBuilder(builder);
+    listBuilder.add_key(listKey);
+    builder.Finish(listBuilder.Finish());
+    ASSERT_TRUE(server.database()->storeList(listKey,
+        Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+
+    // The empty List holds the first watch open, using up the only place, so the second is turned away.
+    std::string watchPath = "/list/watch/" + Confab::Asset::keyToString(listKey) + "/" +
+        Confab::Asset::keyToString(Confab::kBeginList);
+    int watching = sendGet(watchPath);
+    ASSERT_GE(watching, 0);
+    ::usleep(200000);
+    int rejected = sendGet(watchPath);
+    ASSERT_GE(rejected, 0);
+    std::string response = readHeaders(rejected);
+    EXPECT_EQ(0u, response.find("HTTP/1.1 503")) << response;
+    EXPECT_NE(std::string::npos, response.find("Retry-After: 1")) << response;
+    ::close(rejected);
+
+    // The first watch times out with no entries, freeing its place.
+    EXPECT_EQ(0u, readHeaders(watching).find("HTTP/1.1 200"));
+    ::close(watching);
+
+    server.stop();
+    fs::remove_all(path);
+}
@@ -52,6 +52,11 @@ uint64_t Asset::stringToKey(const std::string& keyString) {
     return strtoull(keyString.c_str(), nullptr, 16);
 }
 
+// static
+uint64_t Asset::dataChunkSize(const Data::FlatAsset* flatAsset) {
+    return flatAsset->chunkSize() ? flatAsset->chunkSize() : kDataChunkSize;
+}
+
 Asset::Asset(Asset::Type type) :
     m_type(type),
     m_key(0),
@@ -60,6 +65,7 @@ Asset::Asset(Asset::Type type) :
     m_deprecates(0),
     m_size(0),
     m_chunks(0),
+    m_chunkSize(0),
     m_salt(0),
     m_inlineData(nullptr) {
 }
@@ -72,6 +78,7 @@ Asset::Asset(const Data::FlatAsset* flatAsset)  :
     m_deprecates(flatAsset->deprecates()),
     m_size(flatAsset->size()),
     m_chunks(flatAsset->chunks()),
+    m_chunkSize(flatAsset->chunkSize()),
     m_salt(flatAsset->salt()) {
 
     if (flatAsset->name()) {
@@ -86,6 +93,10 @@ Asset::Asset(const Data::FlatAsset* flatAsset)  :
         std::copy(flatAsset->lists()->begin(), flatAsset->lists()->end(), m_lists.begin());
     }
 
+    if (flatAsset->contentDefinedChunks() && flatAsset->chunkOffsets()) {
+        m_chunkOffsets.assign(flatAsset->chunkOffsets()->begin(), flatAsset->chunkOffsets()->end());
+    }
+
     if (flatAsset->inlineData()) {
         m_inlineData.reset(new uint8_t[m_size]);
         std::memcpy(m_inlineData.get(), flatAsset->inlineData()->data(), m_size);
@@ -97,6 +108,7 @@ void Asset::flatten(flatbuffers::FlatBufferBuilder& builder, const uint8_t* inli
     auto name = m_name != "" ? builder.CreateString(m_name) : 0;
     auto fileExtension = m_fileExtension != "" ? builder.CreateString(m_fileExtension) : 0;
     auto lists = m_lists.size() > 0 ? builder.CreateVector(m_lists) : 0;
+    auto chunkOffsets = m_chunkOffsets.size() > 0 ? builder.CreateVector(m_chunkOffsets) : 0;
     const uint8_t* serialInline = inlineData ? inlineData : m_inlineData.get();
     // These builder Create* calls do a byte-by-byte copy in a for loop of the source data into the builder.
     auto builderInline = serialInline != nullptr ? builder.CreateVector(serialInline, m_size) : 0;
@@ -130,6 +142,13 @@ void Asset::flatten(flatbuffers::FlatBufferBuilder& builder, const uint8_t* inli
     if (m_chunks) {
         assetBuilder.add_chunks(m_chunks);
     }
+    if (m_chunkSize) {
+        assetBuilder.add_chunkSize(m_chunkSize);
+    }
+    if (!chunkOffsets.IsNull()) {
+        assetBuilder.add_contentDefinedChunks(true);
+        assetBuilder.add_chunkOffsets(chunkOffsets);
+    }
     if (m_salt) {
         assetBuilder.add_salt(m_salt);
     }
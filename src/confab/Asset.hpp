@@ -60,6 +60,14 @@ public:
      */
     static uint64_t stringToKey(const std::string& keyString);
 
+    /*! Returns the size of the AssetData chunks of a serialized Asset, accounting for Assets recorded before the chunk
+     * size was stored with each Asset.
+     *
+     * \param flatAsset The serialized FlatAsset.
+     * \return The size in bytes of every AssetData chunk but the last.
+     */
+    static uint64_t dataChunkSize(const Data::FlatAsset* flatAsset);
+
     /*! Constructs a new empty Asset.
      *
      * \param type The type of asset to make.
@@ -186,6 +194,31 @@ public:
      */
     uint64_t chunks() const { return m_chunks; }
 
+    /*! Sets the size of the individual AssetData chunks for this Asset.
+     *
+     * \param chunkSize The size in bytes of every chunk but the last, which may be smaller.
+     */
+    void setChunkSize(uint64_t chunkSize) { m_chunkSize = chunkSize; }
+
+    /*! The size of the AssetData chunks stored for this Asset, or zero if not set.
+     *
+     * \return The size in bytes of every chunk but the last.
+     */
+    uint64_t chunkSize() const { return m_chunkSize; }
+
+    /*! Records that the AssetData chunks were split at content-defined boundaries, at the given offsets. The chunk
+     * size should then be set to the largest size of any chunk.
+     *
+     * \param chunkOffsets The offset of the start of every chunk, the first being zero.
+     */
+    void setChunkOffsets(const std::vector<uint64_t>& chunkOffsets) { m_chunkOffsets = chunkOffsets; }
+
+    /*! The offsets of the AssetData chunks, if they were split at content-defined boundaries.
+     *
+     * \return The offset of the start of every chunk, or an empty vector for chunks of a fixed size.
+     */
+    const std::vector<uint64_t>& chunkOffsets() const { return m_chunkOffsets; }
+
     /*! Adds a salt value to the Asset.
      *
      * \param salt The salt value to add. It will be used as the starting state in hash computations.
@@ -255,6 +288,8 @@ private:
     uint64_t m_deprecates;
     uint64_t m_size;
     uint64_t m_chunks;
+    uint64_t m_chunkSize;
+    std::vector<uint64_t> m_chunkOffsets;
     std::vector<uint64_t> m_lists;
 
     uint64_t m_salt;
@@ -1,7 +1,11 @@
 #include "AssetDatabase.hpp"
 
 #include "Asset.hpp"
+#include "ChunkLayout.hpp"
 #include "Constants.hpp"
+#include "EventLog.hpp"
+#include "Metrics.hpp"
+#include "Tracer.hpp"
 #include "schemas/FlatAsset_generated.h"
 #include "schemas/FlatAssetData_generated.h"
 #include "schemas/FlatList_generated.h"
@@ -10,7 +14,9 @@
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
+#include "xxhash.h"
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cstring>
@@ -30,15 +36,28 @@ static const size_t kAssetKeySize = 9;
  */
 static const size_t kAssetDataKeySize = 17;
 
+/*! The size in bytes of the key of a chunk hash entry, the same as an AssetData key.
+ */
+static const size_t kChunkHashKeySize = 17;
+
 /*! List key size, 9 bytes with one for the kList prefix, followed by 8 bytes of List key.
  */
 static const size_t kListKeySize = 9;
 
+/*! Upload session key size, 9 bytes with one for the kUpload prefix, followed by 8 bytes of upload id.
+ */
+static const size_t kUploadKeySize = 9;
+
+/*! Upstream request key size, 9 bytes with one for the kUpstream prefix, followed by an 8-byte time stamp.
+ */
+static const size_t kUpstreamKeySize = 9;
+
 /*! Addition to lists is done by creating a new key (with no associated value) constructed from the kListEntry prefix,
- * followed by the 64-bit List unique identifier, followed by a 64-bit nanosecond time stamp, which is intended to keep
+ * followed by the 64-bit List unique identifier, followed by a 64-bit microsecond time stamp, which is intended to keep
  * a monotonically increasing part of the key for lexical ordering, followed at last by the key of the data being added,
  * to avoid the (small) possibility of key collision between two different threads adding a list element at the exact
- * same time. This makes for a total key size of (3 * 8) + 1 = 25 bytes.
+ * same time. This makes for a total key size of (3 * 8) + 1 = 25 bytes. The time stamp is stored big-endian, so that
+ * LevelDB's bytewise key ordering matches time order.
  */
 static const size_t kListEntryKeySize = 25;
 
@@ -54,6 +73,12 @@ enum KeyPrefix : char {
      */
     kAssetData = 'd',
 
+    /*! Prefix for the content hashes of AssetData chunks, kept so that delta plans need not load the chunks. Key is the
+     * kChunkHash prefix, followed by 8 bytes of Asset key, followed by the 8-byte big-endian chunk number, so the
+     * hashes of an Asset sort in chunk order. The value is the 8-byte XXH64 of the chunk contents.
+     */
+    kChunkHash = 'h',
+
     /*! Prefix for List metadata entries. Key is the kList prefix, followed by 8 bytes of the List key.
      */
     kList = 'l',
@@ -61,9 +86,35 @@ enum KeyPrefix : char {
     /*! Prefix for List name entries. Key is the kListEntry prefix, followed by 8 bytes of the List key, followed by
      * an 8-byte timestamp, then the final 8 bytes of Asset key. There are no data associated with these keys.
      */
-    kListEntry = 'e'
+    kListEntry = 'e',
+
+    /*! Prefix for staged AssetData entries of uploads not yet committed. Key is the kStagedData prefix, followed by 8
+     * bytes of upload id, followed by 8 bytes of the chunk number, so the same size as an AssetData key.
+     */
+    kStagedData = 's',
+
+    /*! Prefix for upload sessions, which track the staged uploads in progress. Key is the kUpload prefix, followed by 8
+     * bytes of upload id, and the value is the 8-byte time in microseconds since the epoch a chunk was last staged.
+     */
+    kUpload = 'u',
+
+    /*! Prefix for requests to push an Asset upstream. Key is the kUpstream prefix, followed by an 8-byte big-endian
+     * time stamp in microseconds since the epoch, so requests sort oldest first, and the value is the 8-byte Asset key.
+     */
+    kUpstream = 0x0a,
+
+    /*! The key of the database format version record, a single byte with no further key data. The value is the 4-byte
+     * version, see kFormatVersion.
+     */
+    kFormat = 'v'
 };
 
+/*! Version of the layout of keys in the database, stored under the kFormat key. Version 1, which has no kFormat record,
+ * stored List entry time stamps in host byte order, so they did not sort in time order. Version 2 stores them
+ * big-endian. Version 3 adds a kChunkHash entry for every AssetData chunk.
+ */
+static const uint32_t kFormatVersion = 3;
+
 static const char* kAssetNamePrefix = "na";
 static const char* kListNamePrefix = "nl";
 
@@ -71,6 +122,17 @@ static const char* kListNamePrefix = "nl";
  */
 static const size_t kAssetMaxListEntries = 8;
 
+/*! Returns false, and logs an error, if the Asset names more Lists than the database will add it to.
+ */
+static bool checkListCount(uint64_t key, const Confab::Data::FlatAsset* flatAsset) {
+    if (flatAsset->lists() && flatAsset->lists()->size() > kAssetMaxListEntries) {
+        LOG(ERROR) << "rejecting Asset " << Confab::Asset::keyToString(key) << " with " << flatAsset->lists()->size()
+            << " Lists, more than the maximum of " << kAssetMaxListEntries;
+        return false;
+    }
+    return true;
+}
+
 /*! Writes a byte sequence in keyOut suitable for storing or retrieving an Asset record from the database.
  *
  * \param key The key to format.
@@ -93,11 +155,169 @@ inline void makeAssetDataKey(uint64_t key, uint64_t chunkNumber, char* keyOut) n
     std::memcpy(keyOut + 9, reinterpret_cast<const char*>(&chunkNumber), sizeof(uint64_t));
 }
 
+/*! Writes a byte sequence in keyOut suitable for storing or retrieving a staged AssetData record from the database.
+ *
+ * \param uploadId The upload id to format.
+ * \param chunkNumber The number in the sequence of chunks to include in the key.
+ * \param keyOut A pointer to where to store the key sequence, must be at least kAssetDataKeySize in size.
+ */
+inline void makeStagedDataKey(uint64_t uploadId, uint64_t chunkNumber, char* keyOut) noexcept {
+    keyOut[0] = kStagedData;
+    std::memcpy(keyOut + 1, reinterpret_cast<const char*>(&uploadId), sizeof(uint64_t));
+    std::memcpy(keyOut + 9, reinterpret_cast<const char*>(&chunkNumber), sizeof(uint64_t));
+}
+
+inline void makeUploadKey(uint64_t uploadId, char* keyOut) noexcept {
+    keyOut[0] = kUpload;
+    std::memcpy(keyOut + 1, reinterpret_cast<const char*>(&uploadId), sizeof(uint64_t));
+}
+
 inline void makeListKey(uint64_t key, char* keyOut) noexcept {
     keyOut[0] = kList;
     std::memcpy(keyOut + 1, reinterpret_cast<const char*>(&key), sizeof(uint64_t));
 }
 
+/*! Writes a 64-bit value as 8 big-endian bytes, so that bytewise comparison of the output matches numeric order.
+ *
+ * \param value The value to write.
+ * \param out A pointer to where to store the 8 bytes.
+ */
+inline void storeBigEndian(uint64_t value, char* out) noexcept {
+    for (int i = 7; i >= 0; --i) {
+        out[i] = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+/*! Reads 8 big-endian bytes as written by storeBigEndian().
+ *
+ * \param in A pointer to the 8 bytes to read.
+ * \return The decoded value.
+ */
+inline uint64_t loadBigEndian(const char* in) noexcept {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | static_cast<uint8_t>(in[i]);
+    }
+    return value;
+}
+
+/*! Writes a byte sequence in keyOut suitable for storing or retrieving the content hash of an AssetData chunk.
+ *
+ * \param key The key to format.
+ * \param chunkNumber The number in the sequence of chunks to include in the key.
+ * \param keyOut A pointer to where to store the key sequence, must be at least kChunkHashKeySize in size.
+ */
+inline void makeChunkHashKey(uint64_t key, uint64_t chunkNumber, char* keyOut) noexcept {
+    keyOut[0] = kChunkHash;
+    std::memcpy(keyOut + 1, reinterpret_cast<const char*>(&key), sizeof(uint64_t));
+    storeBigEndian(chunkNumber, keyOut + 9);
+}
+
+/*! Hashes the contents of a serialized FlatAssetData chunk, as stored under its kChunkHash key.
+ *
+ * \param flatAssetData The serialized chunk.
+ * \return The XXH64 of the chunk data.
+ */
+inline uint64_t hashChunkContents(const char* flatAssetData) {
+    const Confab::Data::FlatAssetData* chunk = Confab::Data::GetFlatAssetData(flatAssetData);
+    return chunk->data() ? XXH64(chunk->data()->data(), chunk->data()->size(), 0) : XXH64(nullptr, 0, 0);
+}
+
+/*! Metric label values for each AssetDatabase::Operation, in order.
+ */
+static const char* kOperationNames[] = {
+    "find_asset",
+    "find_assets",
+    "find_named_asset",
+    "store_asset",
+    "load_asset_data_chunk",
+    "store_asset_data_chunk",
+    "load_chunk_hashes",
+    "store_list",
+    "load_list",
+    "find_named_list",
+    "get_list_next",
+    "store_staged_data_chunk",
+    "commit_upload",
+    "find_missing_staged_chunks",
+    "expire_uploads",
+    "queue_upstream",
+    "get_upstream_queue",
+    "remove_upstream"
+};
+
+/*! Wraps the LevelDB block cache to count lookup hits and misses, which LevelDB doesn't report itself.
+ */
+class MeteredCache : public leveldb::Cache {
+public:
+    explicit MeteredCache(leveldb::Cache* cache) :
+        m_cache(cache),
+        m_hits(Confab::MetricsRegistry::global().counter("confab_database_block_cache_lookups_total",
+            "LevelDB block cache lookups.", "result=\"hit\"")),
+        m_misses(Confab::MetricsRegistry::global().counter("confab_database_block_cache_lookups_total",
+            "LevelDB block cache lookups.", "result=\"miss\"")) {
+        Confab::Counter* hits = m_hits;
+        Confab::Counter* misses = m_misses;
+        Confab::MetricsRegistry::global().gauge("confab_database_block_cache_hit_ratio",
+            "Fraction of LevelDB block cache lookups that hit, since startup.", "", [hits, misses] {
+            uint64_t lookups = hits->value() + misses->value();
+            return lookups ? static_cast<double>(hits->value()) / lookups : 0.0;
+        });
+    }
+
+    ~MeteredCache() override { }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge,
+        void (*deleter)(const leveldb::Slice& key, void* value)) override {
+        return m_cache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key) override {
+        Handle* handle = m_cache->Lookup(key);
+        if (handle) {
+            m_hits->add();
+        } else {
+            m_misses->add();
+        }
+        return handle;
+    }
+
+    void Release(Handle* handle) override { m_cache->Release(handle); }
+    void* Value(Handle* handle) override { return m_cache->Value(handle); }
+    void Erase(const leveldb::Slice& key) override { m_cache->Erase(key); }
+    uint64_t NewId() override { return m_cache->NewId(); }
+    void Prune() override { m_cache->Prune(); }
+    size_t TotalCharge() const override { return m_cache->TotalCharge(); }
+
+private:
+    std::unique_ptr<leveldb::Cache> m_cache;
+    Confab::Counter* m_hits;
+    Confab::Counter* m_misses;
+};
+
+/*! Times an AssetDatabase operation into its latency histogram and, if the calling thread is tracing a request, into a
+ * span named for the operation.
+ */
+class OperationTimer {
+public:
+    OperationTimer(Confab::Histogram* latency, const char* name) : m_timer(latency), m_span(name) { }
+
+private:
+    Confab::LatencyTimer m_timer;
+    Confab::Span m_span;
+};
+
+/*! Seeks a LevelDB iterator, timed as a span of any request being traced.
+ *
+ * \param iterator The iterator to seek.
+ * \param target The key to seek to.
+ */
+inline void tracedSeek(const std::shared_ptr<leveldb::Iterator>& iterator, const leveldb::Slice& target) {
+    Confab::Span span("leveldb_seek");
+    iterator->Seek(target);
+}
+
 inline bool iteratorMatch(std::shared_ptr<leveldb::Iterator> iterator, char* key, size_t keySize) noexcept {
     return iterator->Valid() &&
            iterator->key().size() == keySize &&
@@ -160,7 +380,14 @@ private:
 
 
 AssetDatabase::AssetDatabase() :
-    m_database(nullptr) {
+    m_database(nullptr),
+    m_lastListTimeStamp(0) {
+    static_assert(sizeof(kOperationNames) / sizeof(kOperationNames[0]) == kNumOperations,
+        "kOperationNames must name every Operation.");
+    for (size_t i = 0; i < kNumOperations; ++i) {
+        m_latency[i] = MetricsRegistry::global().histogram("confab_database_op_seconds",
+            "Latency of AssetDatabase operations.", std::string("op=\"") + kOperationNames[i] + "\"", 1e-6);
+    }
 }
 
 AssetDatabase::~AssetDatabase() {
@@ -171,7 +398,8 @@ bool AssetDatabase::open(const char* path, bool createNew, int cacheSize) {
     options.create_if_missing = createNew;
     options.error_if_exists = createNew;
     if (cacheSize > 0) {
-        options.block_cache = leveldb::NewLRUCache(cacheSize);
+        m_blockCache.reset(new MeteredCache(leveldb::NewLRUCache(cacheSize)));
+        options.block_cache = m_blockCache.get();
     }
 
     leveldb::DB* database = nullptr;
@@ -186,49 +414,157 @@ bool AssetDatabase::open(const char* path, bool createNew, int cacheSize) {
 
     m_database.reset(database);
 
+    if (!checkFormat(createNew)) {
+        m_database.reset();
+        m_blockCache.reset();
+        return false;
+    }
+
+    return true;
+}
+
+bool AssetDatabase::checkFormat(bool createNew) {
+    const char formatKey = kFormat;
+    std::string value;
+    leveldb::Status status = m_database->Get(leveldb::ReadOptions(), leveldb::Slice(&formatKey, 1), &value);
+    // A database without a format record is either new, or from version 1.
+    uint32_t version = createNew ? kFormatVersion : 1;
+    if (status.ok()) {
+        version = 0;
+        if (value.size() == sizeof(uint32_t)) {
+            std::memcpy(&version, value.data(), sizeof(uint32_t));
+        }
+        if (version == 0 || version > kFormatVersion) {
+            LOG(ERROR) << "Database format version " << version << " is not supported, expected " << kFormatVersion;
+            return false;
+        }
+        if (version == kFormatVersion) {
+            return true;
+        }
+    } else if (!status.IsNotFound()) {
+        LOG(ERROR) << "Failure reading database format version. LevelDB status: " << status.ToString();
+        return false;
+    }
+
+    // Each older version is migrated in turn, all in one batch along with recording the new version, so that a failed
+    // migration leaves the database as it was.
+    leveldb::WriteBatch batch;
+    size_t migrated = 0;
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    if (version < 2) {
+        // Rewrite every List entry key with a big-endian time stamp.
+        const char prefix = kListEntry;
+        for (iterator->Seek(leveldb::Slice(&prefix, 1)); iterator->Valid() && iterator->key()[0] == kListEntry;
+             iterator->Next()) {
+            if (iterator->key().size() != kListEntryKeySize) {
+                continue;
+            }
+            std::array<char, kListEntryKeySize> entryKey;
+            std::memcpy(entryKey.data(), iterator->key().data(), kListEntryKeySize);
+            uint64_t timeStamp = 0;
+            std::memcpy(&timeStamp, entryKey.data() + 9, sizeof(uint64_t));
+            storeBigEndian(timeStamp, entryKey.data() + 9);
+            if (iterator->key() == leveldb::Slice(entryKey.data(), kListEntryKeySize)) {
+                continue;
+            }
+            batch.Delete(iterator->key());
+            batch.Put(leveldb::Slice(entryKey.data(), kListEntryKeySize), iterator->value());
+            ++migrated;
+        }
+    }
+    if (version < 3) {
+        // Hash the contents of every AssetData chunk.
+        const char prefix = kAssetData;
+        std::array<char, kChunkHashKeySize> chunkHashKey;
+        for (iterator->Seek(leveldb::Slice(&prefix, 1)); iterator->Valid() && iterator->key()[0] == kAssetData;
+             iterator->Next()) {
+            if (iterator->key().size() != kAssetDataKeySize) {
+                continue;
+            }
+            uint64_t key = 0;
+            uint64_t chunk = 0;
+            std::memcpy(&key, iterator->key().data() + 1, sizeof(uint64_t));
+            std::memcpy(&chunk, iterator->key().data() + 9, sizeof(uint64_t));
+            makeChunkHashKey(key, chunk, chunkHashKey.data());
+            uint64_t contentHash = hashChunkContents(iterator->value().data());
+            batch.Put(leveldb::Slice(chunkHashKey.data(), kChunkHashKeySize),
+                leveldb::Slice(reinterpret_cast<const char*>(&contentHash), sizeof(uint64_t)));
+            ++migrated;
+        }
+    }
+    if (!iterator->status().ok()) {
+        LOG(ERROR) << "Failure reading database to migrate. LevelDB status: " << iterator->status().ToString();
+        return false;
+    }
+    iterator.reset();
+
+    batch.Put(leveldb::Slice(&formatKey, 1),
+        leveldb::Slice(reinterpret_cast<const char*>(&kFormatVersion), sizeof(uint32_t)));
+    status = m_database->Write(leveldb::WriteOptions(), &batch);
+    if (!status.ok()) {
+        LOG(ERROR) << "Failure writing database format version. LevelDB status: " << status.ToString();
+        return false;
+    }
+    if (migrated > 0) {
+        LOG(INFO) << "Migrated " << migrated << " records from database format version " << version << " to "
+            << kFormatVersion;
+    }
     return true;
 }
 
 void AssetDatabase::close() {
     m_database.reset();
+    m_blockCache.reset();
 }
 
 RecordPtr AssetDatabase::findAsset(uint64_t key) {
-    std::array<char, kAssetKeySize> assetKey;
-    makeAssetKey(key, assetKey.data());
-
+    OperationTimer timer(m_latency[kFindAsset], kOperationNames[kFindAsset]);
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(leveldb::Slice(assetKey.data(), kAssetKeySize));
-    if (!iteratorMatch(iterator, assetKey.data(), kAssetKeySize)) {
-        LOG(ERROR) << "Asset " << Asset::keyToString(key) << " not found in database.";
+    if (!seekAsset(iterator, key)) {
         return makeEmptyRecord();
     }
+    return RecordPtr(new DatabaseRecord(iterator));
+}
 
-    uint64_t loadedKey = key;
-    auto flatAsset = Data::GetFlatAsset(iterator->value().data());
-    while (flatAsset->deprecatedBy()) {
-        uint64_t deprecatedBy = flatAsset->deprecatedBy();
-        LOG(INFO) << "Asset " << Asset::keyToString(key) << " deprecated by " << Asset::keyToString(deprecatedBy)
-            << ", loading.";
-        makeAssetKey(deprecatedBy, assetKey.data());
-        iterator->Seek(leveldb::Slice(assetKey.data(), kAssetKeySize));
-        if (!iteratorMatch(iterator, assetKey.data(), kAssetKeySize)) {
-            LOG(ERROR) << "error loaded deprecating asset " << Asset::keyToString(deprecatedBy) << ".";
-            return makeEmptyRecord();
+size_t AssetDatabase::findAssets(const std::vector<uint64_t>& keys, std::function<void(uint64_t, RecordPtr)> callback) {
+    OperationTimer timer(m_latency[kFindAssets], kOperationNames[kFindAssets]);
+    // Sort the keys in the same order as the database stores them, which is the lexical order of the little-endian
+    // key bytes, so that the iterator moves forward through the table as much as possible. Deprecated Assets will
+    // still require a seek elsewhere.
+    std::vector<uint64_t> sortedKeys(keys);
+    std::sort(sortedKeys.begin(), sortedKeys.end(), [](uint64_t a, uint64_t b) {
+        return std::memcmp(&a, &b, sizeof(uint64_t)) < 0;
+    });
+    sortedKeys.erase(std::unique(sortedKeys.begin(), sortedKeys.end()), sortedKeys.end());
+
+    // Use a snapshot so that all of the lookups see the same database state.
+    const leveldb::Snapshot* snapshot = m_database->GetSnapshot();
+    leveldb::ReadOptions readOptions;
+    readOptions.snapshot = snapshot;
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(readOptions));
+
+    size_t found = 0;
+    for (auto key : sortedKeys) {
+        if (seekAsset(iterator, key)) {
+            ++found;
+            callback(key, RecordPtr(new DatabaseRecord(iterator)));
+        } else {
+            callback(key, makeEmptyRecord());
         }
-        flatAsset = Data::GetFlatAsset(iterator->value().data());
-        loadedKey = deprecatedBy;
     }
-    LOG(INFO) << "Loaded Asset " << Asset::keyToString(loadedKey) << " upon request to load original asset "
-        << Asset::keyToString(key);
-    return RecordPtr(new DatabaseRecord(iterator));
+
+    iterator.reset();
+    m_database->ReleaseSnapshot(snapshot);
+    logEvent(kDbAssetBatchFound, found, sortedKeys.size());
+    return found;
 }
 
 RecordPtr AssetDatabase::findNamedAsset(const std::string& name) {
+    OperationTimer timer(m_latency[kFindNamedAsset], kOperationNames[kFindNamedAsset]);
     // Look up name entry, if any.
     std::string nameKey = kAssetNamePrefix + name;
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(nameKey);
+    tracedSeek(iterator, nameKey);
     if (!iteratorMatch(iterator, nameKey.data(), nameKey.size())) {
         LOG(WARNING) << "no named asset found under name " << name;
         return makeEmptyRecord();
@@ -241,72 +577,48 @@ RecordPtr AssetDatabase::findNamedAsset(const std::string& name) {
 }
 
 bool AssetDatabase::storeAsset(uint64_t key, const SizedPointer& assetData) {
-    leveldb::WriteBatch batch;
-
-    // First we parse the Asset data to extract the name, if any.
-    const Data::FlatAsset* flatAsset = Data::GetFlatAsset(assetData.data());
-    // This string, name has to live as long as the call to the database write(), so lives out here.
-    std::string name;
-    if (flatAsset->name() && flatAsset->name()->size() > 0) {
-        name = kAssetNamePrefix + flatAsset->name()->str();
-        LOG(INFO) << "adding name '" << flatAsset->name()->data() << "' lookup to asset " << Asset::keyToString(key);
-        batch.Put(name, leveldb::Slice(reinterpret_cast<const char*>(&key), sizeof(uint64_t)));
-    }
-
-    // Add any list entries to the batch.
-    char listKeys[kListEntryKeySize * kAssetMaxListEntries];
-    uint64_t timeStamp = flatAsset->lists()->size() ?
-        std::chrono::duration_cast<std::chrono::microseconds>(
-        std::chrono::high_resolution_clock::now().time_since_epoch()).count() : 0;
-    for (auto i = 0; i < flatAsset->lists()->size(); ++i) {
-        char* listKey = listKeys + (i * kListEntryKeySize);
-        listKey[0]  = kListEntry;
-        std::memcpy(listKey + 1, flatAsset->lists()->data() + i, sizeof(uint64_t));
-        std::memcpy(listKey + 9, &timeStamp, sizeof(uint64_t));
-        std::memcpy(listKey + 17, &key, sizeof(uint64_t));
-        LOG(INFO) << "adding asset " << Asset::keyToString(key) << " to list " << Asset::keyToString(
-            flatAsset->lists()->data()[i]);
-        batch.Put(leveldb::Slice(listKey, kListEntryKeySize), leveldb::Slice());
-    }
-
-    // Store actual Asset key/value pair.
-    std::array<char, kAssetKeySize> assetKey;
-    makeAssetKey(key, assetKey.data());
-    batch.Put(leveldb::Slice(assetKey.data(), kAssetKeySize), leveldb::Slice(assetData.dataChar(), assetData.size()));
-
-    auto status = m_database->Write(leveldb::WriteOptions(), &batch);
-    if (status.ok()) {
-        LOG(INFO) << "Asset store " << Asset::keyToString(key) << " success.";
-    } else {
-        LOG(ERROR) << "Failed to store Asset " << Asset::keyToString(key) << " in database, status: "
-            << status.ToString();
+    OperationTimer timer(m_latency[kStoreAsset], kOperationNames[kStoreAsset]);
+    if (!checkListCount(key, Data::GetFlatAsset(assetData.data()))) {
+        return false;
     }
-
-    return status.ok();
+    leveldb::WriteBatch batch;
+    uint64_t timeStamp = batchAsset(key, assetData, &batch);
+    return writeAssetBatch(key, assetData, timeStamp, &batch);
 }
 
 RecordPtr AssetDatabase::loadAssetDataChunk(uint64_t key, uint64_t chunk) {
+    OperationTimer timer(m_latency[kLoadAssetDataChunk], kOperationNames[kLoadAssetDataChunk]);
     std::array<char, kAssetDataKeySize> assetDataKey;
     makeAssetDataKey(key, chunk, assetDataKey.data());
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(leveldb::Slice(assetDataKey.data(), kAssetDataKeySize));
+    tracedSeek(iterator, leveldb::Slice(assetDataKey.data(), kAssetDataKeySize));
     if (!iteratorMatch(iterator, assetDataKey.data(), kAssetDataKeySize)) {
         LOG(ERROR) << "asset Data " << Asset::keyToString(key) << " chunk: " << chunk << " not found.";
-    } else {
-        LOG(INFO) << "Loaded Asset " << Asset::keyToString(key) << " chunk: " << chunk << ".";
+        return makeEmptyRecord();
     }
 
+    logEvent(kDbDataChunkLoaded, key, chunk);
+
     return RecordPtr(new DatabaseRecord(iterator));
 }
 
 bool AssetDatabase::storeAssetDataChunk(uint64_t key, uint64_t chunk, const SizedPointer& flatAssetData) {
+    OperationTimer timer(m_latency[kStoreAssetDataChunk], kOperationNames[kStoreAssetDataChunk]);
+    // The chunk and its content hash are written together, so a chunk is never present without its hash.
+    leveldb::WriteBatch batch;
     std::array<char, kAssetDataKeySize> assetDataKey;
     makeAssetDataKey(key, chunk, assetDataKey.data());
-    auto status = m_database->Put(leveldb::WriteOptions(), leveldb::Slice(assetDataKey.data(), kAssetDataKeySize),
+    batch.Put(leveldb::Slice(assetDataKey.data(), kAssetDataKeySize),
         leveldb::Slice(flatAssetData.dataChar(), flatAssetData.size()));
+    std::array<char, kChunkHashKeySize> chunkHashKey;
+    makeChunkHashKey(key, chunk, chunkHashKey.data());
+    uint64_t contentHash = hashChunkContents(flatAssetData.dataChar());
+    batch.Put(leveldb::Slice(chunkHashKey.data(), kChunkHashKeySize),
+        leveldb::Slice(reinterpret_cast<const char*>(&contentHash), sizeof(uint64_t)));
+    auto status = m_database->Write(leveldb::WriteOptions(), &batch);
 
     if (status.ok()) {
-        LOG(INFO) << "Asset Data store " << Asset::keyToString(key) << " chunk " << chunk << " success.";
+        logEvent(kDbDataChunkStored, key, chunk);
     } else {
         LOG(ERROR) << "Failed to store Asset Data " << Asset::keyToString(key) << " chunk " << chunk << ", status: "
             << status.ToString();
@@ -315,7 +627,320 @@ bool AssetDatabase::storeAssetDataChunk(uint64_t key, uint64_t chunk, const Size
     return status.ok();
 }
 
+bool AssetDatabase::loadChunkHashes(uint64_t key, uint64_t chunks, std::vector<uint64_t>& hashes) {
+    OperationTimer timer(m_latency[kLoadChunkHashes], kOperationNames[kLoadChunkHashes]);
+    hashes.clear();
+    hashes.reserve(chunks);
+    // Chunk numbers in hash keys are big-endian, so the hashes of an Asset are read in order with a single seek.
+    std::array<char, kChunkHashKeySize> chunkHashKey;
+    makeChunkHashKey(key, 0, chunkHashKey.data());
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    for (tracedSeek(iterator, leveldb::Slice(chunkHashKey.data(), kChunkHashKeySize));
+            hashes.size() < chunks && iterator->Valid() && iterator->key().size() == kChunkHashKeySize &&
+            std::memcmp(iterator->key().data(), chunkHashKey.data(), 9) == 0; iterator->Next()) {
+        if (loadBigEndian(iterator->key().data() + 9) != hashes.size() ||
+                iterator->value().size() != sizeof(uint64_t)) {
+            break;
+        }
+        uint64_t contentHash = 0;
+        std::memcpy(&contentHash, iterator->value().data(), sizeof(uint64_t));
+        hashes.push_back(contentHash);
+    }
+
+    if (hashes.size() < chunks) {
+        LOG(ERROR) << "Asset " << Asset::keyToString(key) << " has no content hash for chunk " << hashes.size()
+            << " of " << chunks;
+        return false;
+    }
+    return true;
+}
+
+bool AssetDatabase::storeStagedDataChunk(uint64_t uploadId, uint64_t chunk, const SizedPointer& flatAssetData) {
+    OperationTimer timer(m_latency[kStoreStagedDataChunk], kOperationNames[kStoreStagedDataChunk]);
+    // Each chunk refreshes the upload session's time stamp in the same write, so that a session is only ever expired
+    // along with all of its chunks.
+    leveldb::WriteBatch batch;
+    std::array<char, kAssetDataKeySize> stagedDataKey;
+    makeStagedDataKey(uploadId, chunk, stagedDataKey.data());
+    batch.Put(leveldb::Slice(stagedDataKey.data(), kAssetDataKeySize),
+        leveldb::Slice(flatAssetData.dataChar(), flatAssetData.size()));
+    std::array<char, kUploadKeySize> uploadKey;
+    makeUploadKey(uploadId, uploadKey.data());
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    batch.Put(leveldb::Slice(uploadKey.data(), kUploadKeySize),
+        leveldb::Slice(reinterpret_cast<const char*>(&now), sizeof(uint64_t)));
+    leveldb::Status status;
+    {
+        std::lock_guard<std::mutex> lock(m_uploadMutex);
+        status = m_database->Write(leveldb::WriteOptions(), &batch);
+    }
+
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to store staged data for upload " << Asset::keyToString(uploadId) << " chunk " << chunk
+            << ", status: " << status.ToString();
+    }
+
+    return status.ok();
+}
+
+bool AssetDatabase::findMissingStagedChunks(uint64_t uploadId, uint64_t chunks,
+        std::vector<std::pair<uint64_t, uint64_t>>& missing) {
+    OperationTimer timer(m_latency[kFindMissingStagedChunks], kOperationNames[kFindMissingStagedChunks]);
+    missing.clear();
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    std::array<char, kUploadKeySize> uploadKey;
+    makeUploadKey(uploadId, uploadKey.data());
+    tracedSeek(iterator, leveldb::Slice(uploadKey.data(), kUploadKeySize));
+    bool known = iteratorMatch(iterator, uploadKey.data(), kUploadKeySize);
+
+    // Chunk numbers are stored little-endian, so the staged chunks of an upload come back in no useful order, and are
+    // sorted before finding the gaps between them.
+    std::vector<uint64_t> present;
+    if (known) {
+        std::array<char, kAssetDataKeySize> stagedDataKey;
+        makeStagedDataKey(uploadId, 0, stagedDataKey.data());
+        tracedSeek(iterator, leveldb::Slice(stagedDataKey.data(), 9));
+        while (iterator->Valid() && iterator->key().size() == kAssetDataKeySize &&
+                std::memcmp(iterator->key().data(), stagedDataKey.data(), 9) == 0) {
+            uint64_t chunk = 0;
+            std::memcpy(&chunk, iterator->key().data() + 9, sizeof(uint64_t));
+            if (chunk < chunks) {
+                present.push_back(chunk);
+            }
+            iterator->Next();
+        }
+        std::sort(present.begin(), present.end());
+    }
+
+    uint64_t next = 0;
+    for (auto chunk : present) {
+        if (chunk > next) {
+            missing.emplace_back(next, chunk);
+        }
+        next = chunk + 1;
+    }
+    if (next < chunks) {
+        missing.emplace_back(next, chunks);
+    }
+    return known;
+}
+
+size_t AssetDatabase::expireUploads(std::chrono::microseconds maxIdle) {
+    OperationTimer timer(m_latency[kExpireUploads], kOperationNames[kExpireUploads]);
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t cutoff = now - std::min(now, static_cast<uint64_t>(maxIdle.count()));
+
+    size_t expired = 0;
+    size_t deletedChunks = 0;
+    for (auto uploadId : findIdleUploads(cutoff)) {
+        if (expireUpload(uploadId, cutoff, deletedChunks)) {
+            ++expired;
+        }
+    }
+
+    if (expired > 0) {
+        LOG(INFO) << "expired " << expired << " idle uploads, deleting " << deletedChunks << " staged chunks.";
+    }
+    return expired;
+}
+
+std::vector<uint64_t> AssetDatabase::findIdleUploads(uint64_t cutoff) {
+    std::vector<uint64_t> idle;
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    char prefix = kUpload;
+    for (tracedSeek(iterator, leveldb::Slice(&prefix, 1));
+            iterator->Valid() && iterator->key().size() == kUploadKeySize && iterator->key()[0] == kUpload;
+            iterator->Next()) {
+        uint64_t lastStaged = 0;
+        if (iterator->value().size() == sizeof(uint64_t)) {
+            std::memcpy(&lastStaged, iterator->value().data(), sizeof(uint64_t));
+        }
+        if (lastStaged <= cutoff) {
+            uint64_t uploadId = 0;
+            std::memcpy(&uploadId, iterator->key().data() + 1, sizeof(uint64_t));
+            idle.push_back(uploadId);
+        }
+    }
+    return idle;
+}
+
+bool AssetDatabase::expireUpload(uint64_t uploadId, uint64_t cutoff, size_t& deletedChunks) {
+    // Holding the staging lock while the session's time stamp is read again and its chunks are collected means a chunk
+    // staged since findIdleUploads() either refreshed the session, so it is kept, or is staged after the delete, into
+    // a new session.
+    std::lock_guard<std::mutex> lock(m_uploadMutex);
+    std::array<char, kUploadKeySize> uploadKey;
+    makeUploadKey(uploadId, uploadKey.data());
+    std::string value;
+    auto status = m_database->Get(leveldb::ReadOptions(), leveldb::Slice(uploadKey.data(), kUploadKeySize), &value);
+    if (!status.ok()) {
+        return false;
+    }
+    uint64_t lastStaged = 0;
+    if (value.size() == sizeof(uint64_t)) {
+        std::memcpy(&lastStaged, value.data(), sizeof(uint64_t));
+    }
+    if (lastStaged > cutoff) {
+        return false;
+    }
+
+    leveldb::WriteBatch batch;
+    std::array<char, kAssetDataKeySize> stagedDataKey;
+    makeStagedDataKey(uploadId, 0, stagedDataKey.data());
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    tracedSeek(iterator, leveldb::Slice(stagedDataKey.data(), 9));
+    size_t chunks = 0;
+    while (iterator->Valid() && iterator->key().size() == kAssetDataKeySize &&
+            std::memcmp(iterator->key().data(), stagedDataKey.data(), 9) == 0) {
+        batch.Delete(iterator->key());
+        ++chunks;
+        iterator->Next();
+    }
+    batch.Delete(leveldb::Slice(uploadKey.data(), kUploadKeySize));
+    status = m_database->Write(leveldb::WriteOptions(), &batch);
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to expire upload " << Asset::keyToString(uploadId) << ", status: "
+            << status.ToString();
+        return false;
+    }
+    deletedChunks += chunks;
+    return true;
+}
+
+bool AssetDatabase::commitUpload(uint64_t uploadId, const SizedPointer& assetData) {
+    OperationTimer timer(m_latency[kCommitUpload], kOperationNames[kCommitUpload]);
+    const Data::FlatAsset* flatAsset = Data::GetFlatAsset(assetData.data());
+    uint64_t key = flatAsset->key();
+    uint64_t size = flatAsset->size();
+    uint64_t chunks = flatAsset->chunks();
+    ChunkLayout layout = ChunkLayout::fromFlatAsset(flatAsset);
+    std::string uploadString = Asset::keyToString(uploadId);
+    if (!layout.valid()) {
+        LOG(ERROR) << "rejecting commit of upload " << uploadString << " with inconsistent size " << size << " for "
+            << chunks << " chunks of up to " << layout.maxChunkSize() << " bytes.";
+        return false;
+    }
+    if (!checkListCount(key, flatAsset)) {
+        return false;
+    }
+
+    // Check every staged chunk is present and hashes to the Asset key before moving any of them, so that a bad commit
+    // leaves the database untouched. The moves, the chunk content hashes, and the Asset are written in a single batch,
+    // so the data only ever appear under the Asset key complete and with their Asset.
+    leveldb::WriteBatch batch;
+    std::array<char, kAssetDataKeySize> stagedDataKey;
+    std::array<char, kAssetDataKeySize> assetDataKey;
+    std::array<char, kChunkHashKeySize> chunkHashKey;
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    XXH64_state_t* hashState = XXH64_createState();
+    XXH64_reset(hashState, 0);
+    uint64_t digest = 0;
+    bool ok = true;
+    for (uint64_t chunk = 0; ok && chunk < chunks; ++chunk) {
+        makeStagedDataKey(uploadId, chunk, stagedDataKey.data());
+        tracedSeek(iterator, leveldb::Slice(stagedDataKey.data(), kAssetDataKeySize));
+        if (!iteratorMatch(iterator, stagedDataKey.data(), kAssetDataKeySize)) {
+            LOG(ERROR) << "upload " << uploadString << " is missing chunk " << chunk << " of " << chunks;
+            ok = false;
+            break;
+        }
+        const Data::FlatAssetData* flatAssetData = Data::GetFlatAssetData(iterator->value().data());
+        size_t expectedSize = layout.chunkSize(chunk);
+        if (!flatAssetData->data() || flatAssetData->data()->size() != expectedSize) {
+            LOG(ERROR) << "upload " << uploadString << " chunk " << chunk << " is the wrong size, expected "
+                << expectedSize << " bytes.";
+            ok = false;
+            break;
+        }
+        XXH64_update(hashState, flatAssetData->data()->data(), expectedSize);
+        digest = XXH64_digest(hashState);
+        if (digest != flatAssetData->hash()) {
+            LOG(ERROR) << "upload " << uploadString << " chunk " << chunk << " failed incremental hash validation.";
+            ok = false;
+            break;
+        }
+        makeAssetDataKey(key, chunk, assetDataKey.data());
+        batch.Put(leveldb::Slice(assetDataKey.data(), kAssetDataKeySize), iterator->value());
+        batch.Delete(leveldb::Slice(stagedDataKey.data(), kAssetDataKeySize));
+        makeChunkHashKey(key, chunk, chunkHashKey.data());
+        uint64_t contentHash = XXH64(flatAssetData->data()->data(), expectedSize, 0);
+        batch.Put(leveldb::Slice(chunkHashKey.data(), kChunkHashKeySize),
+            leveldb::Slice(reinterpret_cast<const char*>(&contentHash), sizeof(uint64_t)));
+    }
+    XXH64_freeState(hashState);
+    iterator.reset();
+    std::array<char, kUploadKeySize> uploadKey;
+    makeUploadKey(uploadId, uploadKey.data());
+    batch.Delete(leveldb::Slice(uploadKey.data(), kUploadKeySize));
+
+    if (ok && digest != key) {
+        LOG(ERROR) << "upload " << uploadString << " hashes to " << Asset::keyToString(digest) << ", not Asset key "
+            << Asset::keyToString(key);
+        ok = false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    uint64_t timeStamp = batchAsset(key, assetData, &batch);
+    if (!writeAssetBatch(key, assetData, timeStamp, &batch)) {
+        return false;
+    }
+    LOG(INFO) << "committed upload " << uploadString << " as Asset " << Asset::keyToString(key) << ", " << chunks
+        << " chunks.";
+    return true;
+}
+
+uint64_t AssetDatabase::queueUpstream(uint64_t key) {
+    OperationTimer timer(m_latency[kQueueUpstream], kOperationNames[kQueueUpstream]);
+    uint64_t token = nextListTimeStamp();
+    std::array<char, kUpstreamKeySize> upstreamKey;
+    upstreamKey[0] = kUpstream;
+    storeBigEndian(token, upstreamKey.data() + 1);
+    auto status = m_database->Put(leveldb::WriteOptions(), leveldb::Slice(upstreamKey.data(), kUpstreamKeySize),
+        leveldb::Slice(reinterpret_cast<const char*>(&key), sizeof(uint64_t)));
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to queue upstream request for Asset " << Asset::keyToString(key) << ", status: "
+            << status.ToString();
+        return 0;
+    }
+    return token;
+}
+
+size_t AssetDatabase::getUpstreamQueue(size_t maxEntries, std::vector<std::pair<uint64_t, uint64_t>>& entries) {
+    OperationTimer timer(m_latency[kGetUpstreamQueue], kOperationNames[kGetUpstreamQueue]);
+    entries.clear();
+    std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
+    char prefix = kUpstream;
+    for (tracedSeek(iterator, leveldb::Slice(&prefix, 1)); entries.size() < maxEntries && iterator->Valid() &&
+            iterator->key().size() == kUpstreamKeySize && iterator->key()[0] == kUpstream; iterator->Next()) {
+        if (iterator->value().size() != sizeof(uint64_t)) {
+            LOG(ERROR) << "skipping malformed upstream request in database.";
+            continue;
+        }
+        uint64_t key = 0;
+        std::memcpy(&key, iterator->value().data(), sizeof(uint64_t));
+        entries.emplace_back(loadBigEndian(iterator->key().data() + 1), key);
+    }
+    return entries.size();
+}
+
+bool AssetDatabase::removeUpstream(uint64_t token) {
+    OperationTimer timer(m_latency[kRemoveUpstream], kOperationNames[kRemoveUpstream]);
+    std::array<char, kUpstreamKeySize> upstreamKey;
+    upstreamKey[0] = kUpstream;
+    storeBigEndian(token, upstreamKey.data() + 1);
+    auto status = m_database->Delete(leveldb::WriteOptions(), leveldb::Slice(upstreamKey.data(), kUpstreamKeySize));
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to remove upstream request " << token << ", status: " << status.ToString();
+    }
+    return status.ok();
+}
+
 bool AssetDatabase::storeList(uint64_t key, const SizedPointer& listEntry) {
+    OperationTimer timer(m_latency[kStoreList], kOperationNames[kStoreList]);
     leveldb::WriteBatch batch;
 
     // Extract the name, if any, for storage in a lookup table.
@@ -331,14 +956,14 @@ bool AssetDatabase::storeList(uint64_t key, const SizedPointer& listEntry) {
     std::array<char, kListEntryKeySize> listBeginKey;
     listBeginKey[0] = kListEntry;
     std::memcpy(listBeginKey.data() + 1, &key, sizeof(uint64_t));
-    std::memcpy(listBeginKey.data() + 9, &kBeginList, sizeof(uint64_t));
+    storeBigEndian(kBeginList, listBeginKey.data() + 9);
     std::memcpy(listBeginKey.data() + 17, &kBeginList, sizeof(uint64_t));
     batch.Put(leveldb::Slice(listBeginKey.data(), kListEntryKeySize), leveldb::Slice());
 
     std::array<char, kListEntryKeySize> listEndKey;
     listEndKey[0] = kListEntry;
     std::memcpy(listEndKey.data() + 1, &key, sizeof(uint64_t));
-    std::memcpy(listEndKey.data() + 9, &kEndList, sizeof(uint64_t));
+    storeBigEndian(kEndList, listEndKey.data() + 9);
     std::memcpy(listEndKey.data() + 17, &kEndList, sizeof(uint64_t));
     batch.Put(leveldb::Slice(listEndKey.data(), kListEntryKeySize), leveldb::Slice());
 
@@ -348,7 +973,7 @@ bool AssetDatabase::storeList(uint64_t key, const SizedPointer& listEntry) {
 
     auto status = m_database->Write(leveldb::WriteOptions(), &batch);
     if (status.ok()) {
-        LOG(INFO) << "List store " << Asset::keyToString(key) << " success.";
+        logEvent(kDbListStored, key);
     } else {
         LOG(ERROR) << "Failed to store KeyList Data " << Asset::keyToString(key) << ", status: " << status.ToString();
     }
@@ -357,23 +982,26 @@ bool AssetDatabase::storeList(uint64_t key, const SizedPointer& listEntry) {
 }
 
 RecordPtr AssetDatabase::loadList(uint64_t key) {
+    OperationTimer timer(m_latency[kLoadList], kOperationNames[kLoadList]);
     std::array<char, kListKeySize> listKey;
     makeListKey(key, listKey.data());
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(leveldb::Slice(listKey.data(), kListKeySize));
+    tracedSeek(iterator, leveldb::Slice(listKey.data(), kListKeySize));
     if (!iteratorMatch(iterator, listKey.data(), kListKeySize)) {
         LOG(ERROR) << "error retrieving list " << Asset::keyToString(key) << ".";
-    } else {
-        LOG(INFO) << "loaded list " << Asset::keyToString(key) << ".";
+        return makeEmptyRecord();
     }
 
+    logEvent(kDbListLoaded, key);
+
     return RecordPtr(new DatabaseRecord(iterator));
 }
 
 RecordPtr AssetDatabase::findNamedList(const std::string& name) {
+    OperationTimer timer(m_latency[kFindNamedList], kOperationNames[kFindNamedList]);
     std::string nameKey = kListNamePrefix + name;
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(nameKey);
+    tracedSeek(iterator, nameKey);
     if (!iteratorMatch(iterator, nameKey.data(), nameKey.size())) {
         LOG(WARNING) << "no named list found under name " << name;
         return makeEmptyRecord();
@@ -386,6 +1014,7 @@ RecordPtr AssetDatabase::findNamedList(const std::string& name) {
 }
 
 size_t AssetDatabase::getListNext(uint64_t listKey, uint64_t fromToken, size_t maxPairs, uint64_t* listOut) {
+    OperationTimer timer(m_latency[kGetListNext], kOperationNames[kGetListNext]);
     // Early-out for asking for the end of the list.
     if (fromToken == kEndList) {
         if (maxPairs >= 1) {
@@ -399,11 +1028,11 @@ size_t AssetDatabase::getListNext(uint64_t listKey, uint64_t fromToken, size_t m
     std::array<char, kListEntryKeySize> listEntryKey;
     listEntryKey[0] = kListEntry;
     std::memcpy(listEntryKey.data() + 1, &listKey, sizeof(uint64_t));
-    std::memcpy(listEntryKey.data() + 9, &fromToken, sizeof(uint64_t));
+    storeBigEndian(fromToken, listEntryKey.data() + 9);
     std::memcpy(listEntryKey.data() + 17, &kBeginList, sizeof(uint64_t));
 
     std::shared_ptr<leveldb::Iterator> iterator(m_database->NewIterator(leveldb::ReadOptions()));
-    iterator->Seek(leveldb::Slice(listEntryKey.data(), kListEntryKeySize));
+    tracedSeek(iterator, leveldb::Slice(listEntryKey.data(), kListEntryKeySize));
     if (!iterator->Valid()) {
         LOG(ERROR) << "error finding first element token: " << Asset::keyToString(fromToken) << " in list: "
             << Asset::keyToString(listKey);
@@ -420,16 +1049,108 @@ size_t AssetDatabase::getListNext(uint64_t listKey, uint64_t fromToken, size_t m
         // We only compare the first 9 bytes of the list key, to make sure the prefix and key match.
         if (iterator->key().size() != kListEntryKeySize ||
             std::memcmp(iterator->key().data(), listEntryKey.data(), 9) != 0) {
-            LOG(INFO) << "walked off end of list " << Asset::keyToString(listKey) << " after " << pairs << " pairs.";
+            logEvent(kDbListWalkedOffEnd, listKey, pairs);
             break;
         }
 
-        std::memcpy(listOut + (pairs * 2), iterator->key().data() + 9, sizeof(uint64_t) * 2);
+        listOut[pairs * 2] = loadBigEndian(iterator->key().data() + 9);
+        std::memcpy(listOut + (pairs * 2) + 1, iterator->key().data() + 17, sizeof(uint64_t));
         ++pairs;
     }
 
     return pairs;
 }
 
+void AssetDatabase::setListObserver(ListObserver observer) {
+    m_listObserver = observer;
+}
+
+uint64_t AssetDatabase::batchAsset(uint64_t key, const SizedPointer& assetData, leveldb::WriteBatch* batch) {
+    // First we parse the Asset data to extract the name, if any.
+    const Data::FlatAsset* flatAsset = Data::GetFlatAsset(assetData.data());
+    if (flatAsset->name() && flatAsset->name()->size() > 0) {
+        std::string name = kAssetNamePrefix + flatAsset->name()->str();
+        LOG(INFO) << "adding name '" << flatAsset->name()->data() << "' lookup to asset " << Asset::keyToString(key);
+        batch->Put(name, leveldb::Slice(reinterpret_cast<const char*>(&key), sizeof(uint64_t)));
+    }
+
+    // Add any list entries to the batch.
+    size_t numLists = flatAsset->lists() ? flatAsset->lists()->size() : 0;
+    uint64_t timeStamp = numLists ? nextListTimeStamp() : 0;
+    std::array<char, kListEntryKeySize> listKey;
+    for (auto i = 0; i < numLists; ++i) {
+        listKey[0]  = kListEntry;
+        std::memcpy(listKey.data() + 1, flatAsset->lists()->data() + i, sizeof(uint64_t));
+        storeBigEndian(timeStamp, listKey.data() + 9);
+        std::memcpy(listKey.data() + 17, &key, sizeof(uint64_t));
+        logEvent(kDbAssetAddedToList, key, flatAsset->lists()->data()[i]);
+        batch->Put(leveldb::Slice(listKey.data(), kListEntryKeySize), leveldb::Slice());
+    }
+
+    // Store actual Asset key/value pair.
+    std::array<char, kAssetKeySize> assetKey;
+    makeAssetKey(key, assetKey.data());
+    batch->Put(leveldb::Slice(assetKey.data(), kAssetKeySize), leveldb::Slice(assetData.dataChar(), assetData.size()));
+    return timeStamp;
+}
+
+bool AssetDatabase::writeAssetBatch(uint64_t key, const SizedPointer& assetData, uint64_t timeStamp,
+        leveldb::WriteBatch* batch) {
+    auto status = m_database->Write(leveldb::WriteOptions(), batch);
+    if (status.ok()) {
+        logEvent(kDbAssetStored, key);
+        const Data::FlatAsset* flatAsset = Data::GetFlatAsset(assetData.data());
+        size_t numLists = flatAsset->lists() ? flatAsset->lists()->size() : 0;
+        if (m_listObserver) {
+            for (auto i = 0; i < numLists; ++i) {
+                m_listObserver(flatAsset->lists()->Get(i), timeStamp);
+            }
+        }
+    } else {
+        LOG(ERROR) << "Failed to store Asset " << Asset::keyToString(key) << " in database, status: "
+            << status.ToString();
+    }
+    return status.ok();
+}
+
+uint64_t AssetDatabase::nextListTimeStamp() {
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t last = m_lastListTimeStamp.load();
+    uint64_t next;
+    do {
+        next = std::max(now, last + 1);
+    } while (!m_lastListTimeStamp.compare_exchange_weak(last, next));
+    return next;
+}
+
+bool AssetDatabase::seekAsset(std::shared_ptr<leveldb::Iterator> iterator, uint64_t key) {
+    std::array<char, kAssetKeySize> assetKey;
+    makeAssetKey(key, assetKey.data());
+
+    tracedSeek(iterator, leveldb::Slice(assetKey.data(), kAssetKeySize));
+    if (!iteratorMatch(iterator, assetKey.data(), kAssetKeySize)) {
+        LOG(ERROR) << "Asset " << Asset::keyToString(key) << " not found in database.";
+        return false;
+    }
+
+    uint64_t loadedKey = key;
+    auto flatAsset = Data::GetFlatAsset(iterator->value().data());
+    while (flatAsset->deprecatedBy()) {
+        uint64_t deprecatedBy = flatAsset->deprecatedBy();
+        logEvent(kDbAssetDeprecated, key, deprecatedBy);
+        makeAssetKey(deprecatedBy, assetKey.data());
+        tracedSeek(iterator, leveldb::Slice(assetKey.data(), kAssetKeySize));
+        if (!iteratorMatch(iterator, assetKey.data(), kAssetKeySize)) {
+            LOG(ERROR) << "error loaded deprecating asset " << Asset::keyToString(deprecatedBy) << ".";
+            return false;
+        }
+        flatAsset = Data::GetFlatAsset(iterator->value().data());
+        loadedKey = deprecatedBy;
+    }
+    logEvent(kDbAssetFollowedDeprecation, loadedKey, key);
+    return true;
+}
+
 }  // namespace Confab
 
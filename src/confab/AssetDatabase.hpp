@@ -4,9 +4,18 @@
 #include "Record.hpp"
 #include "SizedPointer.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace leveldb {
+    class Cache;
     class DB;
     class Iterator;
     class WriteBatch;
@@ -15,6 +24,7 @@ namespace leveldb {
 namespace Confab {
 
 class Database;
+class Histogram;
 
 /*! Class responsible for storage, retrieval, and verification of FlatAsset and FlatAssetData objects in the provided
  * file database.
@@ -29,6 +39,31 @@ public:
      */
     ~AssetDatabase();
 
+    /*! Database operations timed into per-operation latency histograms, exposed as the confab_database_op_seconds
+     * metric.
+     */
+    enum Operation : size_t {
+        kFindAsset,
+        kFindAssets,
+        kFindNamedAsset,
+        kStoreAsset,
+        kLoadAssetDataChunk,
+        kStoreAssetDataChunk,
+        kLoadChunkHashes,
+        kStoreList,
+        kLoadList,
+        kFindNamedList,
+        kGetListNext,
+        kStoreStagedDataChunk,
+        kCommitUpload,
+        kFindMissingStagedChunks,
+        kExpireUploads,
+        kQueueUpstream,
+        kGetUpstreamQueue,
+        kRemoveUpstream,
+        kNumOperations
+    };
+
     /*! Open or create Database LevelDB database file tree.
      *
      * \param path A path to a directory where the Confab LevelDB database is stored.
@@ -36,7 +71,7 @@ public:
      *                  initialized database as an error condition. If false, open() will expect a valid database to
      *                  exist at \a path.
      * \param cacheSize Size in bytes of the LRU memory cache to request from LevelDB. A size <= 0 will disable the
-     *                  cache.
+     *                  cache. Lookups in the cache are counted in the confab_database_block_cache_lookups_total metric.
      * \return true on success, or false on error.
      */
     bool open(const char* path, bool createNew, int cacheSize);
@@ -57,6 +92,20 @@ public:
      */
     RecordPtr findAsset(uint64_t key);
 
+    /*! Locates a batch of Assets from a single consistent snapshot of the database.
+     *
+     * The keys are sorted into database order and then looked up with a single iterator, so the results reflect the
+     * state of the database at one moment in time even if other threads are storing Assets concurrently. Like
+     * findAsset(), deprecated Assets are followed to their most recent version.
+     *
+     * \param keys The Asset keys to look up. Need not be sorted, and duplicate keys are only looked up once.
+     * \param callback Called once for each unique key in \a keys, with the requested key and a non-owning pointer to
+     *                 the FlatAsset record, or an empty Record if not found. The Record is only valid for the duration
+     *                 of the callback.
+     * \return The number of requested keys that were found.
+     */
+    size_t findAssets(const std::vector<uint64_t>& keys, std::function<void(uint64_t, RecordPtr)> callback);
+
     /*! Locates an Asset associated with the provided name and returns it.
      *
      * Just like findAsset, will return the most recent version of the requested Asset, following deprecations.
@@ -82,7 +131,7 @@ public:
      */
     RecordPtr loadAssetDataChunk(uint64_t key, uint64_t chunk);
 
-    /*! Stores a FlatAssetData record for an Asset into the database.
+    /*! Stores a FlatAssetData record for an Asset into the database, along with the content hash of its data.
      *
      * \param key The key to associate with this Asset data chunk.
      * \param chunk The chunk number to store this under.
@@ -91,6 +140,97 @@ public:
      */
     bool storeAssetDataChunk(uint64_t key, uint64_t chunk, const SizedPointer& flatAssetData);
 
+    /*! Loads the content hashes of the first chunks of an Asset, recorded as its chunks were stored, without loading
+     * the chunks themselves.
+     *
+     * \param key The key associated with the Asset.
+     * \param chunks The number of chunks to load hashes for, starting from chunk 0.
+     * \param hashes Set to the XXH64 of the data of each chunk, in chunk order.
+     * \return true on success, false if any of the chunks is missing.
+     */
+    bool loadChunkHashes(uint64_t key, uint64_t chunks, std::vector<uint64_t>& hashes);
+
+    /*! Stores a FlatAssetData record for a file upload in progress, in a staging area where it isn't visible under any
+     * Asset key until the upload is committed. Also starts or refreshes the upload's session, which expireUploads()
+     * deletes once idle.
+     *
+     * \param uploadId The provisional id the client chose for the upload.
+     * \param chunk The chunk number to store this under.
+     * \param flatAssetData The FlatAssetData record to save.
+     * \return true on success, false on error.
+     */
+    bool storeStagedDataChunk(uint64_t uploadId, uint64_t chunk, const SizedPointer& flatAssetData);
+
+    /*! Commits a staged upload as a file Asset. Checks that every chunk the Asset describes was staged with the right
+     * size, and that the incremental hash chain ends at the Asset key, then in a single write moves the chunks to be
+     * the Asset's AssetData, records their content hashes, and stores the Asset, as storeAsset() does. Nothing is
+     * written if any check fails.
+     *
+     * \param uploadId The id the chunks were staged under.
+     * \param assetData The serialized FlatAsset, with its key, size, and chunk layout set.
+     * \return true on success, false on error.
+     */
+    bool commitUpload(uint64_t uploadId, const SizedPointer& assetData);
+
+    /*! Finds the chunks of a staged upload the database doesn't hold, so the client can resume by sending only those.
+     *
+     * \param uploadId The id the chunks are staged under.
+     * \param chunks The number of chunks in the upload.
+     * \param missing Set to the runs of missing chunks as [start, end) pairs, in ascending order. Covers every chunk
+     *                if the upload is unknown.
+     * \return true if there is a session for the upload, false if it is unknown, committed, or expired.
+     */
+    bool findMissingStagedChunks(uint64_t uploadId, uint64_t chunks,
+            std::vector<std::pair<uint64_t, uint64_t>>& missing);
+
+    /*! Deletes the sessions and staged chunks of uploads that have had no chunk staged for at least maxIdle, which
+     * have most likely been abandoned by their clients. An upload that has a chunk staged while this runs is kept.
+     *
+     * \param maxIdle How long since its last staged chunk an upload is kept for.
+     * \return The number of uploads deleted.
+     */
+    size_t expireUploads(std::chrono::microseconds maxIdle);
+
+    /*! Finds the uploads that have had no chunk staged since a time stamp. The first step of expireUploads().
+     *
+     * \param cutoff The time stamp in microseconds since the epoch, uploads last staged at or before it are idle.
+     * \return The ids of the idle uploads.
+     */
+    std::vector<uint64_t> findIdleUploads(uint64_t cutoff);
+
+    /*! Deletes the session and staged chunks of an upload found by findIdleUploads(), unless a chunk has been staged
+     * for it since the cutoff. The second step of expireUploads().
+     *
+     * \param uploadId The id of the upload to delete.
+     * \param cutoff The time stamp passed to findIdleUploads().
+     * \param deletedChunks Increased by the number of staged chunks deleted.
+     * \return true if the upload was deleted, false if it was refreshed, already gone, or on error.
+     */
+    bool expireUpload(uint64_t uploadId, uint64_t cutoff, size_t& deletedChunks);
+
+    /*! Records a request to push an Asset stored locally, along with its AssetData, to the upstream server. Requests
+     * stay in the database until removed with removeUpstream(), so survive restarts while the server is unreachable.
+     *
+     * \param key The key of the Asset to push upstream.
+     * \return A token identifying the request, increasing with each request queued, or 0 on error.
+     */
+    uint64_t queueUpstream(uint64_t key);
+
+    /*! Returns the oldest upstream requests still queued.
+     *
+     * \param maxEntries The most requests to return.
+     * \param entries Set to <token, Asset key> pairs, oldest first.
+     * \return The number of requests returned.
+     */
+    size_t getUpstreamQueue(size_t maxEntries, std::vector<std::pair<uint64_t, uint64_t>>& entries);
+
+    /*! Deletes a finished upstream request.
+     *
+     * \param token The token returned by queueUpstream().
+     * \return true on success, false on error.
+     */
+    bool removeUpstream(uint64_t token);
+
     /*! Stores a new List entity into the database.
      *
      * \param key The list key to associate with this List.
@@ -126,13 +266,76 @@ public:
      */
     size_t getListNext(uint64_t listKey, uint64_t fromToken, size_t maxPairs, uint64_t* listOut);
 
+    /*! Called after storeAsset() has added an Asset to a List.
+     *
+     * \param listKey The key of the List the Asset was added to.
+     * \param token The list token of the new entry.
+     */
+    using ListObserver = std::function<void(uint64_t listKey, uint64_t token)>;
+
+    /*! Sets a function to call, on the storing thread, each time storeAsset() adds an Asset to a List. Not thread safe,
+     * so should be set before or after, but not during, concurrent use of the database.
+     *
+     * \param observer The function to call, or nullptr to stop observing.
+     */
+    void setListObserver(ListObserver observer);
+
     /// @cond UNDOCUMENTED
     AssetDatabase(const AssetDatabase&) = delete;
     AssetDatabase& operator=(const AssetDatabase&) = delete;
     /// @endcond UNDOCUMENTED
 
 private:
+    /*! Checks the format version of a newly opened database, recording the current version in a new database and
+     * migrating one from an older version.
+     *
+     * \param createNew true if the database was just created.
+     * \return true if the database is now in the current format, false if it is newer than supported or on error.
+     */
+    bool checkFormat(bool createNew);
+
+    /*! Positions the iterator at the Asset with the provided key, following any deprecations to the newest version.
+     *
+     * \param iterator The iterator to seek.
+     * \param key The requested Asset key.
+     * \return true if the iterator now points at a valid FlatAsset record, false if not found.
+     */
+    bool seekAsset(std::shared_ptr<leveldb::Iterator> iterator, uint64_t key);
+
+    /*! Adds the writes that store an Asset, its name lookup, and its List entries to a batch.
+     *
+     * \param key The key to store the serialized asset under.
+     * \param assetData The serialized asset data.
+     * \param batch The batch to add to.
+     * \return The time stamp of the List entries.
+     */
+    uint64_t batchAsset(uint64_t key, const SizedPointer& assetData, leveldb::WriteBatch* batch);
+
+    /*! Writes a batch built with batchAsset(), notifying the List observer of the Asset's List entries on success.
+     *
+     * \param key The key of the Asset in the batch.
+     * \param assetData The serialized asset data.
+     * \param timeStamp The time stamp returned by batchAsset().
+     * \param batch The batch to write.
+     * \return true on success, false on error.
+     */
+    bool writeAssetBatch(uint64_t key, const SizedPointer& assetData, uint64_t timeStamp, leveldb::WriteBatch* batch);
+
+    /*! Returns a time stamp for a new list entry, the current time in microseconds unless that is not greater than the
+     * last time stamp returned, so that list tokens are strictly increasing even if the clock is not.
+     *
+     * \return The new time stamp.
+     */
+    uint64_t nextListTimeStamp();
+
+    // Declared before m_database so that it outlives the database using it.
+    std::unique_ptr<leveldb::Cache> m_blockCache;
     std::unique_ptr<leveldb::DB> m_database;
+    std::array<Histogram*, kNumOperations> m_latency;
+    std::atomic<uint64_t> m_lastListTimeStamp;
+    ListObserver m_listObserver;
+    // Held while staging a chunk and while expiring an upload, so an upload can't be refreshed while it is deleted.
+    std::mutex m_uploadMutex;
 };
 
 }  // namespace Confab
@@ -0,0 +1,446 @@
+#include "AssetDatabase.hpp"
+
+#include "Asset.hpp"
+#include "Constants.hpp"
+#include "schemas/FlatAssetData_generated.h"
+#include "schemas/FlatList_generated.h"
+
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include "xxhash.h"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+class AssetDatabaseTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-asset-database-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::remove_all(m_path);
+        ASSERT_TRUE(m_database.open(m_path.c_str(), true, 0));
+    }
+
+    void TearDown() override {
+        m_database.close();
+        fs::remove_all(m_path);
+    }
+
+    void storeAsset(uint64_t key, uint64_t deprecatedBy = 0, uint64_t listKey = 0) {
+        Confab::Asset asset(Confab::Asset::kSnippet);
+        asset.setKey(key);
+        asset.setDeprecatedBy(deprecatedBy);
+        if (listKey) {
+            asset.addToList(listKey);
+        }
+        flatbuffers::FlatBufferBuilder builder;
+        asset.flatten(builder);
+        ASSERT_TRUE(m_database.storeAsset(key, Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+    }
+
+    // Stages data in chunks of chunkSize bytes under uploadId, except the chunks set in skipMask, returning the hash of
+    // all of data.
+    uint64_t stageData(uint64_t uploadId, const std::string& data, size_t chunkSize, uint64_t skipMask = 0) {
+        XXH64_state_t* hashState = XXH64_createState();
+        XXH64_reset(hashState, 0);
+        uint64_t hash = 0;
+        for (size_t offset = 0, chunk = 0; offset < data.size(); offset += chunkSize, ++chunk) {
+            size_t size = std::min(chunkSize, data.size() - offset);
+            XXH64_update(hashState, data.data() + offset, size);
+            hash = XXH64_digest(hashState);
+            flatbuffers::FlatBufferBuilder builder;
+            auto bytes = builder.CreateVector(reinterpret_cast<const uint8_t*>(data.data() + offset), size);
+            builder.Finish(Confab::Data::CreateFlatAssetData(builder, bytes, hash));
+            if (skipMask & (1ull << chunk)) {
+                continue;
+            }
+            EXPECT_TRUE(m_database.storeStagedDataChunk(uploadId, chunk,
+                Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+        }
+        XXH64_freeState(hashState);
+        return hash;
+    }
+
+    bool commit(uint64_t uploadId, uint64_t key, size_t size, size_t chunkSize) {
+        Confab::Asset asset(Confab::Asset::kSample);
+        asset.setKey(key);
+        asset.setSize(size);
+        asset.setChunks((size + chunkSize - 1) / chunkSize);
+        asset.setChunkSize(chunkSize);
+        flatbuffers::FlatBufferBuilder builder;
+        asset.flatten(builder);
+        return m_database.commitUpload(uploadId, Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+    }
+
+    fs::path m_path;
+    Confab::AssetDatabase m_database;
+};
+
+}  // namespace
+
+TEST_F(AssetDatabaseTest, FindAssetsReturnsEachUniqueKey) {
+    storeAsset(0x0100000000000000);
+    storeAsset(0x00000000000000ff);
+    storeAsset(0x1234567890abcdef);
+
+    std::map<uint64_t, uint64_t> results;
+    size_t found = m_database.findAssets({ 0x1234567890abcdef, 0x42, 0x00000000000000ff, 0x0100000000000000,
+        0x1234567890abcdef }, [&results](uint64_t key, Confab::RecordPtr record) {
+            EXPECT_EQ(0, results.count(key));
+            results[key] = record->empty() ? 0 : Confab::Data::GetFlatAsset(record->data().data())->key();
+        });
+
+    EXPECT_EQ(3, found);
+    ASSERT_EQ(4, results.size());
+    EXPECT_EQ(0x1234567890abcdef, results[0x1234567890abcdef]);
+    EXPECT_EQ(0x00000000000000ff, results[0x00000000000000ff]);
+    EXPECT_EQ(0x0100000000000000, results[0x0100000000000000]);
+    EXPECT_EQ(0, results[0x42]);
+}
+
+TEST_F(AssetDatabaseTest, FindAssetsFollowsDeprecation) {
+    storeAsset(0xa, 0xb);
+    storeAsset(0xb);
+
+    uint64_t loadedKey = 0;
+    size_t found = m_database.findAssets({ 0xa }, [&loadedKey](uint64_t key, Confab::RecordPtr record) {
+        EXPECT_EQ(0xa, key);
+        ASSERT_FALSE(record->empty());
+        loadedKey = Confab::Data::GetFlatAsset(record->data().data())->key();
+    });
+
+    EXPECT_EQ(1, found);
+    EXPECT_EQ(0xb, loadedKey);
+}
+
+TEST_F(AssetDatabaseTest, ListEntriesReturnInOrderAdded) {
+    uint64_t listKey = 0x5151;
+    flatbuffers::FlatBufferBuilder builder;
+    Confab::Data::FlatListBuilder listBuilder(builder);
+    listBuilder.add_key(listKey);
+    builder.Finish(listBuilder.Finish());
+    ASSERT_TRUE(m_database.storeList(listKey, Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+
+    std::vector<std::pair<uint64_t, uint64_t>> notified;
+    m_database.setListObserver([&notified](uint64_t listKey, uint64_t token) {
+        notified.emplace_back(listKey, token);
+    });
+    std::vector<uint64_t> keys = { 0x300, 0x1, 0xff00000000000000, 0x42 };
+    for (auto key : keys) {
+        storeAsset(key, 0, listKey);
+    }
+    m_database.setListObserver(nullptr);
+
+    // Tokens are strictly increasing, and the entries come back in the order they were added.
+    ASSERT_EQ(keys.size(), notified.size());
+    std::array<uint64_t, 16> pairs;
+    ASSERT_EQ(keys.size() + 1, m_database.getListNext(listKey, Confab::kBeginList, pairs.size() / 2, pairs.data()));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(listKey, notified[i].first);
+        EXPECT_EQ(notified[i].second, pairs[i * 2]);
+        EXPECT_EQ(keys[i], pairs[(i * 2) + 1]);
+        if (i > 0) {
+            EXPECT_LT(pairs[(i - 1) * 2], pairs[i * 2]);
+        }
+    }
+    EXPECT_EQ(Confab::kEndList, pairs[keys.size() * 2]);
+
+    // Resuming from a token returns only the entries after it.
+    ASSERT_EQ(2, m_database.getListNext(listKey, pairs[4], 8, pairs.data()));
+    EXPECT_EQ(keys[3], pairs[1]);
+    EXPECT_EQ(Confab::kEndList, pairs[2]);
+}
+
+TEST_F(AssetDatabaseTest, OpenMigratesHostOrderListTokens) {
+    uint64_t listKey = 0x5252;
+    flatbuffers::FlatBufferBuilder builder;
+    Confab::Data::FlatListBuilder listBuilder(builder);
+    listBuilder.add_key(listKey);
+    builder.Finish(listBuilder.Finish());
+    ASSERT_TRUE(m_database.storeList(listKey, Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+    std::vector<uint64_t> keys = { 0x10, 0x20, 0x30 };
+    for (auto key : keys) {
+        storeAsset(key, 0, listKey);
+    }
+    std::array<uint64_t, 8> expected;
+    ASSERT_EQ(keys.size() + 1, m_database.getListNext(listKey, Confab::kBeginList, 4, expected.data()));
+    m_database.close();
+
+    // Rewrite the database as the first format left it, with List entry time stamps in host byte order and no format
+    // version record.
+    {
+        leveldb::DB* database = nullptr;
+        ASSERT_TRUE(leveldb::DB::Open(leveldb::Options(), m_path.c_str(), &database).ok());
+        std::unique_ptr<leveldb::DB> raw(database);
+        leveldb::WriteBatch batch;
+        batch.Delete("v");
+        std::unique_ptr<leveldb::Iterator> iterator(raw->NewIterator(leveldb::ReadOptions()));
+        for (iterator->Seek("e"); iterator->Valid() && iterator->key()[0] == 'e'; iterator->Next()) {
+            std::string key = iterator->key().ToString();
+            uint64_t timeStamp = 0;
+            for (int i = 0; i < 8; ++i) {
+                timeStamp = (timeStamp << 8) | static_cast<uint8_t>(key[9 + i]);
+            }
+            std::memcpy(&key[9], &timeStamp, sizeof(uint64_t));
+            batch.Delete(iterator->key());
+            batch.Put(key, leveldb::Slice());
+        }
+        ASSERT_TRUE(raw->Write(leveldb::WriteOptions(), &batch).ok());
+    }
+
+    ASSERT_TRUE(m_database.open(m_path.c_str(), false, 0));
+    std::array<uint64_t, 8> pairs;
+    ASSERT_EQ(keys.size() + 1, m_database.getListNext(listKey, Confab::kBeginList, 4, pairs.data()));
+    EXPECT_EQ(expected, pairs);
+
+    // Migration happens once, and the entries keep their order on the next open.
+    m_database.close();
+    ASSERT_TRUE(m_database.open(m_path.c_str(), false, 0));
+    ASSERT_EQ(keys.size() + 1, m_database.getListNext(listKey, Confab::kBeginList, 4, pairs.data()));
+    EXPECT_EQ(expected, pairs);
+}
+
+TEST_F(AssetDatabaseTest, OpenRefusesNewerFormat) {
+    m_database.close();
+    {
+        leveldb::DB* database = nullptr;
+        ASSERT_TRUE(leveldb::DB::Open(leveldb::Options(), m_path.c_str(), &database).ok());
+        std::unique_ptr<leveldb::DB> raw(database);
+        uint32_t version = 99;
+        ASSERT_TRUE(raw->Put(leveldb::WriteOptions(), "v",
+            leveldb::Slice(reinterpret_cast<const char*>(&version), sizeof(uint32_t))).ok());
+    }
+    EXPECT_FALSE(m_database.open(m_path.c_str(), false, 0));
+}
+
+TEST_F(AssetDatabaseTest, StoreAssetRejectsTooManyLists) {
+    Confab::Asset asset(Confab::Asset::kSnippet);
+    asset.setKey(0x77);
+    for (uint64_t listKey = 1; listKey <= 9; ++listKey) {
+        asset.addToList(listKey);
+    }
+    flatbuffers::FlatBufferBuilder builder;
+    asset.flatten(builder);
+    EXPECT_FALSE(m_database.storeAsset(0x77, Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+    EXPECT_TRUE(m_database.findAsset(0x77)->empty());
+}
+
+TEST_F(AssetDatabaseTest, CommitUploadMovesStagedChunksToAsset) {
+    std::string data(2500, 'x');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7);
+    }
+    uint64_t uploadId = 0x0a0b;
+    uint64_t key = stageData(uploadId, data, 1000);
+
+    // Staged data isn't visible under the Asset key until committed.
+    EXPECT_TRUE(m_database.findAsset(key)->empty());
+    EXPECT_TRUE(m_database.loadAssetDataChunk(key, 0)->empty());
+
+    ASSERT_TRUE(commit(uploadId, key, data.size(), 1000));
+    ASSERT_FALSE(m_database.findAsset(key)->empty());
+    std::string loaded;
+    for (uint64_t chunk = 0; chunk < 3; ++chunk) {
+        Confab::RecordPtr record = m_database.loadAssetDataChunk(key, chunk);
+        ASSERT_FALSE(record->empty());
+        const Confab::Data::FlatAssetData* flatAssetData = Confab::Data::GetFlatAssetData(record->data().data());
+        loaded.append(reinterpret_cast<const char*>(flatAssetData->data()->data()), flatAssetData->data()->size());
+    }
+    EXPECT_EQ(data, loaded);
+
+    // The staged chunks are gone, so the upload can't be committed twice.
+    EXPECT_FALSE(commit(uploadId, key, data.size(), 1000));
+}
+
+TEST_F(AssetDatabaseTest, CommitUploadRejectsMismatchedUploads) {
+    std::string data(2500, 'y');
+    uint64_t uploadId = 0x0c0d;
+    uint64_t key = stageData(uploadId, data, 1000);
+
+    // Wrong key, wrong size, wrong chunk layout, and missing chunks all leave the database untouched.
+    EXPECT_FALSE(commit(uploadId, key + 1, data.size(), 1000));
+    EXPECT_TRUE(m_database.findAsset(key + 1)->empty());
+    EXPECT_TRUE(m_database.loadAssetDataChunk(key + 1, 0)->empty());
+    EXPECT_FALSE(commit(uploadId, key, data.size() + 1, 1000));
+    EXPECT_FALSE(commit(uploadId, key, data.size(), 500));
+    EXPECT_FALSE(commit(0x0e0f, key, data.size(), 1000));
+    EXPECT_TRUE(m_database.findAsset(key)->empty());
+
+    // The upload is still staged, so a correct commit succeeds.
+    EXPECT_TRUE(commit(uploadId, key, data.size(), 1000));
+}
+
+TEST_F(AssetDatabaseTest, RecordsChunkHashesAsChunksAreStored) {
+    // Chunks posted one at a time, out of order, each get their content hash.
+    uint64_t key = 0x4848;
+    std::vector<std::string> chunks = { "first chunk", "second", "third and last" };
+    for (uint64_t chunk : { 2, 0, 1 }) {
+        flatbuffers::FlatBufferBuilder builder;
+        auto bytes = builder.CreateVector(reinterpret_cast<const uint8_t*>(chunks[chunk].data()), chunks[chunk].size());
+        builder.Finish(Confab::Data::CreateFlatAssetData(builder, bytes, 0));
+        ASSERT_TRUE(m_database.storeAssetDataChunk(key, chunk,
+            Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+        if (chunk == 2) {
+            // Chunk 0 is missing, so no hashes can be loaded yet.
+            std::vector<uint64_t> hashes;
+            EXPECT_FALSE(m_database.loadChunkHashes(key, 3, hashes));
+        }
+    }
+    std::vector<uint64_t> hashes;
+    ASSERT_TRUE(m_database.loadChunkHashes(key, 3, hashes));
+    ASSERT_EQ(3u, hashes.size());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ(XXH64(chunks[i].data(), chunks[i].size(), 0), hashes[i]) << "chunk " << i;
+    }
+    EXPECT_FALSE(m_database.loadChunkHashes(key, 4, hashes));
+    EXPECT_FALSE(m_database.loadChunkHashes(key + 1, 1, hashes));
+
+    // Committing an upload records the hash of each chunk alone, not the incremental hash stored with it.
+    std::string data(2500, 'z');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 13);
+    }
+    uint64_t uploadKey = stageData(0x4949, data, 1000);
+    ASSERT_TRUE(commit(0x4949, uploadKey, data.size(), 1000));
+    ASSERT_TRUE(m_database.loadChunkHashes(uploadKey, 3, hashes));
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(XXH64(data.data() + i * 1000, std::min<size_t>(1000, data.size() - i * 1000), 0), hashes[i])
+            << "chunk " << i;
+    }
+}
+
+TEST_F(AssetDatabaseTest, OpenHashesChunksStoredBeforeHashesWere) {
+    std::string data(2500, 'w');
+    uint64_t key = stageData(0x5050, data, 1000);
+    ASSERT_TRUE(commit(0x5050, key, data.size(), 1000));
+    std::vector<uint64_t> expected;
+    ASSERT_TRUE(m_database.loadChunkHashes(key, 3, expected));
+    m_database.close();
+
+    // Rewrite the database as format version 2 left it, with no chunk hashes.
+    {
+        leveldb::DB* database = nullptr;
+        ASSERT_TRUE(leveldb::DB::Open(leveldb::Options(), m_path.c_str(), &database).ok());
+        std::unique_ptr<leveldb::DB> raw(database);
+        leveldb::WriteBatch batch;
+        uint32_t version = 2;
+        batch.Put("v", leveldb::Slice(reinterpret_cast<const char*>(&version), sizeof(uint32_t)));
+        std::unique_ptr<leveldb::Iterator> iterator(raw->NewIterator(leveldb::ReadOptions()));
+        for (iterator->Seek("h"); iterator->Valid() && iterator->key()[0] == 'h'; iterator->Next()) {
+            batch.Delete(iterator->key());
+        }
+        ASSERT_TRUE(raw->Write(leveldb::WriteOptions(), &batch).ok());
+    }
+
+    ASSERT_TRUE(m_database.open(m_path.c_str(), false, 0));
+    std::vector<uint64_t> hashes;
+    ASSERT_TRUE(m_database.loadChunkHashes(key, 3, hashes));
+    EXPECT_EQ(expected, hashes);
+}
+
+TEST_F(AssetDatabaseTest, FindMissingStagedChunksReturnsGaps) {
+    using Ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+    std::string data(7500, 'z');
+    uint64_t uploadId = 0x1a1b;
+    Ranges missing;
+    EXPECT_FALSE(m_database.findMissingStagedChunks(uploadId, 8, missing));
+    EXPECT_EQ(Ranges({ { 0, 8 } }), missing);
+
+    // Skip chunks 0, 3, 4, and 7.
+    uint64_t key = stageData(uploadId, data, 1000, 0x99);
+    EXPECT_TRUE(m_database.findMissingStagedChunks(uploadId, 8, missing));
+    EXPECT_EQ(Ranges({ { 0, 1 }, { 3, 5 }, { 7, 8 } }), missing);
+    EXPECT_FALSE(commit(uploadId, key, data.size(), 1000));
+
+    // Sending just the missing chunks completes the upload.
+    stageData(uploadId, data, 1000, ~0x99ull);
+    EXPECT_TRUE(m_database.findMissingStagedChunks(uploadId, 8, missing));
+    EXPECT_TRUE(missing.empty());
+    ASSERT_TRUE(commit(uploadId, key, data.size(), 1000));
+
+    // Committing ends the session.
+    EXPECT_FALSE(m_database.findMissingStagedChunks(uploadId, 8, missing));
+}
+
+TEST_F(AssetDatabaseTest, ExpireUploadsDeletesIdleSessions) {
+    std::string data(2500, 'w');
+    uint64_t key = stageData(0x2a2b, data, 1000);
+    stageData(0x3a3b, data, 1000);
+
+    // Nothing has been idle for an hour.
+    EXPECT_EQ(0u, m_database.expireUploads(std::chrono::hours(1)));
+    std::vector<std::pair<uint64_t, uint64_t>> missing;
+    EXPECT_TRUE(m_database.findMissingStagedChunks(0x2a2b, 3, missing));
+    EXPECT_TRUE(missing.empty());
+
+    // With no idle allowance, both uploads are expired along with their chunks, so can't be committed.
+    EXPECT_EQ(2u, m_database.expireUploads(std::chrono::microseconds(0)));
+    EXPECT_FALSE(m_database.findMissingStagedChunks(0x2a2b, 3, missing));
+    EXPECT_FALSE(commit(0x2a2b, key, data.size(), 1000));
+    EXPECT_EQ(0u, m_database.expireUploads(std::chrono::microseconds(0)));
+}
+
+TEST_F(AssetDatabaseTest, ExpireUploadsKeepsSessionsRefreshedAfterScan) {
+    std::string data(2500, 'v');
+    uint64_t uploadId = 0x4a4b;
+    uint64_t key = stageData(uploadId, data, 1000, 0x6);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    uint64_t cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    EXPECT_EQ(std::vector<uint64_t>({ uploadId }), m_database.findIdleUploads(cutoff));
+
+    // The client stages the rest of the upload after the scan found it idle, so the delete must leave it alone.
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    stageData(uploadId, data, 1000, 0x1);
+    size_t deletedChunks = 0;
+    EXPECT_FALSE(m_database.expireUpload(uploadId, cutoff, deletedChunks));
+    EXPECT_EQ(0u, deletedChunks);
+    std::vector<std::pair<uint64_t, uint64_t>> missing;
+    EXPECT_TRUE(m_database.findMissingStagedChunks(uploadId, 3, missing));
+    EXPECT_TRUE(missing.empty());
+    EXPECT_TRUE(commit(uploadId, key, data.size(), 1000));
+}
+
+TEST_F(AssetDatabaseTest, UpstreamQueueIsOldestFirstAndSurvivesReopen) {
+    std::vector<uint64_t> tokens;
+    for (uint64_t key : { 0x5a, 0x1b, 0x3c }) {
+        uint64_t token = m_database.queueUpstream(key);
+        ASSERT_NE(0u, token);
+        tokens.push_back(token);
+    }
+    EXPECT_TRUE(std::is_sorted(tokens.begin(), tokens.end()));
+
+    // Requests outlast the process that queued them.
+    m_database.close();
+    ASSERT_TRUE(m_database.open(m_path.c_str(), false, 0));
+
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    ASSERT_EQ(2u, m_database.getUpstreamQueue(2, entries));
+    EXPECT_EQ(std::make_pair(tokens[0], static_cast<uint64_t>(0x5a)), entries[0]);
+    EXPECT_EQ(std::make_pair(tokens[1], static_cast<uint64_t>(0x1b)), entries[1]);
+
+    // The queue doesn't run on into other entries in the database.
+    storeAsset(0x77);
+    EXPECT_TRUE(m_database.removeUpstream(tokens[0]));
+    ASSERT_EQ(2u, m_database.getUpstreamQueue(8, entries));
+    EXPECT_EQ(0x1bu, entries[0].second);
+    EXPECT_EQ(0x3cu, entries[1].second);
+
+    EXPECT_TRUE(m_database.removeUpstream(tokens[1]));
+    EXPECT_TRUE(m_database.removeUpstream(tokens[2]));
+    EXPECT_EQ(0u, m_database.getUpstreamQueue(8, entries));
+}
@@ -1,4 +1,5 @@
 #include "Asset.hpp"
+#include "Constants.hpp"
 
 #include <cstring>
 #include <gtest/gtest.h>
@@ -25,6 +26,8 @@ TEST(AssetTest, MinimalSerialization) {
     EXPECT_EQ(0, testAsset.deprecates());
     EXPECT_EQ(0, testAsset.size());
     EXPECT_EQ(0, testAsset.chunks());
+    EXPECT_EQ(0, testAsset.chunkSize());
+    EXPECT_EQ(Confab::kDataChunkSize, Confab::Asset::dataChunkSize(flatAsset));
     EXPECT_EQ(0, testAsset.salt());
     EXPECT_EQ(nullptr, testAsset.inlineData());
 }
@@ -43,6 +46,7 @@ TEST(AssetTest, AllFieldsSet) {
         inlineData[i] = 99 - i;
     }
     asset.setChunks(25);
+    asset.setChunkSize(65536);
 
     flatbuffers::FlatBufferBuilder builder;
     asset.flatten(builder);
@@ -63,6 +67,8 @@ TEST(AssetTest, AllFieldsSet) {
     EXPECT_EQ(asset.deprecates(), testAsset.deprecates());
     EXPECT_EQ(asset.salt(), testAsset.salt());
     EXPECT_EQ(asset.chunks(), testAsset.chunks());
+    EXPECT_EQ(asset.chunkSize(), testAsset.chunkSize());
+    EXPECT_EQ(65536, Confab::Asset::dataChunkSize(flatAsset));
     ASSERT_EQ(asset.size(), testAsset.size());
     EXPECT_EQ(std::memcmp(asset.inlineData(), testAsset.inlineData(), asset.size()), 0);
 }
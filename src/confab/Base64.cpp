@@ -0,0 +1,28 @@
+#include "Base64.hpp"
+
+#include "Tracer.hpp"
+
+#include "libbase64.h"
+
+namespace Confab {
+
+std::string encodeBase64(const SizedPointer& data) {
+    Span span("base64_encode");
+    std::string encoded(base64EncodedSize(data.size()), '\0');
+    size_t encodedSize = 0;
+    base64_encode(data.dataChar(), data.size(), &encoded[0], &encodedSize, 0);
+    encoded.resize(encodedSize);
+    return encoded;
+}
+
+bool decodeBase64(const char* encoded, size_t size, std::vector<uint8_t>& decoded) {
+    Span span("base64_decode");
+    // Decoded output is always smaller than 3/4 of the encoded size, rounded up.
+    decoded.resize(((size + 3) / 4) * 3);
+    size_t decodedSize = 0;
+    int status = base64_decode(encoded, size, reinterpret_cast<char*>(decoded.data()), &decodedSize, 0);
+    decoded.resize(decodedSize);
+    return status == 1;
+}
+
+}  // namespace Confab
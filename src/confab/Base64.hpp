@@ -0,0 +1,51 @@
+#ifndef SRC_CONFAB_BASE64_HPP_
+#define SRC_CONFAB_BASE64_HPP_
+
+#include "SizedPointer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Confab {
+
+/*! Computes the size of the base64 encoding of a buffer.
+ *
+ * \param size The size in bytes of the unencoded buffer.
+ * \return The size in bytes of the encoded string, without padding removal.
+ */
+inline size_t base64EncodedSize(size_t size) { return 4 * ((size + 2) / 3); }
+
+/*! Encodes the provided data as a base64 string, suitable for sending as an HTTP body.
+ *
+ * The string is allocated on the heap at the exact encoded size, so there is no upper bound on the size of the data
+ * beyond available memory, and the result can be moved directly into an HTTP response without an additional copy.
+ *
+ * \param data The data to encode.
+ * \return A string with the base64 encoding of data.
+ */
+std::string encodeBase64(const SizedPointer& data);
+
+/*! Decodes a base64 string into the provided buffer.
+ *
+ * \param encoded A pointer to the base64-encoded data.
+ * \param size The size of the encoded data in bytes.
+ * \param decoded A buffer to decode into. Will be resized to exactly fit the decoded data, so callers can reuse the
+ *                same buffer across calls to avoid repeated allocations.
+ * \return true on success, false if the input was not valid base64.
+ */
+bool decodeBase64(const char* encoded, size_t size, std::vector<uint8_t>& decoded);
+
+/*! Convenience overload of decodeBase64 for HTTP body strings.
+ *
+ * \param encoded The base64-encoded string.
+ * \param decoded A buffer to decode into, will be resized to fit the decoded data.
+ * \return true on success, false if the input was not valid base64.
+ */
+inline bool decodeBase64(const std::string& encoded, std::vector<uint8_t>& decoded) {
+    return decodeBase64(encoded.data(), encoded.size(), decoded);
+}
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_BASE64_HPP_
@@ -0,0 +1,113 @@
+#include "BufferPool.hpp"
+
+#include "Constants.hpp"
+#include "Metrics.hpp"
+
+#include <utility>
+
+namespace Confab {
+
+BufferRef::BufferRef(PooledBuffer* buffer) :
+    m_buffer(buffer) {
+    if (m_buffer) {
+        m_buffer->m_references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BufferRef::BufferRef(const BufferRef& ref) :
+    m_buffer(ref.m_buffer) {
+    if (m_buffer) {
+        m_buffer->m_references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BufferRef& BufferRef::operator=(BufferRef ref) noexcept {
+    std::swap(m_buffer, ref.m_buffer);
+    return *this;
+}
+
+BufferRef::~BufferRef() {
+    // The release ordering makes every use of the buffer through this reference happen before the buffer is handed
+    // out again by the pool.
+    if (m_buffer && m_buffer->m_references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        m_buffer->m_pool->release(m_buffer);
+    }
+}
+
+BufferPool::BufferPool(size_t maxFree, size_t maxBufferSize) :
+    m_maxFree(maxFree),
+    m_maxBufferSize(maxBufferSize),
+    m_stats{0, 0, 0, 0} {
+    m_free.reserve(m_maxFree);
+}
+
+BufferPool::~BufferPool() {
+    for (auto buffer : m_free) {
+        delete buffer;
+    }
+}
+
+BufferRef BufferPool::acquire(size_t size) {
+    PooledBuffer* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_free.empty()) {
+            buffer = m_free.back();
+            m_free.pop_back();
+            ++m_stats.reuses;
+        } else {
+            ++m_stats.allocations;
+        }
+    }
+    if (!buffer) {
+        buffer = new PooledBuffer(this);
+    }
+    buffer->m_bytes.resize(size);
+    return BufferRef(buffer);
+}
+
+BufferPool::Stats BufferPool::stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = m_stats;
+    stats.free = m_free.size();
+    return stats;
+}
+
+// static
+BufferPool& BufferPool::global() {
+    // Never destroyed, as records may still be released by other threads during exit.
+    static BufferPool* pool = [] {
+        auto globalPool = new BufferPool(kDefaultMaxFree, kMaxDataChunkSize + kPageSize);
+        MetricsRegistry::global().gauge("confab_buffer_pool_allocations", "Buffers the global pool has allocated.", "",
+            [globalPool] { return static_cast<double>(globalPool->stats().allocations); });
+        MetricsRegistry::global().gauge("confab_buffer_pool_reuses", "Buffers the global pool has handed out again.",
+            "", [globalPool] { return static_cast<double>(globalPool->stats().reuses); });
+        return globalPool;
+    }();
+    return *pool;
+}
+
+void BufferPool::release(PooledBuffer* buffer) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (buffer->m_bytes.capacity() <= m_maxBufferSize && m_free.size() < m_maxFree) {
+            m_free.push_back(buffer);
+            return;
+        }
+        ++m_stats.discards;
+    }
+    delete buffer;
+}
+
+PooledRecord::PooledRecord(BufferRef buffer) :
+    m_buffer(std::move(buffer)),
+    m_data(m_buffer && !m_buffer->bytes().empty() ? SizedPointer(m_buffer->bytes().data(), m_buffer->bytes().size()) :
+        SizedPointer()) {
+}
+
+PooledRecord::PooledRecord(BufferRef buffer, const SizedPointer& data) :
+    m_buffer(std::move(buffer)),
+    m_data(data) {
+}
+
+}  // namespace Confab
@@ -0,0 +1,188 @@
+#ifndef SRC_CONFAB_BUFFER_POOL_HPP_
+#define SRC_CONFAB_BUFFER_POOL_HPP_
+
+#include "Record.hpp"
+#include "SizedPointer.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Confab {
+
+class BufferPool;
+
+/*! A reference counted byte buffer from a BufferPool. The count lives in the buffer itself, so sharing a buffer costs
+ * no allocation, and the buffer goes back to its pool when the last BufferRef to it is dropped.
+ */
+class PooledBuffer {
+public:
+    /*! \return The bytes of the buffer, which the holder of the only reference may resize. */
+    std::vector<uint8_t>& bytes() { return m_bytes; }
+
+    /*! \return The bytes of the buffer. */
+    const std::vector<uint8_t>& bytes() const { return m_bytes; }
+
+    /// @cond UNDOCUMENTED
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    friend class BufferPool;
+    friend class BufferRef;
+
+    explicit PooledBuffer(BufferPool* pool) : m_pool(pool), m_references(0) { }
+
+    BufferPool* m_pool;
+    std::atomic<size_t> m_references;
+    std::vector<uint8_t> m_bytes;
+};
+
+/*! An intrusive reference to a PooledBuffer, which can be copied and moved freely between threads.
+ */
+class BufferRef {
+public:
+    /*! Constructs a reference to no buffer. */
+    BufferRef() : m_buffer(nullptr) { }
+
+    /*! Takes a reference to a buffer.
+     *
+     * \param buffer The buffer to reference, can be nullptr.
+     */
+    explicit BufferRef(PooledBuffer* buffer);
+
+    /// @cond UNDOCUMENTED
+    BufferRef(const BufferRef& ref);
+    BufferRef(BufferRef&& ref) noexcept : m_buffer(ref.m_buffer) { ref.m_buffer = nullptr; }
+    BufferRef& operator=(BufferRef ref) noexcept;
+    ~BufferRef();
+    /// @endcond UNDOCUMENTED
+
+    /*! \return The referenced buffer, or nullptr. */
+    PooledBuffer* get() const { return m_buffer; }
+
+    /*! \return The referenced buffer. */
+    PooledBuffer* operator->() const { return m_buffer; }
+
+    /*! \return true if this references a buffer. */
+    explicit operator bool() const { return m_buffer != nullptr; }
+
+private:
+    PooledBuffer* m_buffer;
+};
+
+/*! A thread-safe free list of byte buffers, so that decoding each network response into a buffer of its own doesn't
+ * cost an allocation once the pool has warmed up.
+ *
+ * Buffers keep their capacity while in the pool, and acquire() prefers the most recently released buffer, whose
+ * capacity most likely already fits. Only up to maxFree buffers of at most maxBufferSize bytes of capacity are kept,
+ * any others are deleted when released, so an occasional large response doesn't pin its memory. Every buffer must be
+ * released before its pool is destroyed, which global() guarantees by never destroying its pool.
+ */
+class BufferPool {
+public:
+    /*! The default number of released buffers to keep for reuse. */
+    static constexpr size_t kDefaultMaxFree = 16;
+
+    /*! A point-in-time copy of the pool counters.
+     */
+    struct Stats {
+        uint64_t allocations;  //!< Buffers created because there were none free.
+        uint64_t reuses;       //!< Buffers handed out from the free list.
+        uint64_t discards;     //!< Released buffers deleted rather than kept.
+        size_t free;           //!< Buffers in the free list now.
+    };
+
+    /*! Constructs an empty pool.
+     *
+     * \param maxFree The most released buffers to keep for reuse.
+     * \param maxBufferSize The largest capacity in bytes of a buffer worth keeping.
+     */
+    BufferPool(size_t maxFree, size_t maxBufferSize);
+
+    /*! Deletes the buffers in the free list.
+     */
+    ~BufferPool();
+
+    /*! Hands out a buffer, reusing a released one if there is one.
+     *
+     * \param size The size to resize the buffer to.
+     * \return The only reference to the buffer.
+     */
+    BufferRef acquire(size_t size);
+
+    /*! \return A copy of the pool counters. */
+    Stats stats();
+
+    /*! \return The process-wide pool, sized for decoded HTTP responses up to the largest AssetData chunk. */
+    static BufferPool& global();
+
+    /// @cond UNDOCUMENTED
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    friend class BufferRef;
+
+    // Called when the last reference to a buffer is dropped.
+    void release(PooledBuffer* buffer);
+
+    const size_t m_maxFree;
+    const size_t m_maxBufferSize;
+
+    std::mutex m_mutex;
+    std::vector<PooledBuffer*> m_free;
+    Stats m_stats;
+};
+
+/*! A Record that owns its data through a reference to a pooled buffer, so unlike a Record pointing into a network
+ * response it remains valid for as long as it is kept. Several records can share one buffer, such as the Assets within
+ * a batch response.
+ */
+class PooledRecord : public Record {
+public:
+    /*! Constructs a record holding all of a buffer.
+     *
+     * \param buffer The buffer holding the record data.
+     */
+    explicit PooledRecord(BufferRef buffer);
+
+    /*! Constructs a record holding part of a buffer.
+     *
+     * \param buffer The buffer holding the record data.
+     * \param data The record data, which must lie within buffer.
+     */
+    PooledRecord(BufferRef buffer, const SizedPointer& data);
+
+    ~PooledRecord() override = default;
+
+    /*! True if this PooledRecord has no data.
+     *
+     * \return true if this Record is empty, false if it has content.
+     */
+    bool empty() const override { return m_data.data() == nullptr; }
+
+    /*! A pointer to the data contents of this Record, valid while this Record exists.
+     *
+     * \return A pointer to the data contents of this Record.
+     */
+    const SizedPointer data() const override { return m_data; }
+
+    /*! A pointer to the key contents of this Record.
+     *
+     * \return Always empty.
+     */
+    const SizedPointer key() const override { return SizedPointer(); }
+
+private:
+    const BufferRef m_buffer;
+    const SizedPointer m_data;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_BUFFER_POOL_HPP_
@@ -0,0 +1,82 @@
+#include "BufferPool.hpp"
+
+#include "Record.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using Confab::BufferPool;
+using Confab::BufferRef;
+using Confab::PooledRecord;
+using Confab::RecordPtr;
+using Confab::SizedPointer;
+
+TEST(BufferPoolTest, ReusesReleasedBuffers) {
+    BufferPool pool(2, 1024);
+    const uint8_t* first = nullptr;
+    {
+        BufferRef buffer = pool.acquire(100);
+        ASSERT_TRUE(buffer);
+        EXPECT_EQ(100u, buffer->bytes().size());
+        first = buffer->bytes().data();
+    }
+    EXPECT_EQ(1u, pool.stats().free);
+
+    // The released buffer comes back with its capacity, so a smaller request doesn't allocate.
+    BufferRef again = pool.acquire(50);
+    EXPECT_EQ(first, again->bytes().data());
+    BufferPool::Stats stats = pool.stats();
+    EXPECT_EQ(1u, stats.allocations);
+    EXPECT_EQ(1u, stats.reuses);
+    EXPECT_EQ(0u, stats.free);
+}
+
+TEST(BufferPoolTest, DiscardsOversizedAndSurplusBuffers) {
+    BufferPool pool(1, 1024);
+    {
+        BufferRef large = pool.acquire(4096);
+        BufferRef a = pool.acquire(10);
+        BufferRef b = pool.acquire(10);
+    }
+    BufferPool::Stats stats = pool.stats();
+    EXPECT_EQ(3u, stats.allocations);
+    EXPECT_EQ(2u, stats.discards);
+    EXPECT_EQ(1u, stats.free);
+}
+
+TEST(BufferPoolTest, BufferReturnsOnlyAfterLastReference) {
+    BufferPool pool(4, 1024);
+    BufferRef buffer = pool.acquire(8);
+    std::memcpy(buffer->bytes().data(), "records", 8);
+    RecordPtr whole = std::make_shared<PooledRecord>(buffer);
+    RecordPtr part = std::make_shared<PooledRecord>(buffer, SizedPointer(buffer->bytes().data() + 4, 4));
+    buffer = BufferRef();
+
+    // The records keep the buffer out of the pool, so its contents stay put.
+    EXPECT_EQ(0u, pool.stats().free);
+    EXPECT_STREQ("records", whole->data().dataChar());
+    EXPECT_STREQ("rds", part->data().dataChar());
+    whole.reset();
+    EXPECT_EQ(0u, pool.stats().free);
+
+    // Records may be dropped on any thread.
+    std::thread([&part] { part.reset(); }).join();
+    EXPECT_EQ(1u, pool.stats().free);
+}
+
+TEST(BufferPoolTest, EmptyBuffersMakeEmptyRecords) {
+    BufferPool pool(4, 1024);
+    PooledRecord record(pool.acquire(0));
+    EXPECT_TRUE(record.empty());
+    EXPECT_EQ(0u, record.data().size());
+}
+
+TEST(BufferPoolTest, EmptyRecordIsShared) {
+    RecordPtr empty = Confab::makeEmptyRecord();
+    EXPECT_TRUE(empty->empty());
+    EXPECT_EQ(empty.get(), Confab::makeEmptyRecord().get());
+}
@@ -1,24 +1,426 @@
 #include "CacheManager.hpp"
 
 #include "Asset.hpp"
+#include "ChunkLayout.hpp"
 #include "Constants.hpp"
+#include "ContentChunker.hpp"
+#include "EventLog.hpp"
 #include "HttpClient.hpp"
+#include "MappedFile.hpp"
+#include "Metrics.hpp"
 #include "schemas/FlatAsset_generated.h"
 #include "schemas/FlatAssetData_generated.h"
 
 #include "glog/logging.h"
+// The saved state of a partial download includes the XXH64 state, so needs the state struct definition.
+#define XXH_STATIC_LINKING_ONLY
 #include "xxhash.h"
 
-#include <array>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/*! The state of one download, shared between CacheManager::download and the chunk callbacks, which run on HTTP client
+ * threads and may outlive the download call itself if it fails early.
+ */
+struct Download {
+    Download(uint64_t key, const Confab::ChunkLayout& layout, size_t window, int fd, const fs::path& filePath) :
+        key(key),
+        layout(layout),
+        fileSize(layout.size()),
+        chunks(layout.chunks()),
+        window(std::max(window, static_cast<size_t>(1))),
+        fd(fd),
+        filePath(filePath),
+        nextChunk(0),
+        nextToHash(0),
+        inFlight(0),
+        failed(false),
+        resumable(true),
+        hashState(XXH64_createState()),
+        digest(0),
+        downloadedSize(0),
+        written(layout.chunks(), false) {
+        XXH64_reset(hashState, 0);
+    }
+
+    ~Download() {
+        XXH64_freeState(hashState);
+    }
+
+    const uint64_t key;
+    const Confab::ChunkLayout layout;
+    const size_t fileSize;
+    const uint64_t chunks;
+    const size_t window;
+    const int fd;
+    const fs::path filePath;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t nextChunk;
+    uint64_t nextToHash;
+    size_t inFlight;
+    bool failed;
+    // False if the partial file can't be trusted, so must not be kept to resume from.
+    bool resumable;
+    XXH64_state_t* hashState;
+    uint64_t digest;
+    size_t downloadedSize;
+    // Chunks written to the file, including those kept from an earlier attempt at the download.
+    std::vector<bool> written;
+    // Chunks written to the file that arrived ahead of an earlier chunk, so must wait for it before being added to
+    // the hash chain, with the incremental hash the server sent for each.
+    std::map<uint64_t, std::pair<std::vector<uint8_t>, uint64_t>> unhashed;
+};
+
+/*! Writes all of data to fd at offset, retrying short writes. Returns false on error.
+ */
+bool writeAt(int fd, const uint8_t* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/*! Reads size bytes from fd at offset into data, retrying short reads. Returns false on error or end of file.
+ */
+bool readAt(int fd, uint8_t* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t bytesRead = ::pread(fd, data, size, offset);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += bytesRead;
+        size -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
+}
+
+// Identifies the sidecar file saving the progress of a partial download. The state includes the raw XXH64 state, so
+// is only meaningful to the same build of the client, and a sidecar from another build is discarded.
+const char kPartialMagic[8] = { 'C', 'F', 'P', 'A', 'R', 'T', '0', '1' };
+
+template<typename T>
+void writeValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool readValue(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+/*! Saves the progress of a download to statePath, so a later download of the same Asset can resume from it. The
+ * sidecar holds the Asset dimensions, the number of chunks verified into the hash chain and its state, and a bitmap
+ * of the chunks written to the partial file. Requires the lock, and no chunks in flight.
+ */
+bool savePartialState(Download& download, const fs::path& statePath) {
+    // The bitmap must never claim chunks that aren't durably in the partial file.
+    if (::fdatasync(download.fd) != 0) {
+        return false;
+    }
+    fs::path tempPath = statePath;
+    tempPath += ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(kPartialMagic, sizeof(kPartialMagic));
+        writeValue(out, download.key);
+        writeValue(out, static_cast<uint64_t>(download.fileSize));
+        writeValue(out, download.chunks);
+        writeValue(out, download.layout.fingerprint());
+        writeValue(out, download.nextToHash);
+        writeValue(out, download.digest);
+        writeValue(out, static_cast<uint32_t>(sizeof(XXH64_state_t)));
+        writeValue(out, *download.hashState);
+        std::vector<uint8_t> bitmap((download.chunks + 7) / 8, 0);
+        for (uint64_t i = 0; i < download.chunks; ++i) {
+            if (download.written[i]) {
+                bitmap[i / 8] |= 1 << (i % 8);
+            }
+        }
+        out.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size());
+        out.flush();
+        if (!out) {
+            fs::remove(tempPath);
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(tempPath, statePath, error);
+    return !error;
+}
+
+/*! Restores the progress of an earlier attempt at a download from statePath, if it was saved for the same Asset.
+ *
+ * \return true if the download now resumes where the earlier attempt stopped, false if it starts from scratch.
+ */
+bool loadPartialState(Download& download, const fs::path& statePath) {
+    std::ifstream in(statePath, std::ios::binary);
+    char magic[sizeof(kPartialMagic)];
+    uint64_t key = 0, fileSize = 0, chunks = 0, fingerprint = 0, verified = 0, digest = 0;
+    uint32_t stateSize = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kPartialMagic, sizeof(magic)) != 0 ||
+            !readValue(in, key) || !readValue(in, fileSize) || !readValue(in, chunks) || !readValue(in, fingerprint) ||
+            !readValue(in, verified) || !readValue(in, digest) || !readValue(in, stateSize)) {
+        return false;
+    }
+    if (key != download.key || fileSize != download.fileSize || chunks != download.chunks ||
+            fingerprint != download.layout.fingerprint() || verified >= chunks || stateSize != sizeof(XXH64_state_t)) {
+        return false;
+    }
+    XXH64_state_t hashState;
+    std::vector<uint8_t> bitmap((chunks + 7) / 8);
+    if (!readValue(in, hashState) || !in.read(reinterpret_cast<char*>(bitmap.data()), bitmap.size())) {
+        return false;
+    }
+
+    *download.hashState = hashState;
+    download.digest = digest;
+    download.nextToHash = verified;
+    download.nextChunk = verified;
+    download.downloadedSize = download.layout.offset(verified);
+    for (uint64_t i = 0; i < chunks; ++i) {
+        download.written[i] = i < verified || (bitmap[i / 8] & (1 << (i % 8)));
+    }
+    return true;
+}
+
+/*! Adds one chunk to the download's hash chain and checks it against the hash the server sent. Requires the lock.
+ */
+void hashChunk(Download& download, const uint8_t* data, size_t size, uint64_t expectedHash) {
+    XXH64_update(download.hashState, data, size);
+    download.digest = XXH64_digest(download.hashState);
+    if (download.digest != expectedHash) {
+        LOG(ERROR) << "incremental hash validation for asset download " << download.filePath << " chunk number "
+            << download.nextToHash << " failed, computed " << Confab::Asset::keyToString(download.digest)
+            << ", expected " << Confab::Asset::keyToString(expectedHash);
+        download.failed = true;
+        download.resumable = false;
+        return;
+    }
+    download.downloadedSize += size;
+    ++download.nextToHash;
+}
+
+/*! Extends the hash chain over the chunks that have arrived, in order, reading back any that an earlier attempt at
+ * the download left in the file. Those have no hash from the server to check, but the final digest covers them.
+ * Requires the lock.
+ */
+void advanceHashChain(Download& download) {
+    std::vector<uint8_t> stored;
+    while (!download.failed && download.nextToHash < download.chunks) {
+        auto next = download.unhashed.begin();
+        if (next != download.unhashed.end() && next->first == download.nextToHash) {
+            hashChunk(download, next->second.first.data(), next->second.first.size(), next->second.second);
+            download.unhashed.erase(next);
+        } else if (download.written[download.nextToHash]) {
+            uint64_t chunk = download.nextToHash;
+            stored.resize(download.layout.chunkSize(chunk));
+            if (!readAt(download.fd, stored.data(), stored.size(), static_cast<off_t>(download.layout.offset(chunk)))) {
+                LOG(ERROR) << "error reading back chunk " << chunk << " of partial file " << download.filePath;
+                download.failed = true;
+                download.resumable = false;
+                return;
+            }
+            XXH64_state_t hashState = *download.hashState;
+            XXH64_update(&hashState, stored.data(), stored.size());
+            hashChunk(download, stored.data(), stored.size(), XXH64_digest(&hashState));
+        } else {
+            return;
+        }
+    }
+}
+
+/*! Writes a received chunk to the file at its offset, then extends the verified hash chain as far as it can.
+ */
+void receiveChunk(Download& download, uint64_t chunkNumber, Confab::RecordPtr assetDataRecord) {
+    bool ok = false;
+    const Confab::Data::FlatAssetData* flatAssetData = nullptr;
+    if (assetDataRecord->empty()) {
+        LOG(ERROR) << "error downloading chunk " << chunkNumber << " for file " << download.filePath;
+    } else {
+        flatAssetData = Confab::Data::GetFlatAssetData(assetDataRecord->data().data());
+        size_t expectedSize = download.layout.chunkSize(chunkNumber);
+        if (!flatAssetData->data() || flatAssetData->data()->size() != expectedSize) {
+            LOG(ERROR) << "chunk " << chunkNumber << " for file " << download.filePath << " has "
+                << (flatAssetData->data() ? flatAssetData->data()->size() : 0) << " bytes, expected " << expectedSize;
+        } else if (!writeAt(download.fd, flatAssetData->data()->data(), expectedSize,
+                static_cast<off_t>(download.layout.offset(chunkNumber)))) {
+            LOG(ERROR) << "error writing chunk " << chunkNumber << " to file " << download.filePath << ": "
+                << std::strerror(errno);
+        } else {
+            ok = true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(download.mutex);
+        --download.inFlight;
+        if (!ok) {
+            download.failed = true;
+        } else if (download.failed) {
+            // Too late to hash, but worth keeping if the download is resumed.
+            download.written[chunkNumber] = true;
+        } else {
+            download.written[chunkNumber] = true;
+            // Chunks arriving in order are hashed straight from the record, others are copied aside until the chunks
+            // before them have arrived.
+            if (chunkNumber == download.nextToHash) {
+                hashChunk(download, flatAssetData->data()->data(), flatAssetData->data()->size(),
+                    flatAssetData->hash());
+            } else {
+                download.unhashed.emplace(chunkNumber, std::make_pair(std::vector<uint8_t>(
+                    flatAssetData->data()->begin(), flatAssetData->data()->end()), flatAssetData->hash()));
+            }
+            advanceHashChain(download);
+        }
+    }
+    download.changed.notify_all();
+}
+
+/*! Splits a cached file of an Asset that the downloading Asset deprecates the same way the downloading Asset is split,
+ * asks the server which chunks of the downloading Asset match, and copies those into the partial file, marking them
+ * written. advanceHashChain() reads them back into the hash chain, and the final digest check catches any that don't
+ * belong. Requires no chunks in flight.
+ *
+ * \return The number of bytes copied, with reusedChunks set to the number of chunks.
+ */
+size_t copyDeltaChunks(Confab::HttpClient& httpClient, Download& download, const fs::path& deprecatedPath,
+        uint64_t& reusedChunks) {
+    reusedChunks = 0;
+    Confab::MappedFile file;
+    if (!file.open(deprecatedPath)) {
+        LOG(ERROR) << "error opening cache file " << deprecatedPath << " to reuse its chunks.";
+        return 0;
+    }
+    const Confab::ChunkLayout& layout = download.layout;
+    std::vector<uint64_t> offsets;
+    if (layout.contentDefined()) {
+        Confab::ContentChunker chunker(layout.maxChunkSize());
+        if (!chunker.split(file, offsets)) {
+            LOG(ERROR) << "error reading cache file " << deprecatedPath << " to find its chunks.";
+            return 0;
+        }
+    } else {
+        for (size_t offset = 0; offset < file.size(); offset += layout.maxChunkSize()) {
+            offsets.push_back(offset);
+        }
+    }
+    if (offsets.empty() || offsets.size() > Confab::kMaxDeltaChunks) {
+        return 0;
+    }
+
+    std::vector<uint64_t> hashes;
+    hashes.reserve(offsets.size());
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        size_t size = (i + 1 < offsets.size() ? offsets[i + 1] : file.size()) - offsets[i];
+        Confab::SizedPointer data = file.read(offsets[i], size);
+        if (!data.data()) {
+            LOG(ERROR) << "error reading chunk " << i << " of cache file " << deprecatedPath;
+            return 0;
+        }
+        hashes.push_back(XXH64(data.data(), data.size(), 0));
+    }
+
+    std::vector<int32_t> sources;
+    if (!httpClient.getDeltaPlan(download.key, hashes, sources) || sources.size() != download.chunks) {
+        LOG(WARNING) << "no usable delta plan for " << download.filePath << ", downloading every chunk.";
+        return 0;
+    }
+
+    size_t reusedBytes = 0;
+    for (uint64_t chunk = 0; chunk < download.chunks; ++chunk) {
+        int32_t source = sources[chunk];
+        if (source < 0 || static_cast<size_t>(source) >= offsets.size()) {
+            continue;
+        }
+        size_t size = layout.chunkSize(chunk);
+        size_t sourceEnd = static_cast<size_t>(source) + 1 < offsets.size() ? offsets[source + 1] : file.size();
+        if (sourceEnd - offsets[source] != size) {
+            continue;
+        }
+        Confab::SizedPointer data = file.read(offsets[source], size);
+        if (!data.data() || !writeAt(download.fd, data.data(), size, static_cast<off_t>(layout.offset(chunk)))) {
+            LOG(ERROR) << "error copying chunk " << source << " of " << deprecatedPath << " to chunk " << chunk
+                << " of " << download.filePath;
+            continue;
+        }
+        download.written[chunk] = true;
+        reusedBytes += size;
+        ++reusedChunks;
+    }
+    return reusedBytes;
+}
+
+/*! Requests chunks until the window ahead of the last verified chunk is full, skipping any already in the file.
+ */
+void requestChunks(std::shared_ptr<Confab::HttpClient> httpClient, std::shared_ptr<Download> download) {
+    std::vector<uint64_t> chunks;
+    {
+        std::lock_guard<std::mutex> lock(download->mutex);
+        while (!download->failed && download->nextChunk < download->chunks &&
+                download->nextChunk < download->nextToHash + download->window) {
+            if (!download->written[download->nextChunk]) {
+                chunks.push_back(download->nextChunk);
+                ++download->inFlight;
+            }
+            ++download->nextChunk;
+        }
+    }
+    for (auto chunk : chunks) {
+        httpClient->getAssetDataAsync(download->key, chunk, [httpClient, download](uint64_t chunkKey,
+                uint64_t chunkNumber, Confab::RecordPtr assetDataRecord) {
+            receiveChunk(*download, chunkNumber, assetDataRecord);
+            requestChunks(httpClient, download);
+        });
+    }
+}
+
+}  // namespace
 
 namespace Confab {
 
-CacheManager::CacheManager(const fs::path& cachePath, size_t maxSize, std::shared_ptr<HttpClient> httpClient) :
+CacheManager::CacheManager(const fs::path& cachePath, size_t maxSize, std::shared_ptr<HttpClient> httpClient,
+        size_t downloadWindow) :
     m_cachePath(cachePath),
+    m_partialPath(cachePath / "partial"),
     m_maxSize(maxSize),
     m_httpClient(httpClient),
-    m_currentSize(0) {
+    m_downloadWindow(downloadWindow),
+    m_currentSize(0),
+    m_downloadLeaders(MetricsRegistry::global().counter("confab_client_coalesced_requests_total",
+        "Asset requests that started a lookup or download, or joined one already in flight.",
+        "request=\"download\",role=\"leader\"")),
+    m_downloadFollowers(MetricsRegistry::global().counter("confab_client_coalesced_requests_total",
+        "Asset requests that started a lookup or download, or joined one already in flight.",
+        "request=\"download\",role=\"follower\"")),
+    m_deltaReusedBytes(MetricsRegistry::global().counter("confab_client_delta_reused_bytes_total",
+        "Bytes of downloaded Assets copied from the cached file of the Asset they deprecate instead of fetched.")) {
 }
 
 void CacheManager::checkExistingEntries(bool validate) {
@@ -31,6 +433,22 @@ void CacheManager::checkExistingEntries(bool validate) {
     }
     m_extensionMap.clear();
 
+    // Partial downloads are only usable with their saved progress, so remove any left without it, or vice versa.
+    std::error_code error;
+    if (fs::is_directory(m_partialPath, error)) {
+        for (auto& entry : fs::directory_iterator(m_partialPath)) {
+            fs::path path = entry.path();
+            fs::path counterpart = path;
+            counterpart.replace_extension(path.extension() == ".part" ? ".state" : ".part");
+            if (!fs::exists(counterpart, error)) {
+                LOG(WARNING) << "removing orphaned partial download file " << path;
+                fs::remove(path, error);
+            } else if (path.extension() == ".part") {
+                LOG(INFO) << "found partial download " << path << ", " << fs::file_size(path, error) << " bytes.";
+            }
+        }
+    }
+
     for (auto& entry : fs::directory_iterator(m_cachePath)) {
         fs::path path = entry.path();
         if (fs::is_regular_file(path)) {
@@ -39,31 +457,19 @@ void CacheManager::checkExistingEntries(bool validate) {
             uint64_t key = Asset::stringToKey(path.stem());
             bool valid = true;
             if (validate) {
-                XXH64_state_t* hashState = XXH64_createState();
-                XXH64_reset(hashState, 0);
-                std::array<char, kDataChunkSize> fileChunk;
-                std::ifstream inFile(path);
-                if (!inFile) {
+                // Validating gigabytes of samples at startup is a sequential scan, so read them through a mapping.
+                MappedFile file;
+                uint64_t hash = 0;
+                if (!file.open(path)) {
                     LOG(ERROR) << "error opening cache file: " << path << " for hash validation.";
                     valid = false;
+                } else if (!file.hash(hash) || hash != key) {
+                    LOG(ERROR) << "error validating cache file: " << path << " computed hash of "
+                        << Asset::keyToString(hash) << ".";
+                    valid = false;
                 } else {
-                    size_t bytesRemaining = fileSize;
-                    while (inFile && bytesRemaining > 0) {
-                        inFile.read(fileChunk.data(), kDataChunkSize);
-                        size_t bytesRead = inFile.gcount();
-                        bytesRemaining -= bytesRead;
-                        XXH64_update(hashState, fileChunk.data(), bytesRead);
-                    }
-                    uint64_t hash = XXH64_digest(hashState);
-                    if (hash != key || bytesRemaining > 0) {
-                        LOG(ERROR) << "error validating cache file: " << path << " computed hash of "
-                            << Asset::keyToString(hash) << " with " << bytesRemaining << " bytes unread.";
-                        valid = false;
-                    } else {
-                        LOG(INFO) << "validated cache file " << path << ".";
-                    }
+                    LOG(INFO) << "validated cache file " << path << ".";
                 }
-                XXH64_freeState(hashState);
             }
             if (valid) {
                 std::lock_guard<std::mutex> lock(m_mutex);
@@ -94,14 +500,14 @@ fs::path CacheManager::checkCache(uint64_t key) {
         std::lock_guard<std::mutex> lock(m_mutex);
         auto extensionPair = m_extensionMap.find(key);
         if (extensionPair == m_extensionMap.end()) {
-            LOG(INFO) << "cache miss for Asset " << Asset::keyToString(key);
+            logEvent(kClientCacheMiss, key);
             return fs::path();
         }
         cachePath = m_cachePath;
         cachePath += fs::path(Asset::keyToString(key) + extensionPair->second);
     }
 
-    LOG(INFO) << "cache hit for Asset " << Asset::keyToString(key) << " at " << cachePath;
+    logEvent(kClientCacheHit, key);
 
     // Update file write time to reflect the access of this cached asset. NOTE that this means the data in m_timeQueue
     // is now invalid, leading to a need for re-verification of write times in the queue when identifying eviction
@@ -110,67 +516,148 @@ fs::path CacheManager::checkCache(uint64_t key) {
     return cachePath;
 }
 
-fs::path CacheManager::download(uint64_t key, size_t fileSize, uint64_t chunks, const std::string& fileExtension) {
+fs::path CacheManager::download(uint64_t key, const ChunkLayout& layout, const std::string& fileExtension,
+        uint64_t deprecates) {
+    std::shared_ptr<std::promise<fs::path>> result(new std::promise<fs::path>);
+    std::future<fs::path> path = result->get_future();
+    if (m_downloads.join(key, [result](fs::path filePath) { result->set_value(filePath); })) {
+        m_downloadLeaders->add();
+        m_downloads.complete(key, fetch(key, layout, fileExtension, deprecates));
+    } else {
+        m_downloadFollowers->add();
+        LOG(INFO) << "waiting on download already in flight for " << Asset::keyToString(key);
+    }
+    return path.get();
+}
+
+fs::path CacheManager::fetch(uint64_t key, const ChunkLayout& layout, const std::string& fileExtension,
+        uint64_t deprecates) {
+    size_t fileSize = layout.size();
+    uint64_t chunks = layout.chunks();
     fs::path filePath = m_cachePath;
     filePath += fs::path("/" + Asset::keyToString(key) + fileExtension);
     LOG(INFO) << "downloading Asset data for " << Asset::keyToString(key) << ", " << chunks << " chunks "
         << fileSize << " bytes, into file " << filePath;
 
-    std::ofstream outFile(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!outFile) {
-        LOG(ERROR) << "error opening file " << filePath << " for writing.";
+    if (!layout.valid()) {
+        LOG(ERROR) << "inconsistent Asset size " << fileSize << " for " << chunks << " chunks of up to "
+            << layout.maxChunkSize() << " bytes, not downloading " << filePath;
         return fs::path();
     }
 
-    size_t downloadedSize = 0;
+    // Chunks are downloaded into a partial file, which is only moved into the cache once its hash is verified. If the
+    // download fails, the partial file is kept with a sidecar of its progress for the next request to resume from.
+    std::string keyString = Asset::keyToString(key);
+    fs::path partialPath = m_partialPath / fs::path(keyString + ".part");
+    fs::path statePath = m_partialPath / fs::path(keyString + ".state");
+    std::error_code error;
+    fs::create_directories(m_partialPath, error);
+    bool hasState = fs::exists(statePath, error);
+    int fd = ::open(partialPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG(ERROR) << "error opening file " << partialPath << " for writing: " << std::strerror(errno);
+        return fs::path();
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::shared_ptr<Download> state(new Download(key, layout, m_downloadWindow, fd, partialPath));
+    bool resumed = hasState && loadPartialState(*state, statePath);
+    if (resumed) {
+        LOG(INFO) << "resuming download of " << keyString << " from chunk " << state->nextToHash << " of " << chunks
+            << ", " << std::count(state->written.begin(), state->written.end(), true) << " chunks already present.";
+    } else if (::ftruncate(fd, 0) != 0) {
+        LOG(ERROR) << "error truncating file " << partialPath << ": " << std::strerror(errno);
+        ::close(fd);
+        return fs::path();
+    }
+    // Once this attempt starts writing, the saved progress no longer describes the file, until saved again on failure.
+    fs::remove(statePath, error);
+
+    // A fresh download of an Asset that replaces a cached one starts from the chunks the two have in common.
+    fs::path deprecatedPath;
+    if (!resumed && deprecates) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto extensionPair = m_extensionMap.find(deprecates);
+        if (extensionPair != m_extensionMap.end()) {
+            deprecatedPath = m_cachePath;
+            deprecatedPath += fs::path("/" + Asset::keyToString(deprecates) + extensionPair->second);
+        }
+    }
+    size_t reusedBytes = 0;
+    if (!deprecatedPath.empty()) {
+        uint64_t reusedChunks = 0;
+        reusedBytes = copyDeltaChunks(*m_httpClient, *state, deprecatedPath, reusedChunks);
+        if (reusedBytes) {
+            LOG(INFO) << "reusing " << reusedChunks << " of " << chunks << " chunks, " << reusedBytes << " bytes, of "
+                << deprecatedPath << " for " << filePath;
+            logEvent(kClientDeltaReused, reusedChunks, reusedBytes, deprecates);
+            m_deltaReusedBytes->add(reusedBytes);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        advanceHashChain(*state);
+    }
+    requestChunks(m_httpClient, state);
+
+    bool ok = false;
+    bool resumable = false;
     uint64_t digest = 0;
-    XXH64_state_t* hashState = XXH64_createState();
-    XXH64_reset(hashState, 0);
-    bool ok = true;
-
-    // Download AssetData chunk-by-chunk sequentially, validate each chunk, then write to file.
-    for (auto i = 0; i < chunks; ++i) {
-        m_httpClient->getAssetData(key, i, [&filePath, &outFile, &downloadedSize, &digest, &hashState, &ok](
-            uint64_t chunkKey, uint64_t chunkNumber, RecordPtr assetDataRecord) {
-            if (assetDataRecord->empty()) {
-                LOG(ERROR) << "error downloading chunk " << chunkNumber << " for file " << filePath;
-                ok = false;
-            } else {
-                // Validate incremental hash of incoming data.
-                const Data::FlatAssetData* flatAssetData = Data::GetFlatAssetData(assetDataRecord->data().data());
-                const uint8_t* chunkData = flatAssetData->data()->data();
-                size_t chunkDataSize = flatAssetData->data()->size();
-                XXH64_update(hashState, chunkData, chunkDataSize);
-                digest = XXH64_digest(hashState);
-                if (digest != flatAssetData->hash()) {
-                    LOG(ERROR) << "incremental hash validation for asset download " << filePath << " chunk number "
-                        << chunkNumber << " failed, computed " << Asset::keyToString(digest) << ", expected "
-                        << Asset::keyToString(flatAssetData->hash());
-                    ok = false;
-                } else {
-                    downloadedSize += chunkDataSize;
-                    outFile.write(reinterpret_cast<const char*>(chunkData), chunkDataSize);
-                }
-            }
+    size_t downloadedSize = 0;
+    {
+        // Wait for every requested chunk to come back, even after a failure, as their callbacks write to the file.
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->changed.wait(lock, [&state] {
+            return state->inFlight == 0 && (state->failed || state->nextToHash == state->chunks);
         });
-        if (!ok) break;
+        ok = !state->failed;
+        digest = state->digest;
+        downloadedSize = state->downloadedSize;
+        if (!ok && state->resumable) {
+            resumable = savePartialState(*state, statePath);
+        }
     }
 
-    XXH64_freeState(hashState);
-    outFile.close();
+    if (::close(fd) != 0) {
+        LOG(ERROR) << "error closing file " << partialPath << ": " << std::strerror(errno);
+        ok = false;
+    }
 
     if (ok && (key != digest || fileSize != downloadedSize)) {
-        LOG(ERROR) << "asset Data mismatch, key: " << Asset::keyToString(key) << " computed hash: "
-            << Asset::keyToString(digest) << " recorded size: " << fileSize << " downloaded bytes: " << downloadedSize;
+        LOG(ERROR) << "asset Data mismatch, key: " << keyString << " computed hash: " << Asset::keyToString(digest)
+            << " recorded size: " << fileSize << " downloaded bytes: " << downloadedSize;
         ok = false;
+        if (reusedBytes) {
+            LOG(WARNING) << "chunks reused from " << deprecatedPath << " may not match, downloading " << filePath
+                << " in full.";
+            fs::remove(partialPath, error);
+            return fetch(key, layout, fileExtension, 0);
+        }
+    }
+
+    if (ok) {
+        fs::rename(partialPath, filePath, error);
+        if (error) {
+            LOG(ERROR) << "error moving " << partialPath << " to " << filePath << ": " << error.message();
+            ok = false;
+        }
     }
 
     if (!ok) {
-        LOG(WARNING) << "failed to download " << filePath << " removing file.";
-        fs::remove(filePath);
+        if (resumable) {
+            LOG(WARNING) << "failed to download " << filePath << ", keeping partial file to resume from.";
+        } else {
+            LOG(WARNING) << "failed to download " << filePath << " removing file.";
+            fs::remove(partialPath, error);
+            fs::remove(statePath, error);
+        }
         return fs::path();
     }
 
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    LOG(INFO) << "downloaded " << fileSize << " bytes of " << filePath << " in " << elapsed.count() << " ms.";
+
     std::chrono::time_point writeTime = fs::last_write_time(filePath);
 
     // Add filePath to cache tracking data structures.
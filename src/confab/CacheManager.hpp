@@ -1,6 +1,8 @@
 #ifndef SRC_CONFAB_SRC_CACHE_MANAGER_HPP_
 #define SRC_CONFAB_SRC_CACHE_MANAGER_HPP_
 
+#include "SingleFlight.hpp"
+
 #include <chrono>
 #include <experimental/filesystem>
 #include <memory>
@@ -14,6 +16,8 @@ namespace fs = std::experimental::filesystem;
 
 namespace Confab {
 
+class ChunkLayout;
+class Counter;
 class HttpClient;
 
 /*! Manages a file cache of file-based Assets, using an LRU eviction strategy to maintain a fixed maximum size.
@@ -21,16 +25,24 @@ class HttpClient;
  */
 class CacheManager {
 public:
+    /*! The default number of chunks of each download to keep in flight, matching the server's default per-peer limit
+     * on AssetData requests. */
+    static constexpr size_t kDefaultDownloadWindow = 8;
+
     /*! Constructs a cache manager to manage cache files out of the provided directory.
      *
      * \param cachePath A path to the cache directory.
      * \param maxSize The size in bytes at which to start evicting least recently used cache entries.
      * \param httpClient A pointer to the HttpClient object, for downloaded resources not in cache.
+     * \param downloadWindow The maximum number of AssetData chunks of one download to have requested but not yet
+     *                       verified at once.
      */
-    CacheManager(const fs::path& cachePath, size_t maxSize, std::shared_ptr<HttpClient> httpClient);
+    CacheManager(const fs::path& cachePath, size_t maxSize, std::shared_ptr<HttpClient> httpClient,
+            size_t downloadWindow = kDefaultDownloadWindow);
 
     /*! Enumerates any existing files, and computes the total size of the cache so far. Can take significant time
-     *  depending on the number of files in the cache and their size, particularly with validation enabled.
+     *  depending on the number of files in the cache and their size, particularly with validation enabled. Also
+     *  removes any partial download that has lost its saved progress.
      *
      * \param validate Hash every file in the cache to ensure validity, deleting any invalid entries. Can add
      *                 significant time to the cache initialization process.
@@ -49,15 +61,36 @@ public:
      * until complete, then returns a path to the newly created cache entry, or an empty path on error. Note that it
      * does not checkCache first, meaning it will clobber any existing file and re-download.
      *
+     * Up to the download window's worth of chunks are requested at once. Chunks are written to a partial file at their
+     * offsets as they arrive, in any order, and the incremental hash of each is verified in chunk order. The partial
+     * file is moved into the cache once the hash of the whole file matches the key. If the download fails, for
+     * example because the network dropped, the partial file is kept in the partial directory of the cache, alongside
+     * a sidecar recording which chunks it holds and the hash state of the verified chunks. A later download of the
+     * same Asset resumes from the first missing chunk, and only requests the chunks missing from the file.
+     *
+     * Concurrent calls for the same key share one download, as they would otherwise write the same partial file. Later
+     * callers block until the first finishes and return its result, and are counted in the
+     * confab_client_coalesced_requests_total metric.
+     *
+     * If the Asset deprecates another whose file is in the cache, a fresh download first splits that file the same way
+     * as the Asset, sends the server the hash of each chunk, and copies the chunks the server reports the Asset shares
+     * with it into the partial file, so that only the rest are requested. The copied chunks are verified with the
+     * whole file, and if it doesn't match the key, the download starts again without them.
+     *
      * \param key The Asset key to download AssetData chunks for.
-     * \param fileSize The size of the Asset in bytes.
-     * \param chunks The number of chunks to download.
+     * \param layout The chunks of the Asset, as returned by ChunkLayout::fromFlatAsset.
      * \param fileExtension The extension to append to the filename when complete, including the dot.
+     * \param deprecates The key of the Asset this Asset deprecates, or 0 if none.
      * \return The path to the file, or an empty path on error.
      */
-    fs::path download(uint64_t key, size_t fileSize, uint64_t chunks, const std::string& fileExtension);
+    fs::path download(uint64_t key, const ChunkLayout& layout, const std::string& fileExtension,
+            uint64_t deprecates = 0);
 
 private:
+    /*! Downloads the Asset as download() describes, without merging concurrent calls.
+     */
+    fs::path fetch(uint64_t key, const ChunkLayout& layout, const std::string& fileExtension, uint64_t deprecates);
+
     /*! Evict items from the cache until the size of the cache is smaller than the maximum size plus the addedBytes.
      *
      * \param addedBytes The number of bytes to ensure the cache will have room for without exceeding the maximum size
@@ -66,8 +99,11 @@ private:
     void makeRoomFor(size_t addedBytes);
 
     const fs::path m_cachePath;
+    // Holds the partial files of interrupted downloads, and their saved progress.
+    const fs::path m_partialPath;
     size_t m_maxSize;
     std::shared_ptr<HttpClient> m_httpClient;
+    const size_t m_downloadWindow;
 
     size_t m_currentSize;
 
@@ -83,6 +119,12 @@ private:
     // key. Even with no extension, presence in this map indicates presence in the cache.
     using ExtensionMap = std::unordered_map<uint64_t, std::string>;
     ExtensionMap m_extensionMap;
+
+    // Downloads in flight, by Asset key.
+    SingleFlight<uint64_t, fs::path> m_downloads;
+    Counter* m_downloadLeaders;
+    Counter* m_downloadFollowers;
+    Counter* m_deltaReusedBytes;
 };
 
 }  // namespace Confab
@@ -0,0 +1,388 @@
+#include "CacheManager.hpp"
+
+#include "Asset.hpp"
+#include "ChunkLayout.hpp"
+#include "HttpClient.hpp"
+#include "Metrics.hpp"
+#include "TestServer.hpp"
+#include "schemas/FlatAsset_generated.h"
+#include "schemas/FlatAssetData_generated.h"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+// Loopback port for the test server.
+const int kServerPort = 19160;
+
+// The AssetData chunk size of the test server, small so that test files have many chunks.
+const size_t kChunkSize = 4096;
+
+// Holds a FlatAssetData built by the test in place of one from the server.
+class BufferRecord : public Confab::Record {
+public:
+    explicit BufferRecord(flatbuffers::DetachedBuffer buffer) : m_buffer(std::move(buffer)) { }
+    bool empty() const override { return false; }
+    const Confab::SizedPointer data() const override { return Confab::SizedPointer(m_buffer.data(), m_buffer.size()); }
+    const Confab::SizedPointer key() const override { return Confab::SizedPointer(); }
+
+private:
+    flatbuffers::DetachedBuffer m_buffer;
+};
+
+// Fetches AssetData from the server, but holds the responses back until every request in flight has one, then delivers
+// them last chunk first, so each window of chunks reaches the CacheManager out of order. Can also damage chosen chunks,
+// and pause delivery altogether.
+class ReorderingClient : public Confab::HttpClient {
+public:
+    enum Fault {
+        kFlipByte,  // Changes a byte of the chunk data, keeping the hash.
+        kTruncate,  // Drops the last byte of the chunk data.
+        kError      // Fails the request, as a dropped connection would.
+    };
+
+    explicit ReorderingClient(const std::string& address) :
+            HttpClient(address),
+            m_running(true),
+            m_paused(false),
+            m_outstanding(0),
+            m_maxOutstanding(0),
+            m_reordered(0) {
+        m_thread = std::thread(&ReorderingClient::deliverLoop, this);
+    }
+
+    ~ReorderingClient() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_changed.notify_all();
+        m_thread.join();
+    }
+
+    void getAssetDataAsync(uint64_t key, uint64_t chunk, std::function<void(uint64_t, uint64_t, Confab::RecordPtr)>
+            callback, Confab::RequestScheduler::Priority priority) override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requested.push_back(chunk);
+            ++m_outstanding;
+            m_maxOutstanding = std::max(m_maxOutstanding, m_outstanding);
+        }
+        HttpClient::getAssetDataAsync(key, chunk, [this, callback](uint64_t key, uint64_t chunk,
+                Confab::RecordPtr record) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_responses.emplace(chunk, std::bind(callback, key, chunk, damage(chunk, record)));
+            }
+            m_changed.notify_all();
+        }, priority);
+    }
+
+    // Damages the next response for chunk.
+    void setFault(uint64_t chunk, Fault fault) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_faults[chunk] = fault;
+    }
+
+    void pause(bool paused) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_paused = paused;
+        }
+        m_changed.notify_all();
+    }
+
+    // Returns the chunks requested since the last call, in the order requested, and resets the counts.
+    std::vector<uint64_t> takeRequested() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<uint64_t> requested = std::move(m_requested);
+        m_requested.clear();
+        m_maxOutstanding = 0;
+        m_reordered = 0;
+        return requested;
+    }
+
+    // The most requests that were in flight at once.
+    size_t maxOutstanding() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_maxOutstanding;
+    }
+
+    // The number of chunks delivered after a later chunk.
+    size_t reordered() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_reordered;
+    }
+
+private:
+    // Requires the lock.
+    Confab::RecordPtr damage(uint64_t chunk, Confab::RecordPtr record) {
+        auto fault = m_faults.find(chunk);
+        if (fault == m_faults.end() || record->empty()) {
+            return record;
+        }
+        Fault kind = fault->second;
+        m_faults.erase(fault);
+        if (kind == kError) {
+            return Confab::makeEmptyRecord();
+        }
+
+        auto flatAssetData = Confab::Data::GetFlatAssetData(record->data().data());
+        std::vector<uint8_t> data(flatAssetData->data()->begin(), flatAssetData->data()->end());
+        if (kind == kFlipByte) {
+            data[data.size() / 2] ^= 0x5a;
+        } else {
+            data.pop_back();
+        }
+        flatbuffers::FlatBufferBuilder builder;
+        auto bytes = builder.CreateVector(data);
+        builder.Finish(Confab::Data::CreateFlatAssetData(builder, bytes, flatAssetData->hash()));
+        return std::make_shared<BufferRecord>(builder.Release());
+    }
+
+    void deliverLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_changed.wait(lock, [this] {
+                return !m_running || (!m_paused && !m_responses.empty() && m_responses.size() == m_outstanding);
+            });
+            if (!m_running) {
+                return;
+            }
+            // Last chunk first. The callbacks request the next window, which is then held back until complete too.
+            std::multimap<uint64_t, std::function<void()>> responses;
+            responses.swap(m_responses);
+            m_outstanding -= responses.size();
+            m_reordered += responses.size() - 1;
+            lock.unlock();
+            for (auto response = responses.rbegin(); response != responses.rend(); ++response) {
+                response->second();
+            }
+            lock.lock();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    bool m_running;
+    bool m_paused;
+    size_t m_outstanding;
+    size_t m_maxOutstanding;
+    size_t m_reordered;
+    std::vector<uint64_t> m_requested;
+    std::map<uint64_t, Fault> m_faults;
+    std::multimap<uint64_t, std::function<void()>> m_responses;
+    std::thread m_thread;
+};
+
+// Runs a confab-server in process holding a multi-chunk file Asset, for CacheManagers to download through a
+// ReorderingClient.
+class CacheManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-cache-manager-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::remove_all(m_path);
+        Confab::HttpEndpoint::Options options = Confab::TestServer::options(kServerPort);
+        options.dataChunkSize = kChunkSize;
+        ASSERT_TRUE(m_server.start(m_path / "server", options));
+
+        m_filePath = m_path / "original.wav";
+        {
+            std::ofstream file(m_filePath, std::ios::binary);
+            for (int i = 0; i < 20000; ++i) {
+                file << "sample " << (i * 7919) % 104729 << "\n";
+            }
+        }
+        {
+            std::ifstream file(m_filePath, std::ios::binary);
+            m_contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        m_client.reset(new ReorderingClient(m_server.address()));
+        m_key = m_client->postFileAsset(Confab::Asset::kSample, "", 0, 0, "", m_filePath);
+        ASSERT_NE(0u, m_key);
+        m_client->getAsset(m_key, [this](uint64_t, Confab::RecordPtr asset) {
+            ASSERT_FALSE(asset->empty());
+            m_layout = Confab::ChunkLayout::fromFlatAsset(Confab::Data::GetFlatAsset(asset->data().data()));
+        });
+        ASSERT_TRUE(m_layout.valid());
+        ASSERT_GT(m_layout.chunks(), 32u);
+    }
+
+    void TearDown() override {
+        m_client->shutdown();
+        m_client.reset();
+        m_server.stop();
+        fs::remove_all(m_path);
+    }
+
+    std::string readFile(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // The CacheManager's count of download() calls in the given role, leader or follower.
+    static uint64_t coalesced(const std::string& role) {
+        return Confab::MetricsRegistry::global().counter("confab_client_coalesced_requests_total",
+            "Asset requests that started a lookup or download, or joined one already in flight.",
+            "request=\"download\",role=\"" + role + "\"")->value();
+    }
+
+    fs::path partialPath(const fs::path& cachePath) {
+        return cachePath / "partial" / (Confab::Asset::keyToString(m_key) + ".part");
+    }
+
+    fs::path m_path;
+    Confab::TestServer m_server;
+    std::shared_ptr<ReorderingClient> m_client;
+    fs::path m_filePath;
+    std::string m_contents;
+    uint64_t m_key = 0;
+    Confab::ChunkLayout m_layout = Confab::ChunkLayout(0, 0, 0);
+};
+
+}  // namespace
+
+TEST_F(CacheManagerTest, DownloadsChunksArrivingOutOfOrder) {
+    for (size_t window : { 1, 2, 3, 8, 17, 64 }) {
+        fs::path cachePath = m_path / ("cache" + std::to_string(window));
+        Confab::CacheManager cache(cachePath, 1 << 30, m_client, window);
+        m_client->takeRequested();
+
+        fs::path path = cache.download(m_key, m_layout, ".wav");
+        ASSERT_FALSE(path.empty()) << "window " << window;
+        EXPECT_EQ(m_contents, readFile(path)) << "window " << window;
+
+        // Each chunk is requested once, the window bounds the requests in flight, and every window bigger than one
+        // chunk arrived out of order.
+        std::vector<uint64_t> requested = m_client->takeRequested();
+        std::sort(requested.begin(), requested.end());
+        ASSERT_EQ(m_layout.chunks(), requested.size()) << "window " << window;
+        for (uint64_t chunk = 0; chunk < requested.size(); ++chunk) {
+            EXPECT_EQ(chunk, requested[chunk]);
+        }
+        EXPECT_LE(m_client->maxOutstanding(), window);
+        if (window > 1) {
+            EXPECT_GT(m_client->reordered(), 0u) << "window " << window;
+        }
+        EXPECT_FALSE(fs::exists(partialPath(cachePath)));
+    }
+}
+
+TEST_F(CacheManagerTest, RejectsCorruptChunks) {
+    fs::path cachePath = m_path / "cache";
+    Confab::CacheManager cache(cachePath, 1 << 30, m_client, 8);
+
+    // A chunk whose data doesn't match its hash fails the download whether it arrives before or after the chunks
+    // ahead of it, and the partial file can't be trusted, so isn't kept.
+    for (uint64_t chunk : { 0, 5, 7 }) {
+        m_client->setFault(chunk, ReorderingClient::kFlipByte);
+        EXPECT_TRUE(cache.download(m_key, m_layout, ".wav").empty()) << "chunk " << chunk;
+        EXPECT_FALSE(fs::exists(partialPath(cachePath))) << "chunk " << chunk;
+        EXPECT_TRUE(cache.checkCache(m_key).empty());
+    }
+
+    // As does a chunk of the wrong size.
+    m_client->setFault(m_layout.chunks() - 1, ReorderingClient::kTruncate);
+    EXPECT_TRUE(cache.download(m_key, m_layout, ".wav").empty());
+    EXPECT_TRUE(cache.checkCache(m_key).empty());
+
+    // Once the chunks come back intact the download succeeds.
+    fs::path path = cache.download(m_key, m_layout, ".wav");
+    ASSERT_FALSE(path.empty());
+    EXPECT_EQ(m_contents, readFile(path));
+    EXPECT_EQ(path, cache.checkCache(m_key));
+}
+
+TEST_F(CacheManagerTest, ResumesFailedDownload) {
+    fs::path cachePath = m_path / "cache";
+    fs::path statePath = cachePath / "partial" / (Confab::Asset::keyToString(m_key) + ".state");
+    const uint64_t kFailedChunk = 20;
+    std::vector<uint64_t> firstAttempt;
+    {
+        Confab::CacheManager cache(cachePath, 1 << 30, m_client, 4);
+        m_client->setFault(kFailedChunk, ReorderingClient::kError);
+        m_client->takeRequested();
+        EXPECT_TRUE(cache.download(m_key, m_layout, ".wav").empty());
+        firstAttempt = m_client->takeRequested();
+    }
+    // The chunks before the failure, and those in flight with it, are kept along with the saved progress.
+    ASSERT_TRUE(fs::exists(partialPath(cachePath)));
+    ASSERT_TRUE(fs::exists(statePath));
+    EXPECT_GT(firstAttempt.size(), kFailedChunk);
+    EXPECT_LT(firstAttempt.size(), m_layout.chunks());
+
+    // A new CacheManager, as after a restart, finds the partial download and requests only the chunks missing from it.
+    Confab::CacheManager cache(cachePath, 1 << 30, m_client, 4);
+    cache.checkExistingEntries(false);
+    ASSERT_TRUE(fs::exists(partialPath(cachePath)));
+    fs::path path = cache.download(m_key, m_layout, ".wav");
+    ASSERT_FALSE(path.empty());
+    EXPECT_EQ(m_contents, readFile(path));
+    EXPECT_FALSE(fs::exists(partialPath(cachePath)));
+    EXPECT_FALSE(fs::exists(statePath));
+
+    std::vector<uint64_t> secondAttempt = m_client->takeRequested();
+    EXPECT_EQ(kFailedChunk, *std::min_element(secondAttempt.begin(), secondAttempt.end()));
+    EXPECT_EQ(m_layout.chunks() + 1, firstAttempt.size() + secondAttempt.size());
+    for (auto chunk : secondAttempt) {
+        if (chunk != kFailedChunk) {
+            EXPECT_EQ(firstAttempt.end(), std::find(firstAttempt.begin(), firstAttempt.end(), chunk)) << chunk;
+        }
+    }
+}
+
+TEST_F(CacheManagerTest, ConcurrentDownloadsShareOne) {
+    const size_t kCallers = 8;
+    Confab::CacheManager cache(m_path / "cache", 1 << 30, m_client, 8);
+    uint64_t leaders = coalesced("leader");
+    uint64_t followers = coalesced("follower");
+    m_client->takeRequested();
+
+    // Hold every chunk back until all the callers have joined the first one's download.
+    m_client->pause(true);
+    std::vector<fs::path> paths(kCallers);
+    std::vector<std::thread> callers;
+    for (size_t i = 0; i < kCallers; ++i) {
+        callers.emplace_back([this, &cache, &paths, i] {
+            paths[i] = cache.download(m_key, m_layout, ".wav");
+        });
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (coalesced("follower") - followers < kCallers - 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    m_client->pause(false);
+    for (auto& caller : callers) {
+        caller.join();
+    }
+
+    EXPECT_EQ(1u, coalesced("leader") - leaders);
+    EXPECT_EQ(kCallers - 1, coalesced("follower") - followers);
+    ASSERT_FALSE(paths[0].empty());
+    for (const auto& path : paths) {
+        EXPECT_EQ(paths[0], path);
+    }
+    EXPECT_EQ(m_contents, readFile(paths[0]));
+
+    // The file was downloaded once.
+    EXPECT_EQ(m_layout.chunks(), m_client->takeRequested().size());
+}
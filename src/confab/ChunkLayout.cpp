@@ -0,0 +1,61 @@
+#include "ChunkLayout.hpp"
+
+#include "Asset.hpp"
+#include "Constants.hpp"
+
+#include "xxhash.h"
+
+#include <utility>
+
+namespace Confab {
+
+// static
+ChunkLayout ChunkLayout::fromFlatAsset(const Data::FlatAsset* flatAsset) {
+    std::vector<uint64_t> offsets;
+    if (flatAsset->contentDefinedChunks()) {
+        if (flatAsset->chunkOffsets()) {
+            offsets.assign(flatAsset->chunkOffsets()->begin(), flatAsset->chunkOffsets()->end());
+        }
+        // A content-defined Asset without offsets has no valid layout, rather than falling back to fixed size chunks.
+        if (offsets.empty()) {
+            return ChunkLayout(flatAsset->size(), flatAsset->chunks(), 0);
+        }
+    }
+    return ChunkLayout(flatAsset->size(), flatAsset->chunks(), Asset::dataChunkSize(flatAsset), std::move(offsets));
+}
+
+ChunkLayout::ChunkLayout(uint64_t size, uint64_t chunks, uint64_t chunkSize, std::vector<uint64_t> offsets) :
+    m_size(size),
+    m_chunks(chunks),
+    m_chunkSize(chunkSize),
+    m_offsets(std::move(offsets)) {
+}
+
+bool ChunkLayout::valid() const {
+    // Every chunk holds at least one byte, which also keeps the products below from overflowing.
+    if (m_chunks == 0 || m_chunkSize == 0 || m_chunks > m_size) {
+        return false;
+    }
+    if (m_offsets.empty()) {
+        return (m_chunks - 1) * m_chunkSize < m_size && m_chunks * m_chunkSize >= m_size;
+    }
+    if (m_offsets.size() != m_chunks || m_offsets.size() > kMaxChunkOffsets || m_offsets[0] != 0) {
+        return false;
+    }
+    for (uint64_t chunk = 0; chunk < m_chunks; ++chunk) {
+        uint64_t end = chunk + 1 < m_chunks ? m_offsets[chunk + 1] : m_size;
+        if (end <= m_offsets[chunk] || end - m_offsets[chunk] > m_chunkSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t ChunkLayout::fingerprint() const {
+    if (m_offsets.empty()) {
+        return m_chunkSize;
+    }
+    return XXH64(m_offsets.data(), m_offsets.size() * sizeof(uint64_t), m_chunkSize);
+}
+
+}  // namespace Confab
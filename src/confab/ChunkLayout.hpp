@@ -0,0 +1,90 @@
+#ifndef SRC_CONFAB_CHUNK_LAYOUT_HPP_
+#define SRC_CONFAB_CHUNK_LAYOUT_HPP_
+
+// Flatbuffer includes generated by calling flatc on the Flatbuffer schema (.fbs) files.
+#include "schemas/FlatAsset_generated.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Confab {
+
+/*! Describes where each AssetData chunk of a file Asset lies within the file.
+ *
+ * Most Assets are split into chunks of a fixed size, all but the last of which are the same size. Assets split by a
+ * ContentChunker instead record the offset of every chunk in their FlatAsset, and each chunk may be any size up to the
+ * chunk size of the Asset. Either way the chunks are contiguous and in order, so code reading or writing chunks should
+ * ask the layout for their offsets and sizes rather than multiplying by the chunk size.
+ */
+class ChunkLayout {
+public:
+    /*! Describes the chunks of a serialized Asset, accounting for Assets recorded before the chunk size was stored.
+     *
+     * \param flatAsset The serialized FlatAsset.
+     * \return The chunk layout recorded in the Asset, which may not be valid().
+     */
+    static ChunkLayout fromFlatAsset(const Data::FlatAsset* flatAsset);
+
+    /*! Constructs a layout.
+     *
+     * \param size The size of the Asset in bytes.
+     * \param chunks The number of chunks the Asset is split into.
+     * \param chunkSize For fixed size chunks, the size of every chunk but the last. Otherwise the largest size of any
+     *                  chunk.
+     * \param offsets Empty for fixed size chunks. Otherwise the offset of the start of every chunk.
+     */
+    ChunkLayout(uint64_t size, uint64_t chunks, uint64_t chunkSize, std::vector<uint64_t> offsets = {});
+
+    /*! Checks the layout describes contiguous chunks, none empty or larger than the chunk size, that exactly cover
+     * the Asset, and records no more than kMaxChunkOffsets offsets. Every other method assumes a valid layout.
+     *
+     * \return true if the layout is consistent.
+     */
+    bool valid() const;
+
+    /*! \return The size of the Asset in bytes. */
+    uint64_t size() const { return m_size; }
+
+    /*! \return The number of chunks. */
+    uint64_t chunks() const { return m_chunks; }
+
+    /*! \return The largest size of any chunk in bytes. */
+    uint64_t maxChunkSize() const { return m_chunkSize; }
+
+    /*! \return true if chunk offsets are recorded, false if the chunks are of a fixed size. */
+    bool contentDefined() const { return !m_offsets.empty(); }
+
+    /*! The offset of the start of a chunk within the Asset.
+     *
+     * \param chunk The chunk number, less than chunks().
+     * \return The offset in bytes.
+     */
+    uint64_t offset(uint64_t chunk) const { return m_offsets.empty() ? chunk * m_chunkSize : m_offsets[chunk]; }
+
+    /*! The size of a chunk.
+     *
+     * \param chunk The chunk number, less than chunks().
+     * \return The size in bytes.
+     */
+    size_t chunkSize(uint64_t chunk) const {
+        return (chunk + 1 < m_chunks ? offset(chunk + 1) : m_size) - offset(chunk);
+    }
+
+    /*! Summarizes the chunk boundaries in a single value, so that saved progress through the chunks can be checked to
+     * belong to the same layout. For fixed size chunks this is the chunk size.
+     *
+     * \return A hash of the chunk boundaries.
+     */
+    uint64_t fingerprint() const;
+
+private:
+    uint64_t m_size;
+    uint64_t m_chunks;
+    uint64_t m_chunkSize;
+    std::vector<uint64_t> m_offsets;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_CHUNK_LAYOUT_HPP_
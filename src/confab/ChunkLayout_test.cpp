@@ -0,0 +1,83 @@
+#include "ChunkLayout.hpp"
+
+#include "Asset.hpp"
+#include "Constants.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using Confab::ChunkLayout;
+
+TEST(ChunkLayoutTest, FixedSizeChunks) {
+    ChunkLayout layout(2500, 3, 1000);
+    ASSERT_TRUE(layout.valid());
+    EXPECT_FALSE(layout.contentDefined());
+    EXPECT_EQ(2000u, layout.offset(2));
+    EXPECT_EQ(1000u, layout.chunkSize(1));
+    EXPECT_EQ(500u, layout.chunkSize(2));
+    // Saved download progress from before chunk offsets were recorded holds the chunk size.
+    EXPECT_EQ(1000u, layout.fingerprint());
+
+    EXPECT_FALSE(ChunkLayout(2500, 4, 1000).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 2, 1000).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 0, 1000).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 3, 0).valid());
+}
+
+TEST(ChunkLayoutTest, ContentDefinedChunks) {
+    ChunkLayout layout(2500, 3, 1200, {0, 700, 1900});
+    ASSERT_TRUE(layout.valid());
+    EXPECT_TRUE(layout.contentDefined());
+    EXPECT_EQ(700u, layout.offset(1));
+    EXPECT_EQ(700u, layout.chunkSize(0));
+    EXPECT_EQ(1200u, layout.chunkSize(1));
+    EXPECT_EQ(600u, layout.chunkSize(2));
+    EXPECT_NE(layout.fingerprint(), ChunkLayout(2500, 3, 1200, {0, 701, 1900}).fingerprint());
+
+    // Offsets must start at zero, cover the Asset in order, and keep every chunk within the chunk size.
+    EXPECT_FALSE(ChunkLayout(2500, 3, 1200, {1, 700, 1900}).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 3, 1200, {0, 1900, 700}).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 3, 1200, {0, 700, 700}).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 3, 1200, {0, 700, 2500}).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 3, 1000, {0, 700, 1900}).valid());
+    EXPECT_FALSE(ChunkLayout(2500, 2, 1200, {0, 700, 1900}).valid());
+
+    // The Asset records every offset, so there can be no more than fit in one.
+    std::vector<uint64_t> offsets;
+    for (uint64_t offset = 0; offset < Confab::kMaxChunkOffsets; ++offset) {
+        offsets.push_back(offset);
+    }
+    EXPECT_TRUE(ChunkLayout(offsets.size(), offsets.size(), 1, offsets).valid());
+    offsets.push_back(offsets.size());
+    EXPECT_FALSE(ChunkLayout(offsets.size(), offsets.size(), 1, offsets).valid());
+}
+
+TEST(ChunkLayoutTest, FromFlatAsset) {
+    Confab::Asset asset(Confab::Asset::kSample);
+    asset.setSize(2500);
+    asset.setChunks(3);
+    asset.setChunkSize(1200);
+    asset.setChunkOffsets({0, 700, 1900});
+    flatbuffers::FlatBufferBuilder builder;
+    asset.flatten(builder);
+    const Confab::Data::FlatAsset* flatAsset = Confab::Data::GetFlatAsset(builder.GetBufferPointer());
+    EXPECT_TRUE(flatAsset->contentDefinedChunks());
+    EXPECT_EQ(3u, Confab::Asset(flatAsset).chunkOffsets().size());
+
+    ChunkLayout layout = ChunkLayout::fromFlatAsset(flatAsset);
+    ASSERT_TRUE(layout.valid());
+    EXPECT_TRUE(layout.contentDefined());
+    EXPECT_EQ(1200u, layout.chunkSize(1));
+
+    // Assets recorded before the chunk size was stored use the old fixed chunk size.
+    Confab::Asset old(Confab::Asset::kSample);
+    old.setSize(Confab::kDataChunkSize + 1);
+    old.setChunks(2);
+    flatbuffers::FlatBufferBuilder oldBuilder;
+    old.flatten(oldBuilder);
+    ChunkLayout oldLayout = ChunkLayout::fromFlatAsset(Confab::Data::GetFlatAsset(oldBuilder.GetBufferPointer()));
+    ASSERT_TRUE(oldLayout.valid());
+    EXPECT_EQ(Confab::kDataChunkSize, oldLayout.offset(1));
+    EXPECT_EQ(1u, oldLayout.chunkSize(1));
+}
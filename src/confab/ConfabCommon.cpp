@@ -3,6 +3,7 @@
 #include "AssetDatabase.hpp"
 #include "Config.hpp"
 #include "Constants.hpp"
+#include "EventLog.hpp"
 #include "common/Version.hpp"
 
 #include "glog/logging.h"
@@ -17,6 +18,8 @@ namespace fs = std::experimental::filesystem;
 // Command line flags for logging.
 DEFINE_bool(chatty, false, "If true confab will log everything to stderr as well as to log files.");
 DEFINE_string(data_directory, "../data/confab", "Path where confab will store the database and log files");
+DEFINE_int32(event_log_drain_ms, 250, "Interval in milliseconds at which hot-path events are formatted into the INFO "
+    "log. Zero keeps events in memory only, where the server's /events route can still show the most recent.");
 
 // Command line flags for the database.
 DEFINE_bool(create_new_database, false, "If true confab will make a new database, if false confab will expect the "
@@ -60,6 +63,7 @@ void ConfabCommon::shutdown() {
     m_assetDatabase->close();
     // Delete pid sentinel file.
     fs::remove(m_pidPath);
+    EventLog::global().stopDrainer();
 }
 
 void ConfabCommon::initializeLogging(char* binaryName) {
@@ -67,6 +71,9 @@ void ConfabCommon::initializeLogging(char* binaryName) {
     FLAGS_log_dir = FLAGS_data_directory + "/log";
     FLAGS_alsologtostderr = FLAGS_chatty;
     google::InitGoogleLogging(binaryName);
+    if (FLAGS_event_log_drain_ms > 0) {
+        EventLog::global().startDrainer(std::chrono::milliseconds(FLAGS_event_log_drain_ms));
+    }
 }
 
 bool ConfabCommon::checkSentinelFile() {
@@ -0,0 +1,95 @@
+#include "ContentChunker.hpp"
+
+#include "MappedFile.hpp"
+
+#include "glog/logging.h"
+
+#include <algorithm>
+#include <array>
+
+namespace Confab {
+
+// The gear table must never change, as chunk boundaries of stored Assets depend on it. It is filled with the output
+// of the splitmix64 generator from a fixed seed.
+static const uint64_t kGearSeed = 0x436f6e6661624344ull;
+
+static constexpr std::array<uint64_t, 256> makeGearTable() {
+    std::array<uint64_t, 256> table {};
+    uint64_t state = kGearSeed;
+    for (size_t i = 0; i < table.size(); ++i) {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        table[i] = z ^ (z >> 31);
+    }
+    return table;
+}
+
+static constexpr std::array<uint64_t, 256> kGearTable = makeGearTable();
+
+// How many bits the masks either side of the average chunk size differ from the bits of the average size, the
+// normalization level of FastCDC.
+static const size_t kNormalization = 2;
+
+// Each step shifts the hash left, so its high bits depend on the most bytes, up to the last 64. The masks use them.
+static uint64_t highBits(size_t bits) {
+    return bits == 0 ? 0 : ~0ull << (64 - std::min(bits, static_cast<size_t>(64)));
+}
+
+ContentChunker::ContentChunker(size_t maxChunkSize) :
+    m_maxChunkSize(std::max(maxChunkSize, static_cast<size_t>(1))),
+    m_averageChunkSize(std::max(m_maxChunkSize / 4, static_cast<size_t>(1))),
+    m_minChunkSize(m_averageChunkSize / 4) {
+    size_t bits = 0;
+    while ((static_cast<size_t>(2) << bits) <= m_averageChunkSize) {
+        ++bits;
+    }
+    m_maskSmall = highBits(bits + kNormalization);
+    m_maskLarge = highBits(bits > kNormalization ? bits - kNormalization : 0);
+}
+
+size_t ContentChunker::cut(const uint8_t* data, size_t size) const {
+    size_t limit = std::min(size, m_maxChunkSize);
+    if (limit <= m_minChunkSize) {
+        return limit;
+    }
+    // The hash of each byte depends on the hash of the byte before it, so it can't be spread over vector lanes. The
+    // loops are kept to a shift, an add, a table lookup and a test per byte instead.
+    size_t normal = std::min(limit, m_averageChunkSize);
+    uint64_t hash = 0;
+    size_t i = m_minChunkSize;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + kGearTable[data[i]];
+        if (!(hash & m_maskSmall)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + kGearTable[data[i]];
+        if (!(hash & m_maskLarge)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+bool ContentChunker::split(MappedFile& file, std::vector<uint64_t>& offsets) const {
+    offsets.clear();
+    size_t fileSize = file.size();
+    size_t offset = 0;
+    while (offset < fileSize) {
+        size_t available = std::min(m_maxChunkSize, fileSize - offset);
+        SizedPointer data = file.read(offset, available);
+        if (!data.data()) {
+            LOG(ERROR) << "error reading " << available << " bytes at offset " << offset << " to find chunk boundary.";
+            return false;
+        }
+        file.prefetch(offset + available, m_maxChunkSize);
+        offsets.push_back(offset);
+        offset += cut(data.data(), available);
+    }
+    return true;
+}
+
+}  // namespace Confab
@@ -0,0 +1,69 @@
+#ifndef SRC_CONFAB_CONTENT_CHUNKER_HPP_
+#define SRC_CONFAB_CONTENT_CHUNKER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Confab {
+
+class MappedFile;
+
+/*! Splits data into chunks at boundaries chosen by the content itself, using the FastCDC algorithm.
+ *
+ * With chunks of a fixed size, inserting a few bytes near the start of a file moves every later chunk boundary, so an
+ * edited file shares no chunks with the original. Here a chunk ends where a gear hash of the last 64 bytes matches a
+ * mask, so boundaries move with the content around them, and beyond the first boundary after an edit the chunks are
+ * the same as before.
+ *
+ * Chunks average a quarter of the maximum chunk size, and are at least a sixteenth of it. Following FastCDC, no
+ * boundary is looked for in the minimum size of each chunk, and a harder mask is used before the average size than
+ * after it, which keeps most chunks close to the average. The gear table is fixed, so every client and server splits
+ * the same data the same way.
+ */
+class ContentChunker {
+public:
+    /*! Constructs a chunker.
+     *
+     * \param maxChunkSize The largest chunk to make, in bytes.
+     */
+    explicit ContentChunker(size_t maxChunkSize);
+
+    /*! \return The smallest size of any chunk but the last. */
+    size_t minChunkSize() const { return m_minChunkSize; }
+
+    /*! \return The size chunks are normalized towards. */
+    size_t averageChunkSize() const { return m_averageChunkSize; }
+
+    /*! \return The largest size of any chunk. */
+    size_t maxChunkSize() const { return m_maxChunkSize; }
+
+    /*! Finds the end of the chunk starting at data.
+     *
+     * \param data The data from the start of the chunk.
+     * \param size The number of bytes available, at least maxChunkSize() unless data runs to the end of the file.
+     * \return The size of the chunk in bytes, at most size.
+     */
+    size_t cut(const uint8_t* data, size_t size) const;
+
+    /*! Splits a whole file into chunks.
+     *
+     * \param file The open file to split.
+     * \param offsets Set to the offset of the start of every chunk.
+     * \return true on success, false if the file could not be read.
+     */
+    bool split(MappedFile& file, std::vector<uint64_t>& offsets) const;
+
+private:
+    const size_t m_maxChunkSize;
+    const size_t m_averageChunkSize;
+    const size_t m_minChunkSize;
+    // The hash must have zeros in all of the mask bits to end a chunk. The small mask is harder to match than the
+    // large one, as it has more bits.
+    uint64_t m_maskSmall;
+    uint64_t m_maskLarge;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_CONTENT_CHUNKER_HPP_
@@ -0,0 +1,111 @@
+#include "ContentChunker.hpp"
+
+#include "MappedFile.hpp"
+
+#include "xxhash.h"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Confab::ContentChunker;
+
+// Makes incompressible test data from a fixed seed.
+std::vector<uint8_t> randomData(size_t size, uint64_t seed) {
+    std::vector<uint8_t> data(size);
+    uint64_t state = seed;
+    for (auto& byte : data) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        byte = static_cast<uint8_t>(state >> 32);
+    }
+    return data;
+}
+
+// Returns the offsets of the chunks of data.
+std::vector<uint64_t> chunkOffsets(const ContentChunker& chunker, const std::vector<uint8_t>& data) {
+    std::vector<uint64_t> offsets;
+    size_t offset = 0;
+    while (offset < data.size()) {
+        offsets.push_back(offset);
+        offset += chunker.cut(data.data() + offset, data.size() - offset);
+    }
+    return offsets;
+}
+
+// Returns the hashes of the contents of the chunks of data.
+std::set<uint64_t> chunkHashes(const ContentChunker& chunker, const std::vector<uint8_t>& data) {
+    std::vector<uint64_t> offsets = chunkOffsets(chunker, data);
+    std::set<uint64_t> hashes;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        size_t end = i + 1 < offsets.size() ? offsets[i + 1] : data.size();
+        hashes.insert(XXH64(data.data() + offsets[i], end - offsets[i], 0));
+    }
+    return hashes;
+}
+
+}  // namespace
+
+TEST(ContentChunkerTest, ChunksStayWithinBounds) {
+    ContentChunker chunker(16384);
+    EXPECT_EQ(4096u, chunker.averageChunkSize());
+    EXPECT_EQ(1024u, chunker.minChunkSize());
+
+    std::vector<uint8_t> data = randomData(1024 * 1024, 1);
+    std::vector<uint64_t> offsets = chunkOffsets(chunker, data);
+    ASSERT_FALSE(offsets.empty());
+    EXPECT_EQ(0u, offsets[0]);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        EXPECT_GE(offsets[i + 1] - offsets[i], chunker.minChunkSize());
+        EXPECT_LE(offsets[i + 1] - offsets[i], chunker.maxChunkSize());
+    }
+    // Normalized chunking keeps the mean chunk size near the average.
+    size_t mean = data.size() / offsets.size();
+    EXPECT_GT(mean, chunker.averageChunkSize() / 2);
+    EXPECT_LT(mean, chunker.averageChunkSize() * 2);
+
+    EXPECT_EQ(offsets, chunkOffsets(chunker, data));
+}
+
+TEST(ContentChunkerTest, InsertionKeepsLaterChunks) {
+    ContentChunker chunker(16384);
+    std::vector<uint8_t> data = randomData(1024 * 1024, 2);
+    std::vector<uint8_t> edited = data;
+    edited.insert(edited.begin() + 100, 7, 0x55);
+
+    std::set<uint64_t> original = chunkHashes(chunker, data);
+    std::set<uint64_t> changed = chunkHashes(chunker, edited);
+    size_t shared = 0;
+    for (auto hash : changed) {
+        shared += original.count(hash);
+    }
+    // Only the chunks around the edit differ.
+    EXPECT_GE(shared + 3, original.size());
+}
+
+TEST(ContentChunkerTest, SplitsFilesLikeBuffers) {
+    fs::path path = fs::temp_directory_path() / fs::path("confab-content-chunker-test-" +
+        std::to_string(::getpid()));
+    std::vector<uint8_t> data = randomData(300 * 1024 + 17, 3);
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    ContentChunker chunker(16384);
+    Confab::MappedFile file;
+    ASSERT_TRUE(file.open(path));
+    std::vector<uint64_t> offsets;
+    EXPECT_TRUE(chunker.split(file, offsets));
+    EXPECT_EQ(chunkOffsets(chunker, data), offsets);
+    file.close();
+    fs::remove(path);
+}
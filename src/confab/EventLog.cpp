@@ -0,0 +1,227 @@
+#include "EventLog.hpp"
+
+#include "Asset.hpp"
+
+#include "glog/logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+/*! Message formats for each Event, in order. "%k" formats the next argument as an Asset or List key, "%u" as an
+ * unsigned decimal number.
+ */
+static const char* kEventFormats[] = {
+    // AssetDatabase events.
+    "adding asset %k to list %k",
+    "Asset store %k success.",
+    "Asset %k deprecated by %k, loading.",
+    "Loaded Asset %k upon request to load original asset %k",
+    "batch Asset lookup found %u of %u requested Assets.",
+    "Loaded Asset %k chunk: %u.",
+    "Asset Data store %k chunk %u success.",
+    "List store %k success.",
+    "loaded list %k.",
+    "walked off end of list %k after %u pairs.",
+
+    // confab-server HTTP events.
+    "processing HTTP GET request for /asset/id/%k",
+    "HTTP get request returning Asset data for %k",
+    "processing HTTP POST request for /asset/id/%k, %u bytes.",
+    "verified FlatAsset %k",
+    "sending OK response after storing asset %k",
+    "processing HTTP POST request for /asset/batch, %u bytes.",
+    "sending %u asset batch entries, %u bytes.",
+    "processing HTTP POST request for /asset/delta/%k, %u local chunk hashes.",
+    "delta plan for Asset %k reuses %u local chunks, %u to fetch.",
+    "processing HTTP GET request for /asset/data/%k/%u",
+    "HTTP get request for Asset Data %k chunk %u returning Asset Data.",
+    "processing HTTP POST request for /asset/data/%k/%u",
+    "verified FlatAssetData %k chunk %u",
+    "sending OK response after storing asset %k data chunk %u",
+    "processing HTTP POST request for /asset/upload/%k/%u",
+    "committed upload %k as asset %k",
+    "processing GET request for /list/id %k",
+    "get request for list %k returning %u bytes of list data.",
+    "processing POST request for /list/id %k",
+    "verified FlatList %k",
+    "sending OK response after storing list %k",
+    "sending %u bytes of named List data.",
+    "processing get /list/items/%k/%k",
+    "processing get /list/watch/%k/%k",
+    "sending %u tokens back to client on list %k, %u bytes.",
+    "serving response cache hit, kind %u key %k chunk %u",
+
+    // confab client events.
+    "issuing AssetData request for %k chunk %u",
+    "received Ok response for AssetData %k chunk %u, %u bytes",
+    "sending POST of asset data for %k chunk %u, %u bytes.",
+    "received ok response on file asset chunk post %k chunk %u",
+    "cache hit for Asset %k",
+    "cache miss for Asset %k",
+    "reusing %u chunks, %u bytes, of deprecated Asset %k"
+};
+
+static_assert(sizeof(kEventFormats) / sizeof(kEventFormats[0]) == Confab::kNumEvents,
+    "kEventFormats must have a format for every Event.");
+
+}  // namespace
+
+namespace Confab {
+
+EventLog::Ring::Ring(uint32_t thread) :
+    drained(0),
+    m_thread(thread),
+    m_head(0),
+    m_records(kRingSize) {
+}
+
+uint64_t EventLog::Ring::copy(uint64_t from, std::vector<EventRecord>& out, uint64_t& dropped) const {
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t start = std::max(from, head > kRingSize ? head - kRingSize : 0);
+    size_t firstCopied = out.size();
+    for (uint64_t i = start; i < head; ++i) {
+        out.push_back(m_records[i % kRingSize]);
+    }
+
+    // The writer may have lapped the copy, in which case the oldest records copied may be torn. Discard those,
+    // including the slot of record headAfter, which the writer may be filling in now without having moved m_head.
+    uint64_t headAfter = m_head.load(std::memory_order_acquire);
+    uint64_t oldestIntact = headAfter + 1 > kRingSize ? headAfter + 1 - kRingSize : 0;
+    if (oldestIntact > start) {
+        size_t torn = std::min(oldestIntact, head) - start;
+        out.erase(out.begin() + firstCopied, out.begin() + firstCopied + torn);
+        start += torn;
+    }
+    dropped += start - std::min(start, from);
+    return head;
+}
+
+// static
+EventLog& EventLog::global() {
+    static EventLog eventLog;
+    return eventLog;
+}
+
+EventLog::EventLog() :
+    m_dropped(0),
+    m_draining(false) {
+}
+
+EventLog::~EventLog() {
+    stopDrainer();
+}
+
+void EventLog::startDrainer(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(m_drainMutex);
+    if (m_draining) {
+        return;
+    }
+    m_draining = true;
+    m_drainThread = std::thread(&EventLog::drainLoop, this, interval);
+}
+
+void EventLog::stopDrainer() {
+    {
+        std::lock_guard<std::mutex> lock(m_drainMutex);
+        m_draining = false;
+    }
+    m_drainCondition.notify_all();
+    if (m_drainThread.joinable()) {
+        m_drainThread.join();
+    }
+}
+
+std::string EventLog::dump(size_t maxEvents) {
+    std::vector<EventRecord> records;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& ring : m_rings) {
+            ring->copy(0, records, dropped);
+        }
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const EventRecord& a, const EventRecord& b) {
+        return a.time < b.time;
+    });
+    size_t first = records.size() > maxEvents ? records.size() - maxEvents : 0;
+    std::string out;
+    for (size_t i = first; i < records.size(); ++i) {
+        out += format(records[i]) + "\n";
+    }
+    return out;
+}
+
+// static
+std::string EventLog::format(const EventRecord& record) {
+    time_t seconds = static_cast<time_t>(record.time / 1000000);
+    struct tm localTime;
+    localtime_r(&seconds, &localTime);
+    char prefix[64];
+    size_t prefixSize = std::strftime(prefix, sizeof(prefix), "%H:%M:%S", &localTime);
+    std::snprintf(prefix + prefixSize, sizeof(prefix) - prefixSize, ".%06u %u] ",
+        static_cast<unsigned int>(record.time % 1000000), record.thread);
+
+    std::string out(prefix);
+    if (record.event >= kNumEvents) {
+        out += "unknown event " + std::to_string(record.event);
+        return out;
+    }
+    size_t arg = 0;
+    for (const char* c = kEventFormats[record.event]; *c; ++c) {
+        if (*c == '%' && (c[1] == 'k' || c[1] == 'u') && arg < 3) {
+            out += c[1] == 'k' ? Asset::keyToString(record.args[arg]) : std::to_string(record.args[arg]);
+            ++arg;
+            ++c;
+        } else {
+            out += *c;
+        }
+    }
+    return out;
+}
+
+EventLog::Ring* EventLog::registerThread() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rings.emplace_back(new Ring(static_cast<uint32_t>(m_rings.size() + 1)));
+    return m_rings.back().get();
+}
+
+void EventLog::drain() {
+    std::vector<EventRecord> records;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& ring : m_rings) {
+            ring->drained = ring->copy(ring->drained, records, dropped);
+        }
+    }
+    if (dropped) {
+        m_dropped += dropped;
+        LOG(WARNING) << "event log dropped " << dropped << " events logged faster than they could be drained.";
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const EventRecord& a, const EventRecord& b) {
+        return a.time < b.time;
+    });
+    for (const auto& record : records) {
+        LOG(INFO) << format(record);
+    }
+}
+
+void EventLog::drainLoop(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(m_drainMutex);
+    while (m_draining) {
+        m_drainCondition.wait_for(lock, interval);
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+    // Log anything added since the last drain before exiting.
+    lock.unlock();
+    drain();
+}
+
+}  // namespace Confab
@@ -0,0 +1,213 @@
+#ifndef SRC_CONFAB_EVENT_LOG_HPP_
+#define SRC_CONFAB_EVENT_LOG_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Confab {
+
+/*! Identifies a hot-path event logged to the EventLog. Each event has a message format, in EventLog.cpp, with
+ * placeholders for up to three integer arguments. Messages that need strings, such as names, stay in glog.
+ */
+enum Event : uint16_t {
+    // AssetDatabase events.
+    kDbAssetAddedToList,
+    kDbAssetStored,
+    kDbAssetDeprecated,
+    kDbAssetFollowedDeprecation,
+    kDbAssetBatchFound,
+    kDbDataChunkLoaded,
+    kDbDataChunkStored,
+    kDbListStored,
+    kDbListLoaded,
+    kDbListWalkedOffEnd,
+
+    // confab-server HTTP events.
+    kHttpGetAsset,
+    kHttpAssetReturned,
+    kHttpPostAsset,
+    kHttpAssetVerified,
+    kHttpAssetStored,
+    kHttpPostAssetBatch,
+    kHttpAssetBatchReturned,
+    kHttpPostDeltaPlan,
+    kHttpDeltaPlanReturned,
+    kHttpGetAssetData,
+    kHttpAssetDataReturned,
+    kHttpPostAssetData,
+    kHttpAssetDataVerified,
+    kHttpAssetDataStored,
+    kHttpPostUploadData,
+    kHttpUploadCommitted,
+    kHttpGetList,
+    kHttpListReturned,
+    kHttpPostList,
+    kHttpListVerified,
+    kHttpListStored,
+    kHttpNamedListReturned,
+    kHttpGetListItems,
+    kHttpWatchListItems,
+    kHttpListItemsReturned,
+    kHttpResponseCacheHit,
+
+    // confab client events.
+    kClientGetAssetData,
+    kClientAssetDataReceived,
+    kClientPostAssetData,
+    kClientAssetDataPosted,
+    kClientCacheHit,
+    kClientCacheMiss,
+    kClientDeltaReused,
+
+    kNumEvents
+};
+
+/*! One logged event, as stored in the ring buffers.
+ */
+struct EventRecord {
+    /*! Wall clock time of the event, in microseconds since the epoch. */
+    uint64_t time;
+    /*! The Event logged. */
+    uint16_t event;
+    /*! Small integer identifying the logging thread. */
+    uint32_t thread;
+    /*! The event arguments, as many as its format uses. */
+    uint64_t args[3];
+};
+
+/*! Low overhead log for events on hot paths, in place of LOG(INFO).
+ *
+ * Each thread appends fixed-size binary records to its own ring buffer, with no locks, no allocation and no
+ * formatting. A background drainer thread formats new records into the INFO log at intervals, and dump() formats the
+ * most recent records on demand. If a thread logs faster than the drainer keeps up the oldest records are overwritten,
+ * and counted in dropped(). Warnings and errors should still go to glog directly.
+ */
+class EventLog {
+public:
+    /*! Number of records each thread's ring holds. */
+    static constexpr size_t kRingSize = 4096;
+
+    /*! \return The process-wide EventLog, the only instance, as each thread's ring is found through a thread_local.
+     */
+    static EventLog& global();
+
+    /*! Stops the drainer, if running.
+     */
+    ~EventLog();
+
+    /*! Logs an event from the calling thread.
+     *
+     * \param event The event to log.
+     * \param a The first argument, if the event format has one.
+     * \param b The second argument.
+     * \param c The third argument.
+     */
+    void log(Event event, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0) {
+        thread_local Ring* ring = registerThread();
+        ring->append(event, a, b, c);
+    }
+
+    /*! Starts a thread that formats newly logged events into the INFO log.
+     *
+     * \param interval How often to drain the rings.
+     */
+    void startDrainer(std::chrono::milliseconds interval);
+
+    /*! Stops the drainer thread after a final drain.
+     */
+    void stopDrainer();
+
+    /*! Formats the most recent events from every thread, oldest first, one per line. Doesn't affect the drainer.
+     *
+     * \param maxEvents The most events to return.
+     * \return The formatted events.
+     */
+    std::string dump(size_t maxEvents);
+
+    /*! \return The number of events overwritten before the drainer could log them. */
+    uint64_t dropped() const { return m_dropped; }
+
+    /*! Formats a single event record.
+     *
+     * \param record The record to format.
+     * \return A line of text, without a trailing newline.
+     */
+    static std::string format(const EventRecord& record);
+
+    /// @cond UNDOCUMENTED
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    EventLog();
+
+    // A single producer ring of records. Only the owning thread writes records and m_head, readers copy records and
+    // then check m_head again to discard any that were overwritten while copying.
+    class Ring {
+    public:
+        explicit Ring(uint32_t thread);
+
+        void append(Event event, uint64_t a, uint64_t b, uint64_t c) {
+            uint64_t head = m_head.load(std::memory_order_relaxed);
+            EventRecord& record = m_records[head % kRingSize];
+            record.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            record.event = event;
+            record.thread = m_thread;
+            record.args[0] = a;
+            record.args[1] = b;
+            record.args[2] = c;
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        // Copies the records from index from, or the oldest still in the ring if later, appending them to out. Returns
+        // the index after the last record in the ring, and adds the number of records missed since from to dropped.
+        uint64_t copy(uint64_t from, std::vector<EventRecord>& out, uint64_t& dropped) const;
+
+        // Index of the next record to drain, only used by the drainer.
+        uint64_t drained;
+
+    private:
+        const uint32_t m_thread;
+        std::atomic<uint64_t> m_head;
+        std::vector<EventRecord> m_records;
+    };
+
+    Ring* registerThread();
+    void drain();
+    void drainLoop(std::chrono::milliseconds interval);
+
+    std::mutex m_mutex;
+    // Rings are kept after their threads exit, so their last events can still be drained.
+    std::vector<std::unique_ptr<Ring>> m_rings;
+    std::atomic<uint64_t> m_dropped;
+
+    std::mutex m_drainMutex;
+    std::condition_variable m_drainCondition;
+    bool m_draining;
+    std::thread m_drainThread;
+};
+
+/*! Logs an event to the global EventLog.
+ *
+ * \param event The event to log.
+ * \param a The first argument, if the event format has one.
+ * \param b The second argument.
+ * \param c The third argument.
+ */
+inline void logEvent(Event event, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0) {
+    EventLog::global().log(event, a, b, c);
+}
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_EVENT_LOG_HPP_
@@ -0,0 +1,81 @@
+#include "EventLog.hpp"
+
+#include "Asset.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+
+TEST(EventLogTest, FormatsKeysAndNumbers) {
+    Confab::EventRecord record = {};
+    record.event = Confab::kHttpGetAssetData;
+    record.args[0] = 0x1234567890abcdef;
+    record.args[1] = 42;
+    std::string line = Confab::EventLog::format(record);
+    EXPECT_NE(std::string::npos, line.find("/asset/data/" + Confab::Asset::keyToString(0x1234567890abcdef) + "/42"));
+
+    record.event = Confab::kNumEvents;
+    EXPECT_NE(std::string::npos, Confab::EventLog::format(record).find("unknown event"));
+}
+
+TEST(EventLogTest, DumpsRecentEventsFromAllThreads) {
+    std::thread other([] {
+        Confab::logEvent(Confab::kDbListWalkedOffEnd, 7, 1001);
+    });
+    other.join();
+    Confab::logEvent(Confab::kDbListWalkedOffEnd, 7, 1002);
+
+    std::string dump = Confab::EventLog::global().dump(16);
+    EXPECT_NE(std::string::npos, dump.find("after 1001 pairs."));
+    EXPECT_NE(std::string::npos, dump.find("after 1002 pairs."));
+    EXPECT_LT(dump.find("after 1001 pairs."), dump.find("after 1002 pairs."));
+}
+
+TEST(EventLogTest, DumpKeepsOnlyMostRecentAfterWrap) {
+    for (uint64_t i = 0; i < Confab::EventLog::kRingSize + 10; ++i) {
+        Confab::logEvent(Confab::kDbAssetBatchFound, i, 0);
+    }
+    std::string dump = Confab::EventLog::global().dump(1);
+    EXPECT_NE(std::string::npos, dump.find("found " + std::to_string(Confab::EventLog::kRingSize + 9) + " of 0"));
+}
+
+TEST(EventLogTest, DumpDiscardsRecordsTornByLappingWriter) {
+    // The writer laps the ring many times over while dumps copy it, and every record it writes has its two counts
+    // equal, so a record overwritten part way through being copied would show as a mismatch.
+    std::atomic<bool> writing(true);
+    std::thread writer([&writing] {
+        for (uint64_t i = 0; writing; ++i) {
+            Confab::logEvent(Confab::kHttpDeltaPlanReturned, 0, i, i);
+        }
+    });
+
+    size_t checked = 0;
+    std::string torn;
+    for (int i = 0; i < 200 && torn.empty(); ++i) {
+        std::istringstream dump(Confab::EventLog::global().dump(Confab::EventLog::kRingSize));
+        std::string line;
+        while (std::getline(dump, line)) {
+            size_t found = line.find(" reuses ");
+            if (found == std::string::npos) {
+                continue;
+            }
+            std::istringstream counts(line.substr(found + 8));
+            uint64_t reused = 0;
+            uint64_t fetched = 0;
+            std::string words;
+            counts >> reused >> words >> words >> fetched;
+            if (reused != fetched) {
+                torn = line;
+                break;
+            }
+            ++checked;
+        }
+    }
+    writing = false;
+    writer.join();
+    EXPECT_EQ("", torn);
+    EXPECT_GT(checked, 0u);
+}
@@ -1,106 +1,147 @@
 #include "HttpClient.hpp"
 
 #include "Asset.hpp"
+#include "Base64.hpp"
+#include "BufferPool.hpp"
+#include "ChunkLayout.hpp"
 #include "Constants.hpp"
+#include "ContentChunker.hpp"
+#include "EventLog.hpp"
+#include "MappedFile.hpp"
+#include "Metrics.hpp"
 #include "Record.hpp"
 #include "schemas/FlatAsset_generated.h"
+#include "schemas/FlatAssetBatch_generated.h"
 #include "schemas/FlatAssetData_generated.h"
+#include "schemas/FlatConfig_generated.h"
+#include "schemas/FlatDeltaPlan_generated.h"
 #include "schemas/FlatList_generated.h"
+#include "schemas/FlatListPage_generated.h"
+#include "schemas/FlatUploadStatus_generated.h"
 
 #include "glog/logging.h"
-#include "libbase64.h"
 #include "pistache/net.h"
 #include "pistache/http.h"
 #include "pistache/client.h"
 #include "xxhash.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <experimental/filesystem>
 #include <inttypes.h>
 #include <fstream>
+#include <future>
 #include <limits>
+#include <strings.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 namespace fs = std::experimental::filesystem;
 
+namespace {
+
+// Splits a comma-separated list of server addresses, ignoring empty entries, but always returning at least one.
+std::vector<std::string> splitAddresses(const std::string& addresses) {
+    std::vector<std::string> split;
+    size_t start = 0;
+    while (start <= addresses.size()) {
+        size_t end = std::min(addresses.find(',', start), addresses.size());
+        if (end > start) {
+            split.push_back(addresses.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    if (split.empty()) {
+        split.push_back(addresses);
+    }
+    return split;
+}
+
+// How long to wait before resending a request turned away without a usable Retry-After header.
+const std::chrono::seconds kDefaultRetryAfter(1);
+// The longest to wait before resending a request turned away, whatever its Retry-After header asks.
+const std::chrono::seconds kMaxRetryAfter(30);
+
+// Returns how long a response turning a request away asks the client to wait, from its Retry-After header in seconds.
+std::chrono::seconds retryAfter(const Pistache::Http::Response& response) {
+    for (const auto& header : response.headers().rawList()) {
+        if (strcasecmp(header.first.c_str(), "Retry-After") != 0) {
+            continue;
+        }
+        // The header may also be an HTTP date, which the servers here never send, so use the default for that.
+        char* end = nullptr;
+        long seconds = std::strtol(header.second.value().c_str(), &end, 10);
+        if (end == header.second.value().c_str() || seconds < 0) {
+            break;
+        }
+        return std::min(std::chrono::seconds(seconds), kMaxRetryAfter);
+    }
+    return kDefaultRetryAfter;
+}
+
+}  // namespace
+
 namespace Confab {
 
-/*! Record class to hold the string values returned by Pistache and allow us to deserialize records from them
- * without additional copies.
+/*! Decodes a base64 response body into a buffer from the global pool, which records made from it keep alive, so that
+ * they remain valid after the response is gone.
  */
-class ClientRecord : public Record {
-public:
-    /*! Default constructor not supported, use makeEmptyRecord().
-     */
-    ClientRecord() = delete;
-
-    /*! Construct a record that wraps a Pistache response string.
-     *
-     * \param bytes The decoded buffer to wrap.
-     * \param size The size of the buffer in bytes.
-     */
-    ClientRecord(const uint8_t* bytes, size_t size) :
-        m_data(bytes, size) {
-    }
-
-    /*! Deletes a ClientRecord, does nothing because the underlying string is not owned by this class.
-     */
-    ~ClientRecord() override { }
-
-    /*! True if this ClientRecord has no results.
-     *
-     * \return true if this Record is empty, false if it has content.
-     */
-    bool empty() const override { return m_data.data() == nullptr; }
-
-    /*! A pointer to the data contents of this Record.
-     *
-     * \return A pointer to the data contents of this Record.
-     */
-    const SizedPointer data() const override {
-        return m_data;
-    }
-
-    /*! A pointer to the key contents of this Record.
-     *
-     * \return Always empty.
-     */
-    const SizedPointer key() const override {
-        return SizedPointer();
-    }
-
-private:
-    const SizedPointer m_data;
-};
-
-HttpClient::HttpClient(const std::string& serverAddress) :
-    m_serverAddress(serverAddress),
+static BufferRef decodeBody(const std::string& body) {
+    BufferRef buffer = BufferPool::global().acquire(0);
+    decodeBase64(body, buffer->bytes());
+    return buffer;
+}
+
+HttpClient::HttpClient(const std::string& serverAddresses, size_t maxInFlight, size_t uploadWindow,
+        bool singlePassUpload, bool contentDefinedChunks) :
     m_client(new Pistache::Http::Client),
-    m_distribution(0, std::numeric_limits<uint64_t>::max()) {
+    m_distribution(0, std::numeric_limits<uint64_t>::max()),
+    m_dataChunkSize(0),
+    m_uploadWindow(std::max(uploadWindow, static_cast<size_t>(1))),
+    m_singlePassUpload(singlePassUpload),
+    m_contentDefinedChunks(contentDefinedChunks),
+    m_upstreams(splitAddresses(serverAddresses), kInitialUpstreamLimit, kMaxUpstreamLimit),
+    m_scheduler(maxInFlight),
+    m_retrying(true) {
+    for (size_t i = 0; i < RequestScheduler::kNumPriorities; ++i) {
+        m_queueLatency[i] = MetricsRegistry::global().histogram("confab_client_queue_seconds",
+            "Time from issuing a client request to sending it to an upstream, by priority.",
+            std::string("priority=\"") + RequestScheduler::priorityName(static_cast<RequestScheduler::Priority>(i)) +
+            "\"", 1e-6);
+    }
+    // Each upstream's adaptive limit decides how many of these connections are actually used, with interactive
+    // requests allowed a little beyond it.
     auto opts = Pistache::Http::Client::options()
         .keepAlive(true)
-        .maxConnectionsPerHost(4)
+        .maxConnectionsPerHost(kMaxUpstreamLimit + RequestScheduler::kInteractiveHeadroom)
+        .maxResponseSize(kMaxHttpMessageSize)
         .threads(4);
     m_client->init(opts);
+    m_retryThread = std::thread(&HttpClient::retryLoop, this);
 }
 
 HttpClient::~HttpClient() {
+    stopRetries();
 }
 
-void HttpClient::getAsset(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback) {
-    std::string request = m_serverAddress + "/asset/id/" + Asset::keyToString(key);
+void HttpClient::getAssetAsync(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback,
+        RequestScheduler::Priority priority) {
+    std::string request = "/asset/id/" + Asset::keyToString(key);
     LOG(INFO) << "issuing Asset request to " << request;
 
-    auto promise = m_client->get(request).send();
-    promise.then([&key, &callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
+    submit(kGet, UpstreamSet::kMetadata, priority, request, "", [key, callback, request](
+            const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
             LOG(INFO) << "received Ok response for Asset request " << request;
-            uint8_t decoded[kPageSize];
-            size_t decodedSize;
-            base64_decode(response.body().c_str(), response.body().size(), reinterpret_cast<char*>(decoded),
-                &decodedSize, 0);
+            BufferRef buffer = decodeBody(response->body());
+            const std::vector<uint8_t>& decoded = buffer->bytes();
             // Verify the Asset record as returned by the server.
-            RecordPtr flatAsset(new ClientRecord(decoded, decodedSize));
-            auto verifier = flatbuffers::Verifier(decoded, decodedSize);
+            RecordPtr flatAsset = std::make_shared<PooledRecord>(buffer);
+            auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
             if (Data::VerifyFlatAssetBuffer(verifier)) {
                 callback(key, flatAsset);
             } else {
@@ -108,64 +149,29 @@ void HttpClient::getAsset(uint64_t key, std::function<void(uint64_t, RecordPtr)>
                 callback(key, makeEmptyRecord());
             }
         } else {
-            LOG(ERROR) << "error code " << response.code() << " on Asset request " << request;
-            callback(key, makeEmptyRecord());
-        }
-    }, Pistache::Async::NoExcept);
-
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
-}
-
-void HttpClient::getNamedAsset(const std::string& name, std::function<void(RecordPtr)> callback) {
-    std::string request = m_serverAddress + "/asset/name";
-    LOG(INFO) << "issuing named Asset for '" << name << "' request to " << request;
-
-    // We supply the Asset name in the body of the request to avoid URL encoding issues with names.
-    auto promise = m_client->get(request).body(name).send();
-    promise.then([&name, &callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "recevied Ok response for named Asset request for '" << name << "'.";
-            uint8_t decoded[kPageSize];
-            size_t decodedSize;
-            base64_decode(response.body().c_str(), response.body().size(), reinterpret_cast<char*>(decoded),
-                &decodedSize, 0);
-            RecordPtr flatAsset(new ClientRecord(decoded, decodedSize));
-            auto verifier = flatbuffers::Verifier(decoded, decodedSize);
-            if (Data::VerifyFlatAssetBuffer(verifier)) {
-                callback(flatAsset);
-            } else {
-                LOG(ERROR) << "failed to verify named asset for request " << request;
-                callback(makeEmptyRecord());
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on Asset request " << request;
             }
-        } else {
-            LOG(ERROR) << "error code " << response.code() << " on named Asset request " << request;
-            callback(makeEmptyRecord());
+            callback(key, makeEmptyRecord());
         }
-    }, Pistache::Async::NoExcept);
-
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+    });
 }
 
-void HttpClient::getAssetData(uint64_t key, uint64_t chunk,
-    std::function<void(uint64_t, uint64_t, RecordPtr)> callback) {
+void HttpClient::getAssetDataAsync(uint64_t key, uint64_t chunk,
+    std::function<void(uint64_t, uint64_t, RecordPtr)> callback, RequestScheduler::Priority priority) {
     char numBuf[32];
     snprintf(numBuf, 32, "%" PRIu64, chunk);
-    std::string request = m_serverAddress + "/asset/data/" + Asset::keyToString(key) + "/" + std::string(numBuf);
-    LOG(INFO) << "issuing AssetData request to " << request;
-
-    auto promise = m_client->get(request).send();
-    promise.then([&key, &chunk, &callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "received Ok response for AssetData request " << request << ", " << response.body().size()
-                << " bytes ";
-            uint8_t decoded[kPageSize];
-            size_t decodedSize;
-            base64_decode(response.body().c_str(), response.body().size(), reinterpret_cast<char*>(decoded),
-                &decodedSize, 0);
-            RecordPtr flatAssetData(new ClientRecord(decoded, decodedSize));
-            auto verifier = flatbuffers::Verifier(decoded, decodedSize);
+    std::string request = "/asset/data/" + Asset::keyToString(key) + "/" + std::string(numBuf);
+    logEvent(kClientGetAssetData, key, chunk);
+
+    submit(kGet, UpstreamSet::kBulk, priority, request, "", [key, chunk, callback, request](
+            const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
+            logEvent(kClientAssetDataReceived, key, chunk, response->body().size());
+            BufferRef buffer = decodeBody(response->body());
+            const std::vector<uint8_t>& decoded = buffer->bytes();
+            RecordPtr flatAssetData = std::make_shared<PooledRecord>(buffer);
+            auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
             if (Data::VerifyFlatAssetDataBuffer(verifier)) {
                 callback(key, chunk, flatAssetData);
             } else {
@@ -173,21 +179,64 @@ void HttpClient::getAssetData(uint64_t key, uint64_t chunk,
                 callback(key, chunk, makeEmptyRecord());
             }
         } else {
-            LOG(ERROR) << "error code " << response.code() << " on AssetData request " << request;
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on AssetData request " << request;
+            }
             callback(key, chunk, makeEmptyRecord());
         }
-    }, Pistache::Async::NoExcept);
+    });
+}
+
+// TODO: could probably flatten this, assetData, and asset requests into a single generic call.
+void HttpClient::getListAsync(uint64_t key, std::function<void(RecordPtr)> callback) {
+    std::string request = "/list/id/" + Asset::keyToString(key);
+    LOG(INFO) << "issuing list request to " << request;
+
+    submit(kGet, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, "", [callback, request](
+            const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
+            LOG(INFO) << "received Ok response for list request " << request;
+            BufferRef buffer = decodeBody(response->body());
+            const std::vector<uint8_t>& decoded = buffer->bytes();
+            // Verify the Asset record as returned by the server.
+            RecordPtr flatList = std::make_shared<PooledRecord>(buffer);
+            auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+            if (Data::VerifyFlatListBuffer(verifier)) {
+                callback(flatList);
+            } else {
+                LOG(ERROR) << "failed to verify server-provided data for list request " << request;
+                callback(makeEmptyRecord());
+            }
+        } else {
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on list request " << request;
+            }
+            callback(makeEmptyRecord());
+        }
+    });
+}
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+void HttpClient::getListItemsAsync(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback) {
+    std::string request = "/list/items/" + Asset::keyToString(key) + "/" + Asset::keyToString(token);
+    LOG(INFO) << "issuing list items request to " << request;
+    requestListPageAsync(UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, callback);
 }
 
-uint64_t HttpClient::postInlineAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
-        const std::string& listIds, uint64_t size, const uint8_t* inlineData) {
+void HttpClient::watchListItemsAsync(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback) {
+    std::string request = "/list/watch/" + Asset::keyToString(key) + "/" + Asset::keyToString(token);
+    LOG(INFO) << "issuing list watch request to " << request;
+    // Watches wait on the server in the background, so yield to requests someone is waiting on.
+    requestListPageAsync(UpstreamSet::kWatch, RequestScheduler::kPrefetch, request, callback);
+}
+
+void HttpClient::postInlineAssetAsync(Asset::Type type, const std::string& name, uint64_t author,
+        uint64_t deprecates, const std::string& listIds, uint64_t size, const uint8_t* inlineData,
+        std::function<void(uint64_t)> callback) {
     if (size > kSingleChunkDataSize) {
         LOG(ERROR) << "attempt to post inline Asset of size " << size << " greater than max of "
             << kSingleChunkDataSize;
-        return 0;
+        callback(0);
+        return;
     }
 
     Asset asset(type);
@@ -195,7 +244,12 @@ uint64_t HttpClient::postInlineAsset(Asset::Type type, const std::string& name,
     asset.setAuthor(author);
     asset.setDeprecates(deprecates);
     // For short assets we add some random salt to the hash, to help avoid hash collisions.
-    asset.setSalt(m_distribution(m_randomDevice));
+    uint64_t salt = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        salt = m_distribution(m_randomDevice);
+    }
+    asset.setSalt(salt);
     uint64_t key = XXH64(inlineData, size, asset.salt());
     asset.setKey(key);
     asset.parseListIds(listIds);
@@ -203,323 +257,1015 @@ uint64_t HttpClient::postInlineAsset(Asset::Type type, const std::string& name,
     flatbuffers::FlatBufferBuilder builder(kPageSize);
     asset.flatten(builder, inlineData);
 
-    std::string request = m_serverAddress + "/asset/id/" + Asset::keyToString(key);
+    std::string request = "/asset/id/" + Asset::keyToString(key);
     LOG(INFO) << "sending POST for new inline asset " << request << ", " << builder.GetSize() << " bytes";
 
-    char base64[kPageSize];
-    size_t encodedSize = 0;
-    base64_encode(reinterpret_cast<const char*>(builder.GetBufferPointer()), builder.GetSize(), base64, &encodedSize,
-        0);
-    CHECK_LT(encodedSize, kPageSize) << "encoded inline asset larger than page size";
-
-    bool ok = true;
-    auto promise = m_client->post(request)
-        .header<Pistache::Http::Header::ContentType>(MIME(Text, Plain))
-        .header<Pistache::Http::Header::ContentLength>(encodedSize)
-        .body(std::string(base64, encodedSize))
-        .send();
-    promise.then([&request, &ok](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
+    std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+    submit(kPost, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, std::move(base64),
+            [key, callback, request](const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
             LOG(INFO) << "received ok response for inline asset post " << request;
+            callback(key);
         } else {
-            LOG(ERROR) << "error code " << response.code() << " on inline Asset post " << request;
-            ok = false;
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on inline Asset post " << request;
+            }
+            callback(0);
+        }
+    });
+}
+
+/*! Classifies the response to a POST, or its absence. A 4xx status means the server found the post itself invalid,
+ * except for timeouts and rate limits, which say nothing about the post.
+ */
+static HttpClient::PostResult postResult(const Pistache::Http::Response* response) {
+    if (!response) {
+        return HttpClient::kFailed;
+    }
+    Pistache::Http::Code code = response->code();
+    if (code == Pistache::Http::Code::Ok) {
+        return HttpClient::kPosted;
+    }
+    if (static_cast<int>(code) >= 400 && static_cast<int>(code) < 500 &&
+            code != Pistache::Http::Code::Request_Timeout && code != Pistache::Http::Code::Too_Many_Requests) {
+        return HttpClient::kRejected;
+    }
+    return HttpClient::kFailed;
+}
+
+void HttpClient::postAssetDataAsync(uint64_t key, uint64_t chunk, const SizedPointer& flatAssetData,
+        std::function<void(PostResult)> callback, size_t upstream) {
+    std::string base64 = encodeBase64(flatAssetData);
+    logEvent(kClientPostAssetData, key, chunk, base64.size());
+    char numBuf[32];
+    snprintf(numBuf, 32, "%" PRIu64, chunk);
+    std::string request = "/asset/data/" + Asset::keyToString(key) + "/" + std::string(numBuf);
+    submit(kPost, UpstreamSet::kBulk, RequestScheduler::kBulk, request, std::move(base64),
+            [key, chunk, callback, request](const Pistache::Http::Response* response) {
+        PostResult result = postResult(response);
+        if (result == kPosted) {
+            logEvent(kClientAssetDataPosted, key, chunk);
+        } else if (response) {
+            LOG(ERROR) << "error code " << response->code() << " on file asset chunk post " << request;
+        }
+        callback(result);
+    }, upstream);
+}
+
+void HttpClient::postUploadDataAsync(uint64_t uploadId, uint64_t chunk, const SizedPointer& flatAssetData,
+        std::function<void(bool)> callback, size_t upstream) {
+    std::string base64 = encodeBase64(flatAssetData);
+    char numBuf[32];
+    snprintf(numBuf, 32, "%" PRIu64, chunk);
+    std::string request = "/asset/upload/" + Asset::keyToString(uploadId) + "/" + std::string(numBuf);
+    submit(kPost, UpstreamSet::kBulk, RequestScheduler::kBulk, request, std::move(base64), [callback, request](
+            const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
+            callback(true);
+        } else {
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on staged chunk post " << request;
+            }
+            callback(false);
+        }
+    }, upstream);
+}
+
+void HttpClient::postListAsync(const std::string& name, std::function<void(uint64_t)> callback) {
+    // Generate random key.
+    uint64_t key = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        key = m_distribution(m_randomDevice);
+    }
+    flatbuffers::FlatBufferBuilder builder(kPageSize);
+    auto listName = builder.CreateString(name);
+    Data::FlatListBuilder listBuilder(builder);
+    listBuilder.add_key(key);
+    listBuilder.add_name(listName);
+    auto list = listBuilder.Finish();
+    builder.Finish(list);
+
+    std::string request = "/list/id/" + Asset::keyToString(key);
+    LOG(INFO) << "sending POST for new list " << request << ", " << builder.GetSize() << " bytes";
+
+    std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+    submit(kPost, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, std::move(base64),
+            [key, callback, request](const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
+            LOG(INFO) << "received ok response for list post " << request;
+            callback(key);
+        } else {
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on list post " << request;
+            }
+            callback(0);
         }
-    }, Pistache::Async::NoExcept);
+    });
+}
+
+void HttpClient::waitForIdle() {
+    std::unique_lock<std::mutex> lock(m_windowMutex);
+    m_idle.wait(lock, [this] { return m_scheduler.inFlight() == 0 && pendingEmpty(); });
+}
+
+std::vector<UpstreamSet::Status> HttpClient::upstreamStatus() {
+    std::lock_guard<std::mutex> lock(m_windowMutex);
+    std::vector<UpstreamSet::Status> status;
+    for (size_t i = 0; i < m_upstreams.size(); ++i) {
+        status.push_back(m_upstreams.status(i));
+    }
+    return status;
+}
+
+void HttpClient::getAsset(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback,
+        RequestScheduler::Priority priority) {
+    wait([this, key, &callback, priority](std::function<void()> done) {
+        getAssetAsync(key, [&callback, done](uint64_t key, RecordPtr asset) {
+            callback(key, asset);
+            done();
+        }, priority);
+    });
+}
+
+/*! Reads a verified FlatAssetBatch response, calling callback for each requested key in it and removing the key from
+ * pending. Sets truncated if the server left out some Assets, so the keys still pending should be requested again.
+ */
+static void readAssetBatch(const Pistache::Http::Response& response, const std::string& request,
+        std::unordered_set<uint64_t>& pending, const std::function<void(uint64_t, RecordPtr)>& callback,
+        bool& truncated) {
+    if (response.code() != Pistache::Http::Code::Ok) {
+        LOG(ERROR) << "error code " << response.code() << " on batch Asset request " << request;
+        return;
+    }
+    BufferRef buffer = decodeBody(response.body());
+    const std::vector<uint8_t>& decoded = buffer->bytes();
+    auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+    if (!Data::VerifyFlatAssetBatchBuffer(verifier)) {
+        LOG(ERROR) << "failed to verify server-provided data for batch Asset request " << request;
+        return;
+    }
+    const Data::FlatAssetBatch* batch = Data::GetFlatAssetBatch(decoded.data());
+    truncated = batch->truncated();
+    if (!batch->entries()) {
+        return;
+    }
+    LOG(INFO) << "received Ok response for batch Asset request with " << batch->entries()->size() << " entries.";
+    for (auto entry : *batch->entries()) {
+        if (pending.erase(entry->key()) == 0) {
+            LOG(WARNING) << "ignoring unrequested key " << Asset::keyToString(entry->key())
+                << " in batch Asset response.";
+            continue;
+        }
+        if (entry->status() != Data::BatchStatus_kFound || !entry->asset()) {
+            callback(entry->key(), makeEmptyRecord());
+            continue;
+        }
+        auto assetVerifier = flatbuffers::Verifier(entry->asset()->data(), entry->asset()->size());
+        if (Data::VerifyFlatAssetBuffer(assetVerifier)) {
+            callback(entry->key(), std::make_shared<PooledRecord>(buffer,
+                SizedPointer(entry->asset()->data(), entry->asset()->size())));
+        } else {
+            LOG(ERROR) << "failed to verify Asset " << Asset::keyToString(entry->key()) << " within batch response.";
+            callback(entry->key(), makeEmptyRecord());
+        }
+    }
+}
+
+void HttpClient::getAssets(const std::vector<uint64_t>& keys, std::function<void(uint64_t, RecordPtr)> callback,
+        RequestScheduler::Priority priority) {
+    std::string request = "/asset/batch";
+
+    for (size_t offset = 0; offset < keys.size(); offset += kAssetBatchMaxKeys) {
+        size_t batchSize = std::min(kAssetBatchMaxKeys, keys.size() - offset);
+        // Track which keys have been returned, so any keys the server omits are still reported to the caller.
+        std::unordered_set<uint64_t> pending(keys.begin() + offset, keys.begin() + offset + batchSize);
+
+        // A server keeping its response under kAssetBatchMaxBytes leaves out some Assets, which are asked for again
+        // for as long as each response returns at least one.
+        bool truncated = true;
+        while (truncated && !pending.empty()) {
+            std::vector<uint64_t> pendingKeys(pending.begin(), pending.end());
+            flatbuffers::FlatBufferBuilder builder(kPageSize);
+            auto batchKeys = builder.CreateVector(pendingKeys);
+            Data::FlatAssetBatchBuilder batchBuilder(builder);
+            batchBuilder.add_keys(batchKeys);
+            builder.Finish(batchBuilder.Finish());
+
+            std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+            LOG(INFO) << "issuing batch Asset request for " << pending.size() << " keys to " << request;
+
+            truncated = false;
+            wait([this, &base64, &callback, &request, &pending, &truncated, priority](std::function<void()> done) {
+                submit(kPost, UpstreamSet::kMetadata, priority, request, std::move(base64),
+                        [&callback, &request, &pending, &truncated, done](const Pistache::Http::Response* response) {
+                    if (response) {
+                        readAssetBatch(*response, request, pending, callback, truncated);
+                    }
+                    done();
+                });
+            });
+            if (pending.size() == pendingKeys.size()) {
+                break;
+            }
+        }
+
+        for (auto key : pending) {
+            callback(key, makeEmptyRecord());
+        }
+    }
+}
+
+void HttpClient::getNamedAsset(const std::string& name, std::function<void(RecordPtr)> callback) {
+    std::string request = "/asset/name";
+    LOG(INFO) << "issuing named Asset for '" << name << "' request to " << request;
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+    // We supply the Asset name in the body of the request to avoid URL encoding issues with names.
+    wait([this, &name, &callback, &request](std::function<void()> done) {
+        submit(kGet, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, name,
+                [&name, &callback, &request, done](const Pistache::Http::Response* response) {
+            if (response && response->code() == Pistache::Http::Code::Ok) {
+                LOG(INFO) << "recevied Ok response for named Asset request for '" << name << "'.";
+                BufferRef buffer = decodeBody(response->body());
+                const std::vector<uint8_t>& decoded = buffer->bytes();
+                RecordPtr flatAsset = std::make_shared<PooledRecord>(buffer);
+                auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+                if (Data::VerifyFlatAssetBuffer(verifier)) {
+                    callback(flatAsset);
+                } else {
+                    LOG(ERROR) << "failed to verify named asset for request " << request;
+                    callback(makeEmptyRecord());
+                }
+            } else {
+                if (response) {
+                    LOG(ERROR) << "error code " << response->code() << " on named Asset request " << request;
+                }
+                callback(makeEmptyRecord());
+            }
+            done();
+        });
+    });
+}
+
+void HttpClient::getAssetData(uint64_t key, uint64_t chunk,
+    std::function<void(uint64_t, uint64_t, RecordPtr)> callback, RequestScheduler::Priority priority) {
+    wait([this, key, chunk, &callback, priority](std::function<void()> done) {
+        getAssetDataAsync(key, chunk, [&callback, done](uint64_t key, uint64_t chunk, RecordPtr assetData) {
+            callback(key, chunk, assetData);
+            done();
+        }, priority);
+    });
+}
 
-    return ok ? key : 0;
+bool HttpClient::getDeltaPlan(uint64_t key, const std::vector<uint64_t>& hashes, std::vector<int32_t>& sources) {
+    std::string request = "/asset/delta/" + Asset::keyToString(key);
+    flatbuffers::FlatBufferBuilder builder(kPageSize);
+    auto hashesVector = builder.CreateVector(hashes);
+    Data::FlatDeltaPlanBuilder planBuilder(builder);
+    planBuilder.add_hashes(hashesVector);
+    builder.Finish(planBuilder.Finish());
+    std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+    LOG(INFO) << "issuing delta plan request with " << hashes.size() << " chunk hashes to " << request;
+
+    bool ok = false;
+    sources.clear();
+    wait([this, &request, &base64, &sources, &ok](std::function<void()> done) {
+        submit(kPost, UpstreamSet::kBulk, RequestScheduler::kBulk, request, std::move(base64),
+                [&request, &sources, &ok, done](const Pistache::Http::Response* response) {
+            if (response && response->code() == Pistache::Http::Code::Ok) {
+                BufferRef buffer = decodeBody(response->body());
+                const std::vector<uint8_t>& decoded = buffer->bytes();
+                auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+                if (Data::VerifyFlatDeltaPlanBuffer(verifier)) {
+                    const Data::FlatDeltaPlan* plan = Data::GetFlatDeltaPlan(decoded.data());
+                    if (plan->sources()) {
+                        sources.assign(plan->sources()->begin(), plan->sources()->end());
+                        ok = true;
+                    } else {
+                        LOG(ERROR) << "delta plan response for " << request << " has no chunk sources.";
+                    }
+                } else {
+                    LOG(ERROR) << "failed to verify server-provided data for delta plan request " << request;
+                }
+            } else if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on delta plan request " << request;
+            }
+            done();
+        });
+    });
+    return ok;
+}
+
+uint64_t HttpClient::postInlineAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
+        const std::string& listIds, uint64_t size, const uint8_t* inlineData) {
+    uint64_t key = 0;
+    wait([&](std::function<void()> done) {
+        postInlineAssetAsync(type, name, author, deprecates, listIds, size, inlineData, [&key, done](uint64_t posted) {
+            key = posted;
+            done();
+        });
+    });
+    return key;
 }
 
 uint64_t HttpClient::postFileAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
         const std::string& listIds, const fs::path& assetFile) {
     // Some Assets like images make sense to serialize to a file, regardless of size, because SuperCollider has no
     // concept of loading an image from a binary blob of memory.
-    size_t fileSize = fs::file_size(assetFile);
+    MappedFile file;
+    if (!file.open(assetFile)) {
+        LOG(ERROR) << "error opening file: " << assetFile << " for upload.";
+        return 0;
+    }
+    size_t fileSize = file.size();
     if (fileSize == 0) {
         LOG(ERROR) << "rejecting addition of zero-size file at " << assetFile;
         return 0;
     }
 
+    // Content-defined chunks average a quarter of the server's chunk size, and are never larger than it.
+    size_t chunkSize = dataChunkSize();
+    std::vector<uint64_t> offsets;
+    if (m_contentDefinedChunks) {
+        ContentChunker chunker(chunkSize);
+        if (!chunker.split(file, offsets)) {
+            LOG(ERROR) << "error reading file " << assetFile << " to find its chunks.";
+            return 0;
+        }
+        // The Asset records every offset, so a file with more chunks than it can hold gets fixed size chunks instead.
+        if (offsets.size() > kMaxChunkOffsets) {
+            LOG(WARNING) << "file " << assetFile << " splits into " << offsets.size() << " chunks, more than the "
+                << "maximum of " << kMaxChunkOffsets << ", using fixed size chunks.";
+            offsets.clear();
+        }
+    }
+    uint64_t chunks = offsets.size() ? offsets.size() : (fileSize + chunkSize - 1) / chunkSize;
+    ChunkLayout layout(fileSize, chunks, chunkSize, offsets);
+
+    Asset asset(type);
+    asset.setName(name);
+    asset.setFileExtension(assetFile.extension());
+    asset.setAuthor(author);
+    asset.setDeprecates(deprecates);
+    asset.setSize(fileSize);
+    asset.setChunks(chunks);
+    asset.setChunkSize(chunkSize);
+    asset.setChunkOffsets(offsets);
+    asset.parseListIds(listIds);
+
+    // Every request of an upload goes to the same upstream, as mirrors don't share staged chunks, and a file Asset
+    // should be complete wherever it is found.
+    size_t upstream = uploadUpstream();
+    uint64_t key = m_singlePassUpload ?
+        postFileAssetSinglePass(asset, file, assetFile, layout, upstream) :
+        postFileAssetTwoPass(asset, file, assetFile, layout, upstream);
+    if (key) {
+        LOG(INFO) << "completed successful upload of file Asset " << Asset::keyToString(key) << " from " << assetFile;
+    }
+    return key;
+}
+
+uint64_t HttpClient::postFileAssetTwoPass(Asset& asset, MappedFile& file, const fs::path& assetFile,
+        const ChunkLayout& layout, size_t upstream) {
     // First we must hash the file. This means we will be traversing this file twice, first for a hash and then second
-    // for the upload. This could be avoided at the cost of loading the file entirely in to memory, or possibly by
-    // designing some incremental upload that specifies the Asset key *last*, but in the interest of simplicity the
-    // current design is to just traverse the file twice. We even recompute the hash twice because storage of the
-    // intermediate hashes for large files is on the order of megabytes.
-    std::array<char, kDataChunkSize> fileChunk;
-    std::ifstream inFile(assetFile, std::ios::in | std::ios::binary);
-    if (!inFile) {
-        LOG(ERROR) << "error opening file: " << assetFile << " for hash computation";
+    // for the upload. postFileAssetSinglePass() avoids this by staging the chunks on the server until the key is
+    // known, which servers without upload staging don't support. We even recompute the hash twice because storage of
+    // the intermediate hashes for large files is on the order of megabytes.
+    uint64_t key = 0;
+    if (!file.hash(key)) {
+        LOG(ERROR) << "file read error hashing " << assetFile;
         return 0;
     }
-    XXH64_state_t* hashState = XXH64_createState();
-    XXH64_reset(hashState, 0);
-    inFile.read(fileChunk.data(), kDataChunkSize);
-    size_t bytesRead = inFile.gcount();
-    size_t bytesRemaining = fileSize - bytesRead;
 
-    while (inFile && bytesRemaining > 0) {
-        XXH64_update(hashState, fileChunk.data(), bytesRead);
-        inFile.read(fileChunk.data(), kDataChunkSize);
-        bytesRead = inFile.gcount();
-        bytesRemaining -= bytesRead;
-    }
+    std::string keyString = Asset::keyToString(key);
+    LOG(INFO) << "computed key " << keyString << " for asset file " << assetFile;
 
-    // Compute any remaining hash bytes.
-    if (bytesRead > 0) {
-        XXH64_update(hashState, fileChunk.data(), bytesRead);
+    asset.setKey(key);
+    if (postFlatAsset("/asset/id/" + keyString, asset, upstream) != kPosted) {
+        LOG(INFO) << "error posting new file asset " << assetFile << " with key " << keyString;
+        return 0;
     }
 
-    uint64_t key = XXH64_digest(hashState);
-    // Free this now, we can re-allocate later, just to avoid potentially leaking it on the various exit paths from this
-    // function.
-    XXH64_freeState(hashState);
+    // Now we upload the individual data chunks of the file. The digest of the final chunk should match the overall
+    // hash of the file.
+    uint64_t chunkHash = 0;
+    if (!postFileChunks(file, assetFile, layout, key, false, nullptr, upstream, chunkHash) ||
+            chunkHash != key) {
+        LOG(ERROR) << "error uploading file " << assetFile << " to server.";
+        return 0;
+    }
+    return key;
+}
 
-    if (bytesRemaining > 0) {
-        LOG(ERROR) << "file read error for " << assetFile << ", " << bytesRemaining << " bytes left unread.";
+uint64_t HttpClient::postFileAssetSinglePass(Asset& asset, MappedFile& file, const fs::path& assetFile,
+        const ChunkLayout& layout, size_t upstream) {
+    // The chunks are staged on the server under a random upload id while we hash them, as the Asset key is the hash of
+    // the whole file, so isn't known until the last chunk is read. If an earlier add of this same file failed, reuse
+    // its upload id and upstream so the server can tell us which chunks it already has.
+    std::error_code error;
+    auto modified = fs::last_write_time(assetFile, error).time_since_epoch().count();
+    std::string fileId = assetFile.string() + ":" + std::to_string(layout.size()) + ":" + std::to_string(modified);
+    uint64_t uploadId = 0;
+    bool resuming = false;
+    {
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        auto interrupted = m_interruptedUploads.find(fileId);
+        if (interrupted != m_interruptedUploads.end()) {
+            uploadId = interrupted->second.first;
+            upstream = interrupted->second.second;
+            m_interruptedUploads.erase(interrupted);
+            resuming = true;
+        } else {
+            uploadId = m_distribution(m_randomDevice);
+        }
+    }
+    std::string uploadString = Asset::keyToString(uploadId);
+    LOG(INFO) << "staging chunks of asset file " << assetFile << " under upload " << uploadString;
+
+    uint64_t chunks = layout.chunks();
+    uint64_t key = 0;
+    bool ok = false;
+    for (int resume = 0; !ok && resume <= kMaxUploadResumes; ++resume) {
+        if (!resuming) {
+            ok = postFileChunks(file, assetFile, layout, uploadId, true, nullptr, upstream, key);
+            resuming = true;
+            continue;
+        }
+        if (resume > 0) {
+            std::this_thread::sleep_for(kUploadResumeDelay * resume);
+        }
+        ChunkRanges missing;
+        if (!getMissingUploadChunks(uploadId, chunks, upstream, missing)) {
+            continue;
+        }
+        uint64_t missingChunks = 0;
+        for (const auto& range : missing) {
+            missingChunks += range.second - range.first;
+        }
+        LOG(WARNING) << "resuming upload " << uploadString << " of asset file " << assetFile << ", resending "
+            << missingChunks << " of " << chunks << " chunks.";
+        ok = postFileChunks(file, assetFile, layout, uploadId, true, &missing, upstream, key);
+    }
+    if (!ok) {
+        LOG(ERROR) << "error uploading file " << assetFile << " to server, keeping upload " << uploadString
+            << " to resume.";
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        m_interruptedUploads[fileId] = std::make_pair(uploadId, upstream);
         return 0;
     }
 
+    // The server checks the staged chunks hash to the key before moving them, and the Asset, into place.
     std::string keyString = Asset::keyToString(key);
-    LOG(INFO) << "computed key " << keyString << " for asset file " << assetFile;
-
-    Asset asset(type);
+    LOG(INFO) << "computed key " << keyString << " for asset file " << assetFile << ", committing upload "
+        << uploadString;
     asset.setKey(key);
-    asset.setName(name);
-    asset.setFileExtension(assetFile.extension());
-    asset.setAuthor(author);
-    asset.setDeprecates(deprecates);
-    asset.setSize(fileSize);
-    asset.setChunks((fileSize / kDataChunkSize) + 1);
-    asset.parseListIds(listIds);
+    if (postFlatAsset("/asset/commit/" + uploadString, asset, upstream) != kPosted) {
+        LOG(ERROR) << "error committing upload " << uploadString << " of file asset " << assetFile << " with key "
+            << keyString;
+        return 0;
+    }
+    return key;
+}
+
+HttpClient::PostResult HttpClient::postAsset(const SizedPointer& flatAsset, size_t upstream) {
+    const Data::FlatAsset* asset = Data::GetFlatAsset(flatAsset.data());
+    return postFlatAsset("/asset/id/" + Asset::keyToString(asset->key()), flatAsset, upstream);
+}
+
+size_t HttpClient::uploadUpstream() {
+    std::lock_guard<std::mutex> lock(m_windowMutex);
+    return m_upstreams.best(UpstreamSet::kBulk, std::chrono::steady_clock::now());
+}
+
+HttpClient::PostResult HttpClient::postFlatAsset(const std::string& request, Asset& asset, size_t upstream) {
     flatbuffers::FlatBufferBuilder builder(kPageSize);
     asset.flatten(builder);
+    return postFlatAsset(request, SizedPointer(builder.GetBufferPointer(), builder.GetSize()), upstream);
+}
 
-    char base64[kPageSize];
-    size_t encodedSize = 0;
-    base64_encode(reinterpret_cast<char*>(builder.GetBufferPointer()), builder.GetSize(), base64, &encodedSize, 0);
-    CHECK_LT(encodedSize, kPageSize) << "encoded file asset record larger than page.";
-    LOG(INFO) << "sending POST of file asset " << keyString << ", " << encodedSize << " bytes.";
+HttpClient::PostResult HttpClient::postFlatAsset(const std::string& request, const SizedPointer& flatAsset,
+        size_t upstream) {
+    std::string base64 = encodeBase64(flatAsset);
+    LOG(INFO) << "sending POST of asset to " << request << ", " << base64.size() << " bytes.";
+
+    PostResult result = kFailed;
+    wait([this, &base64, &request, &result, upstream](std::function<void()> done) {
+        submit(kPost, UpstreamSet::kMetadata, RequestScheduler::kBulk, request, std::move(base64),
+                [&request, &result, done](const Pistache::Http::Response* response) {
+            result = postResult(response);
+            if (result == kPosted) {
+                LOG(INFO) << "received ok response on asset post " << request;
+            } else if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on Asset post " << request;
+            }
+            done();
+        }, upstream);
+    });
+    return result;
+}
 
-    std::string request = m_serverAddress + "/asset/id/" + keyString;
+bool HttpClient::postFileChunks(MappedFile& file, const fs::path& assetFile, const ChunkLayout& layout, uint64_t id,
+        bool staged, const ChunkRanges* send, size_t upstream, uint64_t& chunkHash) {
+    // Keeps up to m_uploadWindow chunk POSTs in flight. Each chunk is copied once, from the mapped file straight into
+    // its FlatAssetData, and hashed from that copy so the hash always covers the bytes sent. The read of the next chunk
+    // is started ahead of time while the current one is hashed and sent. Chunks outside of the ranges to send are
+    // still hashed, as each chunk carries the hash of the file up to its end.
+    auto uploads = std::make_shared<ChunkUploads>();
+    uploads->staged = staged;
+    uploads->upstream = upstream;
+    XXH64_state_t* hashState = XXH64_createState();
+    XXH64_reset(hashState, 0);
+    uint64_t chunks = layout.chunks();
+    chunkHash = 0;
     bool ok = true;
-    auto promise = m_client->post(request)
-        .body(std::string(base64, encodedSize))
-        .send();
-    promise.then([&request, &ok](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "received ok response on file asset post " << request;
-        } else {
-            LOG(ERROR) << "error code " << response.code() << " on file Asset post " << request;
+    uint64_t sent = 0;
+    auto range = send ? send->begin() : ChunkRanges::const_iterator();
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (uint64_t chunk = 0; ok && chunk < chunks; ++chunk) {
+        size_t offset = layout.offset(chunk);
+        size_t flatDataSize = layout.chunkSize(chunk);
+        SizedPointer chunkData = file.read(offset, flatDataSize);
+        if (!chunkData.data()) {
+            LOG(ERROR) << "error reading asset file " << assetFile << " expected " << flatDataSize
+                << " bytes at offset " << offset;
             ok = false;
+            break;
         }
-    }, Pistache::Async::NoExcept);
+        file.prefetch(offset + flatDataSize, layout.maxChunkSize());
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+        flatbuffers::FlatBufferBuilder builder(flatDataSize + kPageSize);
+        uint8_t* flatData = nullptr;
+        auto flatAssetData = builder.CreateUninitializedVector(flatDataSize, &flatData);
+        std::memcpy(flatData, chunkData.data(), flatDataSize);
+        XXH64_update(hashState, flatData, flatDataSize);
+        chunkHash = XXH64_digest(hashState);
+        Data::FlatAssetDataBuilder assetDataBuilder(builder);
+        assetDataBuilder.add_data(flatAssetData);
+        assetDataBuilder.add_hash(chunkHash);
+        auto assetData = assetDataBuilder.Finish();
+        builder.Finish(assetData);
+
+        if (send) {
+            while (range != send->end() && range->second <= chunk) {
+                ++range;
+            }
+            if (range == send->end() || range->first > chunk) {
+                continue;
+            }
+        }
+        ++sent;
+
+        // Wait for room in the window, resending any failed chunks meanwhile, then send this chunk.
+        ok = awaitChunkUploads(uploads, id, m_uploadWindow);
+        if (ok) {
+            {
+                std::lock_guard<std::mutex> lock(uploads->mutex);
+                uploads->pending[chunk].data = builder.Release();
+            }
+            postChunk(uploads, id, chunk);
+        }
+    }
 
+    // Wait for every chunk to be accepted.
+    ok = ok && awaitChunkUploads(uploads, id, 1);
+    XXH64_freeState(hashState);
     if (!ok) {
-        LOG(INFO) << "error posting new file asset " << assetFile << " with key " << keyString;
-        return 0;
+        return false;
     }
 
-    // Now we upload the individual data chunks of the file. We will be reading the bytes directly into the
-    // FlatBufferBuilder object, to skip a copy.
-    hashState = XXH64_createState();
-    XXH64_reset(hashState, 0);
-    inFile.clear();
-    inFile.seekg(0, std::ios::beg);
-    bytesRemaining = fileSize;
-    size_t chunk = 0;
-    uint64_t chunkHash = 0;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    LOG(INFO) << "uploaded " << layout.size() << " bytes, sending " << sent << " of " << chunks << " chunks, in "
+        << seconds << " s, " << (seconds > 0 ? layout.size() / seconds / (1024.0 * 1024.0) : 0.0) << " MB/s, "
+        << uploads->retries << " chunk retries.";
+    return true;
+}
 
-    while (ok && inFile && bytesRemaining > 0) {
-        builder.Clear();
-        uint8_t* flatData = nullptr;
-        size_t flatDataSize = std::min(kDataChunkSize, bytesRemaining);
-        auto flatAssetData = builder.CreateUninitializedVector(flatDataSize, &flatData);
-        inFile.read(reinterpret_cast<char*>(flatData), flatDataSize);
-        bytesRead = inFile.gcount();
-        bytesRemaining -= bytesRead;
-        if (bytesRead != flatDataSize) {
-            LOG(ERROR) << "error re-reading asset file " << assetFile << " expected " << flatDataSize << " bytes, got "
-                << bytesRead << " bytes instead.";
-            ok = false;
-        } else {
-            Data::FlatAssetDataBuilder assetDataBuilder(builder);
-            assetDataBuilder.add_data(flatAssetData);
-            XXH64_update(hashState, flatData, bytesRead);
-            chunkHash = XXH64_digest(hashState);
-            assetDataBuilder.add_hash(chunkHash);
-            auto assetData = assetDataBuilder.Finish();
-            builder.Finish(assetData);
-
-            base64_encode(reinterpret_cast<char*>(builder.GetBufferPointer()), builder.GetSize(), base64, &encodedSize,
-                0);
-            CHECK_LT(encodedSize, kPageSize) << "stack overrun on encode!";
-
-            LOG(INFO) << "sending POST of asset data for " << keyString << " chunk " << chunk << ", " << encodedSize
-                << " bytes.";
-            char numBuf[32];
-            snprintf(numBuf, 32, "%" PRIu64, chunk);
-            request = m_serverAddress + "/asset/data/" + keyString + "/" + std::string(numBuf);
-            promise = m_client->post(request)
-                .body(std::string(base64, encodedSize))
-                .send();
-            promise.then([&request, &ok](Pistache::Http::Response response) {
-                if (response.code() == Pistache::Http::Code::Ok) {
-                    LOG(INFO) << "recived ok response on file asset chunk post " << request;
+bool HttpClient::getMissingUploadChunks(uint64_t uploadId, uint64_t chunks, size_t upstream, ChunkRanges& missing) {
+    std::string request = "/asset/upload/" + Asset::keyToString(uploadId) + "/" + std::to_string(chunks);
+    LOG(INFO) << "issuing upload status request to " << request;
+    bool ok = false;
+    missing.clear();
+    wait([this, &request, &missing, &ok, upstream](std::function<void()> done) {
+        submit(kGet, UpstreamSet::kMetadata, RequestScheduler::kBulk, request, "", [&request, &missing, &ok, done](
+                const Pistache::Http::Response* response) {
+            if (response && response->code() == Pistache::Http::Code::Ok) {
+                BufferRef buffer = decodeBody(response->body());
+                const std::vector<uint8_t>& decoded = buffer->bytes();
+                auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+                if (Data::VerifyFlatUploadStatusBuffer(verifier)) {
+                    const Data::FlatUploadStatus* status = Data::GetFlatUploadStatus(decoded.data());
+                    if (!status->known()) {
+                        LOG(WARNING) << "server has no session for upload, resending every chunk.";
+                    }
+                    if (status->missing()) {
+                        for (const Data::ChunkRange* range : *status->missing()) {
+                            missing.emplace_back(range->start(), range->end());
+                        }
+                    }
+                    ok = true;
                 } else {
-                    LOG(ERROR) << "error code " << response.code() << " on file asset chunk post " << request;
-                    ok = false;
+                    LOG(ERROR) << "failed to verify server-provided data for upload status request " << request;
                 }
-            }, Pistache::Async::NoExcept);
+            } else if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on upload status request " << request;
+            }
+            done();
+        }, upstream);
+    });
+    return ok;
+}
 
-            Pistache::Async::Barrier chunkBarrier(promise);
-            chunkBarrier.wait();
-            ++chunk;
-        }
+size_t HttpClient::dataChunkSize() {
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    if (m_dataChunkSize) {
+        return m_dataChunkSize;
     }
 
-    XXH64_freeState(hashState);
-
-    // Digest hash of final chunk should match the overall hash of the file.
-    if (!ok || bytesRemaining > 0 || chunkHash != key) {
-        LOG(ERROR) << "error uploading file " << assetFile << " to server.";
-        return 0;
+    std::string request = "/config";
+    LOG(INFO) << "issuing config request to " << request;
+    size_t dataChunkSize = 0;
+    wait([this, &request, &dataChunkSize](std::function<void()> done) {
+        submit(kGet, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, "",
+                [&request, &dataChunkSize, done](const Pistache::Http::Response* response) {
+            if (response && response->code() == Pistache::Http::Code::Ok) {
+                BufferRef buffer = decodeBody(response->body());
+                const std::vector<uint8_t>& decoded = buffer->bytes();
+                auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+                if (Data::VerifyFlatConfigBuffer(verifier)) {
+                    dataChunkSize = Data::GetFlatConfig(decoded.data())->dataChunkSize();
+                } else {
+                    LOG(ERROR) << "failed to verify server-provided data for config request " << request;
+                }
+            } else if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on config request " << request;
+            }
+            done();
+        });
+    });
+
+    if (dataChunkSize == 0 || dataChunkSize > kMaxDataChunkSize) {
+        // Older servers don't advertise a chunk size, so fall back to the original fixed size, but don't cache it so
+        // we ask again next time.
+        LOG(WARNING) << "server did not provide a valid data chunk size, using " << kDataChunkSize;
+        return kDataChunkSize;
     }
 
-    LOG(INFO) << "completed successful upload of file Asset " << keyString << " from " << assetFile;
-    return key;
+    LOG(INFO) << "server data chunk size is " << dataChunkSize << " bytes.";
+    m_dataChunkSize = dataChunkSize;
+    return m_dataChunkSize;
 }
 
-// TODO: could probably flatten this, assetData, and asset requests into a single generic call.
 void HttpClient::getList(uint64_t key, std::function<void(RecordPtr)> callback) {
-    std::string request = m_serverAddress + "/list/id/" + Asset::keyToString(key);
-    LOG(INFO) << "issuing list request to " << request;
+    wait([this, key, &callback](std::function<void()> done) {
+        getListAsync(key, [&callback, done](RecordPtr list) {
+            callback(list);
+            done();
+        });
+    });
+}
 
-    auto promise = m_client->get(request).send();
-    promise.then([&key, &callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "received Ok response for list request " << request;
-            uint8_t decoded[kPageSize];
-            size_t decodedSize;
-            base64_decode(response.body().c_str(), response.body().size(), reinterpret_cast<char*>(decoded),
-                &decodedSize, 0);
-            // Verify the Asset record as returned by the server.
-            RecordPtr flatList(new ClientRecord(decoded, decodedSize));
-            auto verifier = flatbuffers::Verifier(decoded, decodedSize);
-            if (Data::VerifyFlatListBuffer(verifier)) {
-                callback(flatList);
+void HttpClient::getNamedList(const std::string& name, std::function<void(RecordPtr)> callback) {
+    std::string request = "/list/name";
+    LOG(INFO) << "issuing named list for '" << name << "' request to " << request;
+
+    wait([this, &name, &callback, &request](std::function<void()> done) {
+        submit(kGet, UpstreamSet::kMetadata, RequestScheduler::kInteractive, request, name,
+                [&name, &callback, &request, done](const Pistache::Http::Response* response) {
+            if (response && response->code() == Pistache::Http::Code::Ok) {
+                LOG(INFO) << "recevied Ok response for named Asset request for '" << name << "'.";
+                BufferRef buffer = decodeBody(response->body());
+                const std::vector<uint8_t>& decoded = buffer->bytes();
+                RecordPtr flatList = std::make_shared<PooledRecord>(buffer);
+                auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+                if (Data::VerifyFlatListBuffer(verifier)) {
+                    callback(flatList);
+                } else {
+                    LOG(ERROR) << "failed to verify named list for request " << request;
+                    callback(makeEmptyRecord());
+                }
             } else {
-                LOG(ERROR) << "failed to verify server-provided data for list request " << request;
+                if (response) {
+                    LOG(ERROR) << "error code " << response->code() << " on named list request " << request;
+                }
                 callback(makeEmptyRecord());
             }
-        } else {
-            LOG(ERROR) << "error code " << response.code() << " on list request " << request;
-            callback(makeEmptyRecord());
-        }
-    }, Pistache::Async::NoExcept);
+            done();
+        });
+    });
+}
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+void HttpClient::getListItems(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback) {
+    wait([this, key, token, &callback](std::function<void()> done) {
+        getListItemsAsync(key, token, [&callback, done](RecordPtr page) {
+            callback(page);
+            done();
+        });
+    });
 }
 
-void HttpClient::getNamedList(const std::string& name, std::function<void(RecordPtr)> callback) {
-    std::string request = m_serverAddress + "/list/name";
-    LOG(INFO) << "issuing named list for '" << name << "' request to " << request;
+void HttpClient::watchListItems(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback) {
+    wait([this, key, token, &callback](std::function<void()> done) {
+        watchListItemsAsync(key, token, [&callback, done](RecordPtr page) {
+            callback(page);
+            done();
+        });
+    });
+}
 
-    auto promise = m_client->get(request).body(name).send();
-    promise.then([&name, &callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "recevied Ok response for named Asset request for '" << name << "'.";
-            uint8_t decoded[kPageSize];
-            size_t decodedSize;
-            base64_decode(response.body().c_str(), response.body().size(), reinterpret_cast<char*>(decoded),
-                &decodedSize, 0);
-            RecordPtr flatList(new ClientRecord(decoded, decodedSize));
-            auto verifier = flatbuffers::Verifier(decoded, decodedSize);
-            if (Data::VerifyFlatListBuffer(verifier)) {
-                callback(flatList);
+uint64_t HttpClient::postList(const std::string& name) {
+    uint64_t key = 0;
+    wait([this, &name, &key](std::function<void()> done) {
+        postListAsync(name, [&key, done](uint64_t posted) {
+            key = posted;
+            done();
+        });
+    });
+    return key;
+}
+
+void HttpClient::postChunk(std::shared_ptr<ChunkUploads> uploads, uint64_t id, uint64_t chunk) {
+    SizedPointer flatAssetData;
+    {
+        std::lock_guard<std::mutex> lock(uploads->mutex);
+        // Only this thread adds or sends chunks, and a chunk isn't erased while in flight, so the data stays put.
+        auto& pending = uploads->pending[chunk];
+        ++pending.attempts;
+        ++uploads->inFlight;
+        flatAssetData = SizedPointer(pending.data.data(), pending.data.size());
+    }
+    auto callback = [uploads, chunk](bool posted) {
+        {
+            std::lock_guard<std::mutex> lock(uploads->mutex);
+            --uploads->inFlight;
+            if (posted) {
+                uploads->pending.erase(chunk);
             } else {
-                LOG(ERROR) << "failed to verify named list for request " << request;
-                callback(makeEmptyRecord());
+                uploads->failed.push_back(chunk);
             }
-        } else {
-            LOG(ERROR) << "error code " << response.code() << " on named list request " << request;
-            callback(makeEmptyRecord());
         }
-    }, Pistache::Async::NoExcept);
-
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+        uploads->changed.notify_all();
+    };
+    if (uploads->staged) {
+        postUploadDataAsync(id, chunk, flatAssetData, callback, uploads->upstream);
+    } else {
+        postAssetDataAsync(id, chunk, flatAssetData, [callback](PostResult result) {
+            callback(result == kPosted);
+        }, uploads->upstream);
+    }
 }
 
-void HttpClient::getListItems(uint64_t key, uint64_t token, std::function<void(const std::string&)> callback) {
-    std::string request = m_serverAddress + "/list/items/" + Asset::keyToString(key) + "/" + Asset::keyToString(token);
-    LOG(INFO) << "issuing list items request to " << request;
-
-    auto promise = m_client->get(request).send();
-    promise.then([&callback, &request](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "received Ok response for list items request " << request;
-            callback(response.body());
-        } else {
-            LOG(ERROR) << "error code " << response.code() << " on list items request " << request;
-            callback("");
+bool HttpClient::awaitChunkUploads(std::shared_ptr<ChunkUploads> uploads, uint64_t id, size_t maxInFlight) {
+    while (true) {
+        uint64_t chunk = 0;
+        int attempts = 0;
+        {
+            std::unique_lock<std::mutex> lock(uploads->mutex);
+            uploads->changed.wait(lock, [&uploads, maxInFlight] {
+                return !uploads->failed.empty() || uploads->inFlight < maxInFlight;
+            });
+            if (uploads->failed.empty()) {
+                return true;
+            }
+            chunk = uploads->failed.front();
+            uploads->failed.pop_front();
+            attempts = uploads->pending[chunk].attempts;
+            if (attempts >= kMaxChunkAttempts) {
+                LOG(ERROR) << "giving up on " << (uploads->staged ? "upload " : "Asset ") << Asset::keyToString(id)
+                    << " chunk " << chunk << " after " << attempts << " attempts.";
+                return false;
+            }
+            ++uploads->retries;
         }
-    }, Pistache::Async::NoExcept);
+        // Back off before resending, as a common cause of failure is the server shedding load.
+        LOG(WARNING) << "retrying POST of " << (uploads->staged ? "upload " : "Asset ") << Asset::keyToString(id)
+            << " chunk " << chunk << ", attempt " << attempts + 1;
+        std::this_thread::sleep_for(kChunkRetryDelay * attempts);
+        postChunk(uploads, id, chunk);
+    }
+}
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+void HttpClient::shutdown() {
+    stopRetries();
+    m_client->shutdown();
+    for (const auto& upstream : upstreamStatus()) {
+        LOG(INFO) << "upstream " << upstream.address << (upstream.healthy ? "" : " (unhealthy)") << ": "
+            << upstream.requests << " requests, " << upstream.failures << " failed, " << upstream.rejections
+            << " turned away, metadata latency " << upstream.latency[UpstreamSet::kMetadata] << " us, bulk latency "
+            << upstream.latency[UpstreamSet::kBulk] << " us, in-flight limit " << upstream.limit;
+    }
 }
 
-uint64_t HttpClient::postList(const std::string& name) {
-    // Generate random key.
-    uint64_t key = m_distribution(m_randomDevice);
-    flatbuffers::FlatBufferBuilder builder(kPageSize);
-    auto listName = builder.CreateString(name);
-    Data::FlatListBuilder listBuilder(builder);
-    listBuilder.add_key(key);
-    listBuilder.add_name(listName);
-    auto list = listBuilder.Finish();
-    builder.Finish(list);
+void HttpClient::submit(Method method, UpstreamSet::RequestClass requestClass, RequestScheduler::Priority priority,
+        const std::string& path, std::string body, ResponseHandler handler, size_t upstream) {
+    auto request = std::make_shared<Request>();
+    request->method = method;
+    request->requestClass = requestClass;
+    request->priority = priority;
+    request->path = path;
+    request->body = std::move(body);
+    request->handler = std::move(handler);
+    request->upstream = upstream;
+    request->tried = 0;
+    request->rejections = 0;
+    request->issued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        m_pending[priority].push_back(std::move(request));
+    }
+    sendPending();
+}
 
-    std::string request = m_serverAddress + "/list/id/" + Asset::keyToString(key);
-    LOG(INFO) << "sending POST for new list " << request << ", " << builder.GetSize() << " bytes";
+void HttpClient::sendPending() {
+    std::vector<std::pair<std::shared_ptr<Request>, size_t>> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        auto now = std::chrono::steady_clock::now();
+        // Upstreams that a waiting request of higher priority could use, which lower priorities must leave for it.
+        uint64_t reserved = 0;
+        // Priorities go highest first, so a request that arrives during a bulk transfer goes out ahead of its
+        // remaining chunks. Within a priority requests go out in order, except that one waiting on a busy upstream
+        // doesn't hold up those that can go to another.
+        for (size_t i = 0; i < RequestScheduler::kNumPriorities; ++i) {
+            auto priority = static_cast<RequestScheduler::Priority>(i);
+            auto& pending = m_pending[priority];
+            uint64_t waiting = 0;
+            for (auto it = pending.begin(); it != pending.end() && m_scheduler.canStart(priority);) {
+                const Request& request = **it;
+                uint64_t excluded = request.upstream == UpstreamSet::kNone ? request.tried :
+                    m_upstreams.all() & ~(1ull << request.upstream);
+                size_t upstream = m_upstreams.select(request.requestClass, excluded | reserved, now,
+                    RequestScheduler::headroom(priority));
+                if (upstream == UpstreamSet::kNone) {
+                    waiting |= m_upstreams.all() & ~excluded;
+                    ++it;
+                    continue;
+                }
+                m_upstreams.start(upstream);
+                m_scheduler.start(priority);
+                m_queueLatency[priority]->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - request.issued).count());
+                ready.emplace_back(std::move(*it), upstream);
+                it = pending.erase(it);
+            }
+            reserved |= waiting;
+        }
+    }
+    for (auto& request : ready) {
+        send(std::move(request.first), request.second);
+    }
+}
 
-    char base64[kPageSize];
-    size_t encodedSize = 0;
-    base64_encode(reinterpret_cast<const char*>(builder.GetBufferPointer()), builder.GetSize(), base64, &encodedSize,
-        0);
-    CHECK_LT(encodedSize, kPageSize) << "encoded list larger than page size";
+void HttpClient::send(std::shared_ptr<Request> request, size_t upstream) {
+    std::string url = m_upstreams.address(upstream) + request->path;
+    auto builder = request->method == kPost ? m_client->post(url) : m_client->get(url);
+    if (request->method == kPost) {
+        builder.header<Pistache::Http::Header::ContentType>(MIME(Text, Plain));
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto promise = builder.body(request->body).send();
+    promise.then([this, request, upstream, start](Pistache::Http::Response response) {
+        complete(request, upstream, start, &response);
+    }, [this, request, upstream, start, url](std::exception_ptr) {
+        LOG(ERROR) << "no response to request " << url;
+        complete(request, upstream, start, nullptr);
+    });
+}
 
-    bool ok = true;
-    auto promise = m_client->post(request)
-        .header<Pistache::Http::Header::ContentType>(MIME(Text, Plain))
-        .header<Pistache::Http::Header::ContentLength>(encodedSize)
-        .body(std::string(base64, encodedSize))
-        .send();
-    promise.then([&request, &ok](Pistache::Http::Response response) {
-        if (response.code() == Pistache::Http::Code::Ok) {
-            LOG(INFO) << "received ok response for list post " << request;
+void HttpClient::complete(std::shared_ptr<Request> request, size_t upstream,
+        std::chrono::steady_clock::time_point start, const Pistache::Http::Response* response) {
+    auto now = std::chrono::steady_clock::now();
+    // An upstream over capacity turns requests away with how long to wait. That's back-pressure, not a failure, so
+    // the upstream just takes no more requests until then, and the request is queued again, without counting as
+    // tried, to go to whichever upstream can take it first.
+    bool overloaded = response && response->code() == Pistache::Http::Code::Service_Unavailable;
+    std::chrono::seconds wait = overloaded ? retryAfter(*response) : std::chrono::seconds(0);
+    // Other server errors count against the upstream's health. A mirror may not have an Asset or List yet, so reads
+    // that aren't found are also worth trying elsewhere.
+    bool ok = response && static_cast<int>(response->code()) < 500;
+    bool retry = !ok || (request->method == kGet && response->code() == Pistache::Http::Code::Not_Found);
+    bool deferred = false;
+    bool failover = false;
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        if (overloaded) {
+            m_upstreams.reject(upstream, now + wait);
+            if (request->rejections < kMaxRejections) {
+                ++request->rejections;
+                deferred = true;
+                m_retryTimes.push(now + wait);
+                m_pending[request->priority].push_front(request);
+            }
         } else {
-            LOG(ERROR) << "error code " << response.code() << " on list post " << request;
-            ok = false;
+            m_upstreams.finish(upstream, request->requestClass, ok,
+                std::chrono::duration_cast<std::chrono::microseconds>(now - start), now);
+        }
+        if (!deferred) {
+            request->tried |= 1ull << upstream;
+            if (retry && request->upstream == UpstreamSet::kNone && (request->tried & m_upstreams.all()) !=
+                    m_upstreams.all()) {
+                failover = true;
+                m_pending[request->priority].push_front(request);
+            }
+        }
+    }
+    if (deferred) {
+        m_retryChanged.notify_one();
+        LOG(WARNING) << m_upstreams.address(upstream) << " is over capacity, resending request " << request->path
+            << " after " << wait.count() << " s";
+    } else if (failover) {
+        LOG(WARNING) << "retrying request " << request->path << " on another upstream after "
+            << (response ? "error code " + std::to_string(static_cast<int>(response->code())) : "no response")
+            << " from " << m_upstreams.address(upstream);
+    } else {
+        request->handler(response);
+    }
+    finish(request->priority);
+}
+
+void HttpClient::finish(RequestScheduler::Priority priority) {
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        m_scheduler.finish(priority);
+        if (m_scheduler.inFlight() == 0 && pendingEmpty()) {
+            m_idle.notify_all();
+        }
+    }
+    sendPending();
+}
+
+void HttpClient::retryLoop() {
+    std::unique_lock<std::mutex> lock(m_windowMutex);
+    while (m_retrying) {
+        if (m_retryTimes.empty()) {
+            m_retryChanged.wait(lock);
+            continue;
         }
-    }, Pistache::Async::NoExcept);
+        auto now = std::chrono::steady_clock::now();
+        if (m_retryTimes.top() > now) {
+            m_retryChanged.wait_until(lock, m_retryTimes.top());
+            continue;
+        }
+        while (!m_retryTimes.empty() && m_retryTimes.top() <= now) {
+            m_retryTimes.pop();
+        }
+        lock.unlock();
+        sendPending();
+        lock.lock();
+    }
+}
 
-    Pistache::Async::Barrier barrier(promise);
-    barrier.wait();
+void HttpClient::stopRetries() {
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        m_retrying = false;
+    }
+    m_retryChanged.notify_all();
+    if (m_retryThread.joinable()) {
+        m_retryThread.join();
+    }
+}
 
-    return ok ? key : 0;
+bool HttpClient::pendingEmpty() const {
+    for (const auto& pending : m_pending) {
+        if (!pending.empty()) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void HttpClient::shutdown() {
-    m_client->shutdown();
+// static
+void HttpClient::wait(std::function<void(std::function<void()> done)> request) {
+    // The promise is shared with the done function, so it outlives any call to done() still returning on another
+    // thread after this one wakes.
+    auto finished = std::make_shared<std::promise<void>>();
+    std::future<void> future = finished->get_future();
+    request([finished] { finished->set_value(); });
+    future.wait();
 }
 
-}  // namespace Confab
+void HttpClient::requestListPageAsync(UpstreamSet::RequestClass requestClass, RequestScheduler::Priority priority,
+        const std::string& request, std::function<void(RecordPtr)> callback) {
+    submit(kGet, requestClass, priority, request, "", [callback, request](const Pistache::Http::Response* response) {
+        if (response && response->code() == Pistache::Http::Code::Ok) {
+            LOG(INFO) << "received Ok response for list page request " << request;
+            BufferRef buffer = decodeBody(response->body());
+            const std::vector<uint8_t>& decoded = buffer->bytes();
+            auto verifier = flatbuffers::Verifier(decoded.data(), decoded.size());
+            if (Data::VerifyFlatListPageBuffer(verifier)) {
+                callback(std::make_shared<PooledRecord>(buffer));
+            } else {
+                LOG(ERROR) << "failed to verify list page for request " << request;
+                callback(makeEmptyRecord());
+            }
+        } else {
+            if (response) {
+                LOG(ERROR) << "error code " << response->code() << " on list page request " << request;
+            }
+            callback(makeEmptyRecord());
+        }
+    });
+}
 
+}  // namespace Confab
@@ -2,51 +2,247 @@
 #define SRC_CONFAB_HTTP_CLIENT_HPP_
 
 #include "Asset.hpp"
+#include "MappedFile.hpp"
 #include "Record.hpp"
+#include "RequestScheduler.hpp"
+#include "UpstreamSet.hpp"
 
+#include "flatbuffers/flatbuffers.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <experimental/filesystem>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace fs = std::experimental::filesystem;
 
 namespace Pistache {
 namespace Http {
 class Client;
+class Response;
 }   // namespace Http
 }   // namespace Pistache
 
 namespace Confab {
 
+class ChunkLayout;
+class Histogram;
+
 /*! Class responsible for communication with upstream confab instances.
+ *
+ * The methods ending in Async return as soon as the request is queued, and call their callback later on an HTTP client
+ * thread. At most maxInFlight requests are sent to the servers at once, any more wait in a queue until an earlier
+ * request completes. The blocking methods are wrappers that wait for the equivalent asynchronous call to complete, so
+ * must not be called from within an asynchronous callback.
+ *
+ * Every request has a RequestScheduler priority: interactive for lookups someone is waiting on, prefetch for requests
+ * made ahead of need, such as List watches, and bulk for AssetData transfers and uploads. Queued requests are sent
+ * highest priority first, part of the in-flight window is reserved for the higher priorities, and interactive requests
+ * may go a little over an upstream's limit, so lookups stay fast while large files sync. Bulk transfers yield to other
+ * requests at chunk boundaries, as each chunk is a separate request.
+ *
+ * The client can talk to several upstream servers that mirror the same Assets and Lists. Each request goes to the
+ * upstream an UpstreamSet picks for it, by latency, error rate, and load. A request that gets no response or a server
+ * error, or a read that isn't found, is retried on each other upstream in turn before failing. The requests of a file
+ * upload all go to the same upstream. A server over capacity answers 503 Service Unavailable with a Retry-After time,
+ * which is treated as back-pressure rather than an error: the request is queued again, to go to any upstream not
+ * also waiting, and doesn't count against the upstream's health or in-flight limit.
  */
 class HttpClient {
 public:
+    /*! The default number of requests to have in flight to the server at once. */
+    static constexpr size_t kDefaultMaxInFlight = 16;
+
+    /*! The default number of chunk POSTs of each file upload to have in flight at once, matching the server's default
+     * per-peer limit on AssetData requests. */
+    static constexpr size_t kDefaultUploadWindow = 8;
+
+    /*! The number of requests each upstream can have in flight at first. */
+    static constexpr size_t kInitialUpstreamLimit = 4;
+
+    /*! The most requests, and so connections, each upstream can have in flight once its limit has adapted. */
+    static constexpr size_t kMaxUpstreamLimit = 16;
+
+    /*! The outcome of POSTing an Asset or AssetData chunk.
+     */
+    enum PostResult {
+        kPosted,   //!< The server accepted the post.
+        kFailed,   //!< The post failed in a way a retry may fix, such as an unreachable or overloaded server.
+        kRejected  //!< The server refused the post as invalid with a 4xx status, so would refuse it again.
+    };
+
     /*! Construct a new HttpClient for use in upstream communication.
      *
-     * \param serverAddress The address part of the URLs that the client will construct, such as
-     *                      "http://sclork-s01.local:9080".
+     * \param serverAddresses The address part of the URLs that the client will construct, such as
+     *                        "http://sclork-s01.local:9080", or a comma-separated list of them for several upstream
+     *                        servers, in order of preference.
+     * \param maxInFlight The maximum number of requests to have in flight to all servers at once.
+     * \param uploadWindow The maximum number of AssetData chunk POSTs of each file upload to have in flight at once.
+     * \param singlePassUpload If true, postFileAsset() reads each file once, staging its chunks on the server until
+     *                         the key is known. Set false for servers that predate upload staging.
+     * \param contentDefinedChunks If true, postFileAsset() splits files into chunks at boundaries found by a
+     *                             ContentChunker, so an edited file shares most of its chunks with the original.
+     *                             Finding the boundaries takes an extra read of the file. Files splitting into
+     *                             more than kMaxChunkOffsets chunks are sent with fixed size chunks.
      */
-    HttpClient(const std::string& serverAddress);
+    HttpClient(const std::string& serverAddresses, size_t maxInFlight = kDefaultMaxInFlight,
+            size_t uploadWindow = kDefaultUploadWindow, bool singlePassUpload = true,
+            bool contentDefinedChunks = false);
 
     /*! Destructs an HttpClient.
      */
-    ~HttpClient();
+    virtual ~HttpClient();
+
+    /*! Requests an asset metadata entry from the server without blocking.
+     *
+     * \param key The asset key associated with this asset.
+     * \param callback Called on an HTTP client thread when the request completes, with the key of the requested asset
+     *                 along with a Record holding the FlatAsset, which owns its data so may be kept after the
+     *                 callback, or an empty Record on error.
+     * \param priority The priority of the request, interactive unless made ahead of need.
+     */
+    void getAssetAsync(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback,
+            RequestScheduler::Priority priority = RequestScheduler::kInteractive);
+
+    /*! Retrieves an asset data chunk from the server without blocking.
+     *
+     * \param key The asset key associated with these AssetData records.
+     * \param chunk The chunk number to download.
+     * \param callback Called on an HTTP client thread when the request completes, with the key of the asset, the chunk
+     *                 number, and a Record holding the FlatAssetData, which may be kept after the callback, or an
+     *                 empty Record on error.
+     * \param priority The priority of the request, bulk unless someone is waiting on this chunk alone.
+     *
+     * Virtual so that tests can delay, reorder, or alter the responses CacheManager sees.
+     */
+    virtual void getAssetDataAsync(uint64_t key, uint64_t chunk,
+            std::function<void(uint64_t, uint64_t, RecordPtr)> callback,
+            RequestScheduler::Priority priority = RequestScheduler::kBulk);
+
+    /*! Requests a list metadata entry from the server without blocking.
+     *
+     * \param key The key of the list to retrieve.
+     * \param callback Called on an HTTP client thread with a Record holding the FlatList structure, which may be kept
+     *                 after the callback, or an empty Record on error.
+     */
+    void getListAsync(uint64_t key, std::function<void(RecordPtr)> callback);
+
+    /*! Requests the next page of list items from the server without blocking.
+     *
+     * \param key The key of the list to retrieve.
+     * \param token The list token marker to start iterating from (can be 0 to start at beginning).
+     * \param callback Called on an HTTP client thread with a Record holding a verified FlatListPage, which may be kept
+     *                 after the callback, or an empty Record on error.
+     */
+    void getListItemsAsync(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback);
+
+    /*! Waits for list items after token to be added on the server, without blocking. The request holds one of the
+     * in-flight slots until the server answers, which may take as long as the server's watch timeout.
+     *
+     * \param key The key of the list to watch.
+     * \param token The list token marker to return items after, typically the last token seen.
+     * \param callback Called on an HTTP client thread with a Record holding a verified FlatListPage, which may be kept
+     *                 after the callback, or an empty Record on error.
+     */
+    void watchListItemsAsync(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback);
+
+    /*! Uploads a new Asset with inline data to the server without blocking. The Asset is serialized before returning,
+     * so inlineData need only live until then.
+     *
+     * \param type The Asset type.
+     * \param name The Asset name, can be "".
+     * \param author An optional Asset key.
+     * \param deprecates An optional Asset key.
+     * \param listIds A comma-separated concatenated string of list ids to add this asset to.
+     * \param size The size of the data pointed to by inlineData, should be smaller than kDataChunkSize
+     * \param inlineData The inline Asset data to serialize.
+     * \param callback Called when the upload completes, with the computed key for this Asset, or zero on error.
+     */
+    void postInlineAssetAsync(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
+            const std::string& listIds, uint64_t size, const uint8_t* inlineData,
+            std::function<void(uint64_t)> callback);
+
+    /*! Uploads one serialized FlatAssetData chunk of an Asset to the server without blocking. The chunk is encoded
+     * before returning, so flatAssetData need only live until then.
+     *
+     * \param key The key of the Asset the chunk belongs to.
+     * \param chunk The chunk number.
+     * \param flatAssetData The serialized FlatAssetData.
+     * \param callback Called when the upload completes, with whether the server accepted, failed, or rejected it.
+     * \param upstream The index of the upstream to send the chunk to, or UpstreamSet::kNone for any.
+     */
+    void postAssetDataAsync(uint64_t key, uint64_t chunk, const SizedPointer& flatAssetData,
+            std::function<void(PostResult)> callback, size_t upstream = UpstreamSet::kNone);
+
+    /*! Uploads one serialized FlatAssetData chunk of a file to the server's staging area without blocking, where it
+     * isn't visible under any Asset key until the upload is committed.
+     *
+     * \param uploadId The provisional id of the upload the chunk belongs to.
+     * \param chunk The chunk number.
+     * \param flatAssetData The serialized FlatAssetData.
+     * \param callback Called when the upload completes, with true on success.
+     * \param upstream The index of the upstream to stage the chunk on, which must be the one the upload is committed
+     *                 to, or UpstreamSet::kNone for any.
+     */
+    void postUploadDataAsync(uint64_t uploadId, uint64_t chunk, const SizedPointer& flatAssetData,
+            std::function<void(bool)> callback, size_t upstream = UpstreamSet::kNone);
+
+    /*! Uploads a new List to the server without blocking.
+     *
+     * \param name The name of the list. If non-unique, will clobber old list name (but not old list).
+     * \param callback Called when the upload completes, with the key of the new named list, or 0 on error.
+     */
+    void postListAsync(const std::string& name, std::function<void(uint64_t)> callback);
+
+    /*! Blocks until every request issued so far, including those still queued, has completed.
+     */
+    void waitForIdle();
+
+    /*! Returns the state of each upstream server, in the order they were given to the constructor.
+     *
+     * \return A copy of the state of every upstream.
+     */
+    std::vector<UpstreamSet::Status> upstreamStatus();
 
     /*! Requests an asset metadata entry from the server. Blocks until an outcome is reached.
      *
-     * This function and getAssetData rely on callbacks to return their data, both to allow the returning of multiple
-     * arguments in a convenient fashion, but also more importantly to avoid a copy of the record out of the internal
-     * HTTP data structures, that go out of scope when these functions return. By calling a callback, we are able to
-     * expose the raw pointers inside of these data structures while they are still in scope.
+     * This function and getAssetData return their data through callbacks, to allow the returning of multiple arguments
+     * in a convenient fashion. The Records passed to the callbacks hold a pooled buffer the response was decoded into,
+     * so they stay valid for as long as they are kept, without a copy.
      *
      * \param key The asset key associated with this asset.
      * \param callback The function to call when the asset is downloaded, with the key of the provided asset along with
-     *                 a non-owning pointer to the FlatAsset or an empty Record on error.
+     *                 a Record holding the FlatAsset or an empty Record on error.
+     * \param priority The priority of the request, interactive unless made ahead of need.
+     */
+    void getAsset(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback,
+            RequestScheduler::Priority priority = RequestScheduler::kInteractive);
+
+    /*! Requests a batch of asset metadata entries from the server in as few round trips as possible. Blocks until all
+     * keys have an outcome.
+     *
+     * Keys are sent to the server in groups of at most kAssetBatchMaxKeys, and each returned record is then fanned out
+     * to the callback individually, just as if getAsset() had been called on each key. Keys of Assets the server leaves
+     * out of a response, to keep it under kAssetBatchMaxBytes, are sent again.
+     *
+     * \param keys The asset keys to request.
+     * \param callback The function to call once per unique requested key, with the requested key along with a
+     *                 Record holding the FlatAsset or an empty Record if not found or on error.
+     * \param priority The priority of the request, interactive unless made ahead of need.
      */
-    void getAsset(uint64_t key, std::function<void(uint64_t, RecordPtr)> callback);
+    void getAssets(const std::vector<uint64_t>& keys, std::function<void(uint64_t, RecordPtr)> callback,
+            RequestScheduler::Priority priority = RequestScheduler::kInteractive);
 
     /*! Requests an asset by name from the server. Blocks until return.
      *
@@ -62,8 +258,21 @@ public:
      * \param chunk The chunk number to download.
      * \param callback The function to call when the FlatAssetData record is downloaded, with the key of the asset, the
      *                 chunk number, and the FlatAssetData record, or an empty Record on error.
+     * \param priority The priority of the request, bulk unless someone is waiting on this chunk alone.
      */
-    void getAssetData(uint64_t key, uint64_t chunk, std::function<void(uint64_t, uint64_t, RecordPtr)> callback);
+    void getAssetData(uint64_t key, uint64_t chunk, std::function<void(uint64_t, uint64_t, RecordPtr)> callback,
+            RequestScheduler::Priority priority = RequestScheduler::kBulk);
+
+    /*! Asks the server which chunks of an Asset match chunks of a local file, so that only the rest need be fetched.
+     * Blocking.
+     *
+     * \param key The key of the Asset to fetch.
+     * \param hashes The XXH64 hash, with seed 0, of each chunk of the local file, split the same way as the Asset.
+     * \param sources Set to one entry per chunk of the Asset, the index into hashes of a local chunk with the same
+     *                contents, or -1 if the chunk must be fetched.
+     * \return true if the server provided a plan, false on error.
+     */
+    bool getDeltaPlan(uint64_t key, const std::vector<uint64_t>& hashes, std::vector<int32_t>& sources);
 
     /*! Uploads a new Asset with inline data to the server. Blocking.
      *
@@ -80,6 +289,11 @@ public:
             const std::string& listIds, uint64_t size, const uint8_t* inlineData);
 
     /*! Uploads a new Asset along with all AssetData chunks in the file to the server. Blocking.
+     *
+     * Up to the upload window's worth of chunks are POSTed at once, and each failed chunk POST is retried a few times
+     * before the upload gives up. In single-pass mode the file is read once, hashing each chunk as it is staged on the
+     * server, and the Asset is then committed under the final hash. Otherwise the file is read once to compute the
+     * key and again to upload the chunks.
      *
      * \param type The Asset type.
      * \param name The Asset name, can be "".
@@ -92,27 +306,55 @@ public:
     uint64_t postFileAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
             const std::string& listIds, const fs::path& assetFile);
 
+    /*! Uploads an already serialized Asset to the server, without any AssetData, such as an Asset first added to a
+     * local database. Blocking.
+     *
+     * \param flatAsset The serialized FlatAsset, with its key set.
+     * \param upstream The index of the upstream to send the Asset to, or UpstreamSet::kNone for any.
+     * \return Whether the server accepted, failed, or rejected the Asset.
+     */
+    PostResult postAsset(const SizedPointer& flatAsset, size_t upstream = UpstreamSet::kNone);
+
+    /*! Picks the upstream every request of an upload should go to, so that the Asset and all of its AssetData end up
+     * on the same server.
+     *
+     * \return The index of the upstream, to pass to the upload methods.
+     */
+    size_t uploadUpstream();
+
     /*! Requests a list metadata entry from the server. Blocking.
      *
      * \param key The key of the list to retrieve.
-     * \param callback The function to callback with a non-owning pointer to the FlatList structure, or empty on error.
+     * \param callback The function to callback with a Record holding the FlatList structure, or empty on error.
      */
     void getList(uint64_t key, std::function<void(RecordPtr)> callback);
 
     /*! Requests a list metadata entry by name from the server. Blocking.
      *
      * \param name The name of the requested list.
-     * \param callback The function to callback with a non-owning pointer to the FlatList structure, or empty on error.
+     * \param callback The function to callback with a Record holding the FlatList structure, or empty on error.
      */
     void getNamedList(const std::string& name, std::function<void(RecordPtr)> callback);
 
-    /*! Requests the most recent list items from the server. Blocking.
+    /*! Requests the next page of list items from the server. Blocking.
      *
      * \param key The key of the list to retrieve.
      * \param token The list token marker to start iterating from (can be 0 to start at beginning).
-     * \param callback The function to callback with list items as a string of "<token> <asset key>\n" pairs.
+     * \param callback The function to callback with a Record holding a verified FlatListPage, or an empty
+     *                 Record on error. Decode the page with readListPage(), and request the following page from its
+     *                 next token.
+     */
+    void getListItems(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback);
+
+    /*! Waits for list items after token to be added on the server. Blocking, until either new items are added or the
+     * server times out the request, in which case the callback is called with an empty page.
+     *
+     * \param key The key of the list to watch.
+     * \param token The list token marker to return items after, typically the last token seen.
+     * \param callback The function to callback with a Record holding a verified FlatListPage, or an empty
+     *                 Record on error.
      */
-    void getListItems(uint64_t key, uint64_t token, std::function<void(const std::string&)> callback);
+    void watchListItems(uint64_t key, uint64_t token, std::function<void(RecordPtr)> callback);
 
     /*! Uploads a new List to the server. Blocking.
      *
@@ -121,15 +363,264 @@ public:
      */
     uint64_t postList(const std::string& name);
 
+    /*! Returns the size of AssetData chunks to use when adding new file Assets, as advertised by the server. The
+     * server is only queried until it provides a valid answer, after which the value is cached.
+     *
+     * \return The chunk size in bytes, or kDataChunkSize if the server could not be reached.
+     */
+    size_t dataChunkSize();
+
     /*! Closes any pending requests and shuts down.
      */
     void shutdown();
 
 private:
-    const std::string m_serverAddress;
+    enum Method {
+        kGet,
+        kPost
+    };
+
+    // The number of times to try POSTing each chunk of a file upload before giving up on the upload.
+    static constexpr int kMaxChunkAttempts = 3;
+    // The delay before resending a failed chunk, multiplied by the number of attempts so far.
+    static constexpr std::chrono::milliseconds kChunkRetryDelay{100};
+    // The number of times to resume a staged upload that failed, by resending only the chunks the server is missing.
+    static constexpr int kMaxUploadResumes = 3;
+    // The delay before resuming a failed staged upload, multiplied by the number of resumes so far.
+    static constexpr std::chrono::milliseconds kUploadResumeDelay{1000};
+    // The number of times a request is queued again after being turned away by an upstream over capacity, before the
+    // rejection is treated as a server error.
+    static constexpr int kMaxRejections = 5;
+
+    // Runs of chunk numbers as [start, end) pairs.
+    using ChunkRanges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    // Called with the response, or with nullptr if the request failed without one.
+    using ResponseHandler = std::function<void(const Pistache::Http::Response*)>;
+
+    struct Request {
+        Method method;
+        UpstreamSet::RequestClass requestClass;
+        RequestScheduler::Priority priority;
+        // The path and query part of the URL, to follow the address of whichever upstream the request goes to.
+        std::string path;
+        std::string body;
+        ResponseHandler handler;
+        // The upstream the request must go to, or UpstreamSet::kNone if any will do.
+        size_t upstream;
+        // A bitmask of the upstreams the request has been sent to already.
+        uint64_t tried;
+        // The number of times an upstream has turned the request away for being over capacity.
+        int rejections;
+        // When the request was first submitted.
+        std::chrono::steady_clock::time_point issued;
+    };
+
+    // The chunk POSTs of one file upload, shared with their callbacks.
+    struct ChunkUploads {
+        struct Chunk {
+            // The serialized FlatAssetData, kept until the server accepts it in case it must be resent.
+            flatbuffers::DetachedBuffer data;
+            int attempts = 0;
+        };
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::map<uint64_t, Chunk> pending;
+        std::deque<uint64_t> failed;
+        // True if the chunks go to the staging area under an upload id, false if stored under the Asset key.
+        bool staged = false;
+        // The upstream every chunk goes to.
+        size_t upstream = UpstreamSet::kNone;
+        size_t inFlight = 0;
+        size_t retries = 0;
+    };
+
+    /*! Hashes the file to compute the Asset key, posts the Asset, then rereads the file to upload its chunks.
+     *
+     * \param asset The Asset to post, complete except for its key.
+     * \param file The open file.
+     * \param assetFile The path of the file, for logging.
+     * \param layout The chunks of the file.
+     * \param upstream The upstream to send the Asset and its chunks to.
+     * \return The computed key for this Asset, or zero on error.
+     */
+    uint64_t postFileAssetTwoPass(Asset& asset, MappedFile& file, const fs::path& assetFile, const ChunkLayout& layout,
+            size_t upstream);
+
+    /*! Stages the file's chunks on the server under a random upload id while hashing them, then commits the upload
+     * as the Asset under the final hash. If any chunk fails, asks the server which chunks it is missing and resends
+     * only those, up to kMaxUploadResumes times. An upload that still fails is remembered by the file's path, size,
+     * and modification time, so that adding the same file again resumes it rather than starting over.
+     *
+     * \param asset The Asset to commit, complete except for its key.
+     * \param file The open file.
+     * \param assetFile The path of the file, for logging.
+     * \param layout The chunks of the file.
+     * \param upstream The upstream to stage the chunks on and commit to, unless resuming an upload to another.
+     * \return The computed key for this Asset, or zero on error.
+     */
+    uint64_t postFileAssetSinglePass(Asset& asset, MappedFile& file, const fs::path& assetFile,
+            const ChunkLayout& layout, size_t upstream);
+
+    /*! Serializes an Asset and POSTs it to the server. Blocking.
+     *
+     * \param request The path part of the request URL.
+     * \param asset The Asset to post.
+     * \param upstream The upstream to post to.
+     * \return Whether the server accepted, failed, or rejected the Asset.
+     */
+    PostResult postFlatAsset(const std::string& request, Asset& asset, size_t upstream);
+
+    /*! POSTs an already serialized Asset to the server. Blocking.
+     *
+     * \param request The path part of the request URL.
+     * \param flatAsset The serialized FlatAsset.
+     * \param upstream The upstream to post to, or UpstreamSet::kNone for any.
+     * \return Whether the server accepted, failed, or rejected the Asset.
+     */
+    PostResult postFlatAsset(const std::string& request, const SizedPointer& flatAsset, size_t upstream);
+
+    /*! Reads a file from the start, uploading it in the chunks of the layout with the incremental hash of the file so
+     * far. Blocking.
+     *
+     * \param file The open file.
+     * \param assetFile The path of the file, for logging.
+     * \param layout The chunks to upload.
+     * \param id The Asset key, or the upload id if staged.
+     * \param staged If true, POST the chunks to the staging area rather than as AssetData.
+     * \param send If not null, only the chunks in these ascending ranges are sent, although every chunk is still read
+     *             to compute the hashes.
+     * \param upstream The upstream to send the chunks to.
+     * \param chunkHash Set to the hash of the whole file, as stored with the last chunk.
+     * \return true if every chunk was read and every chunk sent was accepted by the server.
+     */
+    bool postFileChunks(MappedFile& file, const fs::path& assetFile, const ChunkLayout& layout, uint64_t id,
+            bool staged, const ChunkRanges* send, size_t upstream, uint64_t& chunkHash);
+
+    /*! Asks the server which chunks of a staged upload it doesn't have. Blocking.
+     *
+     * \param uploadId The id the chunks are staged under.
+     * \param chunks The number of chunks in the upload.
+     * \param upstream The upstream the chunks are staged on.
+     * \param missing Set to the missing chunks, in ascending ranges.
+     * \return true if the server answered, false on error.
+     */
+    bool getMissingUploadChunks(uint64_t uploadId, uint64_t chunks, size_t upstream, ChunkRanges& missing);
+
+    /*! POSTs a pending chunk of a file upload, queueing it for a retry if the POST fails. Doesn't block.
+     *
+     * \param uploads The upload the chunk belongs to.
+     * \param id The key of the Asset being uploaded, or the upload id if staged.
+     * \param chunk The chunk number, which must have data in uploads->pending.
+     */
+    void postChunk(std::shared_ptr<ChunkUploads> uploads, uint64_t id, uint64_t chunk);
+
+    /*! Blocks until fewer than maxInFlight chunks of a file upload are in flight, resending failed chunks meanwhile.
+     *
+     * \param uploads The upload to wait on.
+     * \param id The key of the Asset being uploaded, or the upload id if staged.
+     * \param maxInFlight The number of chunks in flight to wait to drop below, so 1 waits for all of them.
+     * \return false if a chunk failed kMaxChunkAttempts times, true otherwise.
+     */
+    bool awaitChunkUploads(std::shared_ptr<ChunkUploads> uploads, uint64_t id, size_t maxInFlight);
+
+    /*! Sends a request once there is room in the in-flight window and on an upstream, queueing it until then. Never
+     * blocks.
+     *
+     * \param method The request method.
+     * \param requestClass The class of the request, for choosing an upstream.
+     * \param priority The priority of the request, for scheduling it against other requests.
+     * \param path The path part of the request URL.
+     * \param body The request body.
+     * \param handler Called on an HTTP client thread when the request completes.
+     * \param upstream The upstream the request must go to, or UpstreamSet::kNone to choose one and fail over.
+     */
+    void submit(Method method, UpstreamSet::RequestClass requestClass, RequestScheduler::Priority priority,
+            const std::string& path, std::string body, ResponseHandler handler, size_t upstream = UpstreamSet::kNone);
+
+    /*! Sends the queued requests there is now room for, highest priority first, each to the upstream selected for it.
+     * A request of lower priority is never sent to an upstream that a waiting request of higher priority could use.
+     */
+    void sendPending();
+
+    /*! Sends a request that already holds an in-flight slot on an upstream.
+     */
+    void send(std::shared_ptr<Request> request, size_t upstream);
+
+    /*! Records the outcome of a request against its upstream, then either queues it to fail over to another upstream
+     * or passes the response to its handler.
+     *
+     * \param request The completed request.
+     * \param upstream The upstream the request was sent to.
+     * \param start When the request was sent.
+     * \param response The response, or nullptr if there was none.
+     */
+    void complete(std::shared_ptr<Request> request, size_t upstream, std::chrono::steady_clock::time_point start,
+            const Pistache::Http::Response* response);
+
+    /*! Releases a completed request's in-flight slot, and sends any queued requests that can now go.
+     *
+     * \param priority The priority of the completed request.
+     */
+    void finish(RequestScheduler::Priority priority);
+
+    /*! Sends queued requests again as the waits asked for by upstreams over capacity run out. Runs on m_retryThread
+     * until stopRetries().
+     */
+    void retryLoop();
+
+    /*! Stops the retry thread. Requests still waiting out a rejection stay queued.
+     */
+    void stopRetries();
+
+    /*! \return true if no requests of any priority are queued. Must be called with m_windowMutex held. */
+    bool pendingEmpty() const;
+
+    /*! Runs an asynchronous request and blocks until it calls the done function it is given, which it must do after
+     * its callback has finished.
+     *
+     * \param request Starts the request.
+     */
+    static void wait(std::function<void(std::function<void()> done)> request);
+
+    /*! Issues a GET request for a FlatListPage and verifies the response, without blocking.
+     *
+     * \param requestClass The class of the request, for choosing an upstream.
+     * \param priority The priority of the request.
+     * \param request The path part of the request URL.
+     * \param callback The function to callback with the verified FlatListPage, or an empty Record on error.
+     */
+    void requestListPageAsync(UpstreamSet::RequestClass requestClass, RequestScheduler::Priority priority,
+            const std::string& request, std::function<void(RecordPtr)> callback);
+
     std::unique_ptr<Pistache::Http::Client> m_client;
+    std::mutex m_randomMutex;
     std::random_device m_randomDevice;
     std::uniform_int_distribution<uint64_t> m_distribution;
+    // Upload ids and upstreams of failed staged uploads, by file path, size, and modification time.
+    std::map<std::string, std::pair<uint64_t, size_t>> m_interruptedUploads;
+
+    std::mutex m_configMutex;
+    size_t m_dataChunkSize;
+
+    const size_t m_uploadWindow;
+    const bool m_singlePassUpload;
+    const bool m_contentDefinedChunks;
+
+    std::mutex m_windowMutex;
+    std::condition_variable m_idle;
+    UpstreamSet m_upstreams;
+    RequestScheduler m_scheduler;
+    // Queued requests, by priority.
+    std::array<std::deque<std::shared_ptr<Request>>, RequestScheduler::kNumPriorities> m_pending;
+    std::array<Histogram*, RequestScheduler::kNumPriorities> m_queueLatency;
+    // When upstreams that turned requests away will take requests again, earliest on top.
+    std::priority_queue<std::chrono::steady_clock::time_point, std::vector<std::chrono::steady_clock::time_point>,
+        std::greater<std::chrono::steady_clock::time_point>> m_retryTimes;
+    std::condition_variable m_retryChanged;
+    bool m_retrying;
+    std::thread m_retryThread;
 };
 
 }  // namespace Confab
@@ -0,0 +1,333 @@
+#include "HttpClient.hpp"
+
+#include "Asset.hpp"
+#include "AssetDatabase.hpp"
+#include "ChunkLayout.hpp"
+#include "Constants.hpp"
+#include "ContentChunker.hpp"
+#include "MappedFile.hpp"
+#include "TestServer.hpp"
+#include "schemas/FlatAsset_generated.h"
+
+#include "xxhash.h"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+// Loopback ports for the test servers.
+const int kBasePort = 19180;
+const size_t kNumServers = 3;
+
+// Runs several confab-server instances in process, each with its own database, standing in for mirrors.
+class HttpClientTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-http-client-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::remove_all(m_path);
+        for (size_t i = 0; i < kNumServers; ++i) {
+            Confab::HttpEndpoint::Options options = Confab::TestServer::options(kBasePort + static_cast<int>(i));
+            options.dataChunkSize = 4096;
+            ASSERT_TRUE(m_servers[i].start(m_path / ("db" + std::to_string(i)), options));
+        }
+    }
+
+    void TearDown() override {
+        for (auto& server : m_servers) {
+            server.stop();
+        }
+        fs::remove_all(m_path);
+    }
+
+    std::string serverAddress(size_t server) const {
+        return m_servers[server].address();
+    }
+
+    // Adds an inline Asset to one server only, returning its key.
+    uint64_t postToServer(size_t server, const std::string& contents) {
+        Confab::HttpClient client(serverAddress(server));
+        uint64_t key = client.postInlineAsset(Confab::Asset::kSnippet, "", 0, 0, "", contents.size(),
+            reinterpret_cast<const uint8_t*>(contents.data()));
+        client.shutdown();
+        return key;
+    }
+
+    // Returns true if the client finds the Asset.
+    static bool findAsset(Confab::HttpClient& client, uint64_t key) {
+        bool found = false;
+        client.getAsset(key, [&found](uint64_t, Confab::RecordPtr asset) {
+            found = !asset->empty();
+        });
+        return found;
+    }
+
+    fs::path m_path;
+    std::array<Confab::TestServer, kNumServers> m_servers;
+};
+
+}  // namespace
+
+TEST_F(HttpClientTest, SpreadsRequestsAcrossUpstreams) {
+    std::string contents = "mirrored snippet";
+    uint64_t key = 0;
+    for (size_t i = 0; i < kNumServers; ++i) {
+        key = postToServer(i, contents);
+        ASSERT_NE(0u, key);
+    }
+
+    Confab::HttpClient client(serverAddress(0) + "," + serverAddress(1) + "," + serverAddress(2));
+    for (int i = 0; i < 30; ++i) {
+        EXPECT_TRUE(findAsset(client, key));
+    }
+
+    // Each upstream is tried before any has a latency to compare, and all stay healthy.
+    auto upstreams = client.upstreamStatus();
+    ASSERT_EQ(kNumServers, upstreams.size());
+    for (const auto& upstream : upstreams) {
+        EXPECT_GT(upstream.requests, 0u) << upstream.address;
+        EXPECT_EQ(0u, upstream.failures) << upstream.address;
+        EXPECT_TRUE(upstream.healthy);
+        EXPECT_GT(upstream.latency[Confab::UpstreamSet::kMetadata], 0.0);
+    }
+    client.shutdown();
+}
+
+TEST_F(HttpClientTest, RequestsAgainAssetsLeftOutOfLargeBatch) {
+    // Assets with as many chunk offsets as allowed are about half a megabyte each, so the server can't return them all
+    // in one batch response.
+    std::vector<uint64_t> offsets;
+    for (uint64_t chunk = 0; chunk < Confab::kMaxChunkOffsets; ++chunk) {
+        offsets.push_back(chunk * 16);
+    }
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 0x1000; key < 0x1005; ++key) {
+        Confab::Asset asset(Confab::Asset::kSample);
+        asset.setKey(key);
+        asset.setSize(offsets.size() * 16);
+        asset.setChunks(offsets.size());
+        asset.setChunkSize(16);
+        asset.setChunkOffsets(offsets);
+        flatbuffers::FlatBufferBuilder builder;
+        asset.flatten(builder);
+        ASSERT_GT(builder.GetSize(), Confab::kAssetBatchMaxBytes / 4);
+        ASSERT_TRUE(m_servers[0].database()->storeAsset(key,
+            Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+        keys.push_back(key);
+    }
+    uint64_t missingKey = 0x2000;
+    keys.push_back(missingKey);
+
+    Confab::HttpClient client(serverAddress(0));
+    std::map<uint64_t, uint64_t> chunks;
+    client.getAssets(keys, [&chunks](uint64_t key, Confab::RecordPtr asset) {
+        EXPECT_EQ(0u, chunks.count(key)) << "key " << key;
+        chunks[key] = asset->empty() ? 0 :
+            Confab::ChunkLayout::fromFlatAsset(Confab::Data::GetFlatAsset(asset->data().data())).chunks();
+    });
+
+    // Every Asset arrives whole, over more than one request, and the missing key is still reported.
+    ASSERT_EQ(keys.size(), chunks.size());
+    for (uint64_t key = 0x1000; key < 0x1005; ++key) {
+        EXPECT_EQ(Confab::kMaxChunkOffsets, chunks[key]) << "key " << key;
+    }
+    EXPECT_EQ(0u, chunks[missingKey]);
+    auto upstreams = client.upstreamStatus();
+    ASSERT_EQ(1u, upstreams.size());
+    EXPECT_GE(upstreams[0].requests, 3u);
+    client.shutdown();
+}
+
+TEST_F(HttpClientTest, FollowsDeprecationsPastCachedResponses) {
+    Confab::HttpClient client(serverAddress(0));
+    std::string first = "first take";
+    uint64_t original = client.postInlineAsset(Confab::Asset::kSnippet, "", 0, 0, "", first.size(),
+        reinterpret_cast<const uint8_t*>(first.data()));
+    ASSERT_NE(0u, original);
+    std::string second = "second take";
+    uint64_t revised = client.postInlineAsset(Confab::Asset::kSnippet, "", 0, original, "", second.size(),
+        reinterpret_cast<const uint8_t*>(second.data()));
+    ASSERT_NE(0u, revised);
+
+    auto resolve = [&client](uint64_t key) {
+        uint64_t found = 0;
+        client.getAsset(key, [&found](uint64_t, Confab::RecordPtr asset) {
+            if (!asset->empty()) {
+                found = Confab::Data::GetFlatAsset(asset->data().data())->key();
+            }
+        });
+        return found;
+    };
+    // Ask twice, so a cached response would be in place and served.
+    EXPECT_EQ(revised, resolve(original));
+    EXPECT_EQ(revised, resolve(original));
+
+    // Deprecating the end of the chain moves every earlier version on to the new one.
+    std::string third = "third take";
+    uint64_t latest = client.postInlineAsset(Confab::Asset::kSnippet, "", 0, revised, "", third.size(),
+        reinterpret_cast<const uint8_t*>(third.data()));
+    ASSERT_NE(0u, latest);
+    EXPECT_EQ(latest, resolve(original));
+    EXPECT_EQ(latest, resolve(revised));
+    client.shutdown();
+}
+
+TEST_F(HttpClientTest, FailsOverFromDeadUpstream) {
+    uint64_t key = postToServer(1, "only on the second server");
+    ASSERT_NE(0u, key);
+
+    // The first upstream refuses every connection, and the third doesn't have the Asset, so every request must find
+    // its way to the second.
+    std::string deadAddress = Confab::TestServer::address(Confab::TestServer::kDeadPort);
+    Confab::HttpClient client(deadAddress + "," + serverAddress(1) + "," + serverAddress(2));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(findAsset(client, key));
+    }
+    EXPECT_FALSE(findAsset(client, key + 1));
+
+    auto upstreams = client.upstreamStatus();
+    ASSERT_EQ(3u, upstreams.size());
+    EXPECT_FALSE(upstreams[0].healthy);
+    EXPECT_GE(upstreams[0].failures, static_cast<uint64_t>(Confab::UpstreamSet::kMaxConsecutiveFailures));
+    EXPECT_LT(upstreams[0].requests, 10u);
+    EXPECT_TRUE(upstreams[1].healthy);
+    EXPECT_TRUE(upstreams[2].healthy);
+    EXPECT_EQ(0u, upstreams[2].failures);
+    client.shutdown();
+}
+
+TEST_F(HttpClientTest, UploadsFileToOneUpstream) {
+    fs::create_directories(m_path);
+    fs::path filePath = m_path / "upload.wav";
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        for (int i = 0; i < 5000; ++i) {
+            file << "sample " << i << "\n";
+        }
+    }
+
+    Confab::HttpClient client(serverAddress(0) + "," + serverAddress(1) + "," + serverAddress(2));
+    uint64_t key = client.postFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+    ASSERT_NE(0u, key);
+    client.shutdown();
+
+    // The Asset and all of its chunks went to the same mirror, so it is complete there and absent from the others.
+    size_t holders = 0;
+    for (size_t i = 0; i < kNumServers; ++i) {
+        Confab::RecordPtr asset = m_servers[i].database()->findAsset(key);
+        if (asset->empty()) {
+            continue;
+        }
+        ++holders;
+        for (uint64_t chunk = 0; chunk < (fs::file_size(filePath) + 4095) / 4096; ++chunk) {
+            EXPECT_FALSE(m_servers[i].database()->loadAssetDataChunk(key, chunk)->empty()) << "chunk " << chunk;
+        }
+    }
+    EXPECT_EQ(1u, holders);
+}
+
+TEST_F(HttpClientTest, PlansDeltaFromLocalChunks) {
+    fs::create_directories(m_path);
+    fs::path originalPath = m_path / "original.wav";
+    fs::path editedPath = m_path / "edited.wav";
+    {
+        std::ofstream original(originalPath, std::ios::binary);
+        std::ofstream edited(editedPath, std::ios::binary);
+        for (int i = 0; i < 20000; ++i) {
+            original << "sample " << (i * 7919) % 104729 << "\n";
+            if (i == 100) {
+                edited << "inserted near the start\n";
+            }
+            edited << "sample " << (i * 7919) % 104729 << "\n";
+        }
+    }
+
+    Confab::HttpClient client(serverAddress(0), Confab::HttpClient::kDefaultMaxInFlight,
+        Confab::HttpClient::kDefaultUploadWindow, true, true);
+    uint64_t key = client.postFileAsset(Confab::Asset::kSample, "", 0, 0, "", editedPath);
+    ASSERT_NE(0u, key);
+    uint64_t chunks = 0;
+    client.getAsset(key, [&chunks](uint64_t, Confab::RecordPtr asset) {
+        ASSERT_FALSE(asset->empty());
+        chunks = Confab::Data::GetFlatAsset(asset->data().data())->chunks();
+    });
+
+    // Split the original file the way the edited one was split, as a client holding it would.
+    Confab::MappedFile file;
+    ASSERT_TRUE(file.open(originalPath));
+    std::vector<uint64_t> offsets;
+    ASSERT_TRUE(Confab::ContentChunker(4096).split(file, offsets));
+    std::vector<uint64_t> hashes;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        size_t size = (i + 1 < offsets.size() ? offsets[i + 1] : file.size()) - offsets[i];
+        Confab::SizedPointer data = file.read(offsets[i], size);
+        hashes.push_back(XXH64(data.data(), data.size(), 0));
+    }
+
+    std::vector<int32_t> sources;
+    ASSERT_TRUE(client.getDeltaPlan(key, hashes, sources));
+    ASSERT_EQ(chunks, sources.size());
+    // Only the chunks around the insertion must be fetched.
+    size_t missing = std::count(sources.begin(), sources.end(), -1);
+    EXPECT_GE(missing, 1u);
+    EXPECT_LE(missing, 3u);
+    for (auto source : sources) {
+        EXPECT_LT(source, static_cast<int32_t>(hashes.size()));
+    }
+
+    EXPECT_FALSE(client.getDeltaPlan(key + 1, hashes, sources));
+    client.shutdown();
+}
+
+TEST_F(HttpClientTest, WaitsOutServerOverCapacity) {
+    // A server with room for one List watch at a time turns the second of two away until the first times out.
+    Confab::TestServer server;
+    Confab::HttpEndpoint::Options options = Confab::TestServer::options(kBasePort + kNumServers);
+    options.maxListWatchers = 1;
+    ASSERT_TRUE(server.start(m_path / "busy", options));
+
+    Confab::HttpClient client(server.address());
+    uint64_t listKey = client.postList("watched");
+    ASSERT_NE(0u, listKey);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t pages = 0;
+    for (int i = 0; i < 2; ++i) {
+        client.watchListItemsAsync(listKey, Confab::kBeginList, [&mutex, &changed, &pages](Confab::RecordPtr page) {
+            EXPECT_FALSE(page->empty());
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++pages;
+            }
+            changed.notify_all();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        EXPECT_TRUE(changed.wait_for(lock, std::chrono::seconds(10), [&pages] { return pages == 2; }));
+    }
+
+    // The rejection was waited out and sent again, without counting against the server.
+    auto upstreams = client.upstreamStatus();
+    ASSERT_EQ(1u, upstreams.size());
+    EXPECT_GE(upstreams[0].rejections, 1u);
+    EXPECT_EQ(0u, upstreams[0].failures);
+    EXPECT_TRUE(upstreams[0].healthy);
+    EXPECT_GE(upstreams[0].limit, static_cast<double>(Confab::HttpClient::kInitialUpstreamLimit));
+    client.shutdown();
+    server.stop();
+}
@@ -1,19 +1,79 @@
 #include "HttpEndpoint.hpp"
 
+#include "AdmissionController.hpp"
 #include "Asset.hpp"
 #include "AssetDatabase.hpp"
+#include "Base64.hpp"
+#include "ChunkLayout.hpp"
 #include "Constants.hpp"
+#include "EventLog.hpp"
+#include "ListPage.hpp"
+#include "ListWatcher.hpp"
+#include "Metrics.hpp"
+#include "RequestCapture.hpp"
+#include "ResponseCache.hpp"
+#include "SingleFlight.hpp"
+#include "Tracer.hpp"
+#include "WorkerPool.hpp"
 #include "schemas/FlatAsset_generated.h"
+#include "schemas/FlatAssetBatch_generated.h"
 #include "schemas/FlatAssetData_generated.h"
+#include "schemas/FlatConfig_generated.h"
+#include "schemas/FlatDeltaPlan_generated.h"
 #include "schemas/FlatList_generated.h"
+#include "schemas/FlatUploadStatus_generated.h"
 
 #include "glog/logging.h"
-#include "libbase64.h"
 #include "pistache/endpoint.h"
 #include "pistache/router.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 namespace Confab {
 
+// How long clients are asked to wait before retrying a request rejected for being over capacity.
+static const int kRetryAfterSeconds = 1;
+
+// Number of most recent events returned by /events.
+static const size_t kEventsDumpSize = 1000;
+
+// Metric label values for each HttpHandler::Route, in order.
+static const char* kRouteNames[] = {
+    "get_config",
+    "get_status",
+    "get_metrics",
+    "get_asset",
+    "post_asset",
+    "get_named_asset",
+    "post_asset_batch",
+    "post_delta_plan",
+    "get_asset_data",
+    "post_asset_data",
+    "post_upload_data",
+    "commit_upload",
+    "get_upload_status",
+    "get_list",
+    "post_list",
+    "get_named_list",
+    "get_list_items",
+    "watch_list_items"
+};
+
+// Metric label values for each HttpHandler::SizeClass, in order, and the payload size in bytes each extends up to.
+static const char* kSizeClassNames[] = { "4k", "64k", "1m", "inf" };
+static const size_t kSizeClassLimits[] = { 4 * 1024, 64 * 1024, 1024 * 1024 };
+
 /*! Handler class for processing incoming HTTP requests. Uses the Pistache Router to connect specific REST-style API
  * queries from clients to private method calls within this class.
  */
@@ -21,52 +81,97 @@ class HttpEndpoint::HttpHandler {
 public:
     /*! Constructs an empty handler.
      *
-     * \param listenPort The TCP port to listen on for HTTP requests.
-     * \param numThreads The number of threads to use to listen on the port.
+     * \param options The server configuration.
      * \param assetDatabase A pointer to the shared AssetDatabase instance.
      */
-    HttpHandler(int listenPort, int numThreads, std::shared_ptr<AssetDatabase> assetDatabase) :
-        m_listenPort(listenPort),
-        m_numThreads(numThreads),
-        m_assetDatabase(assetDatabase) { }
+    HttpHandler(const HttpEndpoint::Options& options, std::shared_ptr<AssetDatabase> assetDatabase) :
+        m_options(options),
+        m_assetDatabase(assetDatabase),
+        m_responseCache(options.responseCacheSize),
+        m_workerPool(options.metadataThreads, options.bulkThreads),
+        m_admission(options.limits),
+        m_listWatcher(options.maxListWatchers),
+        m_stopExpiry(false) {
+        if (!options.capturePath.empty()) {
+            m_capture.reset(new RequestCapture);
+            if (!m_capture->open(options.capturePath, options.captureMaxBodySize)) {
+                m_capture.reset();
+            }
+        }
+        static_assert(sizeof(kRouteNames) / sizeof(kRouteNames[0]) == kNumRoutes, "kRouteNames must name every Route.");
+        static_assert(sizeof(kSizeClassNames) / sizeof(kSizeClassNames[0]) == kNumSizeClasses,
+            "kSizeClassNames must name every SizeClass.");
+        for (size_t i = 0; i < kNumRoutes; ++i) {
+            m_routeLatency[i] = MetricsRegistry::global().histogram("confab_http_request_seconds",
+                "Time from receiving an HTTP request to sending the response, by route.",
+                std::string("route=\"") + kRouteNames[i] + "\"", 1e-6);
+        }
+        for (size_t i = 0; i < kNumSizeClasses; ++i) {
+            m_sizeClassLatency[i] = MetricsRegistry::global().histogram("confab_http_request_by_size_seconds",
+                "Time from receiving an HTTP request to sending the response, by size of the request or response "
+                "payload, whichever is larger, up to the size in the size label.",
+                std::string("size=\"") + kSizeClassNames[i] + "\"", 1e-6);
+        }
+    }
 
     /*! Setup HTTP URL routes and initialize server.
      */
     void setupRoutes() {
-        Pistache::Address address(Pistache::Ipv4::any(), Pistache::Port(m_listenPort));
+        Pistache::Address address(Pistache::Ipv4::any(), Pistache::Port(m_options.listenPort));
         m_server.reset(new Pistache::Http::Endpoint(address));
-        auto opts = Pistache::Http::Endpoint::options().threads(m_numThreads).maxRequestSize(2 * kPageSize);
+        auto opts = Pistache::Http::Endpoint::options()
+            .threads(m_options.numThreads)
+            .maxRequestSize(kMaxHttpMessageSize)
+            .maxResponseSize(kMaxHttpMessageSize);
         m_server->init(opts);
 
-        Pistache::Rest::Routes::Get(m_router, "/asset/id/:key", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getAsset, this));
-        Pistache::Rest::Routes::Post(m_router, "/asset/id/:key", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::postAsset, this));
+        Pistache::Rest::Routes::Get(m_router, "/config", captured(&HttpEndpoint::HttpHandler::getConfig));
+        Pistache::Rest::Routes::Get(m_router, "/status", Pistache::Rest::Routes::bind(
+            &HttpEndpoint::HttpHandler::getStatus, this));
+        Pistache::Rest::Routes::Get(m_router, "/metrics", Pistache::Rest::Routes::bind(
+            &HttpEndpoint::HttpHandler::getMetrics, this));
+        Pistache::Rest::Routes::Get(m_router, "/trace", Pistache::Rest::Routes::bind(
+            &HttpEndpoint::HttpHandler::getTrace, this));
+        Pistache::Rest::Routes::Get(m_router, "/events", Pistache::Rest::Routes::bind(
+            &HttpEndpoint::HttpHandler::getEvents, this));
+
+        Pistache::Rest::Routes::Get(m_router, "/asset/id/:key", captured(&HttpEndpoint::HttpHandler::getAsset));
+        Pistache::Rest::Routes::Post(m_router, "/asset/id/:key", captured(&HttpEndpoint::HttpHandler::postAsset));
 
-        Pistache::Rest::Routes::Get(m_router, "/asset/name", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getNamedAsset, this));
+        Pistache::Rest::Routes::Get(m_router, "/asset/name", captured(&HttpEndpoint::HttpHandler::getNamedAsset));
 
-        Pistache::Rest::Routes::Get(m_router, "/asset/data/:key/:chunk", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getAssetData, this));
-        Pistache::Rest::Routes::Post(m_router, "/asset/data/:key/:chunk", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::postAssetData, this));
+        Pistache::Rest::Routes::Post(m_router, "/asset/batch", captured(&HttpEndpoint::HttpHandler::postAssetBatch));
+        Pistache::Rest::Routes::Post(m_router, "/asset/delta/:key", captured(
+            &HttpEndpoint::HttpHandler::postDeltaPlan));
 
-        Pistache::Rest::Routes::Get(m_router, "/list/id/:key", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getList, this));
-        Pistache::Rest::Routes::Post(m_router, "/list/id/:key", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::postList, this));
+        Pistache::Rest::Routes::Get(m_router, "/asset/data/:key/:chunk", captured(
+            &HttpEndpoint::HttpHandler::getAssetData));
+        Pistache::Rest::Routes::Post(m_router, "/asset/data/:key/:chunk", captured(
+            &HttpEndpoint::HttpHandler::postAssetData));
 
-        Pistache::Rest::Routes::Get(m_router, "/list/name", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getNamedList, this));
+        Pistache::Rest::Routes::Post(m_router, "/asset/upload/:upload/:chunk", captured(
+            &HttpEndpoint::HttpHandler::postUploadData));
+        Pistache::Rest::Routes::Get(m_router, "/asset/upload/:upload/:chunks", captured(
+            &HttpEndpoint::HttpHandler::getUploadStatus));
+        Pistache::Rest::Routes::Post(m_router, "/asset/commit/:upload", captured(
+            &HttpEndpoint::HttpHandler::commitUpload));
 
-        Pistache::Rest::Routes::Get(m_router, "/list/items/:key/:from", Pistache::Rest::Routes::bind(
-            &HttpEndpoint::HttpHandler::getListItems, this));
+        Pistache::Rest::Routes::Get(m_router, "/list/id/:key", captured(&HttpEndpoint::HttpHandler::getList));
+        Pistache::Rest::Routes::Post(m_router, "/list/id/:key", captured(&HttpEndpoint::HttpHandler::postList));
+
+        Pistache::Rest::Routes::Get(m_router, "/list/name", captured(&HttpEndpoint::HttpHandler::getNamedList));
+
+        Pistache::Rest::Routes::Get(m_router, "/list/items/:key/:from", captured(
+            &HttpEndpoint::HttpHandler::getListItems));
+        Pistache::Rest::Routes::Get(m_router, "/list/watch/:key/:from", captured(
+            &HttpEndpoint::HttpHandler::watchListItems));
     }
 
     /*! Starts a thread that will listen on the provided TCP port and process incoming requests for storage and
      * retrieval of assets.
      */
     void startServerThread() {
+        startWorkers();
         m_server->setHandler(m_router.handler());
         m_server->serveThreaded();
     }
@@ -74,6 +179,7 @@ public:
     /*! Starts the server on this thread, blocking the thread. Call one of this method or startServerThread().
      */
     void startServer() {
+        startWorkers();
         m_server->setHandler(m_router.handler());
         m_server->serve();
     }
@@ -82,242 +188,1009 @@ public:
      */
     void shutdown() {
         m_server->shutdown();
+        if (m_expiryThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_expiryMutex);
+                m_stopExpiry = true;
+            }
+            m_expiryCondition.notify_all();
+            m_expiryThread.join();
+        }
+        // Answer any open List watches, then finish the database work already queued, which also sends the responses
+        // still owed to clients.
+        m_listWatcher.shutdown();
+        m_workerPool.shutdown();
+        m_assetDatabase->setListObserver(nullptr);
+        if (m_capture) {
+            m_capture->close();
+        }
+        LOG(INFO) << "response cache " << m_responseCache.hits() << " hits, " << m_responseCache.misses()
+            << " misses, " << m_responseCache.evictions() << " evictions, " << m_inFlight.followers()
+            << " requests coalesced into " << m_inFlight.leaders() << " loads.";
     }
 
 private:
+    /*! Routes timed into per-route latency histograms, exposed as the confab_http_request_seconds metric.
+     */
+    enum Route : size_t {
+        kGetConfig,
+        kGetStatus,
+        kGetMetrics,
+        kGetAsset,
+        kPostAsset,
+        kGetNamedAsset,
+        kPostAssetBatch,
+        kPostDeltaPlan,
+        kGetAssetData,
+        kPostAssetData,
+        kPostUploadData,
+        kCommitUpload,
+        kGetUploadStatus,
+        kGetList,
+        kPostList,
+        kGetNamedList,
+        kGetListItems,
+        kWatchListItems,
+        kNumRoutes
+    };
+
+    /*! Request payload sizes timed into separate latency histograms, so that the cost of serving large chunks can be
+     * told apart from small metadata requests.
+     */
+    enum SizeClass : size_t {
+        kUpTo4KiB,
+        kUpTo64KiB,
+        kUpTo1MiB,
+        kOver1MiB,
+        kNumSizeClasses
+    };
+
+    /*! The outcome of a load of a cacheable response, passed to every request that joined it.
+     */
+    struct SharedLoad {
+        bool admitted;             //!< False if the leading request was rejected, so all that joined it are too.
+        ResponseCache::Body body;  //!< The response body, or nullptr if the record was not found.
+    };
+
+    /*! Records the latency of a request when destroyed, and holds the request's trace if it was sampled for tracing.
+     * Shared by everything that may answer the request, so the time recorded runs from arrival until the last of them,
+     * normally the one sending the response, lets go.
+     */
+    class RequestTimer {
+    public:
+        /*! Starts timing a request.
+         *
+         * \param handler The handler to record the latency with.
+         * \param route The route the request arrived on.
+         * \param payloadSize The size of the request body, in bytes.
+         */
+        RequestTimer(HttpHandler* handler, Route route, size_t payloadSize) :
+            m_handler(handler),
+            m_route(route),
+            m_payloadSize(payloadSize),
+            m_start(std::chrono::steady_clock::now()),
+            m_trace(Tracer::global().startTrace(kRouteNames[route])) { }
+
+        ~RequestTimer() {
+            m_handler->recordLatency(m_route, m_payloadSize, std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_start).count());
+        }
+
+        /*! Sets the payload size to the size of the response body, if larger than the request body.
+         *
+         * \param responseSize The size of the response body, in bytes.
+         */
+        void setResponseSize(size_t responseSize) { m_payloadSize = std::max(m_payloadSize, responseSize); }
+
+        /*! \return When the request arrived. */
+        std::chrono::steady_clock::time_point start() const { return m_start; }
+
+        /*! \return The request's trace, or nullptr if not sampled. */
+        const std::shared_ptr<Trace>& trace() const { return m_trace; }
+
+        /*! Adds a span directly under the request to its trace, if it has one.
+         *
+         * \param name The name of the stage.
+         * \param start When the stage started.
+         * \param end When the stage ended.
+         */
+        void addSpan(const char* name, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end) {
+            if (m_trace) {
+                m_trace->addSpan(name, m_trace->newSpanId(), 0, start, end);
+            }
+        }
+
+        /// @cond UNDOCUMENTED
+        RequestTimer(const RequestTimer&) = delete;
+        RequestTimer& operator=(const RequestTimer&) = delete;
+        /// @endcond UNDOCUMENTED
+
+    private:
+        HttpHandler* m_handler;
+        Route m_route;
+        size_t m_payloadSize;
+        std::chrono::steady_clock::time_point m_start;
+        std::shared_ptr<Trace> m_trace;
+    };
+
+    using Handler = void (HttpHandler::*)(const Pistache::Rest::Request&, Pistache::Http::ResponseWriter);
+
+    /*! Binds a route handler that first records the request to the capture file, if capturing.
+     *
+     * \param handler The method to handle the request.
+     * \return The route handler.
+     */
+    Pistache::Rest::Route::Handler captured(Handler handler) {
+        return [this, handler](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+            if (m_capture) {
+                m_capture->record(request.method() == Pistache::Http::Method::Post ? RequestCapture::kPost :
+                    RequestCapture::kGet, request.resource(), request.body());
+            }
+            (this->*handler)(request, std::move(response));
+            return Pistache::Rest::Route::Result::Ok;
+        };
+    }
+
+    /*! Sends a response. If a request trace is current on this thread, times the write to the socket into it.
+     *
+     * \param response The writer to send the response with.
+     * \param code The HTTP status code.
+     * \param body The response body.
+     * \param mime The content type of the body.
+     */
+    static void send(Pistache::Http::ResponseWriter& response, Pistache::Http::Code code, const std::string& body = "",
+            const Pistache::Http::Mime::MediaType& mime = Pistache::Http::Mime::MediaType()) {
+        Trace* trace = currentTrace();
+        if (!trace) {
+            response.send(code, body, mime);
+            return;
+        }
+
+        // The write completes later on the reactor thread, so keep the trace open until then.
+        std::shared_ptr<Trace> sharedTrace = trace->shared_from_this();
+        uint32_t id = trace->newSpanId();
+        uint32_t parent = currentSpanId();
+        auto start = std::chrono::steady_clock::now();
+        response.send(code, body, mime).then([sharedTrace, id, parent, start](ssize_t) {
+            sharedTrace->addSpan("socket_write", id, parent, start, std::chrono::steady_clock::now());
+        }, Pistache::Async::IgnoreException);
+    }
+
+    /*! Verifies a serialized flatbuffer, timed as a span of the current request trace, if any.
+     *
+     * \param verifyBuffer The generated verification function for the expected root type.
+     * \param buffer The serialized flatbuffer.
+     * \return true if the buffer verified.
+     */
+    static bool verify(bool (*verifyBuffer)(flatbuffers::Verifier&), const std::vector<uint8_t>& buffer) {
+        Span span("verify");
+        flatbuffers::Verifier verifier(buffer.data(), buffer.size());
+        return verifyBuffer(verifier);
+    }
+
+    /*! Records the latency of a finished request.
+     *
+     * \param route The route the request arrived on.
+     * \param payloadSize The larger of the request and response body sizes, in bytes.
+     * \param microseconds The time taken to answer the request.
+     */
+    void recordLatency(Route route, size_t payloadSize, uint64_t microseconds) {
+        m_routeLatency[route]->record(microseconds);
+        size_t sizeClass = 0;
+        while (sizeClass < kNumSizeClasses - 1 && payloadSize > kSizeClassLimits[sizeClass]) {
+            ++sizeClass;
+        }
+        m_sizeClassLatency[sizeClass]->record(microseconds);
+    }
+
+    /*! Starts the database worker threads, List watch timer, and upload expiry thread, and connects List watches to
+     * List updates.
+     */
+    void startWorkers() {
+        m_workerPool.start();
+        m_listWatcher.start();
+        m_assetDatabase->setListObserver([this](uint64_t listKey, uint64_t /* token */) {
+            m_listWatcher.notify(listKey);
+        });
+        if (m_options.uploadSessionTimeout.count() > 0) {
+            m_expiryThread = std::thread(&HttpHandler::expireUploads, this);
+        }
+    }
+
+    /*! Runs on the expiry thread until shutdown, deleting the staged chunks of abandoned uploads every quarter of the
+     * upload session timeout, so no upload outlives the timeout by more than a quarter of it.
+     */
+    void expireUploads() {
+        auto interval = std::max(std::chrono::duration_cast<std::chrono::seconds>(m_options.uploadSessionTimeout / 4),
+            std::chrono::seconds(1));
+        std::unique_lock<std::mutex> lock(m_expiryMutex);
+        while (!m_expiryCondition.wait_for(lock, interval, [this] { return m_stopExpiry; })) {
+            lock.unlock();
+            m_assetDatabase->expireUploads(m_options.uploadSessionTimeout);
+            lock.lock();
+        }
+    }
+
+    /*! Called on a worker thread to do the database work for a request and send the response.
+     */
+    using Work = std::function<void(Pistache::Http::ResponseWriter& response)>;
+
+    /*! Answers a request refused by admission control with 503 Service Unavailable, and a Retry-After header telling
+     * the client when to try again.
+     *
+     * \param requestClass The class of the refused request.
+     * \param response The writer to send the response with.
+     */
+    void reject(AdmissionController::RequestClass requestClass, Pistache::Http::ResponseWriter& response) {
+        LOG(ERROR) << "rejecting " << AdmissionController::className(requestClass) << " request, over capacity.";
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        response.headers().addRaw(Pistache::Http::Header::Raw("Retry-After", std::to_string(kRetryAfterSeconds)));
+        send(response, Pistache::Http::Code::Service_Unavailable);
+    }
+
+    /*! Admits a request of the given class, or rejects it if the server is at capacity for that class. Then moves the
+     * request off of the Pistache reactor thread and onto a database worker thread, freeing the reactor thread to
+     * service other connections while the worker blocks on LevelDB.
+     *
+     * \param requestClass The class of the request, which determines its limits and worker lane.
+     * \param route The route the request arrived on, for timing.
+     * \param request The request, used to identify the peer.
+     * \param response The writer to send the response with, which will be passed to work.
+     * \param work Does the database work and sends the response. Must capture everything it needs from the request by
+     *             value, as the request will not outlive this call.
+     */
+    void dispatch(AdmissionController::RequestClass requestClass, Route route, const Pistache::Rest::Request& request,
+            Pistache::Http::ResponseWriter response, Work work) {
+        auto timer = std::make_shared<RequestTimer>(this, route, request.body().size());
+        std::shared_ptr<AdmissionController::Ticket> ticket = m_admission.admit(requestClass, request.address().host());
+        if (!ticket) {
+            reject(requestClass, response);
+            return;
+        }
+
+        // The ResponseWriter is move-only, while std::function requires copyable captures, so share ownership of it.
+        // The ticket is released, and the request timed, when the task is destroyed after the response is sent.
+        auto writer = std::make_shared<Pistache::Http::ResponseWriter>(std::move(response));
+        auto posted = std::chrono::steady_clock::now();
+        timer->addSpan("route", timer->start(), posted);
+        auto task = [writer, work, ticket, timer, posted] {
+            ticket->start();
+            timer->addSpan("queue", posted, std::chrono::steady_clock::now());
+            TraceScope scope(timer->trace());
+            work(*writer);
+        };
+        if (!m_workerPool.post(laneFor(requestClass), task)) {
+            // Only possible during shutdown, do the work here rather than leave the client without a response.
+            task();
+        }
+    }
+
+    /*! Serves a cacheable GET response, first from the response cache, then by joining any identical request already
+     * in flight, and only then, if admitted, by calling load on a database worker thread to read and encode the
+     * response. Cache hits, and requests that join one in flight, are served without counting against any limits.
+     *
+     * \param requestClass The class of the request, which determines its limits and worker lane.
+     * \param route The route the request arrived on, for timing.
+     * \param request The request, used to identify the peer.
+     * \param cacheKey Identifies the response.
+     * \param response The writer to send the response with.
+     * \param load Reads and encodes the response body, returning nullptr if the requested record was not found. Sets
+     *             its argument to false if the body must not be cached, as it starts out true.
+     */
+    void serveCached(AdmissionController::RequestClass requestClass, Route route,
+            const Pistache::Rest::Request& request, const ResponseCache::Key& cacheKey,
+            Pistache::Http::ResponseWriter response, std::function<ResponseCache::Body(bool&)> load) {
+        auto timer = std::make_shared<RequestTimer>(this, route, request.body().size());
+        TraceScope scope(timer->trace());
+        ResponseCache::Body body = m_responseCache.find(cacheKey);
+        if (body) {
+            logEvent(kHttpResponseCacheHit, cacheKey.kind, cacheKey.key, cacheKey.chunk);
+            timer->setResponseSize(body->size());
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            send(response, Pistache::Http::Code::Ok, *body, MIME(Text, Plain));
+            return;
+        }
+
+        // The ResponseWriter is move-only, and any request that joins this one will be answered from whichever thread
+        // completes the load, so share ownership of it with the callback.
+        auto writer = std::make_shared<Pistache::Http::ResponseWriter>(std::move(response));
+        bool leader = m_inFlight.join(cacheKey, [this, requestClass, writer, timer](SharedLoad loaded) {
+            // Called on the thread that completed the load, which may be tracing a different request.
+            TraceScope scope(timer->trace());
+            if (!loaded.admitted) {
+                reject(requestClass, *writer);
+                return;
+            }
+            writer->headers().add<Pistache::Http::Header::Server>("confab");
+            if (loaded.body) {
+                timer->setResponseSize(loaded.body->size());
+                send(*writer, Pistache::Http::Code::Ok, *loaded.body, MIME(Text, Plain));
+            } else {
+                send(*writer, Pistache::Http::Code::Not_Found);
+            }
+        });
+        if (!leader) {
+            return;
+        }
+
+        // Only the leader counts against the limits, as the requests that join it add no database work. Otherwise a
+        // crowd of clients after the same hot chunk would be turned away while a single read serves all of them.
+        std::shared_ptr<AdmissionController::Ticket> ticket = m_admission.admit(requestClass, request.address().host());
+        if (!ticket) {
+            m_inFlight.complete(cacheKey, { false, nullptr });
+            return;
+        }
+
+        uint64_t generation = m_responseCache.generation();
+        auto posted = std::chrono::steady_clock::now();
+        timer->addSpan("route", timer->start(), posted);
+        auto loadAndComplete = [this, cacheKey, generation, load, ticket, timer, posted] {
+            ticket->start();
+            timer->addSpan("queue", posted, std::chrono::steady_clock::now());
+            ResponseCache::Body body;
+            bool cacheable = true;
+            {
+                TraceScope scope(timer->trace());
+                body = load(cacheable);
+            }
+            if (body && cacheable) {
+                m_responseCache.insert(cacheKey, body, generation);
+            }
+            m_inFlight.complete(cacheKey, { true, body });
+        };
+        if (!m_workerPool.post(laneFor(requestClass), loadAndComplete)) {
+            loadAndComplete();
+        }
+    }
+
+    /*! Maps a request class to the worker lane that serves it.
+     *
+     * \param requestClass The class of the request.
+     * \return The worker lane to run the request on.
+     */
+    static WorkerPool::Lane laneFor(AdmissionController::RequestClass requestClass) {
+        return requestClass == AdmissionController::kBulk ? WorkerPool::kBulk : WorkerPool::kMetadata;
+    }
+
+    void getStatus(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        RequestTimer timer(this, kGetStatus, 0);
+        TraceScope scope(timer.trace());
+        LOG(INFO) << "processing HTTP GET request for /status";
+        std::string status;
+        for (size_t i = 0; i < AdmissionController::kNumClasses; ++i) {
+            auto requestClass = static_cast<AdmissionController::RequestClass>(i);
+            AdmissionController::ClassStats stats = m_admission.stats(requestClass);
+            status += std::string(AdmissionController::className(requestClass)) + " queued " +
+                std::to_string(stats.queued) + " running " + std::to_string(stats.running) + " admitted " +
+                std::to_string(stats.admitted) + " rejected " + std::to_string(stats.rejected) + "\n";
+        }
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        send(response, Pistache::Http::Code::Ok, status, MIME(Text, Plain));
+    }
+
+    /*! Reports server metrics in the Prometheus text exposition format. Adds the admission, worker, cache and List
+     * watch state of this server to the metrics kept in the global MetricsRegistry.
+     */
+    void getMetrics(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        RequestTimer timer(this, kGetMetrics, 0);
+        TraceScope scope(timer.trace());
+        LOG(INFO) << "processing HTTP GET request for /metrics";
+        std::string metrics = MetricsRegistry::global().exposition();
+
+        std::array<AdmissionController::ClassStats, AdmissionController::kNumClasses> stats;
+        for (size_t i = 0; i < AdmissionController::kNumClasses; ++i) {
+            stats[i] = m_admission.stats(static_cast<AdmissionController::RequestClass>(i));
+        }
+        auto appendClassSamples = [&metrics, &stats](const char* name, const char* type, const char* help,
+                std::function<uint64_t(const AdmissionController::ClassStats&)> value) {
+            for (size_t i = 0; i < AdmissionController::kNumClasses; ++i) {
+                appendSample(metrics, name, type, i == 0 ? help : "", std::string("class=\"") +
+                    AdmissionController::className(static_cast<AdmissionController::RequestClass>(i)) + "\"",
+                    value(stats[i]));
+            }
+        };
+        appendClassSamples("confab_admission_queued", "gauge", "Admitted requests waiting for a worker thread.",
+            [](const AdmissionController::ClassStats& stats) { return stats.queued; });
+        appendClassSamples("confab_admission_running", "gauge", "Admitted requests running on a worker thread.",
+            [](const AdmissionController::ClassStats& stats) { return stats.running; });
+        appendClassSamples("confab_admission_admitted_total", "counter", "Requests admitted.",
+            [](const AdmissionController::ClassStats& stats) { return stats.admitted; });
+        appendClassSamples("confab_admission_rejected_total", "counter", "Requests rejected for being over capacity.",
+            [](const AdmissionController::ClassStats& stats) { return stats.rejected; });
+
+        appendSample(metrics, "confab_worker_queue_depth", "gauge", "Tasks waiting for a database worker thread.",
+            "lane=\"metadata\"", m_workerPool.queueDepth(WorkerPool::kMetadata));
+        appendSample(metrics, "confab_worker_queue_depth", "gauge", "", "lane=\"bulk\"",
+            m_workerPool.queueDepth(WorkerPool::kBulk));
+
+        appendSample(metrics, "confab_response_cache_lookups_total", "counter", "Response cache lookups.",
+            "result=\"hit\"", m_responseCache.hits());
+        appendSample(metrics, "confab_response_cache_lookups_total", "counter", "", "result=\"miss\"",
+            m_responseCache.misses());
+        appendSample(metrics, "confab_response_cache_evictions_total", "counter", "Responses evicted from the cache.",
+            "", m_responseCache.evictions());
+        appendSample(metrics, "confab_response_cache_bytes", "gauge", "Size of the responses in the cache.", "",
+            m_responseCache.size());
+        appendSample(metrics, "confab_coalesced_requests_total", "counter",
+            "Cache misses that loaded a response, or joined a load already in flight.", "role=\"leader\"",
+            m_inFlight.leaders());
+        appendSample(metrics, "confab_coalesced_requests_total", "counter", "", "role=\"follower\"",
+            m_inFlight.followers());
+
+        appendSample(metrics, "confab_list_watchers", "gauge", "Open List watch requests.", "", m_listWatcher.size());
+
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        send(response, Pistache::Http::Code::Ok, metrics, MIME(Text, Plain));
+    }
+
+    /*! Dumps the most recent sampled request traces as Chrome trace event JSON. Untimed and untraced, so that dumping
+     * the traces doesn't add to them.
+     */
+    void getTrace(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        LOG(INFO) << "processing HTTP GET request for /trace";
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        response.send(Pistache::Http::Code::Ok, Tracer::global().chromeTraceJson(), MIME(Application, Json));
+    }
+
+    /*! Formats the most recent hot-path events from the EventLog, including those not yet drained to the INFO log.
+     * Untimed and untraced, like /trace.
+     */
+    void getEvents(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        LOG(INFO) << "processing HTTP GET request for /events";
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        response.send(Pistache::Http::Code::Ok, EventLog::global().dump(kEventsDumpSize), MIME(Text, Plain));
+    }
+
+    void getConfig(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        RequestTimer timer(this, kGetConfig, 0);
+        TraceScope scope(timer.trace());
+        LOG(INFO) << "processing HTTP GET request for /config";
+        flatbuffers::FlatBufferBuilder builder(kPageSize);
+        Data::FlatConfigBuilder configBuilder(builder);
+        configBuilder.add_versionMajor(kConfabVersionMajor);
+        configBuilder.add_versionMinor(kConfabVersionMinor);
+        configBuilder.add_versionPatch(kConfabVersionPatch);
+        configBuilder.add_dataChunkSize(m_options.dataChunkSize);
+        builder.Finish(configBuilder.Finish(), Data::FlatConfigIdentifier());
+        std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
+    }
+
     void getAsset(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
-        LOG(INFO) << "processing HTTP GET request for /asset/id/" << keyString;
         uint64_t key = Asset::stringToKey(keyString);
-        RecordPtr record = m_assetDatabase->findAsset(key);
-        if (record->empty()) {
-            LOG(ERROR) << "HTTP get request for Asset " << keyString << " not found, returning 404.";
-            response.headers().add<Pistache::Http::Header::Server>("confab");
-            response.send(Pistache::Http::Code::Not_Found);
-        } else {
-            LOG(INFO) << "HTTP get request returning Asset data for " << keyString;
-            char base64[kPageSize];
-            size_t encodedSize = 0;
-            base64_encode(reinterpret_cast<const char*>(record->data().data()), record->data().size(), base64,
-                &encodedSize, 0);
-            if (encodedSize >= kPageSize) {
-                LOG(ERROR) << "encoded size: " << encodedSize << " exceeds buffer size " << kPageSize;
+        logEvent(kHttpGetAsset, key);
+        ResponseCache::Key cacheKey = { ResponseCache::kAsset, key, 0 };
+        serveCached(AdmissionController::kMetadata, kGetAsset, request, cacheKey, std::move(response),
+                [this, key, keyString](bool& cacheable) -> ResponseCache::Body {
+            RecordPtr record = m_assetDatabase->findAsset(key);
+            if (record->empty()) {
+                LOG(ERROR) << "HTTP get request for Asset " << keyString << " not found, returning 404.";
+                return nullptr;
             }
-            response.headers().add<Pistache::Http::Header::Server>("confab");
-            response.send(Pistache::Http::Code::Ok, std::string(base64, encodedSize), MIME(Text, Plain));
-        }
+            // An Asset found by following deprecations can go stale when any Asset along the chain is deprecated, and
+            // a store only erases the responses for the Asset it deprecates, so only the newest version is cached.
+            cacheable = Data::GetFlatAsset(record->data().data())->key() == key;
+            logEvent(kHttpAssetReturned, key);
+            return std::make_shared<const std::string>(encodeBase64(record->data()));
+        });
     }
 
     void postAsset(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
         uint64_t key = Asset::stringToKey(keyString);
-        uint8_t decoded[kPageSize];
-        size_t decodedSize;
-        base64_decode(request.body().data(), request.body().size(), reinterpret_cast<char*>(decoded), &decodedSize, 0);
-        SizedPointer postedData(decoded, decodedSize);
-        LOG(INFO) << "processing HTTP POST request for /asset/id/" << keyString << ", " << postedData.size() << " bytes.";
-
-        // Sanity-check the provided serialized FlatAsset data.
-        auto verifier = flatbuffers::Verifier(postedData.data(), postedData.size());
-        bool status = Data::VerifyFlatAssetBuffer(verifier);
-        if (status) {
-            LOG(INFO) << "verified FlatAsset " << keyString;
-            status = m_assetDatabase->storeAsset(key, postedData);
-        } else {
-            LOG(ERROR) << "posted data did not verify for asset " << keyString;
-        }
+        std::string body = request.body();
+        dispatch(AdmissionController::kMetadata, kPostAsset, request, std::move(response),
+                [this, key, keyString, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
+            SizedPointer postedData(decoded.data(), decoded.size());
+            logEvent(kHttpPostAsset, key, postedData.size());
 
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (status) {
-            LOG(INFO) << "sending OK response after storing asset " << keyString;
-            response.send(Pistache::Http::Code::Ok);
-        } else {
-            LOG(ERROR) << "sending error response after failure to store asset " << keyString;
-            response.send(Pistache::Http::Code::Internal_Server_Error);
-        }
+            // Sanity-check the provided serialized FlatAsset data.
+            bool valid = verify(Data::VerifyFlatAssetBuffer, decoded);
+            if (valid && Data::GetFlatAsset(postedData.data())->chunkSize() > kMaxDataChunkSize) {
+                LOG(ERROR) << "posted asset " << keyString << " has chunk size larger than maximum of "
+                    << kMaxDataChunkSize;
+                valid = false;
+            }
+            if (valid && Data::GetFlatAsset(postedData.data())->contentDefinedChunks() &&
+                    !ChunkLayout::fromFlatAsset(Data::GetFlatAsset(postedData.data())).valid()) {
+                LOG(ERROR) << "posted asset " << keyString << " has too many chunk offsets, or offsets inconsistent "
+                    "with its size.";
+                valid = false;
+            }
+            bool status = false;
+            if (valid) {
+                logEvent(kHttpAssetVerified, key);
+                status = m_assetDatabase->storeAsset(key, postedData);
+                // Any cached response for this key, or for an Asset this one deprecates, may now be stale.
+                m_responseCache.erase({ ResponseCache::kAsset, key, 0 });
+                uint64_t deprecates = Data::GetFlatAsset(postedData.data())->deprecates();
+                if (deprecates) {
+                    m_responseCache.erase({ ResponseCache::kAsset, deprecates, 0 });
+                }
+            } else {
+                LOG(ERROR) << "posted data did not verify for asset " << keyString;
+            }
+
+            // An invalid Asset is refused with a client error, so the sender knows not to send it again.
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (status) {
+                logEvent(kHttpAssetStored, key);
+                send(response, Pistache::Http::Code::Ok);
+            } else if (!valid) {
+                send(response, Pistache::Http::Code::Bad_Request);
+            } else {
+                LOG(ERROR) << "sending error response after failure to store asset " << keyString;
+                send(response, Pistache::Http::Code::Internal_Server_Error);
+            }
+        });
     }
 
     void getNamedAsset(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto name = request.body();
         LOG(INFO) << "processing HTTP GET request for /asset/name/" << name;
-        RecordPtr record = m_assetDatabase->findNamedAsset(name);
-        if (record->empty()) {
-            LOG(ERROR) << "HTTP get request for named Asset " << name << " not found, returning 404.";
+        dispatch(AdmissionController::kMetadata, kGetNamedAsset, request, std::move(response),
+                [this, name](Pistache::Http::ResponseWriter& response) {
+            RecordPtr record = m_assetDatabase->findNamedAsset(name);
+            if (record->empty()) {
+                LOG(ERROR) << "HTTP get request for named Asset " << name << " not found, returning 404.";
+                response.headers().add<Pistache::Http::Header::Server>("confab");
+                send(response, Pistache::Http::Code::Not_Found);
+            } else {
+                LOG(INFO) << "HTTP get request returning named asset data for " << name;
+                std::string base64 = encodeBase64(record->data());
+                response.headers().add<Pistache::Http::Header::Server>("confab");
+                send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
+            }
+        });
+    }
+
+    void postAssetBatch(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        logEvent(kHttpPostAssetBatch, request.body().size());
+        std::string body = request.body();
+        dispatch(AdmissionController::kMetadata, kPostAssetBatch, request, std::move(response),
+                [this, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
             response.headers().add<Pistache::Http::Header::Server>("confab");
-            response.send(Pistache::Http::Code::Not_Found);
-        } else {
-            LOG(INFO) << "HTTP get request returning named asset data for " << name;
-            char base64[kPageSize];
-            size_t encodedSize = 0;
-            base64_encode(reinterpret_cast<const char*>(record->data().data()), record->data().size(), base64,
-                &encodedSize, 0);
-            if (encodedSize >= kPageSize) {
-                LOG(ERROR) << "encoded size: " << encodedSize << " exceeds buffer size " << kPageSize;
+
+            if (!verify(Data::VerifyFlatAssetBatchBuffer, decoded)) {
+                LOG(ERROR) << "posted data did not verify for asset batch request.";
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
             }
+            const Data::FlatAssetBatch* requestBatch = Data::GetFlatAssetBatch(decoded.data());
+            if (!requestBatch->keys() || requestBatch->keys()->size() == 0 ||
+                requestBatch->keys()->size() > kAssetBatchMaxKeys) {
+                LOG(ERROR) << "rejecting asset batch request with bad number of keys.";
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
+            }
+
+            std::vector<uint64_t> keys(requestBatch->keys()->begin(), requestBatch->keys()->end());
+            flatbuffers::FlatBufferBuilder builder(kPageSize);
+            std::vector<flatbuffers::Offset<Data::FlatAssetBatchEntry>> entries;
+            entries.reserve(keys.size());
+            // Any one FlatAsset fits well under kAssetBatchMaxBytes, so the first found is always returned, and the
+            // client makes progress however large the rest are.
+            size_t assetBytes = 0;
+            bool truncated = false;
+            m_assetDatabase->findAssets(keys, [&builder, &entries, &assetBytes, &truncated](uint64_t key,
+                    RecordPtr record) {
+                if (record->empty()) {
+                    entries.push_back(Data::CreateFlatAssetBatchEntry(builder, key, Data::BatchStatus_kNotFound));
+                } else if (assetBytes > 0 && assetBytes + record->data().size() > kAssetBatchMaxBytes) {
+                    truncated = true;
+                } else {
+                    assetBytes += record->data().size();
+                    auto asset = builder.CreateVector(record->data().data(), record->data().size());
+                    entries.push_back(Data::CreateFlatAssetBatchEntry(builder, key, Data::BatchStatus_kFound, asset));
+                }
+            });
+            auto entriesVector = builder.CreateVector(entries);
+            Data::FlatAssetBatchBuilder batchBuilder(builder);
+            batchBuilder.add_entries(entriesVector);
+            batchBuilder.add_truncated(truncated);
+            builder.Finish(batchBuilder.Finish());
+
+            std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+            logEvent(kHttpAssetBatchReturned, entries.size(), base64.size());
+            send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
+        });
+    }
+
+    void postDeltaPlan(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto keyString = request.param(":key").as<std::string>();
+        uint64_t key = Asset::stringToKey(keyString);
+        std::string body = request.body();
+        dispatch(AdmissionController::kBulk, kPostDeltaPlan, request, std::move(response),
+                [this, key, keyString, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
             response.headers().add<Pistache::Http::Header::Server>("confab");
-            response.send(Pistache::Http::Code::Ok, std::string(base64, encodedSize), MIME(Text, Plain));
-        }
+
+            if (!verify(Data::VerifyFlatDeltaPlanBuffer, decoded)) {
+                LOG(ERROR) << "posted data did not verify for delta plan request for Asset " << keyString;
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
+            }
+            const Data::FlatDeltaPlan* requestPlan = Data::GetFlatDeltaPlan(decoded.data());
+            if (!requestPlan->hashes() || requestPlan->hashes()->size() > kMaxDeltaChunks) {
+                LOG(ERROR) << "rejecting delta plan request for Asset " << keyString << " with bad number of hashes.";
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
+            }
+            logEvent(kHttpPostDeltaPlan, key, requestPlan->hashes()->size());
+
+            RecordPtr record = m_assetDatabase->findAsset(key);
+            if (record->empty()) {
+                LOG(ERROR) << "delta plan request for Asset " << keyString << " not found, returning 404.";
+                send(response, Pistache::Http::Code::Not_Found);
+                return;
+            }
+            const Data::FlatAsset* flatAsset = Data::GetFlatAsset(record->data().data());
+            ChunkLayout layout = ChunkLayout::fromFlatAsset(flatAsset);
+            if (layout.chunks() == 0 || layout.chunks() > kMaxDeltaChunks || !layout.valid()) {
+                LOG(ERROR) << "rejecting delta plan request for Asset " << keyString << " with " << layout.chunks()
+                    << " chunks.";
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
+            }
+
+            // The content hash of each chunk is recorded as the chunk is stored, so the plan is built without loading
+            // any chunk data.
+            std::vector<uint64_t> chunkHashes;
+            if (!m_assetDatabase->loadChunkHashes(key, layout.chunks(), chunkHashes)) {
+                LOG(ERROR) << "delta plan request for Asset " << keyString << " missing chunks, returning 404.";
+                send(response, Pistache::Http::Code::Not_Found);
+                return;
+            }
+
+            // Where the client holds more than one chunk with the same contents, any of them will do.
+            std::unordered_map<uint64_t, int32_t> localChunks;
+            for (size_t i = 0; i < requestPlan->hashes()->size(); ++i) {
+                localChunks.emplace(requestPlan->hashes()->Get(i), static_cast<int32_t>(i));
+            }
+            std::vector<int32_t> sources;
+            sources.reserve(layout.chunks());
+            uint64_t missingChunks = 0;
+            uint64_t missingBytes = 0;
+            for (uint64_t chunk = 0; chunk < layout.chunks(); ++chunk) {
+                auto found = localChunks.find(chunkHashes[chunk]);
+                if (found == localChunks.end()) {
+                    sources.push_back(-1);
+                    ++missingChunks;
+                    missingBytes += layout.chunkSize(chunk);
+                } else {
+                    sources.push_back(found->second);
+                }
+            }
+
+            flatbuffers::FlatBufferBuilder builder(kPageSize);
+            auto sourcesVector = builder.CreateVector(sources);
+            Data::FlatDeltaPlanBuilder planBuilder(builder);
+            planBuilder.add_sources(sourcesVector);
+            planBuilder.add_missingChunks(missingChunks);
+            planBuilder.add_missingBytes(missingBytes);
+            builder.Finish(planBuilder.Finish());
+
+            std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+            logEvent(kHttpDeltaPlanReturned, key, sources.size() - missingChunks, missingChunks);
+            send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
+        });
     }
 
     void getAssetData(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
         auto chunk = request.param(":chunk").as<uint64_t>();
-        LOG(INFO) << "processing HTTP GET request for /asset/data/" << keyString << "/" << chunk;
         uint64_t key = Asset::stringToKey(keyString);
-        RecordPtr assetData = m_assetDatabase->loadAssetDataChunk(key, chunk);
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (assetData->empty()) {
-            LOG(ERROR) << "HTTP get request for Asset Data " << keyString << " chunk " << chunk
-                << " not found, returning 404.";
-            response.send(Pistache::Http::Code::Not_Found);
-        } else {
-            LOG(INFO) << "HTTP get request for Asset Data " << keyString << " chunk " << chunk
-                << " returning Asset Data.";
-            char base64[kPageSize];
-            size_t encodedSize = 0;
-            base64_encode(reinterpret_cast<const char*>(assetData->data().data()), assetData->data().size(), base64,
-                &encodedSize, 0);
-            if (encodedSize >= kPageSize) {
-                LOG(ERROR) << "encoded Size: " << encodedSize << " exceeds buffer size " << kPageSize;
-            } else {
-                LOG(INFO) << "sending " << encodedSize << " bytes of Asset Data.";
+        logEvent(kHttpGetAssetData, key, chunk);
+        ResponseCache::Key cacheKey = { ResponseCache::kAssetData, key, chunk };
+        serveCached(AdmissionController::kBulk, kGetAssetData, request, cacheKey, std::move(response),
+                [this, key, keyString, chunk](bool&) -> ResponseCache::Body {
+            RecordPtr assetData = m_assetDatabase->loadAssetDataChunk(key, chunk);
+            if (assetData->empty()) {
+                LOG(ERROR) << "HTTP get request for Asset Data " << keyString << " chunk " << chunk
+                    << " not found, returning 404.";
+                return nullptr;
             }
-            response.send(Pistache::Http::Code::Ok, std::string(base64, encodedSize), MIME(Text, Plain));
-        }
+            logEvent(kHttpAssetDataReturned, key, chunk);
+            return std::make_shared<const std::string>(encodeBase64(assetData->data()));
+        });
     }
 
     void postAssetData(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
         auto chunk = request.param(":chunk").as<uint64_t>();
-        LOG(INFO) << "processing HTTP POST request for /asset/data/" << keyString << "/" << chunk;
         uint64_t key = Asset::stringToKey(keyString);
-        uint8_t decoded[kPageSize];
-        size_t decodedSize;
-        base64_decode(request.body().data(), request.body().size(), reinterpret_cast<char*>(decoded), &decodedSize, 0);
-        auto verifier = flatbuffers::Verifier(decoded, decodedSize);
-        bool status = Data::VerifyFlatAssetDataBuffer(verifier);
-        if (status) {
-            LOG(INFO) << "verified FlatAssetData " << keyString << " chunk " << chunk;
-            SizedPointer postedData(decoded, decodedSize);
-            status = m_assetDatabase->storeAssetDataChunk(key, chunk, postedData);
-        } else {
-            LOG(ERROR) << "posted data did not verify for asset data " << keyString << " chunk " << chunk;
-        }
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (status) {
-            LOG(INFO) << "sending OK response after storing asset " << keyString << " data chunk " << chunk;
-            response.send(Pistache::Http::Code::Ok);
-        } else {
-            LOG(ERROR) << "sending error response after failure to store asset " << keyString << " data chunk "
-                << chunk;
-            response.send(Pistache::Http::Code::Internal_Server_Error);
-        }
+        logEvent(kHttpPostAssetData, key, chunk);
+        std::string body = request.body();
+        dispatch(AdmissionController::kBulk, kPostAssetData, request, std::move(response),
+                [this, key, keyString, chunk, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
+            bool valid = verify(Data::VerifyFlatAssetDataBuffer, decoded);
+            bool status = false;
+            if (valid) {
+                logEvent(kHttpAssetDataVerified, key, chunk);
+                SizedPointer postedData(decoded.data(), decoded.size());
+                status = m_assetDatabase->storeAssetDataChunk(key, chunk, postedData);
+                m_responseCache.erase({ ResponseCache::kAssetData, key, chunk });
+            } else {
+                LOG(ERROR) << "posted data did not verify for asset data " << keyString << " chunk " << chunk;
+            }
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (status) {
+                logEvent(kHttpAssetDataStored, key, chunk);
+                send(response, Pistache::Http::Code::Ok);
+            } else if (!valid) {
+                send(response, Pistache::Http::Code::Bad_Request);
+            } else {
+                LOG(ERROR) << "sending error response after failure to store asset " << keyString << " data chunk "
+                    << chunk;
+                send(response, Pistache::Http::Code::Internal_Server_Error);
+            }
+        });
+    }
+
+    void postUploadData(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto uploadString = request.param(":upload").as<std::string>();
+        auto chunk = request.param(":chunk").as<uint64_t>();
+        uint64_t uploadId = Asset::stringToKey(uploadString);
+        logEvent(kHttpPostUploadData, uploadId, chunk);
+        std::string body = request.body();
+        dispatch(AdmissionController::kBulk, kPostUploadData, request, std::move(response),
+                [this, uploadId, uploadString, chunk, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
+            bool status = verify(Data::VerifyFlatAssetDataBuffer, decoded);
+            if (status) {
+                status = m_assetDatabase->storeStagedDataChunk(uploadId, chunk,
+                    SizedPointer(decoded.data(), decoded.size()));
+            } else {
+                LOG(ERROR) << "posted data did not verify for upload " << uploadString << " chunk " << chunk;
+            }
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (status) {
+                send(response, Pistache::Http::Code::Ok);
+            } else {
+                LOG(ERROR) << "sending error response after failure to stage upload " << uploadString << " chunk "
+                    << chunk;
+                send(response, Pistache::Http::Code::Internal_Server_Error);
+            }
+        });
+    }
+
+    void getUploadStatus(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto uploadString = request.param(":upload").as<std::string>();
+        auto chunks = request.param(":chunks").as<uint64_t>();
+        uint64_t uploadId = Asset::stringToKey(uploadString);
+        LOG(INFO) << "processing HTTP GET request for /asset/upload/" << uploadString << "/" << chunks;
+        dispatch(AdmissionController::kMetadata, kGetUploadStatus, request, std::move(response),
+                [this, uploadId, chunks](Pistache::Http::ResponseWriter& response) {
+            std::vector<std::pair<uint64_t, uint64_t>> missing;
+            bool known = m_assetDatabase->findMissingStagedChunks(uploadId, chunks, missing);
+            std::vector<Data::ChunkRange> ranges;
+            ranges.reserve(missing.size());
+            for (const auto& range : missing) {
+                ranges.emplace_back(range.first, range.second);
+            }
+            flatbuffers::FlatBufferBuilder builder(kPageSize);
+            auto rangesOffset = builder.CreateVectorOfStructs(ranges);
+            builder.Finish(Data::CreateFlatUploadStatus(builder, known, rangesOffset));
+            std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
+        });
+    }
+
+    void commitUpload(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto uploadString = request.param(":upload").as<std::string>();
+        uint64_t uploadId = Asset::stringToKey(uploadString);
+        LOG(INFO) << "processing HTTP POST request for /asset/commit/" << uploadString;
+        std::string body = request.body();
+        // Committing reads and hashes every chunk of the upload, so it is admitted and queued as bulk work.
+        dispatch(AdmissionController::kBulk, kCommitUpload, request, std::move(response),
+                [this, uploadId, uploadString, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
+            SizedPointer postedData(decoded.data(), decoded.size());
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+
+            if (!verify(Data::VerifyFlatAssetBuffer, decoded) ||
+                Data::GetFlatAsset(postedData.data())->chunkSize() > kMaxDataChunkSize) {
+                LOG(ERROR) << "posted asset did not verify for commit of upload " << uploadString;
+                send(response, Pistache::Http::Code::Bad_Request);
+                return;
+            }
+
+            const Data::FlatAsset* flatAsset = Data::GetFlatAsset(postedData.data());
+            if (!m_assetDatabase->commitUpload(uploadId, postedData)) {
+                LOG(ERROR) << "sending error response after failure to commit upload " << uploadString;
+                send(response, Pistache::Http::Code::Internal_Server_Error);
+                return;
+            }
+
+            // Any cached response for this Asset, its data, or an Asset it deprecates, may now be stale.
+            uint64_t key = flatAsset->key();
+            m_responseCache.erase({ ResponseCache::kAsset, key, 0 });
+            for (uint64_t chunk = 0; chunk < flatAsset->chunks(); ++chunk) {
+                m_responseCache.erase({ ResponseCache::kAssetData, key, chunk });
+            }
+            if (flatAsset->deprecates()) {
+                m_responseCache.erase({ ResponseCache::kAsset, flatAsset->deprecates(), 0 });
+            }
+            logEvent(kHttpUploadCommitted, uploadId, key);
+            send(response, Pistache::Http::Code::Ok);
+        });
     }
 
     void getList(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
-        LOG(INFO) << "processing GET request for /list/id " << keyString;
         uint64_t key = Asset::stringToKey(keyString);
-        RecordPtr listData = m_assetDatabase->loadList(key);
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (listData->empty()) {
-            LOG(ERROR) << "get frequest for list " << keyString << " not found, 404.";
-            response.send(Pistache::Http::Code::Not_Found);
-        } else {
-            LOG(INFO) << "get request for list " << keyString << " returning list data.";
-            char base64[kPageSize];
-            size_t encodedSize = 0;
-            base64_encode(reinterpret_cast<const char*>(listData->data().data()), listData->data().size(), base64,
-                &encodedSize, 0);
-            if (encodedSize >= kPageSize) {
-                LOG(ERROR) << "encoded size: " << encodedSize << " exceeds buffer size " << kPageSize;
+        logEvent(kHttpGetList, key);
+        dispatch(AdmissionController::kList, kGetList, request, std::move(response),
+                [this, key, keyString](Pistache::Http::ResponseWriter& response) {
+            RecordPtr listData = m_assetDatabase->loadList(key);
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (listData->empty()) {
+                LOG(ERROR) << "get frequest for list " << keyString << " not found, 404.";
+                send(response, Pistache::Http::Code::Not_Found);
             } else {
-                LOG(INFO) << "sending " << encodedSize << " bytes of List data.";
+                std::string base64 = encodeBase64(listData->data());
+                logEvent(kHttpListReturned, key, base64.size());
+                send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
             }
-            response.send(Pistache::Http::Code::Ok, std::string(base64, encodedSize), MIME(Text, Plain));
-        }
+        });
     }
 
     void postList(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
-        LOG(INFO) << "processing POST request for /list/id " << keyString;
         uint64_t key = Asset::stringToKey(keyString);
-        uint8_t decoded[kPageSize];
-        size_t decodedSize;
-        base64_decode(request.body().data(), request.body().size(), reinterpret_cast<char*>(decoded), &decodedSize, 0);
-        auto verifier = flatbuffers::Verifier(decoded, decodedSize);
-        bool status = Data::VerifyFlatListBuffer(verifier);
-        if (status) {
-            LOG(INFO) << "verified FlatList " << keyString;
-            SizedPointer postedData(decoded, decodedSize);
-            status = m_assetDatabase->storeList(key, postedData);
-        } else {
-            LOG(ERROR) << "posted data did not verify for list " << keyString;
-        }
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (status) {
-            LOG(INFO) << "sending OK  response after storing list " << keyString;
-            response.send(Pistache::Http::Code::Ok);
-        } else {
-            LOG(ERROR) << "sending error response after failure to store list " << keyString;
-            response.send(Pistache::Http::Code::Internal_Server_Error);
-        }
+        logEvent(kHttpPostList, key);
+        std::string body = request.body();
+        dispatch(AdmissionController::kList, kPostList, request, std::move(response),
+                [this, key, keyString, body](Pistache::Http::ResponseWriter& response) {
+            std::vector<uint8_t> decoded;
+            decodeBase64(body, decoded);
+            bool status = verify(Data::VerifyFlatListBuffer, decoded);
+            if (status) {
+                logEvent(kHttpListVerified, key);
+                SizedPointer postedData(decoded.data(), decoded.size());
+                status = m_assetDatabase->storeList(key, postedData);
+            } else {
+                LOG(ERROR) << "posted data did not verify for list " << keyString;
+            }
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (status) {
+                logEvent(kHttpListStored, key);
+                send(response, Pistache::Http::Code::Ok);
+            } else {
+                LOG(ERROR) << "sending error response after failure to store list " << keyString;
+                send(response, Pistache::Http::Code::Internal_Server_Error);
+            }
+        });
     }
 
     void getNamedList(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto name = request.body();
         LOG(INFO) << "processing GET request for /list/name '" << name << "'.";
-        RecordPtr listData = m_assetDatabase->findNamedList(name);
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (listData->empty()) {
-            LOG(ERROR) << "get request for list named " << name << " not found, 404.";
-            response.send(Pistache::Http::Code::Not_Found);
-        } else {
-            char base64[kPageSize];
-            size_t encodedSize = 0;
-            base64_encode(reinterpret_cast<const char*>(listData->data().data()), listData->data().size(), base64,
-                &encodedSize, 0);
-            if (encodedSize >= kPageSize) {
-                LOG(ERROR) << "encoded Size: " << encodedSize << " exceeds buffer size " << kPageSize;
+        dispatch(AdmissionController::kList, kGetNamedList, request, std::move(response),
+                [this, name](Pistache::Http::ResponseWriter& response) {
+            RecordPtr listData = m_assetDatabase->findNamedList(name);
+            response.headers().add<Pistache::Http::Header::Server>("confab");
+            if (listData->empty()) {
+                LOG(ERROR) << "get request for list named " << name << " not found, 404.";
+                send(response, Pistache::Http::Code::Not_Found);
             } else {
-                LOG(INFO) << "sending " << encodedSize << " bytes of Asset Data.";
+                std::string base64 = encodeBase64(listData->data());
+                logEvent(kHttpNamedListReturned, base64.size());
+                send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
             }
-            response.send(Pistache::Http::Code::Ok, std::string(base64, encodedSize), MIME(Text, Plain));
+        });
+    }
+
+    /*! Reads a page of List entries following token, and sends them as a base64-encoded FlatListPage.
+     *
+     * \param key The List key.
+     * \param keyString The List key as a string, for logging.
+     * \param token The token to list entries after.
+     * \param response The writer to send the response with.
+     */
+    void sendListItems(uint64_t key, const std::string& keyString, uint64_t token,
+            Pistache::Http::ResponseWriter& response) {
+        std::vector<uint64_t> pairs(m_options.listPageSize * 2);
+        size_t numPairs = m_assetDatabase->getListNext(key, token, m_options.listPageSize, pairs.data());
+        response.headers().add<Pistache::Http::Header::Server>("confab");
+        if (numPairs == 0) {
+            LOG(ERROR) << "error retrieving iterator pair list for " << keyString;
+            send(response, Pistache::Http::Code::Internal_Server_Error);
+        } else {
+            flatbuffers::FlatBufferBuilder builder(kPageSize);
+            builder.Finish(buildListPage(builder, token, pairs.data(), numPairs));
+            std::string base64 = encodeBase64(SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+            logEvent(kHttpListItemsReturned, numPairs, key, base64.size());
+            send(response, Pistache::Http::Code::Ok, base64, MIME(Text, Plain));
         }
     }
 
     void getListItems(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto keyString = request.param(":key").as<std::string>();
         auto fromString = request.param(":from").as<std::string>();
-        LOG(INFO) << "processing get /list/items/" << keyString << "/" << fromString;
+        uint64_t key = Asset::stringToKey(keyString);
+        uint64_t token = Asset::stringToKey(fromString);
+        logEvent(kHttpGetListItems, key, token);
+        dispatch(AdmissionController::kList, kGetListItems, request, std::move(response),
+                [this, key, keyString, token](Pistache::Http::ResponseWriter& response) {
+            sendListItems(key, keyString, token, response);
+        });
+    }
 
+    void watchListItems(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto keyString = request.param(":key").as<std::string>();
+        auto fromString = request.param(":from").as<std::string>();
         uint64_t key = Asset::stringToKey(keyString);
         uint64_t token = Asset::stringToKey(fromString);
-        std::array<uint64_t, kPageSize / 17> pairs;
-        size_t numPairs = m_assetDatabase->getListNext(key, token, pairs.size() / 2, pairs.data());
-        response.headers().add<Pistache::Http::Header::Server>("confab");
-        if (numPairs == 0) {
-            LOG(ERROR) << "error retrieving iterator pair list for " << keyString;
-            response.send(Pistache::Http::Code::Internal_Server_Error);
-        } else {
-            LOG(INFO) << "sending " << numPairs << " tokens back to client on list " << keyString;
-            std::string pairList;
-            for (auto i = 0; i < numPairs; ++i) {
-                pairList += Asset::keyToString(pairs[i * 2]) + " " + Asset::keyToString(pairs[(i * 2) + 1]) + "\n";
+        logEvent(kHttpWatchListItems, key, token);
+        auto timer = std::make_shared<RequestTimer>(this, kWatchListItems, 0);
+        auto writer = std::make_shared<Pistache::Http::ResponseWriter>(std::move(response));
+        auto respond = [this, key, keyString, token, writer, timer] {
+            if (!m_workerPool.post(WorkerPool::kMetadata, [this, key, keyString, token, writer, timer] {
+                    TraceScope scope(timer->trace());
+                    sendListItems(key, keyString, token, *writer);
+                })) {
+                TraceScope scope(timer->trace());
+                sendListItems(key, keyString, token, *writer);
+            }
+        };
+
+        // Watches are held open without counting against the List request limits, which are meant for requests doing
+        // database work, but are separately limited in number.
+        std::shared_ptr<ListWatcher::Waiter> waiter = m_listWatcher.watch(key, m_options.listWatchTimeout, respond);
+        if (!waiter) {
+            reject(AdmissionController::kList, *writer);
+            return;
+        }
+
+        // The waiter is registered before checking the list, so an entry added at any point after this check will
+        // notify it. If there are already entries after token, claim the waiter and answer right away.
+        auto check = [this, key, keyString, token, writer, waiter, timer] {
+            TraceScope scope(timer->trace());
+            std::array<uint64_t, 2> next;
+            size_t numPairs = m_assetDatabase->getListNext(key, token, 1, next.data());
+            if ((numPairs == 0 || next[0] != kEndList) && m_listWatcher.cancel(waiter)) {
+                sendListItems(key, keyString, token, *writer);
             }
-            response.send(Pistache::Http::Code::Ok, pairList, MIME(Text, Plain));
+        };
+        if (!m_workerPool.post(WorkerPool::kMetadata, check)) {
+            check();
         }
     }
 
-    int m_listenPort;
-    int m_numThreads;
+    HttpEndpoint::Options m_options;
     std::shared_ptr<AssetDatabase> m_assetDatabase;
+    ResponseCache m_responseCache;
+    SingleFlight<ResponseCache::Key, SharedLoad, ResponseCache::KeyHash> m_inFlight;
+    WorkerPool m_workerPool;
+    AdmissionController m_admission;
+    ListWatcher m_listWatcher;
+    std::thread m_expiryThread;
+    std::mutex m_expiryMutex;
+    std::condition_variable m_expiryCondition;
+    bool m_stopExpiry;
+    std::unique_ptr<RequestCapture> m_capture;
+    std::array<Histogram*, kNumRoutes> m_routeLatency;
+    std::array<Histogram*, kNumSizeClasses> m_sizeClassLatency;
     std::shared_ptr<Pistache::Http::Endpoint> m_server;
     Pistache::Rest::Router m_router;
 };
 
-HttpEndpoint::HttpEndpoint(int listenPort, int numThreads, std::shared_ptr<AssetDatabase> assetDatabase) :
-    m_handler(new HttpHandler(listenPort, numThreads, assetDatabase)) {
+HttpEndpoint::HttpEndpoint(const Options& options, std::shared_ptr<AssetDatabase> assetDatabase) :
+    m_handler(new HttpHandler(options, assetDatabase)) {
 }
 
 HttpEndpoint::~HttpEndpoint() {
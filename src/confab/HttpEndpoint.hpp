@@ -1,7 +1,13 @@
 #ifndef SRC_CONFAB_HTTP_ENDPOINT_HPP_
 #define SRC_CONFAB_HTTP_ENDPOINT_HPP_
 
+#include "AdmissionController.hpp"
+#include "Constants.hpp"
+
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <string>
 
 namespace Confab {
 
@@ -12,13 +18,43 @@ class AssetDatabase;
 class HttpEndpoint {
 public:
 
+    /*! Configuration for the HTTP server. The defaults match those of the confab-server command line flags.
+     */
+    struct Options {
+        /*! The TCP port to listen on for HTTP requests. */
+        int listenPort = 9080;
+        /*! The number of threads to use to listen on the port. */
+        int numThreads = 1;
+        /*! The size in bytes of AssetData chunks the server advertises for clients to use when adding new Assets. */
+        size_t dataChunkSize = kDefaultDataChunkSize;
+        /*! The maximum size in bytes of encoded Asset and AssetData responses to cache in memory. */
+        size_t responseCacheSize = 64 * 1024 * 1024;
+        /*! The number of database worker threads serving Asset, name, and List requests. */
+        int metadataThreads = 2;
+        /*! The number of database worker threads serving AssetData chunk requests. */
+        int bulkThreads = 2;
+        /*! The concurrency limits for each class of request, beyond which requests are rejected with 503. */
+        AdmissionController::Limits limits;
+        /*! How long a List watch request waits for new entries before returning with none. */
+        std::chrono::milliseconds listWatchTimeout = std::chrono::seconds(30);
+        /*! The maximum number of List watch requests to hold open at once. */
+        size_t maxListWatchers = 1024;
+        /*! How long an upload may go without a chunk being staged before its chunks are deleted, or 0 to never. */
+        std::chrono::seconds uploadSessionTimeout = std::chrono::hours(24);
+        /*! The maximum number of entries to return in each page of List items. */
+        size_t listPageSize = kDefaultListPageSize;
+        /*! If not empty, the file to capture incoming Asset and List requests to, for replay with confab-replay. */
+        std::string capturePath;
+        /*! Request bodies up to this many bytes are captured in full, larger ones by size and hash only. */
+        size_t captureMaxBodySize = 4096;
+    };
+
     /*! Constructs an HttpHandler to listen on the port with the supplied number of threads.
      *
-     * \param listenPort The TCP port to listen on for HTTP requests.
-     * \param numThreads The number of threads to use to listen on the port.
+     * \param options The server configuration.
      * \param assetDatabase A pointer to the shared AssetDatabase instance.
      */
-    HttpEndpoint(int listenPort, int numThreads, std::shared_ptr<AssetDatabase> assetDatabase);
+    HttpEndpoint(const Options& options, std::shared_ptr<AssetDatabase> assetDatabase);
 
     /*! Destructs an HttpHandler. Declared here to let us use std::unique_ptr with forward-declared classes.
      */
@@ -0,0 +1,70 @@
+#include "ListPage.hpp"
+
+#include "Constants.hpp"
+
+#include <vector>
+
+namespace Confab {
+
+flatbuffers::Offset<Data::FlatListPage> buildListPage(flatbuffers::FlatBufferBuilder& builder, uint64_t fromToken,
+    const uint64_t* pairs, size_t numPairs) {
+    bool end = numPairs > 0 && pairs[(numPairs - 1) * 2] == kEndList;
+    size_t numEntries = end ? numPairs - 1 : numPairs;
+
+    // A varint is at most 10 bytes, but the common case is 2 or 3.
+    std::vector<uint8_t> deltas;
+    deltas.reserve(numEntries * 3);
+    std::vector<uint64_t> keys(numEntries);
+    uint64_t previous = fromToken;
+    for (size_t i = 0; i < numEntries; ++i) {
+        uint64_t token = pairs[i * 2];
+        uint64_t delta = token - previous;
+        while (delta >= 0x80) {
+            deltas.push_back(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        deltas.push_back(static_cast<uint8_t>(delta));
+        keys[i] = pairs[(i * 2) + 1];
+        previous = token;
+    }
+
+    auto tokenDeltas = builder.CreateVector(deltas);
+    auto keysVector = builder.CreateVector(keys);
+    Data::FlatListPageBuilder pageBuilder(builder);
+    pageBuilder.add_from(fromToken);
+    pageBuilder.add_tokenDeltas(tokenDeltas);
+    pageBuilder.add_keys(keysVector);
+    pageBuilder.add_next(previous);
+    pageBuilder.add_end(end);
+    return pageBuilder.Finish();
+}
+
+bool readListPage(const Data::FlatListPage* page, std::function<void(uint64_t token, uint64_t key)> callback) {
+    if (!page->keys()) {
+        return !page->tokenDeltas() || page->tokenDeltas()->size() == 0;
+    }
+    if (!page->tokenDeltas()) {
+        return page->keys()->size() == 0;
+    }
+
+    const uint8_t* delta = page->tokenDeltas()->data();
+    const uint8_t* deltaEnd = delta + page->tokenDeltas()->size();
+    uint64_t token = page->from();
+    for (auto key : *page->keys()) {
+        uint64_t value = 0;
+        int shift = 0;
+        do {
+            if (delta == deltaEnd || shift > 63) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(*delta & 0x7f) << shift;
+            shift += 7;
+        } while (*(delta++) & 0x80);
+        token += value;
+        callback(token, key);
+    }
+
+    return delta == deltaEnd;
+}
+
+}  // namespace Confab
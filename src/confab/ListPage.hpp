@@ -0,0 +1,35 @@
+#ifndef SRC_CONFAB_LIST_PAGE_HPP_
+#define SRC_CONFAB_LIST_PAGE_HPP_
+
+#include "schemas/FlatListPage_generated.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace Confab {
+
+/*! Serializes a page of List entries, as returned by AssetDatabase::getListNext(), into a FlatListPage.
+ *
+ * \param builder The builder to serialize into. The caller is responsible for finishing the buffer.
+ * \param fromToken The token the page follows.
+ * \param pairs The <token, key> pairs, in list order. A trailing <kEndList, kEndList> pair is not added to the page,
+ *              but marks the page as the end of the List.
+ * \param numPairs The number of pairs in pairs.
+ * \return The offset of the serialized FlatListPage.
+ */
+flatbuffers::Offset<Data::FlatListPage> buildListPage(flatbuffers::FlatBufferBuilder& builder, uint64_t fromToken,
+    const uint64_t* pairs, size_t numPairs);
+
+/*! Decodes the entries of a FlatListPage.
+ *
+ * \param page The page to decode, which should already have been verified.
+ * \param callback Called once for each entry in the page, in order, with the entry's token and Asset key.
+ * \return true on success, false if the page was malformed, in which case callback may have been called for some of
+ *         the entries.
+ */
+bool readListPage(const Data::FlatListPage* page, std::function<void(uint64_t token, uint64_t key)> callback);
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_LIST_PAGE_HPP_
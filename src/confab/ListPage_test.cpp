@@ -0,0 +1,67 @@
+#include "ListPage.hpp"
+
+#include "Constants.hpp"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::vector<std::pair<uint64_t, uint64_t>> roundTrip(uint64_t fromToken, const std::vector<uint64_t>& pairs,
+    uint64_t* next, bool* end) {
+    flatbuffers::FlatBufferBuilder builder;
+    builder.Finish(Confab::buildListPage(builder, fromToken, pairs.data(), pairs.size() / 2));
+
+    auto verifier = flatbuffers::Verifier(builder.GetBufferPointer(), builder.GetSize());
+    EXPECT_TRUE(Confab::Data::VerifyFlatListPageBuffer(verifier));
+    const Confab::Data::FlatListPage* page = Confab::Data::GetFlatListPage(builder.GetBufferPointer());
+    *next = page->next();
+    *end = page->end();
+
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    EXPECT_TRUE(Confab::readListPage(page, [&entries](uint64_t token, uint64_t key) {
+        entries.emplace_back(token, key);
+    }));
+    return entries;
+}
+
+}  // namespace
+
+TEST(ListPageTest, RoundTripsEntriesAndContinuation) {
+    std::vector<uint64_t> pairs = {
+        1563000000000000, 0x1234567890abcdef,
+        1563000000000001, 0xffffffffffffffff,
+        1563000000300000, 0,
+    };
+    uint64_t next = 0;
+    bool end = true;
+    auto entries = roundTrip(Confab::kBeginList, pairs, &next, &end);
+
+    ASSERT_EQ(3, entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        EXPECT_EQ(pairs[i * 2], entries[i].first);
+        EXPECT_EQ(pairs[(i * 2) + 1], entries[i].second);
+    }
+    EXPECT_EQ(1563000000300000, next);
+    EXPECT_FALSE(end);
+}
+
+TEST(ListPageTest, EndOfListSentinelSetsEnd) {
+    std::vector<uint64_t> pairs = { 200, 0xa, Confab::kEndList, Confab::kEndList };
+    uint64_t next = 0;
+    bool end = false;
+    auto entries = roundTrip(100, pairs, &next, &end);
+
+    ASSERT_EQ(1, entries.size());
+    EXPECT_EQ(200, entries[0].first);
+    EXPECT_EQ(0xa, entries[0].second);
+    EXPECT_EQ(200, next);
+    EXPECT_TRUE(end);
+
+    entries = roundTrip(200, { Confab::kEndList, Confab::kEndList }, &next, &end);
+    EXPECT_EQ(0, entries.size());
+    EXPECT_EQ(200, next);
+    EXPECT_TRUE(end);
+}
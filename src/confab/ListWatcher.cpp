@@ -0,0 +1,162 @@
+#include "ListWatcher.hpp"
+
+#include <algorithm>
+
+namespace Confab {
+
+struct ListWatcher::Waiter {
+    uint64_t listKey;
+    // Set to nullptr when claimed, which also releases anything the callback captured.
+    Callback callback;
+};
+
+ListWatcher::ListWatcher(size_t maxWaiters) :
+    m_maxWaiters(maxWaiters),
+    m_running(false),
+    m_numWaiters(0) {
+}
+
+ListWatcher::~ListWatcher() {
+    shutdown();
+}
+
+void ListWatcher::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    m_timerThread = std::thread(&ListWatcher::timerLoop, this);
+}
+
+void ListWatcher::shutdown() {
+    std::vector<Callback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        for (auto& list : m_waiters) {
+            for (auto& waiter : list.second) {
+                callbacks.push_back(std::move(waiter->callback));
+                waiter->callback = nullptr;
+            }
+        }
+        m_waiters.clear();
+        m_numWaiters = 0;
+        m_deadlines = decltype(m_deadlines)();
+    }
+    m_condition.notify_all();
+    if (m_timerThread.joinable()) {
+        m_timerThread.join();
+    }
+
+    for (auto& callback : callbacks) {
+        callback();
+    }
+}
+
+std::shared_ptr<ListWatcher::Waiter> ListWatcher::watch(uint64_t listKey, std::chrono::milliseconds timeout,
+    Callback callback) {
+    auto waiter = std::make_shared<Waiter>();
+    waiter->listKey = listKey;
+    waiter->callback = std::move(callback);
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running || m_numWaiters >= m_maxWaiters) {
+            return nullptr;
+        }
+        m_waiters[listKey].push_back(waiter);
+        ++m_numWaiters;
+        m_deadlines.emplace(deadline, waiter);
+    }
+
+    // Wake the timer thread in case this is now the earliest deadline.
+    m_condition.notify_one();
+    return waiter;
+}
+
+bool ListWatcher::cancel(const std::shared_ptr<Waiter>& waiter) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return claim(waiter) != nullptr;
+}
+
+void ListWatcher::notify(uint64_t listKey) {
+    std::vector<Callback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto list = m_waiters.find(listKey);
+        if (list == m_waiters.end()) {
+            return;
+        }
+        for (auto& waiter : list->second) {
+            callbacks.push_back(std::move(waiter->callback));
+            waiter->callback = nullptr;
+        }
+        m_numWaiters -= list->second.size();
+        m_waiters.erase(list);
+    }
+
+    for (auto& callback : callbacks) {
+        callback();
+    }
+}
+
+size_t ListWatcher::size() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numWaiters;
+}
+
+void ListWatcher::timerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        if (m_deadlines.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (m_deadlines.top().first > now) {
+            m_condition.wait_until(lock, m_deadlines.top().first);
+            continue;
+        }
+
+        std::vector<Callback> callbacks;
+        while (!m_deadlines.empty() && m_deadlines.top().first <= now) {
+            Callback callback = claim(m_deadlines.top().second);
+            if (callback) {
+                callbacks.push_back(std::move(callback));
+            }
+            m_deadlines.pop();
+        }
+
+        lock.unlock();
+        for (auto& callback : callbacks) {
+            callback();
+        }
+        callbacks.clear();
+        lock.lock();
+    }
+}
+
+ListWatcher::Callback ListWatcher::claim(const std::shared_ptr<Waiter>& waiter) {
+    if (!waiter->callback) {
+        return nullptr;
+    }
+
+    auto list = m_waiters.find(waiter->listKey);
+    if (list != m_waiters.end()) {
+        auto& waiters = list->second;
+        waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+        if (waiters.empty()) {
+            m_waiters.erase(list);
+        }
+    }
+    --m_numWaiters;
+
+    Callback callback = std::move(waiter->callback);
+    waiter->callback = nullptr;
+    return callback;
+}
+
+}  // namespace Confab
@@ -0,0 +1,111 @@
+#ifndef SRC_CONFAB_LIST_WATCHER_HPP_
+#define SRC_CONFAB_LIST_WATCHER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Confab {
+
+/*! Registry of clients waiting for new entries to be added to Lists.
+ *
+ * Each waiter is a callback registered against a List key, called exactly once, either when notify() reports a change
+ * to that List or when the waiter's timeout expires. Idle waiters hold no thread, just a small entry in the registry,
+ * and a single timer thread handles the timeouts of all of them.
+ */
+class ListWatcher {
+public:
+    /*! Called once when the watched List changes or the watch times out.
+     */
+    using Callback = std::function<void()>;
+
+    /*! An opaque handle to a registered waiter, for use with cancel().
+     */
+    struct Waiter;
+
+    /*! Constructs a stopped ListWatcher.
+     *
+     * \param maxWaiters The maximum number of waiters to allow at once.
+     */
+    explicit ListWatcher(size_t maxWaiters);
+
+    /*! Shuts down the ListWatcher, if running.
+     */
+    ~ListWatcher();
+
+    /*! Starts the timer thread.
+     */
+    void start();
+
+    /*! Calls back every remaining waiter, so clients aren't left hanging, then stops the timer thread. Further calls to
+     * watch() will fail.
+     */
+    void shutdown();
+
+    /*! Registers a callback to call when the List changes, or the timeout expires, whichever happens first.
+     *
+     * \param listKey The key of the List to watch.
+     * \param timeout How long to wait for a change before calling back anyway.
+     * \param callback The function to call, from either the notifying thread or the timer thread.
+     * \return A handle to the new waiter, or nullptr if already at maxWaiters or shut down.
+     */
+    std::shared_ptr<Waiter> watch(uint64_t listKey, std::chrono::milliseconds timeout, Callback callback);
+
+    /*! Removes a waiter before it is called back. Used to claim a waiter when the caller has found the List already
+     * changed, and will answer the client itself.
+     *
+     * \param waiter The waiter to remove.
+     * \return true if the waiter was removed and its callback will never be called, false if the callback has already
+     *         been claimed by a notification, timeout, or previous cancel.
+     */
+    bool cancel(const std::shared_ptr<Waiter>& waiter);
+
+    /*! Calls back, on this thread, every waiter on a List.
+     *
+     * \param listKey The key of the List that changed.
+     */
+    void notify(uint64_t listKey);
+
+    /*! \return The number of waiters currently registered. */
+    size_t size();
+
+    /// @cond UNDOCUMENTED
+    ListWatcher(const ListWatcher&) = delete;
+    ListWatcher& operator=(const ListWatcher&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    using Deadline = std::pair<std::chrono::steady_clock::time_point, std::shared_ptr<Waiter>>;
+    struct DeadlineLater {
+        bool operator()(const Deadline& a, const Deadline& b) const { return a.first > b.first; }
+    };
+
+    void timerLoop();
+
+    // Removes waiter from m_waiters and returns its callback, or nullptr if already claimed. Must hold m_mutex.
+    Callback claim(const std::shared_ptr<Waiter>& waiter);
+
+    const size_t m_maxWaiters;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_running;
+    size_t m_numWaiters;
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<Waiter>>> m_waiters;
+    // Earliest deadline on top. Claimed waiters are left in place and skipped when they come due.
+    std::priority_queue<Deadline, std::vector<Deadline>, DeadlineLater> m_deadlines;
+    std::thread m_timerThread;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_LIST_WATCHER_HPP_
@@ -0,0 +1,136 @@
+#include "ListWatcher.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using Confab::ListWatcher;
+
+namespace {
+
+// Counts callbacks, so tests can wait for them to arrive from the timer thread.
+class CallCounter {
+public:
+    ListWatcher::Callback callback() {
+        return [this] {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_calls;
+            }
+            m_changed.notify_all();
+        };
+    }
+
+    bool waitFor(int calls, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_changed.wait_for(lock, timeout, [this, calls] { return m_calls >= calls; });
+    }
+
+    int calls() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_calls;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    int m_calls = 0;
+};
+
+const std::chrono::milliseconds kLongTimeout(60000);
+
+}  // namespace
+
+TEST(ListWatcherTest, NotifyCallsBackOnlyWaitersOnThatList) {
+    ListWatcher watcher(8);
+    watcher.start();
+    CallCounter first;
+    CallCounter second;
+    CallCounter other;
+    ASSERT_NE(nullptr, watcher.watch(1, kLongTimeout, first.callback()));
+    ASSERT_NE(nullptr, watcher.watch(1, kLongTimeout, second.callback()));
+    ASSERT_NE(nullptr, watcher.watch(2, kLongTimeout, other.callback()));
+    EXPECT_EQ(3u, watcher.size());
+
+    // Notification calls back on the notifying thread, so the callbacks have run by the time it returns.
+    watcher.notify(1);
+    EXPECT_EQ(1, first.calls());
+    EXPECT_EQ(1, second.calls());
+    EXPECT_EQ(0, other.calls());
+    EXPECT_EQ(1u, watcher.size());
+
+    // Each waiter is called back once, and notifying a List with no waiters does nothing.
+    watcher.notify(1);
+    watcher.notify(3);
+    EXPECT_EQ(1, first.calls());
+    EXPECT_EQ(0, other.calls());
+    watcher.shutdown();
+}
+
+TEST(ListWatcherTest, TimeoutCallsBackWithoutNotify) {
+    ListWatcher watcher(8);
+    watcher.start();
+    CallCounter late;
+    CallCounter soon;
+    auto lateStart = std::chrono::steady_clock::now();
+    ASSERT_NE(nullptr, watcher.watch(1, std::chrono::milliseconds(200), late.callback()));
+    ASSERT_NE(nullptr, watcher.watch(1, std::chrono::milliseconds(20), soon.callback()));
+
+    // The later-registered but earlier deadline wakes the timer thread first.
+    ASSERT_TRUE(soon.waitFor(1, std::chrono::seconds(5)));
+    EXPECT_EQ(0, late.calls());
+    ASSERT_TRUE(late.waitFor(1, std::chrono::seconds(5)));
+    EXPECT_GE(std::chrono::steady_clock::now() - lateStart, std::chrono::milliseconds(200));
+    EXPECT_EQ(0u, watcher.size());
+
+    // A timed out waiter is gone, so a later notification doesn't call it again.
+    watcher.notify(1);
+    EXPECT_EQ(1, late.calls());
+    EXPECT_EQ(1, soon.calls());
+    watcher.shutdown();
+}
+
+TEST(ListWatcherTest, CancelClaimsWaiterOnce) {
+    ListWatcher watcher(8);
+    watcher.start();
+    CallCounter counter;
+    auto waiter = watcher.watch(1, std::chrono::milliseconds(20), counter.callback());
+    ASSERT_NE(nullptr, waiter);
+    EXPECT_TRUE(watcher.cancel(waiter));
+    EXPECT_FALSE(watcher.cancel(waiter));
+    EXPECT_EQ(0u, watcher.size());
+
+    // Neither the timeout nor a notification reach a cancelled waiter.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    watcher.notify(1);
+    EXPECT_EQ(0, counter.calls());
+
+    // Once called back, a waiter can no longer be cancelled.
+    waiter = watcher.watch(1, kLongTimeout, counter.callback());
+    watcher.notify(1);
+    EXPECT_FALSE(watcher.cancel(waiter));
+    EXPECT_EQ(1, counter.calls());
+    watcher.shutdown();
+}
+
+TEST(ListWatcherTest, RejectsWaitersOverLimitOrAfterShutdown) {
+    ListWatcher watcher(2);
+    CallCounter counter;
+
+    // Not yet started.
+    EXPECT_EQ(nullptr, watcher.watch(1, kLongTimeout, counter.callback()));
+
+    watcher.start();
+    ASSERT_NE(nullptr, watcher.watch(1, kLongTimeout, counter.callback()));
+    ASSERT_NE(nullptr, watcher.watch(2, kLongTimeout, counter.callback()));
+    EXPECT_EQ(nullptr, watcher.watch(3, kLongTimeout, counter.callback()));
+
+    // Shutdown calls back the remaining waiters rather than leaving their clients hanging.
+    watcher.shutdown();
+    EXPECT_EQ(2, counter.calls());
+    EXPECT_EQ(0u, watcher.size());
+    EXPECT_EQ(nullptr, watcher.watch(1, kLongTimeout, counter.callback()));
+}
@@ -0,0 +1,149 @@
+#include "MappedFile.hpp"
+
+#include "glog/logging.h"
+#include "xxhash.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+size_t pageSize() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+}  // namespace
+
+namespace Confab {
+
+MappedFile::MappedFile(size_t maxMapSize, size_t windowSize) :
+    m_maxMapSize(maxMapSize),
+    m_windowSize(std::max((windowSize + pageSize() - 1) / pageSize(), static_cast<size_t>(1)) * pageSize()),
+    m_fd(-1),
+    m_size(0),
+    m_mapping(nullptr),
+    m_mappingOffset(0),
+    m_mappingSize(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const fs::path& path) {
+    close();
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        LOG(ERROR) << "error opening file " << path << " for reading: " << std::strerror(errno);
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0) {
+        LOG(ERROR) << "error reading size of file " << path << ": " << std::strerror(errno);
+        close();
+        return false;
+    }
+    m_size = static_cast<size_t>(fileStat.st_size);
+    if (m_size > 0 && !map(0, std::min(m_size, m_windowSize))) {
+        LOG(WARNING) << "unable to map file " << path << ", falling back to buffered reads: " << std::strerror(errno);
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    unmap();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_size = 0;
+    std::vector<uint8_t>().swap(m_buffer);
+}
+
+const SizedPointer MappedFile::read(size_t offset, size_t size) {
+    if (m_fd < 0 || size == 0 || offset > m_size || size > m_size - offset) {
+        return SizedPointer();
+    }
+    if (m_mapping && offset >= m_mappingOffset && offset + size <= m_mappingOffset + m_mappingSize) {
+        return SizedPointer(m_mapping + (offset - m_mappingOffset), size);
+    }
+    // A file mapped whole is always in the mapping, so a miss means either another window is needed or mmap failed.
+    if (m_mapping && m_size > m_maxMapSize && map(offset, size)) {
+        return SizedPointer(m_mapping + (offset - m_mappingOffset), size);
+    }
+
+    m_buffer.resize(size);
+    size_t bytesRead = 0;
+    while (bytesRead < size) {
+        ssize_t result = pread(m_fd, m_buffer.data() + bytesRead, size - bytesRead, offset + bytesRead);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            LOG(ERROR) << "error reading " << size << " bytes at offset " << offset << ": "
+                << (result < 0 ? std::strerror(errno) : "unexpected end of file");
+            return SizedPointer();
+        }
+        bytesRead += static_cast<size_t>(result);
+    }
+    return SizedPointer(m_buffer.data(), size);
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) {
+    if (m_fd >= 0 && offset < m_size) {
+        posix_fadvise(m_fd, offset, std::min(size, m_size - offset), POSIX_FADV_WILLNEED);
+    }
+}
+
+bool MappedFile::hash(uint64_t& hash) {
+    XXH64_state_t* hashState = XXH64_createState();
+    XXH64_reset(hashState, 0);
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < m_size; offset += m_windowSize) {
+        SizedPointer data = read(offset, std::min(m_windowSize, m_size - offset));
+        ok = data.data() != nullptr;
+        if (ok) {
+            XXH64_update(hashState, data.data(), data.size());
+        }
+    }
+    hash = XXH64_digest(hashState);
+    XXH64_freeState(hashState);
+    return ok && m_fd >= 0;
+}
+
+bool MappedFile::map(size_t offset, size_t size) {
+    unmap();
+    size_t mappingOffset = 0;
+    size_t mappingSize = m_size;
+    if (m_size > m_maxMapSize) {
+        mappingOffset = offset - (offset % pageSize());
+        mappingSize = std::min(std::max(m_windowSize, offset + size - mappingOffset), m_size - mappingOffset);
+    }
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, m_fd, mappingOffset);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+    m_mapping = static_cast<uint8_t*>(mapping);
+    m_mappingOffset = mappingOffset;
+    m_mappingSize = mappingSize;
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (m_mapping) {
+        munmap(m_mapping, m_mappingSize);
+        m_mapping = nullptr;
+        m_mappingOffset = 0;
+        m_mappingSize = 0;
+    }
+}
+
+}  // namespace Confab
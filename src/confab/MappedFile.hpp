@@ -0,0 +1,105 @@
+#ifndef SRC_CONFAB_MAPPED_FILE_HPP_
+#define SRC_CONFAB_MAPPED_FILE_HPP_
+
+#include "SizedPointer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace Confab {
+
+/*! Read-only view of a file for sequential scans like hashing and chunked upload, backed by mmap so that bytes are read
+ * straight out of the page cache instead of being copied into a buffer first.
+ *
+ * Files up to maxMapSize bytes are mapped whole. Larger files are mapped a window at a time, so that a scan of a huge
+ * file needs only a bounded amount of address space. Mappings are advised as sequential, which lets the kernel read
+ * ahead aggressively and drop pages behind the scan. If mmap fails, for example on some network filesystems, reads
+ * fall back to pread into an owned buffer.
+ */
+class MappedFile {
+public:
+    /*! Files at or below this size are mapped whole. */
+    static constexpr size_t kDefaultMaxMapSize = 1024 * 1024 * 1024;
+    /*! Size of each mapping of a file too big to map whole. */
+    static constexpr size_t kDefaultWindowSize = 64 * 1024 * 1024;
+
+    /*! Constructs a closed MappedFile.
+     *
+     * \param maxMapSize Files larger than this many bytes are mapped a window at a time.
+     * \param windowSize The size of each window of a larger file, rounded up to a whole number of pages.
+     */
+    MappedFile(size_t maxMapSize = kDefaultMaxMapSize, size_t windowSize = kDefaultWindowSize);
+
+    /*! Unmaps and closes the file, if open.
+     */
+    ~MappedFile();
+
+    /*! Opens a file for reading and maps it, or its first window.
+     *
+     * \param path The file to open.
+     * \return true on success, false if the file could not be opened.
+     */
+    bool open(const fs::path& path);
+
+    /*! Unmaps and closes the file.
+     */
+    void close();
+
+    /*! Exposes a range of the file. The returned pointer is valid until the next call to read() or close().
+     *
+     * \param offset The offset of the first byte in the file.
+     * \param size The number of bytes, which must be no more than the window size.
+     * \return A pointer to the bytes, or an empty SizedPointer if the range is out of bounds or could not be read.
+     */
+    const SizedPointer read(size_t offset, size_t size);
+
+    /*! Hints that a range of the file will be read soon, so the kernel can start reading it in. Does not block.
+     *
+     * \param offset The offset of the first byte in the file.
+     * \param size The number of bytes.
+     */
+    void prefetch(size_t offset, size_t size);
+
+    /*! Computes the XXH64 hash of the whole file, with seed 0.
+     *
+     * \param hash Set to the hash of the file contents.
+     * \return true on success, false if the file could not be read.
+     */
+    bool hash(uint64_t& hash);
+
+    /*! \return The size of the open file in bytes. */
+    size_t size() const { return m_size; }
+
+    /*! \return true if reads come from a mapping, false if from the pread fallback or if the file is closed. */
+    bool mapped() const { return m_mapping != nullptr; }
+
+    /// @cond UNDOCUMENTED
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    /*! Maps the window holding a range of the file, replacing any current mapping.
+     *
+     * \return true on success, false if mmap failed.
+     */
+    bool map(size_t offset, size_t size);
+    void unmap();
+
+    const size_t m_maxMapSize;
+    const size_t m_windowSize;
+    int m_fd;
+    size_t m_size;
+    uint8_t* m_mapping;
+    size_t m_mappingOffset;
+    size_t m_mappingSize;
+    std::vector<uint8_t> m_buffer;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_MAPPED_FILE_HPP_
@@ -0,0 +1,111 @@
+#include "MappedFile.hpp"
+
+#include "xxhash.h"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+class MappedFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-mapped-file-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+    }
+
+    void TearDown() override {
+        fs::remove(m_path);
+    }
+
+    void writeFile(size_t size) {
+        m_contents.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            m_contents[i] = static_cast<uint8_t>((i * 131) ^ (i >> 8));
+        }
+        std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(m_contents.data()), m_contents.size());
+    }
+
+    fs::path m_path;
+    std::vector<uint8_t> m_contents;
+};
+
+}  // namespace
+
+TEST_F(MappedFileTest, ReadsWholeMappedFile) {
+    writeFile(100000);
+    Confab::MappedFile file;
+    ASSERT_TRUE(file.open(m_path));
+    EXPECT_TRUE(file.mapped());
+    EXPECT_EQ(m_contents.size(), file.size());
+
+    Confab::SizedPointer data = file.read(12345, 5000);
+    ASSERT_NE(nullptr, data.data());
+    ASSERT_EQ(5000u, data.size());
+    EXPECT_EQ(0, std::memcmp(m_contents.data() + 12345, data.data(), data.size()));
+
+    uint64_t hash = 0;
+    EXPECT_TRUE(file.hash(hash));
+    EXPECT_EQ(XXH64(m_contents.data(), m_contents.size(), 0), hash);
+}
+
+TEST_F(MappedFileTest, ReadsLargeFileInWindows) {
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    writeFile(pageSize * 10 + 123);
+    // Map files above one page a window of two pages at a time.
+    Confab::MappedFile file(pageSize, pageSize * 2);
+    ASSERT_TRUE(file.open(m_path));
+
+    // Reads in order across window boundaries, including ones that straddle them and end at the end of the file.
+    size_t chunkSize = pageSize + 100;
+    for (size_t offset = 0; offset < m_contents.size(); offset += chunkSize) {
+        size_t size = std::min(chunkSize, m_contents.size() - offset);
+        Confab::SizedPointer data = file.read(offset, size);
+        ASSERT_NE(nullptr, data.data());
+        ASSERT_EQ(size, data.size());
+        EXPECT_EQ(0, std::memcmp(m_contents.data() + offset, data.data(), size)) << "offset " << offset;
+    }
+
+    // Reads can go backwards too.
+    Confab::SizedPointer data = file.read(10, 20);
+    ASSERT_NE(nullptr, data.data());
+    EXPECT_EQ(0, std::memcmp(m_contents.data() + 10, data.data(), 20));
+
+    uint64_t hash = 0;
+    EXPECT_TRUE(file.hash(hash));
+    EXPECT_EQ(XXH64(m_contents.data(), m_contents.size(), 0), hash);
+}
+
+TEST_F(MappedFileTest, RejectsOutOfBoundsReads) {
+    writeFile(1000);
+    Confab::MappedFile file;
+    ASSERT_TRUE(file.open(m_path));
+    EXPECT_EQ(nullptr, file.read(900, 101).data());
+    EXPECT_EQ(nullptr, file.read(1001, 1).data());
+    EXPECT_NE(nullptr, file.read(900, 100).data());
+
+    file.close();
+    EXPECT_EQ(0u, file.size());
+    EXPECT_EQ(nullptr, file.read(0, 1).data());
+}
+
+TEST_F(MappedFileTest, EmptyAndMissingFiles) {
+    writeFile(0);
+    Confab::MappedFile file;
+    ASSERT_TRUE(file.open(m_path));
+    EXPECT_EQ(0u, file.size());
+    uint64_t hash = 0;
+    EXPECT_TRUE(file.hash(hash));
+    EXPECT_EQ(XXH64(nullptr, 0, 0), hash);
+
+    fs::remove(m_path);
+    EXPECT_FALSE(file.open(m_path));
+}
@@ -0,0 +1,236 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+/*! Returns the shard the calling thread should update. Threads are assigned shards round-robin on first use.
+ */
+size_t threadShard() {
+    static std::atomic<size_t> nextShard(0);
+    thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % Confab::kMetricShards;
+    return shard;
+}
+
+std::string formatDouble(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    return std::string(buffer);
+}
+
+std::string withLabels(const std::string& name, const std::string& labels, const std::string& extra = "") {
+    if (labels.empty() && extra.empty()) {
+        return name;
+    }
+    if (labels.empty() || extra.empty()) {
+        return name + "{" + labels + extra + "}";
+    }
+    return name + "{" + labels + "," + extra + "}";
+}
+
+}  // namespace
+
+namespace Confab {
+
+Counter::Counter() {
+    for (auto& shard : m_shards) {
+        shard.value = 0;
+    }
+}
+
+void Counter::add(uint64_t amount) {
+    m_shards[threadShard()].value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& shard : m_shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram() {
+    for (auto& shard : m_shards) {
+        for (auto& bucket : shard.buckets) {
+            bucket = 0;
+        }
+        shard.count = 0;
+        shard.sum = 0;
+    }
+}
+
+void Histogram::record(uint64_t value) {
+    Shard& shard = m_shards[threadShard()];
+    shard.buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (const auto& shard : m_shards) {
+        total += shard.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Histogram::sum() const {
+    uint64_t total = 0;
+    for (const auto& shard : m_shards) {
+        total += shard.sum.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Histogram::quantile(double quantile) const {
+    std::array<uint64_t, kNumBuckets> buckets = {};
+    uint64_t total = 0;
+    for (const auto& shard : m_shards) {
+        for (size_t i = 0; i < kNumBuckets; ++i) {
+            uint64_t count = shard.buckets[i].load(std::memory_order_relaxed);
+            buckets[i] += count;
+            total += count;
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // The rank of the value at the quantile, counting from 1.
+    uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(total) + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return bucketValue(i);
+        }
+    }
+    return bucketValue(kNumBuckets - 1);
+}
+
+// static
+size_t Histogram::bucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= kMaxExponent) {
+        return kNumBuckets - 1;
+    }
+    size_t subBucket = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return ((exponent - kSubBucketBits + 1) * kSubBuckets) + subBucket;
+}
+
+// static
+uint64_t Histogram::bucketValue(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    int exponent = static_cast<int>(index / kSubBuckets) + kSubBucketBits - 1;
+    uint64_t width = 1ull << (exponent - kSubBucketBits);
+    uint64_t lower = (kSubBuckets + (index % kSubBuckets)) * width;
+    return lower + (width / 2);
+}
+
+// static
+MetricsRegistry& MetricsRegistry::global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::MetricsRegistry() {
+}
+
+Counter* MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Family& family = m_families[name];
+    family.help = help;
+    family.type = kCounter;
+    family.scale = 1.0;
+    auto& counter = family.counters[labels];
+    if (!counter) {
+        counter.reset(new Counter());
+    }
+    return counter.get();
+}
+
+Histogram* MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels,
+    double scale) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Family& family = m_families[name];
+    family.help = help;
+    family.type = kHistogram;
+    family.scale = scale;
+    auto& histogram = family.histograms[labels];
+    if (!histogram) {
+        histogram.reset(new Histogram());
+    }
+    return histogram.get();
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels,
+    std::function<double()> sample) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Family& family = m_families[name];
+    family.help = help;
+    family.type = kGauge;
+    family.scale = 1.0;
+    family.gauges[labels] = std::move(sample);
+}
+
+std::string MetricsRegistry::exposition() {
+    static const std::array<double, 4> kQuantiles = { { 0.5, 0.9, 0.99, 0.999 } };
+
+    std::string out;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& entry : m_families) {
+        const std::string& name = entry.first;
+        const Family& family = entry.second;
+        out += "# HELP " + name + " " + family.help + "\n";
+        switch (family.type) {
+            case kCounter:
+                out += "# TYPE " + name + " counter\n";
+                for (const auto& counter : family.counters) {
+                    out += withLabels(name, counter.first) + " " + std::to_string(counter.second->value()) + "\n";
+                }
+                break;
+
+            case kGauge:
+                out += "# TYPE " + name + " gauge\n";
+                for (const auto& gauge : family.gauges) {
+                    out += withLabels(name, gauge.first) + " " + formatDouble(gauge.second()) + "\n";
+                }
+                break;
+
+            case kHistogram:
+                out += "# TYPE " + name + " summary\n";
+                for (const auto& histogram : family.histograms) {
+                    const std::string& labels = histogram.first;
+                    for (double quantile : kQuantiles) {
+                        out += withLabels(name, labels, "quantile=\"" + formatDouble(quantile) + "\"") + " " +
+                            formatDouble(histogram.second->quantile(quantile) * family.scale) + "\n";
+                    }
+                    out += withLabels(name + "_sum", labels) + " " +
+                        formatDouble(histogram.second->sum() * family.scale) + "\n";
+                    out += withLabels(name + "_count", labels) + " " + std::to_string(histogram.second->count()) +
+                        "\n";
+                }
+                break;
+        }
+    }
+    return out;
+}
+
+void appendSample(std::string& out, const std::string& name, const char* type, const std::string& help,
+    const std::string& labels, double value) {
+    if (!help.empty()) {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    }
+    out += withLabels(name, labels) + " " + formatDouble(value) + "\n";
+}
+
+}  // namespace Confab
@@ -0,0 +1,230 @@
+#ifndef SRC_CONFAB_METRICS_HPP_
+#define SRC_CONFAB_METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Confab {
+
+/*! Number of independent shards each metric keeps. Threads are spread across shards so that concurrent updates
+ * almost never touch the same cache line, making updates a single uncontended relaxed atomic add.
+ */
+constexpr size_t kMetricShards = 8;
+
+/*! A monotonically increasing count, updated without locks.
+ */
+class Counter {
+public:
+    Counter();
+
+    /*! Adds to the count.
+     *
+     * \param amount The amount to add.
+     */
+    void add(uint64_t amount = 1);
+
+    /*! \return The sum of all additions so far. */
+    uint64_t value() const;
+
+    /// @cond UNDOCUMENTED
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value;
+    };
+    std::array<Shard, kMetricShards> m_shards;
+};
+
+/*! A distribution of recorded values in log-linear buckets, in the style of an HDR histogram. Values are bucketed by
+ * their power of two and then into 8 linear sub-buckets within it, so quantiles are accurate to within 12.5% across the
+ * whole range. Updated without locks.
+ */
+class Histogram {
+public:
+    /*! Values at or above 2^kMaxExponent are counted in the top bucket.
+     */
+    static constexpr int kMaxExponent = 40;
+    static constexpr int kSubBucketBits = 3;
+    static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+    static constexpr size_t kNumBuckets = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    Histogram();
+
+    /*! Adds a value to the distribution.
+     *
+     * \param value The value to record.
+     */
+    void record(uint64_t value);
+
+    /*! \return The number of values recorded. */
+    uint64_t count() const;
+
+    /*! \return The sum of all values recorded. */
+    uint64_t sum() const;
+
+    /*! Estimates a quantile of the recorded values.
+     *
+     * \param quantile The quantile to compute, between 0 and 1.
+     * \return The estimated value at the quantile, or 0 if nothing has been recorded.
+     */
+    uint64_t quantile(double quantile) const;
+
+    /*! Computes the bucket a value is counted in.
+     *
+     * \param value The value to bucket.
+     * \return The bucket index, less than kNumBuckets.
+     */
+    static size_t bucketIndex(uint64_t value);
+
+    /*! Computes a representative value for a bucket, the midpoint of the range of values it counts.
+     *
+     * \param index The bucket index.
+     * \return The midpoint value.
+     */
+    static uint64_t bucketValue(size_t index);
+
+    /// @cond UNDOCUMENTED
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, kNumBuckets> buckets;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+    };
+    std::array<Shard, kMetricShards> m_shards;
+};
+
+/*! Records the time from construction to destruction, in microseconds, into a Histogram.
+ */
+class LatencyTimer {
+public:
+    /*! Starts timing.
+     *
+     * \param histogram The histogram to record into, or nullptr to record nothing.
+     */
+    explicit LatencyTimer(Histogram* histogram) :
+        m_histogram(histogram),
+        m_start(std::chrono::steady_clock::now()) { }
+
+    ~LatencyTimer() {
+        if (m_histogram) {
+            m_histogram->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_start).count());
+        }
+    }
+
+    /// @cond UNDOCUMENTED
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    Histogram* m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/*! A process-wide collection of named metrics, which can be rendered in the Prometheus text exposition format.
+ *
+ * Metrics are created on first request and live as long as the process, so callers look them up once and keep the
+ * returned pointers, and updates never touch the registry.
+ */
+class MetricsRegistry {
+public:
+    /*! \return The process-wide registry. */
+    static MetricsRegistry& global();
+
+    MetricsRegistry();
+
+    /*! Returns the counter with the given name and labels, creating it if needed.
+     *
+     * \param name The metric family name, such as "confab_http_requests_total".
+     * \param help A description of the metric family.
+     * \param labels Prometheus labels distinguishing this counter within its family, such as "route=\"get_asset\"", or
+     *               empty for none.
+     * \return A pointer to the counter, valid for the life of the registry.
+     */
+    Counter* counter(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    /*! Returns the histogram with the given name and labels, creating it if needed. Histograms are exposed as
+     * Prometheus summaries with 0.5, 0.9, 0.99, and 0.999 quantiles.
+     *
+     * \param name The metric family name, such as "confab_http_request_duration_seconds".
+     * \param help A description of the metric family.
+     * \param labels Prometheus labels distinguishing this histogram within its family.
+     * \param scale Multiplier applied to recorded values when exposed, such as 1e-6 to expose microseconds as seconds.
+     * \return A pointer to the histogram, valid for the life of the registry.
+     */
+    Histogram* histogram(const std::string& name, const std::string& help, const std::string& labels = "",
+        double scale = 1.0);
+
+    /*! Registers a gauge, sampled by calling a function each time metrics are rendered. Replaces any gauge already
+     * registered with the same name and labels. As the registry lives as long as the process, the function should only
+     * depend on state that does too, such as other metrics in the registry.
+     *
+     * \param name The metric family name.
+     * \param help A description of the metric family.
+     * \param labels Prometheus labels distinguishing this gauge within its family.
+     * \param sample Returns the current value of the gauge.
+     */
+    void gauge(const std::string& name, const std::string& help, const std::string& labels,
+        std::function<double()> sample);
+
+    /*! Renders every metric in the Prometheus text exposition format.
+     *
+     * \return The rendered metrics.
+     */
+    std::string exposition();
+
+    /// @cond UNDOCUMENTED
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    enum Type { kCounter, kGauge, kHistogram };
+
+    struct Family {
+        std::string help;
+        Type type;
+        double scale;
+        // Keyed by labels.
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::function<double()>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+};
+
+/*! Appends a single sample to Prometheus text exposition output, for values kept outside of any MetricsRegistry and
+ * read when metrics are rendered.
+ *
+ * \param out The output to append to.
+ * \param name The metric name.
+ * \param type The Prometheus metric type, "counter" or "gauge".
+ * \param help A description of the metric, or empty to omit the HELP and TYPE lines when this is not the first sample
+ *             in its family.
+ * \param labels Prometheus labels for the sample, or empty for none.
+ * \param value The sampled value.
+ */
+void appendSample(std::string& out, const std::string& name, const char* type, const std::string& help,
+    const std::string& labels, double value);
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_METRICS_HPP_
@@ -0,0 +1,56 @@
+#include "Metrics.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(MetricsTest, HistogramBucketsWithinRelativeError) {
+    for (uint64_t value = 0; value < (1 << 20); value += 7) {
+        uint64_t bucketValue = Confab::Histogram::bucketValue(Confab::Histogram::bucketIndex(value));
+        EXPECT_LE(bucketValue, value + (value / 16) + 1);
+        EXPECT_GE(bucketValue + (value / 16) + 1, value);
+    }
+    EXPECT_EQ(Confab::Histogram::kNumBuckets - 1, Confab::Histogram::bucketIndex(~0ull));
+}
+
+TEST(MetricsTest, HistogramQuantilesAcrossThreads) {
+    Confab::Histogram histogram;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&histogram] {
+            for (uint64_t value = 1; value <= 1000; ++value) {
+                histogram.record(value);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(4000u, histogram.count());
+    EXPECT_EQ(4 * 500500u, histogram.sum());
+    EXPECT_NEAR(500.0, histogram.quantile(0.5), 500.0 / 8);
+    EXPECT_NEAR(990.0, histogram.quantile(0.99), 990.0 / 8);
+    EXPECT_EQ(0u, Confab::Histogram().quantile(0.5));
+}
+
+TEST(MetricsTest, RegistryExposition) {
+    Confab::MetricsRegistry registry;
+    Confab::Counter* hits = registry.counter("test_lookups_total", "Test lookups.", "result=\"hit\"");
+    EXPECT_EQ(hits, registry.counter("test_lookups_total", "Test lookups.", "result=\"hit\""));
+    hits->add(3);
+    registry.counter("test_lookups_total", "Test lookups.", "result=\"miss\"")->add();
+    registry.histogram("test_seconds", "Test latency.", "", 1e-6)->record(2);
+    registry.gauge("test_ratio", "Test ratio.", "", [] { return 0.75; });
+
+    std::string text = registry.exposition();
+    EXPECT_NE(std::string::npos, text.find("# TYPE test_lookups_total counter\n"));
+    EXPECT_NE(std::string::npos, text.find("test_lookups_total{result=\"hit\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("test_lookups_total{result=\"miss\"} 1\n"));
+    EXPECT_NE(std::string::npos, text.find("# TYPE test_seconds summary\n"));
+    EXPECT_NE(std::string::npos, text.find("test_seconds{quantile=\"0.5\"} 2e-06\n"));
+    EXPECT_NE(std::string::npos, text.find("test_seconds_count 1\n"));
+    EXPECT_NE(std::string::npos, text.find("test_ratio 0.75\n"));
+}
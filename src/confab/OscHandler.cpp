@@ -3,8 +3,13 @@
 #include "Asset.hpp"
 #include "AssetDatabase.hpp"
 #include "CacheManager.hpp"
+#include "ChunkLayout.hpp"
 #include "Constants.hpp"
 #include "HttpClient.hpp"
+#include "ListPage.hpp"
+#include "Metrics.hpp"
+#include "UpstreamQueue.hpp"
+#include "WorkerPool.hpp"
 #include "schemas/FlatAsset_generated.h"
 #include "schemas/FlatAssetData_generated.h"
 #include "schemas/FlatList_generated.h"
@@ -15,11 +20,26 @@
 #include "osc/OscPacketListener.h"
 #include "osc/OscReceivedElements.h"
 
+#include <algorithm>
 #include <cstring>
-#include <future>
+#include <vector>
 
 namespace Confab {
 
+// Maximum number of List entries to send to sclang in a single /listItems message. Each entry is 34 characters, so
+// this keeps the packet well within the largest UDP datagram.
+static const size_t kOscMaxListItems = 1024;
+
+// Threads handling lookups, List requests, and short string Assets, and threads handling Asset loads and file
+// additions. Loads can wait a long time on downloads, so they get their own threads and lookups don't queue behind
+// them.
+static const int kOscMetadataThreads = 4;
+static const int kOscBulkThreads = 4;
+
+static const char* kCoalescedMetric = "confab_client_coalesced_requests_total";
+static const char* kCoalescedHelp =
+    "Asset requests that started a lookup or download, or joined one already in flight.";
+
 /*! Handler class for processing incoming OSC messages.
  */
 class OscHandler::OscListener : public osc::OscPacketListener {
@@ -53,7 +73,7 @@ public:
                 if (assetKey == 0) {
                     LOG(ERROR) << "/assetFind got invalid key value: " << assetIdString;
                 } else {
-                    std::async(std::launch::async, [this, assetKey] {
+                    m_handler->m_workers->post(WorkerPool::kMetadata, [this, assetKey] {
                         m_handler->findAsset(assetKey);
                     });
                 }
@@ -65,7 +85,7 @@ public:
                 }
 
                 LOG(INFO) << "processing [/assetFindName " << name << "]";
-                std::async(std::launch::async, [this, name] {
+                m_handler->m_workers->post(WorkerPool::kMetadata, [this, name] {
                     m_handler->findNamedAsset(name);
                 });
             } else if (std::strcmp("/assetLoad", message.AddressPattern()) == 0) {
@@ -81,7 +101,7 @@ public:
                 if (key == 0) {
                     LOG(ERROR) << "/assetLoad got invalid key value: " << keyString;
                 } else {
-                    std::async(std::launch::async, [this, key] {
+                    m_handler->m_workers->post(WorkerPool::kBulk, [this, key] {
                         m_handler->loadAsset(key);
                     });
                 };
@@ -113,8 +133,8 @@ public:
                 if (type == Asset::kInvalid) {
                     LOG(ERROR) << "/assetAddFile got bad type string: " << typeString;
                 } else {
-                    std::async(std::launch::async, [this, type, serialNumber, name, author, deprecates, listIds,
-                            filePath] {
+                    m_handler->m_workers->post(WorkerPool::kBulk, [this, type, serialNumber, name, author,
+                            deprecates, listIds, filePath] {
                         m_handler->addAssetFile(type, serialNumber, name, author, deprecates, listIds, filePath);
                     });
                 }
@@ -146,8 +166,8 @@ public:
                 if (type == Asset::kInvalid) {
                     LOG(ERROR) << "/assetAddString got bad type string: " << typeString;
                 } else {
-                    std::async(std::launch::async, [this, type, serialNumber, name, author, deprecates, listIds,
-                            assetString] {
+                    m_handler->m_workers->post(WorkerPool::kMetadata, [this, type, serialNumber, name, author,
+                            deprecates, listIds, assetString] {
                         m_handler->addAssetString(type, serialNumber, name, author, deprecates, listIds, assetString);
                     });
                 }
@@ -160,7 +180,7 @@ public:
 
                 LOG(INFO) << "processing [/listAdd, " << name << "]";
 
-                std::async(std::launch::async, [this, name] {
+                m_handler->m_workers->post(WorkerPool::kMetadata, [this, name] {
                     m_handler->addList(name);
                 });
             } else if (std::strcmp("/listFind", message.AddressPattern()) == 0) {
@@ -172,7 +192,7 @@ public:
 
                 LOG(INFO) << "processing [/listFind, " << name << "]";
 
-                std::async(std::launch::async, [this, name] {
+                m_handler->m_workers->post(WorkerPool::kMetadata, [this, name] {
                     m_handler->findList(name);
                 });
             } else if (std::strcmp("/listNext", message.AddressPattern()) == 0) {
@@ -184,7 +204,7 @@ public:
 
                 LOG(INFO) << "processing [/listNext, " << keyString << ", " << tokenString << "]";
 
-                std::async(std::launch::async, [this, key, token] {
+                m_handler->m_workers->post(WorkerPool::kMetadata, [this, key, token] {
                     m_handler->nextList(key, token);
                 });
             } else {
@@ -200,12 +220,23 @@ private:
 };
 
 OscHandler::OscHandler(int listenPort, int sendPort, std::shared_ptr<AssetDatabase> assetDatabase,
-    std::shared_ptr<HttpClient> httpClient, std::shared_ptr<CacheManager> cacheManager) :
+    std::shared_ptr<HttpClient> httpClient, std::shared_ptr<CacheManager> cacheManager,
+    std::shared_ptr<UpstreamQueue> upstreamQueue) :
     m_listenPort(listenPort),
     m_sendPort(sendPort),
     m_assetDatabase(assetDatabase),
     m_httpClient(httpClient),
-    m_cacheManager(cacheManager) {
+    m_cacheManager(cacheManager),
+    m_upstreamQueue(upstreamQueue),
+    m_workers(new WorkerPool(kOscMetadataThreads, kOscBulkThreads)),
+    m_findLeaders(MetricsRegistry::global().counter(kCoalescedMetric, kCoalescedHelp,
+        "request=\"find\",role=\"leader\"")),
+    m_findFollowers(MetricsRegistry::global().counter(kCoalescedMetric, kCoalescedHelp,
+        "request=\"find\",role=\"follower\"")),
+    m_loadLeaders(MetricsRegistry::global().counter(kCoalescedMetric, kCoalescedHelp,
+        "request=\"load\",role=\"leader\"")),
+    m_loadFollowers(MetricsRegistry::global().counter(kCoalescedMetric, kCoalescedHelp,
+        "request=\"load\",role=\"follower\"")) {
 }
 
 OscHandler::~OscHandler() {
@@ -214,43 +245,76 @@ OscHandler::~OscHandler() {
 void OscHandler::run() {
     m_transmitSocket.reset(new UdpTransmitSocket(IpEndpointName("127.0.0.1", m_sendPort)));
 
+    // The upstream queue reports progress through the transmit socket, and is started before any message can add an
+    // Asset to it.
+    m_upstreamQueue->start([this](uint64_t key, UpstreamQueue::State state, uint64_t chunksSent, uint64_t chunks) {
+        static const char* kStateNames[] = { "queued", "sending", "retrying", "done", "failed" };
+        char buffer[kPageSize];
+        osc::OutboundPacketStream p(buffer, kPageSize);
+        p << osc::BeginMessage("/assetUpstream") << Asset::keyToString(key).c_str() << kStateNames[state]
+            << static_cast<osc::int32>(chunksSent) << static_cast<osc::int32>(chunks) << osc::EndMessage;
+        m_transmitSocket->Send(p.Data(), p.Size());
+    });
+
+    m_workers->start();
     m_listener.reset(new OscListener(this));
     m_listenSocket.reset(new UdpListeningReceiveSocket(IpEndpointName(IpEndpointName::ANY_ADDRESS, m_listenPort),
         m_listener.get()));
-    std::async(std::launch::async, [this] {
+    m_listenThread = std::thread([this] {
         m_listenSocket->Run();
     });
 }
 
 void OscHandler::shutdown() {
     m_listenSocket->AsynchronousBreak();
+    if (m_listenThread.joinable()) {
+        m_listenThread.join();
+    }
+    // Finish the requests already received, which may still add Assets to the upstream queue.
+    m_workers->shutdown();
+    m_upstreamQueue->shutdown();
+    LOG(INFO) << m_finds.followers() << " /assetFind requests coalesced into " << m_finds.leaders() << " lookups, "
+        << m_loads.followers() << " /assetLoad requests coalesced into " << m_loads.leaders() << " loads.";
 }
 
 void OscHandler::findAsset(uint64_t assetId) {
+    bool leader = m_finds.join(assetId, [this, assetId](RecordPtr record) {
+        if (record->empty()) {
+            char buffer[kDataChunkSize];
+            osc::OutboundPacketStream p(buffer, kDataChunkSize);
+            p << osc::BeginMessage("/assetError") << Asset::keyToString(assetId).c_str()
+                << "Failed to find asset associated with key." << osc::EndMessage;
+            m_transmitSocket->Send(p.Data(), p.Size());
+        } else {
+            sendAsset(Asset::keyToString(assetId), record);
+        }
+    });
+    if (!leader) {
+        m_findFollowers->add();
+        LOG(INFO) << "joined lookup already in flight for asset " << Asset::keyToString(assetId);
+        return;
+    }
+    m_findLeaders->add();
+
     // First check database cache.
     RecordPtr databaseAsset = m_assetDatabase->findAsset(assetId);
     if (!databaseAsset->empty()) {
         LOG(INFO) << "database cache hit for asset " << Asset::keyToString(assetId) << " sending to SC.";
-        sendAsset(Asset::keyToString(assetId), databaseAsset);
+        m_finds.complete(assetId, databaseAsset);
         return;
     }
 
     // Failing database cache, request from upstream server.
     m_httpClient->getAsset(assetId, [this, assetId](uint64_t loadedKey, RecordPtr record) {
         if (record->empty()) {
-            char buffer[kDataChunkSize];
-            osc::OutboundPacketStream p(buffer, kDataChunkSize);
             LOG(ERROR) << "failed to retrieve Asset " << Asset::keyToString(assetId) << ".";
-            p << osc::BeginMessage("/assetError") << Asset::keyToString(assetId).c_str()
-                << "Failed to find asset associated with key." << osc::EndMessage;
-            m_transmitSocket->Send(p.Data(), p.Size());
         } else {
             // Store in database cache for future use.
             m_assetDatabase->storeAsset(loadedKey, record->data());
-            // Send to client.
             LOG(INFO) << "downloaded asset " << Asset::keyToString(assetId) << " cached and sending to SC.";
-            sendAsset(Asset::keyToString(assetId), record);
         }
+        // Answer every waiting request while the record is still valid.
+        m_finds.complete(assetId, record);
     });
 }
 
@@ -277,29 +341,46 @@ void OscHandler::findNamedAsset(std::string name) {
 }
 
 void OscHandler::loadAsset(uint64_t key) {
+    bool leader = m_loads.join(key, [this, key](std::pair<uint64_t, std::string> loaded) {
+        char buffer[kPageSize];
+        osc::OutboundPacketStream p(buffer, kPageSize);
+        p << osc::BeginMessage("/assetLoaded")
+            << Asset::keyToString(key).c_str()
+            << Asset::keyToString(loaded.first).c_str()
+            << loaded.second.c_str()
+            << osc::EndMessage;
+        m_transmitSocket->Send(p.Data(), p.Size());
+    });
+    if (!leader) {
+        m_loadFollowers->add();
+        LOG(INFO) << "joined load already in flight for asset " << Asset::keyToString(key);
+        return;
+    }
+    m_loadLeaders->add();
+
     uint64_t downloadKey = 0;
     fs::path assetPath = m_cacheManager->checkCache(key);
 
     if (assetPath.empty()) {
         LOG(INFO) << "file cache miss for asset " << Asset::keyToString(key) << ", downloading.";
-        size_t size = 0;
-        uint64_t chunks = 0;
+        ChunkLayout layout(0, 0, 0);
         std::string fileExtension;
+        uint64_t deprecates = 0;
         // First check cache for this Asset.
         RecordPtr asset = m_assetDatabase->findAsset(key);
         if (asset->empty()) {
             LOG(INFO) << "cache miss for asset " << Asset::keyToString(key);
-            m_httpClient->getAsset(key, [this, &downloadKey, &size, &chunks, &fileExtension](uint64_t loadedKey,
-                RecordPtr record) {
+            m_httpClient->getAsset(key, [this, &downloadKey, &layout, &fileExtension, &deprecates](
+                uint64_t loadedKey, RecordPtr record) {
                 if (record->empty()) {
                     LOG(ERROR) << "asset not found " << Asset::keyToString(loadedKey);
                 } else {
                     m_assetDatabase->storeAsset(loadedKey, record->data());
                     const Data::FlatAsset* flatAsset = Data::GetFlatAsset(record->data().data());
                     downloadKey = loadedKey;
-                    size = flatAsset->size();
-                    chunks = flatAsset->chunks();
+                    layout = ChunkLayout::fromFlatAsset(flatAsset);
                     fileExtension = flatAsset->fileExtension()->str();
+                    deprecates = flatAsset->deprecates();
                 }
             });
         } else {
@@ -307,34 +388,28 @@ void OscHandler::loadAsset(uint64_t key) {
             const Data::FlatAsset* flatAsset = Data::GetFlatAsset(asset->data().data());
             // TODO: code duplication not great here.
             downloadKey = key;
-            size = flatAsset->size();
-            chunks = flatAsset->chunks();
+            layout = ChunkLayout::fromFlatAsset(flatAsset);
             fileExtension = flatAsset->fileExtension()->str();
+            deprecates = flatAsset->deprecates();
         }
 
         // We should have extracted what we need from the asset to download now.
         if (downloadKey != 0) {
             LOG(INFO) << "starting download for asset " << Asset::keyToString(downloadKey) << " for requested asset "
-                << Asset::keyToString(key) << ", " << size << " bytes, " << chunks << " chunks, " << fileExtension;
-            assetPath = m_cacheManager->download(downloadKey, size, chunks, fileExtension);
+                << Asset::keyToString(key) << ", " << layout.size() << " bytes, " << layout.chunks() << " chunks, "
+                << fileExtension;
+            assetPath = m_cacheManager->download(downloadKey, layout, fileExtension, deprecates);
         } else {
             LOG(ERROR) << "unable to find Asset " << Asset::keyToString(key);
         }
     }
 
-    char buffer[kPageSize];
-    osc::OutboundPacketStream p(buffer, kPageSize);
-    p << osc::BeginMessage("/assetLoaded")
-        << Asset::keyToString(key).c_str()
-        << Asset::keyToString(downloadKey).c_str()
-        << assetPath.c_str()
-        << osc::EndMessage;
-    m_transmitSocket->Send(p.Data(), p.Size());
+    m_loads.complete(key, std::make_pair(downloadKey, assetPath.string()));
 }
 
 void OscHandler::addAssetFile(Asset::Type type, int serialNumber, std::string name, uint64_t author,
     uint64_t deprecates, std::string listIds, std::string filePath) {
-    uint64_t key = m_httpClient->postFileAsset(type, name, author, deprecates, listIds, filePath);
+    uint64_t key = m_upstreamQueue->addFileAsset(type, name, author, deprecates, listIds, filePath);
     char buffer[kPageSize];
     osc::OutboundPacketStream p(buffer, kPageSize);
     p << osc::BeginMessage("/assetAdded") << serialNumber << Asset::keyToString(key).c_str()
@@ -344,7 +419,7 @@ void OscHandler::addAssetFile(Asset::Type type, int serialNumber, std::string na
 
 void OscHandler::addAssetString(Asset::Type type, int serialNumber, std::string name, uint64_t author,
     uint64_t deprecates, std::string listIds, std::string assetString) {
-    uint64_t key = m_httpClient->postInlineAsset(type, name, author, deprecates, listIds, assetString.size(),
+    uint64_t key = m_upstreamQueue->addInlineAsset(type, name, author, deprecates, listIds, assetString.size(),
         reinterpret_cast<const uint8_t*>(assetString.c_str()));
 
     // Regardless of success or failure of Asset add we return the key and serial number.
@@ -408,9 +483,33 @@ void OscHandler::findList(std::string name) {
 }
 
 void OscHandler::nextList(uint64_t key, uint64_t token) {
-    m_httpClient->getListItems(key, token, [this, &key](const std::string& tokens) {
-        char buffer[kPageSize];
-        osc::OutboundPacketStream p(buffer, kPageSize);
+    m_httpClient->getListItems(key, token, [this, &key](RecordPtr record) {
+        // The sclang side expects "<token> <asset key>\n" pairs, ending with a <kEndList, kEndList> pair at the end of
+        // the list. Entries past what fits in a single UDP packet are left for the next request, which will resume from
+        // the last token sent.
+        std::string tokens;
+        bool end = false;
+        if (!record->empty()) {
+            const Data::FlatListPage* page = Data::GetFlatListPage(record->data().data());
+            size_t numEntries = 0;
+            tokens.reserve(std::min<size_t>(page->keys() ? page->keys()->size() : 0, kOscMaxListItems) * 34);
+            bool valid = readListPage(page, [&tokens, &numEntries](uint64_t token, uint64_t assetKey) {
+                if (numEntries < kOscMaxListItems) {
+                    tokens += Asset::keyToString(token) + " " + Asset::keyToString(assetKey) + "\n";
+                }
+                ++numEntries;
+            });
+            if (!valid) {
+                LOG(ERROR) << "malformed list page for list " << Asset::keyToString(key);
+            }
+            end = valid && page->end() && numEntries <= kOscMaxListItems;
+        }
+        if (end) {
+            tokens += Asset::keyToString(kEndList) + " " + Asset::keyToString(kEndList) + "\n";
+        }
+
+        std::vector<char> buffer(tokens.size() + kPageSize);
+        osc::OutboundPacketStream p(buffer.data(), buffer.size());
         p << osc::BeginMessage("/listItems") << Asset::keyToString(key).c_str() << tokens.c_str() << osc::EndMessage;
         m_transmitSocket->Send(p.Data(), p.Size());
     });
@@ -3,10 +3,13 @@
 
 #include "Asset.hpp"
 #include "Record.hpp"
+#include "SingleFlight.hpp"
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <thread>
+#include <utility>
 
 // Forward declarations from OscPack library.
 class UdpListeningReceiveSocket;
@@ -16,9 +19,19 @@ namespace Confab {
 
 class AssetDatabase;
 class CacheManager;
+class Counter;
 class HttpClient;
+class UpstreamQueue;
+class WorkerPool;
 
 /*! Class for listening and responding to OSC messages from a single SuperCollider client.
+ *
+ * Patterns often fire several /assetFind or /assetLoad messages for the same Asset at once. Only the first starts a
+ * lookup or download, and the rest wait on it and get the same reply, which also keeps concurrent downloads from
+ * writing the same cache file. The merged requests are counted in the confab_client_coalesced_requests_total metric.
+ *
+ * Messages are handled on a WorkerPool, with loads and file additions on the bulk lane, so a lookup is answered while
+ * downloads are still running.
  */
 class OscHandler {
 public:
@@ -29,26 +42,30 @@ public:
      * \param assetDatabase The shared reference to the AssetDatabase instance, for caching smaller Assets locally.
      * \param httpClient A shared reference to the HttpClient instance this OscHandler should use for Asset queries.
      * \param cacheManager A shared reference to the CacheManager instnace this OscHandler should use for Cache queries.
+     * \param upstreamQueue A shared reference to the UpstreamQueue this OscHandler should add new Assets through.
      */
     OscHandler(int listenPort, int sendPort, std::shared_ptr<AssetDatabase> assetDatabase,
-        std::shared_ptr<HttpClient> httpClient, std::shared_ptr<CacheManager> cacheManager);
+        std::shared_ptr<HttpClient> httpClient, std::shared_ptr<CacheManager> cacheManager,
+        std::shared_ptr<UpstreamQueue> upstreamQueue);
 
     /*! Destructs an OSCHandler. Declared here to let us use std::unique_ptr with forward-declared classes.
      */
     ~OscHandler();
 
-    /*! Launch a thread to run the OSC message processing loop. Call shutdown() to stop the processing loop.
+    /*! Launch a thread to run the OSC message processing loop, and start sending added Assets upstream, reporting
+     * their progress to SuperCollider. Call shutdown() to stop both.
      */
     void run();
 
-    /*! Stops the processing loop and closes the open ports.
+    /*! Stops the processing loop, finishes handling the messages already received, stops the upstream queue, and
+     * closes the open ports.
      */
     void shutdown();
 
 private:
     class OscListener;
 
-    /*! Searches for an asset with provided id. Should run as a task.
+    /*! Searches for an asset with provided id, or waits on a search for it already in flight. Should run as a task.
      */
     void findAsset(uint64_t assetId);
 
@@ -56,16 +73,19 @@ private:
      */
     void findNamedAsset(std::string name);
 
-    /*! Downloads an asset file to cache, provides path back to caller. Should run as a task.
+    /*! Downloads an asset file to cache, or waits on a download of it already in flight, provides path back to caller.
+     * Should run as a task.
      */
     void loadAsset(uint64_t key);
 
-    /*! Processes an asset addition request for a given file path. Should run as a task.
+    /*! Processes an asset addition request for a given file path, replying once the Asset is stored locally, before
+     * it is sent upstream. Should run as a task.
      */
     void addAssetFile(Asset::Type type, int serialNumber, std::string name, uint64_t author, uint64_t deprecates,
         std::string listIds, std::string filePath);
 
-    /*! Processes an asset addition request for a short string. Should run as a task.
+    /*! Processes an asset addition request for a short string, replying once the Asset is stored locally, before it
+     * is sent upstream. Should run as a task.
      */
     void addAssetString(Asset::Type type, int serialNumber, std::string name, uint64_t author, uint64_t deprecates,
         std::string listIds, std::string assetString);
@@ -92,10 +112,23 @@ private:
     std::shared_ptr<AssetDatabase> m_assetDatabase;
     std::shared_ptr<HttpClient> m_httpClient;
     std::shared_ptr<CacheManager> m_cacheManager;
+    std::shared_ptr<UpstreamQueue> m_upstreamQueue;
+    std::unique_ptr<WorkerPool> m_workers;
 
     std::unique_ptr<UdpTransmitSocket> m_transmitSocket;
     std::unique_ptr<OscListener> m_listener;
     std::unique_ptr<UdpListeningReceiveSocket> m_listenSocket;
+    std::thread m_listenThread;
+
+    // Asset lookups in flight, by requested key. The Records from HttpClient are only valid during its callback, so
+    // waiting requests are answered from within it.
+    SingleFlight<uint64_t, RecordPtr> m_finds;
+    // Asset loads in flight, by requested key, completed with the key downloaded and the path to the cached file.
+    SingleFlight<uint64_t, std::pair<uint64_t, std::string>> m_loads;
+    Counter* m_findLeaders;
+    Counter* m_findFollowers;
+    Counter* m_loadLeaders;
+    Counter* m_loadFollowers;
 };
 
 }  // namespace Confab
@@ -0,0 +1,257 @@
+#include "OscHandler.hpp"
+
+#include "Asset.hpp"
+#include "AssetDatabase.hpp"
+#include "CacheManager.hpp"
+#include "Constants.hpp"
+#include "HttpClient.hpp"
+#include "Metrics.hpp"
+#include "TestServer.hpp"
+#include "UpstreamQueue.hpp"
+
+#include "ip/UdpSocket.h"
+#include "osc/OscOutboundPacketStream.h"
+#include "osc/OscPacketListener.h"
+#include "osc/OscReceivedElements.h"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+// Loopback ports for the test server, and for OSC messages to and from the OscHandler.
+const int kServerPort = 19200;
+const int kListenPort = 19201;
+const int kSendPort = 19202;
+
+// Stands in for sclang, collecting the messages the OscHandler sends as their address followed by their string and
+// integer arguments.
+class OscReceiver : public osc::OscPacketListener {
+public:
+    using Message = std::vector<std::string>;
+
+    OscReceiver() :
+        m_socket(IpEndpointName(IpEndpointName::ANY_ADDRESS, kSendPort), this),
+        m_thread([this] { m_socket.Run(); }) { }
+
+    ~OscReceiver() {
+        m_socket.AsynchronousBreak();
+        m_thread.join();
+    }
+
+    // Waits for a message to arrive that matches, returning it, or an empty message on timeout.
+    Message waitFor(std::function<bool(const Message&)> match) {
+        std::vector<Message> found = waitForAll(match, 1);
+        return found.empty() ? Message() : found[0];
+    }
+
+    // Waits for count messages to arrive that match, returning those that arrived before the timeout.
+    std::vector<Message> waitForAll(std::function<bool(const Message&)> match, size_t count) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::vector<Message> found;
+        m_changed.wait_for(lock, std::chrono::seconds(10), [this, &match, &found, count] {
+            found.clear();
+            for (const auto& message : m_messages) {
+                if (match(message)) {
+                    found.push_back(message);
+                }
+            }
+            return found.size() >= count;
+        });
+        return found;
+    }
+
+protected:
+    void ProcessMessage(const osc::ReceivedMessage& received, const IpEndpointName&) override {
+        Message message = { received.AddressPattern() };
+        for (auto argument = received.ArgumentsBegin(); argument != received.ArgumentsEnd(); ++argument) {
+            if (argument->IsString()) {
+                message.push_back(argument->AsString());
+            } else if (argument->IsInt32()) {
+                message.push_back(std::to_string(argument->AsInt32()));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_messages.push_back(message);
+        }
+        m_changed.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<Message> m_messages;
+    UdpListeningReceiveSocket m_socket;
+    std::thread m_thread;
+};
+
+// Holds requests for AssetData chunks while paused, keeping an Asset load in flight.
+class PausingClient : public Confab::HttpClient {
+public:
+    explicit PausingClient(const std::string& address) : HttpClient(address), m_paused(false) { }
+
+    void pause(bool paused) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_paused = paused;
+        }
+        m_changed.notify_all();
+    }
+
+    void getAssetDataAsync(uint64_t key, uint64_t chunk, std::function<void(uint64_t, uint64_t, Confab::RecordPtr)>
+            callback, Confab::RequestScheduler::Priority priority) override {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return !m_paused; });
+        }
+        HttpClient::getAssetDataAsync(key, chunk, callback, priority);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    bool m_paused;
+};
+
+// Runs a confab-server in process, and an OscHandler started the way confab starts it, talking to the server through a
+// client with its own local database.
+class OscHandlerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-osc-handler-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::remove_all(m_path);
+        fs::create_directories(m_path / "client");
+        ASSERT_TRUE(m_server.start(m_path / "server", Confab::TestServer::options(kServerPort)));
+        m_clientDatabase.reset(new Confab::AssetDatabase);
+        ASSERT_TRUE(m_clientDatabase->open((m_path / "client").c_str(), true, 0));
+        m_client.reset(new PausingClient(m_server.address()));
+        m_cacheManager.reset(new Confab::CacheManager(m_path / "cache", 1024 * 1024 * 1024, m_client));
+        m_upstreamQueue.reset(new Confab::UpstreamQueue(m_clientDatabase, m_client, 4));
+        m_receiver.reset(new OscReceiver);
+        m_handler.reset(new Confab::OscHandler(kListenPort, kSendPort, m_clientDatabase, m_client, m_cacheManager,
+            m_upstreamQueue));
+        m_handler->run();
+        m_transmitSocket.reset(new UdpTransmitSocket(IpEndpointName("127.0.0.1", kListenPort)));
+    }
+
+    void TearDown() override {
+        m_handler->shutdown();
+        m_client->shutdown();
+        m_receiver.reset();
+        m_server.stop();
+        m_clientDatabase->close();
+        fs::remove_all(m_path);
+    }
+
+    // Sends a message to the OscHandler, as sclang would.
+    void send(std::function<void(osc::OutboundPacketStream&)> arguments, const char* address) {
+        char buffer[Confab::kPageSize];
+        osc::OutboundPacketStream p(buffer, Confab::kPageSize);
+        p << osc::BeginMessage(address);
+        arguments(p);
+        p << osc::EndMessage;
+        m_transmitSocket->Send(p.Data(), p.Size());
+    }
+
+    // The OscHandler's count of requests of the given kind, find or load, in the given role, leader or follower.
+    static uint64_t coalesced(const std::string& request, const std::string& role) {
+        return Confab::MetricsRegistry::global().counter("confab_client_coalesced_requests_total",
+            "Asset requests that started a lookup or download, or joined one already in flight.",
+            "request=\"" + request + "\",role=\"" + role + "\"")->value();
+    }
+
+    fs::path m_path;
+    Confab::TestServer m_server;
+    std::shared_ptr<Confab::AssetDatabase> m_clientDatabase;
+    std::shared_ptr<PausingClient> m_client;
+    std::shared_ptr<Confab::CacheManager> m_cacheManager;
+    std::shared_ptr<Confab::UpstreamQueue> m_upstreamQueue;
+    std::unique_ptr<OscReceiver> m_receiver;
+    std::unique_ptr<Confab::OscHandler> m_handler;
+    std::unique_ptr<UdpTransmitSocket> m_transmitSocket;
+};
+
+}  // namespace
+
+TEST_F(OscHandlerTest, SendsAddedAssetsUpstream) {
+    send([](osc::OutboundPacketStream& p) {
+        p << 7 << "snippet" << "" << "" << "" << "" << "added over OSC";
+    }, "/assetAddString");
+    OscReceiver::Message added = m_receiver->waitFor([](const OscReceiver::Message& message) {
+        return message[0] == "/assetAdded";
+    });
+    ASSERT_EQ(3u, added.size());
+    EXPECT_EQ("7", added[1]);
+    uint64_t key = Confab::Asset::stringToKey(added[2]);
+    ASSERT_NE(0u, key);
+
+    // The upstream queue runs while the handler is serving, sending the Asset on and reporting its progress.
+    OscReceiver::Message done = m_receiver->waitFor([&added](const OscReceiver::Message& message) {
+        return message[0] == "/assetUpstream" && message[1] == added[2] && message[2] == "done";
+    });
+    ASSERT_FALSE(done.empty());
+    EXPECT_FALSE(m_server.database()->findAsset(key)->empty());
+}
+
+TEST_F(OscHandlerTest, CoalescesOverlappingLoads) {
+    fs::path filePath = m_path / "loop.wav";
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        for (int i = 0; i < 20000; ++i) {
+            file << "sample " << (i * 7919) % 104729 << "\n";
+        }
+    }
+    uint64_t key = m_client->postFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+    ASSERT_NE(0u, key);
+    std::string keyString = Confab::Asset::keyToString(key);
+
+    uint64_t leaders = coalesced("load", "leader");
+    uint64_t followers = coalesced("load", "follower");
+    const uint64_t kLoads = 8;
+
+    // With the download held, every /assetLoad after the first must join it while it is in flight.
+    m_client->pause(true);
+    for (uint64_t i = 0; i < kLoads; ++i) {
+        send([&keyString](osc::OutboundPacketStream& p) { p << keyString.c_str(); }, "/assetLoad");
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (coalesced("load", "follower") < followers + kLoads - 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(leaders + 1, coalesced("load", "leader"));
+    EXPECT_EQ(followers + kLoads - 1, coalesced("load", "follower"));
+
+    // A lookup is answered while the loads are still waiting on the download.
+    send([&keyString](osc::OutboundPacketStream& p) { p << keyString.c_str(); }, "/assetFind");
+    OscReceiver::Message found = m_receiver->waitFor([&keyString](const OscReceiver::Message& message) {
+        return message[0] == "/assetFound" && message.size() > 1 && message[1] == keyString;
+    });
+    EXPECT_FALSE(found.empty());
+
+    m_client->pause(false);
+    std::vector<OscReceiver::Message> loaded = m_receiver->waitForAll([&keyString](
+            const OscReceiver::Message& message) {
+        return message[0] == "/assetLoaded" && message[1] == keyString;
+    }, kLoads);
+    ASSERT_EQ(kLoads, loaded.size());
+    for (const auto& message : loaded) {
+        ASSERT_EQ(4u, message.size());
+        EXPECT_EQ(keyString, message[2]);
+        EXPECT_EQ(loaded[0][3], message[3]);
+    }
+    EXPECT_TRUE(fs::exists(loaded[0][3]));
+}
@@ -62,11 +62,13 @@ public:
     const SizedPointer key() const override { return SizedPointer(); }
 };
 
-/*! Convenience routine to quickly construct an always empty RecordPtr.
- * \return A new EmptyRecord.
+/*! Convenience routine to quickly get an always empty RecordPtr. Records are read-only, so every caller shares the same
+ * EmptyRecord, and asking for one never allocates.
+ * \return The shared EmptyRecord.
  */
 inline RecordPtr makeEmptyRecord() {
-    return RecordPtr(new EmptyRecord());
+    static const RecordPtr emptyRecord = std::make_shared<EmptyRecord>();
+    return emptyRecord;
 }
 
 }  // namespace Confab
@@ -0,0 +1,185 @@
+#include "RequestCapture.hpp"
+
+#include "Constants.hpp"
+
+#include "glog/logging.h"
+#include "xxhash.h"
+
+#include <cstring>
+
+namespace {
+
+const char kCaptureMagic[8] = { 'C', 'F', 'C', 'A', 'P', 'T', '0', '1' };
+
+// Flag bits in each record's flags byte.
+const uint8_t kMethodMask = 0x7f;
+const uint8_t kHasBody = 0x80;
+
+void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool readVarint(std::istream& in, uint64_t& value) {
+    value = 0;
+    int shift = 0;
+    int byte = 0;
+    do {
+        byte = in.get();
+        if (byte == std::char_traits<char>::eof() || shift > 63) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return true;
+}
+
+}  // namespace
+
+namespace Confab {
+
+RequestCapture::RequestCapture() :
+    m_open(false),
+    m_maxBodySize(0),
+    m_lastTime(0) {
+}
+
+RequestCapture::~RequestCapture() {
+    close();
+}
+
+bool RequestCapture::open(const std::string& path, size_t maxBodySize) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        LOG(ERROR) << "unable to open request capture file " << path << " for writing.";
+        return false;
+    }
+    m_file.write(kCaptureMagic, sizeof(kCaptureMagic));
+    m_open = true;
+    m_maxBodySize = maxBodySize;
+    m_start = std::chrono::steady_clock::now();
+    m_lastTime = 0;
+    LOG(INFO) << "capturing requests to " << path << ", bodies up to " << maxBodySize << " bytes.";
+    return true;
+}
+
+void RequestCapture::record(Method method, const std::string& resource, const std::string& body) {
+    uint64_t bodyHash = body.empty() ? 0 : XXH64(body.data(), body.size(), 0);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open) {
+        return;
+    }
+    bool hasBody = body.size() <= m_maxBodySize;
+    // Timestamps are taken under the lock, so they only ever increase from one record to the next.
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+    m_buffer.clear();
+    appendVarint(m_buffer, time - m_lastTime);
+    m_lastTime = time;
+    m_buffer += static_cast<char>((method & kMethodMask) | (hasBody ? kHasBody : 0));
+    appendVarint(m_buffer, resource.size());
+    m_buffer += resource;
+    appendVarint(m_buffer, body.size());
+    if (!body.empty()) {
+        char hashBytes[sizeof(uint64_t)];
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            hashBytes[i] = static_cast<char>(bodyHash >> (i * 8));
+        }
+        m_buffer.append(hashBytes, sizeof(hashBytes));
+        if (hasBody) {
+            m_buffer += body;
+        }
+    }
+    m_file.write(m_buffer.data(), m_buffer.size());
+}
+
+void RequestCapture::close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open) {
+        return;
+    }
+    m_open = false;
+    m_file.close();
+}
+
+// static
+bool RequestCapture::load(const std::string& path, std::vector<Entry>& entries) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        LOG(ERROR) << "unable to open request capture file " << path;
+        return false;
+    }
+    char magic[sizeof(kCaptureMagic)];
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, kCaptureMagic, sizeof(magic)) != 0) {
+        LOG(ERROR) << "file " << path << " is not a request capture.";
+        return false;
+    }
+
+    uint64_t time = 0;
+    bool truncated = false;
+    while (file.peek() != std::char_traits<char>::eof()) {
+        Entry entry;
+        uint64_t delta = 0;
+        uint64_t resourceSize = 0;
+        int flags = 0;
+        if (!readVarint(file, delta) || (flags = file.get()) == std::char_traits<char>::eof() ||
+            !readVarint(file, resourceSize)) {
+            truncated = true;
+            break;
+        }
+        time += delta;
+        entry.time = time;
+        entry.method = static_cast<Method>(flags & kMethodMask);
+        if (entry.method != kGet && entry.method != kPost) {
+            LOG(ERROR) << "unknown method " << (flags & kMethodMask) << " in request capture " << path;
+            return false;
+        }
+        if (resourceSize > kMaxHttpMessageSize) {
+            LOG(ERROR) << "resource of " << resourceSize << " bytes in request capture " << path;
+            return false;
+        }
+        entry.resource.resize(resourceSize);
+        if (!file.read(&entry.resource[0], resourceSize) || !readVarint(file, entry.bodySize)) {
+            truncated = true;
+            break;
+        }
+        if (entry.bodySize > kMaxHttpMessageSize) {
+            LOG(ERROR) << "body of " << entry.bodySize << " bytes in request capture " << path;
+            return false;
+        }
+        entry.bodyHash = 0;
+        entry.hasBody = entry.bodySize == 0 || (flags & kHasBody);
+        if (entry.bodySize > 0) {
+            unsigned char hashBytes[sizeof(uint64_t)];
+            if (!file.read(reinterpret_cast<char*>(hashBytes), sizeof(hashBytes))) {
+                truncated = true;
+                break;
+            }
+            for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+                entry.bodyHash |= static_cast<uint64_t>(hashBytes[i]) << (i * 8);
+            }
+            if (entry.hasBody) {
+                entry.body.resize(entry.bodySize);
+                if (!file.read(&entry.body[0], entry.bodySize)) {
+                    truncated = true;
+                    break;
+                }
+            }
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    if (truncated) {
+        LOG(WARNING) << "request capture " << path << " ends with a partial record, read " << entries.size()
+            << " complete requests.";
+    }
+    return true;
+}
+
+}  // namespace Confab
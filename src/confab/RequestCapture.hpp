@@ -0,0 +1,102 @@
+#ifndef SRC_CONFAB_REQUEST_CAPTURE_HPP_
+#define SRC_CONFAB_REQUEST_CAPTURE_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Confab {
+
+/*! Records incoming HTTP requests to a compact capture file, for replay against a server with confab-replay.
+ *
+ * The file starts with an 8-byte magic number, followed by one record per request. Each record holds the time since the
+ * previous record, the method, the resource, the size and XXH64 hash of the body, and the body itself if no larger than
+ * the capture's body size limit. Integers are unsigned LEB128 varints, except the hash, which is 8 little-endian bytes.
+ */
+class RequestCapture {
+public:
+    /*! The HTTP methods the server routes.
+     */
+    enum Method : uint8_t {
+        kGet = 0,
+        kPost = 1
+    };
+
+    /*! One captured request.
+     */
+    struct Entry {
+        /*! Arrival time of the request, in microseconds since the capture started. */
+        uint64_t time;
+        /*! The request method. */
+        Method method;
+        /*! The request path, such as "/asset/data/0123456789abcdef/4". */
+        std::string resource;
+        /*! The size of the request body in bytes. */
+        uint64_t bodySize;
+        /*! The XXH64 hash of the request body, or 0 if the body is empty. */
+        uint64_t bodyHash;
+        /*! True if body holds the request body, false if only its size and hash were captured. */
+        bool hasBody;
+        /*! The request body, if captured. */
+        std::string body;
+    };
+
+    /*! Constructs a closed capture.
+     */
+    RequestCapture();
+
+    /*! Closes the capture file, if open.
+     */
+    ~RequestCapture();
+
+    /*! Creates a capture file, replacing any existing file at path, and starts the capture clock.
+     *
+     * \param path The file to write.
+     * \param maxBodySize Request bodies up to this many bytes are captured in full, larger ones by size and hash only.
+     * \return true on success, false if the file could not be opened.
+     */
+    bool open(const std::string& path, size_t maxBodySize);
+
+    /*! Appends a request to the capture. Thread safe, and does nothing if the capture is not open.
+     *
+     * \param method The request method.
+     * \param resource The request path.
+     * \param body The request body.
+     */
+    void record(Method method, const std::string& resource, const std::string& body);
+
+    /*! Flushes and closes the capture file.
+     */
+    void close();
+
+    /*! Reads every request from a capture file.
+     *
+     * \param path The capture file to read.
+     * \param entries Filled with the captured requests, in arrival order.
+     * \return true on success, false if the file could not be read or was malformed. A capture cut short by a crash is
+     *         read up to its last complete record and still returns true.
+     */
+    static bool load(const std::string& path, std::vector<Entry>& entries);
+
+    /// @cond UNDOCUMENTED
+    RequestCapture(const RequestCapture&) = delete;
+    RequestCapture& operator=(const RequestCapture&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    bool m_open;
+    size_t m_maxBodySize;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_lastTime;
+    std::string m_buffer;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_REQUEST_CAPTURE_HPP_
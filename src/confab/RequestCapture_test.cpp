@@ -0,0 +1,85 @@
+#include "RequestCapture.hpp"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+class RequestCaptureTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-request-capture-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+    }
+
+    void TearDown() override {
+        fs::remove(m_path);
+    }
+
+    fs::path m_path;
+};
+
+}  // namespace
+
+TEST_F(RequestCaptureTest, RoundTripsRequestsInOrder) {
+    {
+        Confab::RequestCapture capture;
+        ASSERT_TRUE(capture.open(m_path.string(), 8));
+        capture.record(Confab::RequestCapture::kGet, "/asset/id/0123456789abcdef", "");
+        capture.record(Confab::RequestCapture::kGet, "/asset/name", "drums");
+        capture.record(Confab::RequestCapture::kPost, "/asset/data/0123456789abcdef/3", std::string(100, 'x'));
+    }
+
+    std::vector<Confab::RequestCapture::Entry> entries;
+    ASSERT_TRUE(Confab::RequestCapture::load(m_path.string(), entries));
+    ASSERT_EQ(3u, entries.size());
+
+    EXPECT_EQ(Confab::RequestCapture::kGet, entries[0].method);
+    EXPECT_EQ("/asset/id/0123456789abcdef", entries[0].resource);
+    EXPECT_EQ(0u, entries[0].bodySize);
+    EXPECT_TRUE(entries[0].hasBody);
+
+    EXPECT_EQ("/asset/name", entries[1].resource);
+    EXPECT_TRUE(entries[1].hasBody);
+    EXPECT_EQ("drums", entries[1].body);
+    EXPECT_NE(0u, entries[1].bodyHash);
+    EXPECT_LE(entries[0].time, entries[1].time);
+
+    // Bodies over the limit keep only their size and hash.
+    EXPECT_EQ(Confab::RequestCapture::kPost, entries[2].method);
+    EXPECT_FALSE(entries[2].hasBody);
+    EXPECT_TRUE(entries[2].body.empty());
+    EXPECT_EQ(100u, entries[2].bodySize);
+    EXPECT_NE(0u, entries[2].bodyHash);
+    EXPECT_LE(entries[1].time, entries[2].time);
+}
+
+TEST_F(RequestCaptureTest, LoadStopsAtPartialRecord) {
+    {
+        Confab::RequestCapture capture;
+        ASSERT_TRUE(capture.open(m_path.string(), 1024));
+        capture.record(Confab::RequestCapture::kGet, "/list/items/0123456789abcdef/0", "");
+        capture.record(Confab::RequestCapture::kPost, "/list/id/0123456789abcdef", "list data");
+    }
+    fs::resize_file(m_path, fs::file_size(m_path) - 3);
+
+    std::vector<Confab::RequestCapture::Entry> entries;
+    ASSERT_TRUE(Confab::RequestCapture::load(m_path.string(), entries));
+    ASSERT_EQ(1u, entries.size());
+    EXPECT_EQ("/list/items/0123456789abcdef/0", entries[0].resource);
+}
+
+TEST_F(RequestCaptureTest, LoadRejectsOtherFiles) {
+    {
+        std::ofstream file(m_path.string());
+        file << "not a capture";
+    }
+    std::vector<Confab::RequestCapture::Entry> entries;
+    EXPECT_FALSE(Confab::RequestCapture::load(m_path.string(), entries));
+}
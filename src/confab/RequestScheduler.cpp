@@ -0,0 +1,79 @@
+#include "RequestScheduler.hpp"
+
+#include <algorithm>
+
+namespace Confab {
+
+RequestScheduler::RequestScheduler(size_t maxInFlight) {
+    size_t limit = std::max(maxInFlight, static_cast<size_t>(1));
+    size_t reserve = std::max(limit / kReservedShare, static_cast<size_t>(1));
+    for (size_t i = 0; i < kNumPriorities; ++i) {
+        m_limits[i] = limit;
+        // Every tier keeps at least one slot, so small windows still let bulk transfers make progress.
+        limit = limit > reserve ? limit - reserve : 1;
+    }
+    m_inFlight.fill(0);
+    m_started.fill(0);
+}
+
+bool RequestScheduler::canStart(Priority priority) const {
+    // Starting a request adds to its own tier and every tier above it, so all of those must have room.
+    for (size_t i = 0; i <= priority; ++i) {
+        if (inFlightAtOrBelow(static_cast<Priority>(i)) >= m_limits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RequestScheduler::start(Priority priority) {
+    ++m_inFlight[priority];
+    ++m_started[priority];
+}
+
+void RequestScheduler::finish(Priority priority) {
+    if (m_inFlight[priority] > 0) {
+        --m_inFlight[priority];
+    }
+}
+
+size_t RequestScheduler::inFlight() const {
+    return inFlightAtOrBelow(kInteractive);
+}
+
+// static
+size_t RequestScheduler::headroom(Priority priority) {
+    return priority == kInteractive ? kInteractiveHeadroom : 0;
+}
+
+RequestScheduler::Stats RequestScheduler::stats(Priority priority) const {
+    Stats stats;
+    stats.inFlight = m_inFlight[priority];
+    stats.limit = m_limits[priority];
+    stats.started = m_started[priority];
+    return stats;
+}
+
+// static
+const char* RequestScheduler::priorityName(Priority priority) {
+    switch (priority) {
+        case kInteractive:
+            return "interactive";
+        case kPrefetch:
+            return "prefetch";
+        case kBulk:
+            return "bulk";
+        default:
+            return "unknown";
+    }
+}
+
+size_t RequestScheduler::inFlightAtOrBelow(Priority priority) const {
+    size_t inFlight = 0;
+    for (size_t i = priority; i < kNumPriorities; ++i) {
+        inFlight += m_inFlight[i];
+    }
+    return inFlight;
+}
+
+}  // namespace Confab
@@ -0,0 +1,109 @@
+#ifndef SRC_CONFAB_REQUEST_SCHEDULER_HPP_
+#define SRC_CONFAB_REQUEST_SCHEDULER_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace Confab {
+
+/*! Shares a client's in-flight request slots between priority classes, so that a long background transfer can't
+ * hold up the lookups a performer is waiting on.
+ *
+ * Slots are reserved in nested tiers. Requests of each priority, together with all those of lower priority, may hold
+ * at most that priority's limit of slots, so the last share of the window is only ever used by interactive requests,
+ * and the share before it only by interactive and prefetch requests. Bulk transfers are made of many chunk
+ * requests, and as queued requests are always started highest priority first, a bulk transfer yields at the next
+ * chunk boundary to any request of higher priority that arrives while it runs, without cancelling chunks in flight.
+ *
+ * Not thread safe, callers must serialize access.
+ */
+class RequestScheduler {
+public:
+    /*! The priority classes of client requests, in descending order of priority.
+     */
+    enum Priority : size_t {
+        kInteractive = 0,  //!< Requests someone is waiting on now, such as Asset and List lookups.
+        kPrefetch = 1,     //!< Requests made ahead of need, such as List watches.
+        kBulk = 2,         //!< AssetData chunk transfers, and the requests of uploads.
+        kNumPriorities = 3
+    };
+
+    /*! Each priority above bulk has one kReservedShare'th of the in-flight window reserved for it, at least one slot.
+     */
+    static constexpr size_t kReservedShare = 4;
+
+    /*! How many more interactive requests than its adaptive limit an upstream may have in flight, so that there is
+     * always room for one even while bulk transfers keep every upstream at its limit. */
+    static constexpr size_t kInteractiveHeadroom = 1;
+
+    /*! A point-in-time copy of the counters for one priority.
+     */
+    struct Stats {
+        size_t inFlight;    //!< Requests in flight.
+        size_t limit;       //!< The most requests of this and lower priorities that may be in flight together.
+        uint64_t started;   //!< Total requests started.
+    };
+
+    /*! Constructs a scheduler with nothing in flight.
+     *
+     * \param maxInFlight The number of requests that may be in flight at once, of all priorities combined. A value of
+     *                    zero is treated as one.
+     */
+    explicit RequestScheduler(size_t maxInFlight);
+
+    /*! Whether a request of a priority may take an in-flight slot now.
+     *
+     * \param priority The priority of the request.
+     * \return true if starting the request keeps every tier within its limit.
+     */
+    bool canStart(Priority priority) const;
+
+    /*! Counts a request as started, which should only be done after canStart() returned true.
+     *
+     * \param priority The priority of the request.
+     */
+    void start(Priority priority);
+
+    /*! Counts a request started with start() as finished, releasing its slot.
+     *
+     * \param priority The priority of the request.
+     */
+    void finish(Priority priority);
+
+    /*! \return The number of requests in flight, of all priorities. */
+    size_t inFlight() const;
+
+    /*! Returns how many requests a priority may send to an upstream beyond the upstream's adaptive limit.
+     *
+     * \param priority The priority of the request.
+     * \return kInteractiveHeadroom for interactive requests, zero otherwise.
+     */
+    static size_t headroom(Priority priority);
+
+    /*! Copies the current counters for a priority.
+     *
+     * \param priority The priority to report on.
+     * \return The counters.
+     */
+    Stats stats(Priority priority) const;
+
+    /*! A short lower-case name for a priority, for logging and metrics.
+     *
+     * \param priority The priority to name.
+     * \return The priority name.
+     */
+    static const char* priorityName(Priority priority);
+
+private:
+    // Requests in flight of a priority and every priority below it.
+    size_t inFlightAtOrBelow(Priority priority) const;
+
+    std::array<size_t, kNumPriorities> m_limits;
+    std::array<size_t, kNumPriorities> m_inFlight;
+    std::array<uint64_t, kNumPriorities> m_started;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_REQUEST_SCHEDULER_HPP_
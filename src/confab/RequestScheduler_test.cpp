@@ -0,0 +1,68 @@
+#include "RequestScheduler.hpp"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using Confab::RequestScheduler;
+
+// Starts requests of a priority until the scheduler refuses one, returning how many were started.
+size_t fill(RequestScheduler& scheduler, RequestScheduler::Priority priority) {
+    size_t started = 0;
+    while (scheduler.canStart(priority)) {
+        scheduler.start(priority);
+        ++started;
+    }
+    return started;
+}
+
+}  // namespace
+
+TEST(RequestSchedulerTest, ReservesSlotsForHigherPriorities) {
+    RequestScheduler scheduler(16);
+    EXPECT_EQ(16u, scheduler.stats(RequestScheduler::kInteractive).limit);
+    EXPECT_EQ(12u, scheduler.stats(RequestScheduler::kPrefetch).limit);
+    EXPECT_EQ(8u, scheduler.stats(RequestScheduler::kBulk).limit);
+
+    // Bulk transfers fill their share, prefetches the next, and only interactive requests can take the rest.
+    EXPECT_EQ(8u, fill(scheduler, RequestScheduler::kBulk));
+    EXPECT_EQ(4u, fill(scheduler, RequestScheduler::kPrefetch));
+    EXPECT_EQ(4u, fill(scheduler, RequestScheduler::kInteractive));
+    EXPECT_EQ(16u, scheduler.inFlight());
+
+    // A slot freed by an interactive request can't be taken by a lower priority.
+    scheduler.finish(RequestScheduler::kInteractive);
+    EXPECT_FALSE(scheduler.canStart(RequestScheduler::kBulk));
+    EXPECT_FALSE(scheduler.canStart(RequestScheduler::kPrefetch));
+    EXPECT_TRUE(scheduler.canStart(RequestScheduler::kInteractive));
+
+    // But a slot freed by a bulk transfer can go to any priority.
+    scheduler.finish(RequestScheduler::kBulk);
+    EXPECT_TRUE(scheduler.canStart(RequestScheduler::kBulk));
+    EXPECT_EQ(8u, scheduler.stats(RequestScheduler::kBulk).started);
+    EXPECT_EQ(7u, scheduler.stats(RequestScheduler::kBulk).inFlight);
+}
+
+TEST(RequestSchedulerTest, HigherPrioritiesCanUseTheWholeWindow) {
+    RequestScheduler scheduler(16);
+    EXPECT_EQ(12u, fill(scheduler, RequestScheduler::kPrefetch));
+    EXPECT_FALSE(scheduler.canStart(RequestScheduler::kBulk));
+    EXPECT_EQ(4u, fill(scheduler, RequestScheduler::kInteractive));
+
+    RequestScheduler interactive(16);
+    EXPECT_EQ(16u, fill(interactive, RequestScheduler::kInteractive));
+    EXPECT_FALSE(interactive.canStart(RequestScheduler::kBulk));
+}
+
+TEST(RequestSchedulerTest, SmallWindowsStillAllowEveryPriority) {
+    RequestScheduler scheduler(0);
+    EXPECT_EQ(1u, scheduler.stats(RequestScheduler::kBulk).limit);
+    EXPECT_EQ(1u, fill(scheduler, RequestScheduler::kBulk));
+    EXPECT_FALSE(scheduler.canStart(RequestScheduler::kInteractive));
+    scheduler.finish(RequestScheduler::kBulk);
+    EXPECT_EQ(0u, scheduler.inFlight());
+
+    EXPECT_EQ(RequestScheduler::kInteractiveHeadroom, RequestScheduler::headroom(RequestScheduler::kInteractive));
+    EXPECT_EQ(0u, RequestScheduler::headroom(RequestScheduler::kBulk));
+    EXPECT_STREQ("prefetch", RequestScheduler::priorityName(RequestScheduler::kPrefetch));
+}
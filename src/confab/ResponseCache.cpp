@@ -0,0 +1,79 @@
+#include "ResponseCache.hpp"
+
+namespace Confab {
+
+// The most keys to remember the last erase() of.
+static const size_t kMaxErasedKeys = 4096;
+
+ResponseCache::ResponseCache(size_t maxBytes) :
+    m_maxBytes(maxBytes),
+    m_size(0),
+    m_oldestLoad(0),
+    m_generation(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0) {
+}
+
+ResponseCache::Body ResponseCache::find(const Key& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_index.find(key);
+    if (found == m_index.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    return found->second->second;
+}
+
+void ResponseCache::insert(const Key& key, Body body, uint64_t generation) {
+    if (!body || body->size() > m_maxBytes / 8) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation < m_oldestLoad || m_index.find(key) != m_index.end()) {
+        return;
+    }
+    auto erased = m_erased.find(key);
+    if (erased != m_erased.end() && erased->second > generation) {
+        return;
+    }
+
+    while (m_size + body->size() > m_maxBytes && !m_entries.empty()) {
+        auto& oldest = m_entries.back();
+        m_size -= oldest.second->size();
+        m_index.erase(oldest.first);
+        m_entries.pop_back();
+        ++m_evictions;
+    }
+
+    m_size += body->size();
+    m_entries.emplace_front(key, std::move(body));
+    m_index.emplace(key, m_entries.begin());
+}
+
+void ResponseCache::erase(const Key& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t generation = ++m_generation;
+    if (m_erased.size() >= kMaxErasedKeys) {
+        m_erased.clear();
+        m_oldestLoad = generation;
+    }
+    m_erased[key] = generation;
+    auto found = m_index.find(key);
+    if (found == m_index.end()) {
+        return;
+    }
+    m_size -= found->second->second->size();
+    m_entries.erase(found->second);
+    m_index.erase(found);
+}
+
+size_t ResponseCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+}  // namespace Confab
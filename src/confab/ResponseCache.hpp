@@ -0,0 +1,130 @@
+#ifndef SRC_CONFAB_RESPONSE_CACHE_HPP_
+#define SRC_CONFAB_RESPONSE_CACHE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Confab {
+
+/*! A bounded, byte-budgeted LRU cache of encoded HTTP response bodies, for serving the hottest Assets and AssetData
+ * chunks without touching the database or repeating the base64 encode.
+ *
+ * Cached bodies are immutable and shared, so a hit costs one reference count increment and no copy until the body is
+ * handed to the network layer.
+ */
+class ResponseCache {
+public:
+    /*! Identifies the kind of record a cached response holds.
+     */
+    enum Kind : uint8_t {
+        kAsset = 1,
+        kAssetData = 2
+    };
+
+    /*! Identifies a single cached response.
+     */
+    struct Key {
+        Kind kind;
+        uint64_t key;
+        uint64_t chunk;
+
+        bool operator==(const Key& other) const {
+            return kind == other.kind && key == other.key && chunk == other.chunk;
+        }
+    };
+
+    /*! Hash function for Key, for use in unordered containers.
+     */
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<uint64_t>()(key.key ^ (key.chunk * 0x9e3779b97f4a7c15ull) ^ key.kind);
+        }
+    };
+
+    /*! A shared, immutable response body.
+     */
+    using Body = std::shared_ptr<const std::string>;
+
+    /*! Constructs an empty cache.
+     *
+     * \param maxBytes The total size of response bodies the cache may hold before evicting the least recently used.
+     *                 A value of zero disables the cache.
+     */
+    explicit ResponseCache(size_t maxBytes);
+
+    /*! Looks up a cached response, marking it as most recently used.
+     *
+     * \param key The response to look up.
+     * \return The cached body, or nullptr on a miss.
+     */
+    Body find(const Key& key);
+
+    /*! The current generation number, which changes on every call to erase(). Callers that compute a response to cache
+     * should read this before reading the database, and pass it to insert(), so a response computed from data that
+     * was replaced in the meantime is never cached. Only an erase() of the same key holds back an insert, so loads
+     * of other responses still fill the cache while records are being replaced.
+     *
+     * \return The current generation.
+     */
+    uint64_t generation() const { return m_generation; }
+
+    /*! Adds a response to the cache, evicting least recently used entries until it fits within the byte budget.
+     * Responses larger than an eighth of the budget are not cached, so a single large body can't flush the cache.
+     *
+     * \param key The response to add.
+     * \param body The encoded response body.
+     * \param generation The value of generation() from before the data in body was read. If the same key was erased
+     *                   since, the response is not cached.
+     */
+    void insert(const Key& key, Body body, uint64_t generation);
+
+    /*! Removes a response from the cache, because the underlying record has changed.
+     *
+     * \param key The response to remove.
+     */
+    void erase(const Key& key);
+
+    /*! \return The number of lookups that found a cached response. */
+    uint64_t hits() const { return m_hits; }
+    /*! \return The number of lookups that did not find a cached response. */
+    uint64_t misses() const { return m_misses; }
+    /*! \return The number of responses evicted to make room for newer ones. */
+    uint64_t evictions() const { return m_evictions; }
+    /*! \return The total size in bytes of the responses currently cached. */
+    size_t size() const;
+
+    /// @cond UNDOCUMENTED
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    using Entry = std::pair<Key, Body>;
+    using EntryList = std::list<Entry>;
+
+    const size_t m_maxBytes;
+
+    mutable std::mutex m_mutex;
+    // Most recently used entries are at the front of the list.
+    EntryList m_entries;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> m_index;
+    size_t m_size;
+    // The generation of the most recent erase() of each key, so that loads which started before it aren't cached.
+    // When it grows too large it is cleared, and m_oldestLoad set to hold back every load that started before that.
+    std::unordered_map<Key, uint64_t, KeyHash> m_erased;
+    uint64_t m_oldestLoad;
+
+    std::atomic<uint64_t> m_generation;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_evictions;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_RESPONSE_CACHE_HPP_
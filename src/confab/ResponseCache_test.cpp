@@ -0,0 +1,87 @@
+#include "ResponseCache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+using Confab::ResponseCache;
+
+namespace {
+
+ResponseCache::Key assetKey(uint64_t key) {
+    return { ResponseCache::kAsset, key, 0 };
+}
+
+ResponseCache::Body body(size_t size) {
+    return std::make_shared<const std::string>(size, 'x');
+}
+
+}  // namespace
+
+TEST(ResponseCacheTest, EvictsLeastRecentlyUsedWithinBudget) {
+    ResponseCache cache(1000);
+    cache.insert(assetKey(1), body(100), cache.generation());
+    cache.insert(assetKey(2), body(100), cache.generation());
+    EXPECT_EQ(200u, cache.size());
+
+    // Bodies over an eighth of the budget are never cached.
+    cache.insert(assetKey(3), body(126), cache.generation());
+    EXPECT_FALSE(cache.find(assetKey(3)));
+
+    // Touch the first, so the second is the least recently used.
+    EXPECT_TRUE(cache.find(assetKey(1)));
+    for (uint64_t key = 10; key < 19; ++key) {
+        cache.insert(assetKey(key), body(100), cache.generation());
+    }
+    EXPECT_EQ(1000u, cache.size());
+    EXPECT_EQ(1u, cache.evictions());
+    EXPECT_TRUE(cache.find(assetKey(1)));
+    EXPECT_FALSE(cache.find(assetKey(2)));
+    EXPECT_TRUE(cache.find(assetKey(10)));
+
+    // Chunks of the same Asset are cached separately.
+    ResponseCache::Key chunk = { ResponseCache::kAssetData, 1, 3 };
+    EXPECT_FALSE(cache.find(chunk));
+    EXPECT_EQ(3u, cache.hits());
+    EXPECT_EQ(3u, cache.misses());
+
+    ResponseCache disabled(0);
+    disabled.insert(assetKey(1), body(1), disabled.generation());
+    EXPECT_FALSE(disabled.find(assetKey(1)));
+}
+
+TEST(ResponseCacheTest, EraseDuringLoadHoldsBackOnlyThatKey) {
+    ResponseCache cache(1000);
+    uint64_t generation = cache.generation();
+
+    // Both loads read the database, then the first key is replaced and erased before either is inserted.
+    cache.erase(assetKey(1));
+    cache.insert(assetKey(1), body(10), generation);
+    cache.insert(assetKey(2), body(10), generation);
+    EXPECT_FALSE(cache.find(assetKey(1)));
+    EXPECT_TRUE(cache.find(assetKey(2)));
+
+    // A load that starts after the erase is cached.
+    cache.insert(assetKey(1), body(10), cache.generation());
+    EXPECT_TRUE(cache.find(assetKey(1)));
+
+    cache.erase(assetKey(1));
+    EXPECT_FALSE(cache.find(assetKey(1)));
+    EXPECT_EQ(10u, cache.size());
+}
+
+TEST(ResponseCacheTest, ForgettingErasesHoldsBackOlderLoads) {
+    ResponseCache cache(100000);
+    uint64_t generation = cache.generation();
+    for (uint64_t key = 100; key < 10000; ++key) {
+        cache.erase(assetKey(key));
+    }
+
+    // Once too many erased keys are remembered, any load older than the last erase can't be told apart from one
+    // that raced it, so none are cached.
+    cache.insert(assetKey(1), body(10), generation);
+    EXPECT_FALSE(cache.find(assetKey(1)));
+    cache.insert(assetKey(1), body(10), cache.generation());
+    EXPECT_TRUE(cache.find(assetKey(1)));
+}
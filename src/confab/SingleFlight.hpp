@@ -0,0 +1,104 @@
+#ifndef SRC_CONFAB_SINGLE_FLIGHT_HPP_
+#define SRC_CONFAB_SINGLE_FLIGHT_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Confab {
+
+/*! Merges concurrent requests for the same key into a single computation of the result.
+ *
+ * The first caller to join() a key becomes the leader, and is responsible for computing the value and calling
+ * complete(). Any callers that join() the same key before the leader completes have their callbacks queued, and all
+ * callbacks are called with the one computed value. Nothing ever blocks waiting on the leader, so this is safe to use
+ * from threads that must not block, such as network reactor threads.
+ *
+ * \tparam Key The type used to identify identical requests. Must be hashable with std::hash.
+ * \tparam Value The type of the shared result, should be cheap to copy, such as a std::shared_ptr.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class SingleFlight {
+public:
+    /*! Called with the result of the computation.
+     */
+    using Callback = std::function<void(Value)>;
+
+    SingleFlight() : m_leaders(0), m_followers(0) { }
+
+    /*! Attaches a callback to the computation of the value for key, starting a new computation if none is in flight.
+     *
+     * \param key The key identifying the request.
+     * \param callback The function to call with the computed value, called exactly once from the thread that calls
+     *                 complete().
+     * \return true if the caller is the leader, and so must compute the value and call complete(), or false if the
+     *         callback was attached to a computation already in flight.
+     */
+    bool join(const Key& key, Callback callback) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto inFlight = m_inFlight.find(key);
+        if (inFlight != m_inFlight.end()) {
+            inFlight->second.push_back(std::move(callback));
+            ++m_followers;
+            return false;
+        }
+        m_inFlight[key].push_back(std::move(callback));
+        ++m_leaders;
+        return true;
+    }
+
+    /*! Delivers the computed value to every callback waiting on key, and retires the key so the next join() starts a
+     * fresh computation. Must be called exactly once by the leader.
+     *
+     * \param key The key identifying the request.
+     * \param value The computed value.
+     */
+    void complete(const Key& key, Value value) {
+        std::vector<Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto inFlight = m_inFlight.find(key);
+            if (inFlight == m_inFlight.end()) {
+                return;
+            }
+            callbacks.swap(inFlight->second);
+            m_inFlight.erase(inFlight);
+        }
+
+        // Call back outside of the lock, so callbacks are free to start new requests.
+        for (auto& callback : callbacks) {
+            callback(value);
+        }
+    }
+
+    /*! The number of computations started, one for each leader.
+     *
+     * \return The count of calls to join() that returned true.
+     */
+    uint64_t leaders() const { return m_leaders; }
+
+    /*! The number of requests that were merged into a computation already in flight.
+     *
+     * \return The count of calls to join() that returned false.
+     */
+    uint64_t followers() const { return m_followers; }
+
+    /// @cond UNDOCUMENTED
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<Key, std::vector<Callback>, Hash> m_inFlight;
+    std::atomic<uint64_t> m_leaders;
+    std::atomic<uint64_t> m_followers;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_SINGLE_FLIGHT_HPP_
@@ -0,0 +1,76 @@
+#include "SingleFlight.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Confab::SingleFlight;
+
+TEST(SingleFlightTest, CompleteFansOutToEveryJoinedCaller) {
+    SingleFlight<uint64_t, std::string> flight;
+    std::vector<std::string> results;
+    auto record = [&results](std::string value) { results.push_back(value); };
+
+    EXPECT_TRUE(flight.join(1, record));
+    EXPECT_FALSE(flight.join(1, record));
+    EXPECT_FALSE(flight.join(1, record));
+    EXPECT_TRUE(flight.join(2, record));
+    EXPECT_TRUE(results.empty());
+
+    flight.complete(1, "one");
+    ASSERT_EQ(3u, results.size());
+    for (const auto& result : results) {
+        EXPECT_EQ("one", result);
+    }
+    EXPECT_EQ(2u, flight.leaders());
+    EXPECT_EQ(2u, flight.followers());
+
+    // The key is retired, so the next join starts a fresh computation, and completing it again does nothing.
+    flight.complete(1, "again");
+    EXPECT_EQ(3u, results.size());
+    EXPECT_TRUE(flight.join(1, record));
+
+    flight.complete(2, "two");
+    EXPECT_EQ("two", results.back());
+}
+
+TEST(SingleFlightTest, CallbacksMayJoinAgain) {
+    SingleFlight<uint64_t, int> flight;
+    int second = 0;
+    ASSERT_TRUE(flight.join(7, [&flight, &second](int) {
+        // Called outside the lock, and after the key is retired, so this leads a new computation.
+        EXPECT_TRUE(flight.join(7, [&second](int value) { second = value; }));
+    }));
+    flight.complete(7, 1);
+    flight.complete(7, 2);
+    EXPECT_EQ(2, second);
+}
+
+TEST(SingleFlightTest, ConcurrentJoinsShareOneLeader) {
+    SingleFlight<uint64_t, int> flight;
+    const int kThreads = 8;
+    std::atomic<int> leaders(0);
+    std::atomic<int> delivered(0);
+    std::atomic<int> joined(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&flight, &leaders, &delivered, &joined] {
+            if (flight.join(3, [&delivered](int value) { delivered += value; })) {
+                ++leaders;
+            }
+            ++joined;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(kThreads, joined);
+    EXPECT_EQ(1, leaders);
+    flight.complete(3, 1);
+    EXPECT_EQ(kThreads, delivered);
+    EXPECT_EQ(1u, flight.leaders());
+    EXPECT_EQ(static_cast<uint64_t>(kThreads - 1), flight.followers());
+}
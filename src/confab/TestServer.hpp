@@ -0,0 +1,101 @@
+#ifndef SRC_CONFAB_TEST_SERVER_HPP_
+#define SRC_CONFAB_TEST_SERVER_HPP_
+
+#include "AssetDatabase.hpp"
+#include "HttpEndpoint.hpp"
+
+#include <chrono>
+#include <experimental/filesystem>
+#include <memory>
+#include <string>
+
+namespace fs = std::experimental::filesystem;
+
+namespace Confab {
+
+/*! Runs a confab-server in process on a loopback port, with its own database, so tests can run clients against a real
+ * server. Shared by the tests, not built into any of the programs.
+ */
+class TestServer {
+public:
+    /*! Nothing listens on this port, so requests to it are refused. */
+    static constexpr int kDeadPort = 19099;
+
+    /*! Options for a test server on port, with few threads and limits high enough that no test request is rejected.
+     */
+    static HttpEndpoint::Options options(int port) {
+        HttpEndpoint::Options options;
+        options.listenPort = port;
+        options.numThreads = 2;
+        options.responseCacheSize = 0;
+        options.metadataThreads = 1;
+        options.limits.global = { { 64, 64, 64 } };
+        options.limits.perPeer = options.limits.global;
+        options.listWatchTimeout = std::chrono::seconds(1);
+        options.maxListWatchers = 4;
+        options.uploadSessionTimeout = std::chrono::hours(1);
+        options.captureMaxBodySize = 0;
+        return options;
+    }
+
+    /*! \return The URL of a server on a loopback port. */
+    static std::string address(int port) {
+        return "http://127.0.0.1:" + std::to_string(port);
+    }
+
+    TestServer() : m_port(0) { }
+
+    /*! Stops the server, if running. */
+    ~TestServer() {
+        stop();
+    }
+
+    /*! Creates and opens a database at databasePath and starts serving it.
+     *
+     * \param databasePath The directory to keep the server database in.
+     * \param options The server configuration, typically from options().
+     * \return true on success, false if the database could not be opened.
+     */
+    bool start(const fs::path& databasePath, const HttpEndpoint::Options& options) {
+        fs::create_directories(databasePath);
+        m_database.reset(new AssetDatabase);
+        if (!m_database->open(databasePath.c_str(), true, 0)) {
+            return false;
+        }
+        m_port = options.listenPort;
+        m_endpoint.reset(new HttpEndpoint(options, m_database));
+        m_endpoint->startServerThread();
+        return true;
+    }
+
+    /*! Stops serving and closes the database. */
+    void stop() {
+        if (m_endpoint) {
+            m_endpoint->shutdown();
+            m_endpoint.reset();
+        }
+        if (m_database) {
+            m_database->close();
+        }
+    }
+
+    /*! \return The URL of this server. */
+    std::string address() const { return address(m_port); }
+
+    /*! \return The server's database. */
+    std::shared_ptr<AssetDatabase> database() { return m_database; }
+
+    /// @cond UNDOCUMENTED
+    TestServer(const TestServer&) = delete;
+    TestServer& operator=(const TestServer&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    int m_port;
+    std::shared_ptr<AssetDatabase> m_database;
+    std::unique_ptr<HttpEndpoint> m_endpoint;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_TEST_SERVER_HPP_
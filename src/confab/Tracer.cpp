@@ -0,0 +1,247 @@
+#include "Tracer.hpp"
+
+#include "glog/logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace {
+
+thread_local Confab::Trace* t_currentTrace = nullptr;
+thread_local uint32_t t_currentSpan = 0;
+
+/*! Returns the next number from a per-thread xorshift generator, which is plenty random enough for sampling and much
+ * cheaper than anything in <random>.
+ */
+uint64_t nextRandom() {
+    thread_local uint64_t state = (static_cast<uint64_t>(Confab::Tracer::threadId()) * 0x9e3779b97f4a7c15ull) ^
+        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+void appendJsonString(std::string& out, const char* value) {
+    out += '"';
+    for (const char* c = value; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+        }
+        out += *c;
+    }
+    out += '"';
+}
+
+void appendChromeEvent(std::string& out, const char* name, const char* category, uint32_t thread, uint64_t start,
+    uint64_t duration, uint64_t traceId) {
+    if (out.back() == '}') {
+        out += ",\n";
+    }
+    out += "{\"name\":";
+    appendJsonString(out, name);
+    out += ",\"cat\":\"";
+    out += category;
+    out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(thread) + ",\"ts\":" + std::to_string(start) +
+        ",\"dur\":" + std::to_string(duration) + ",\"args\":{\"trace\":" + std::to_string(traceId) + "}}";
+}
+
+}  // namespace
+
+namespace Confab {
+
+Trace::Trace(Tracer* tracer, uint64_t id, const char* name, bool sampled) :
+    m_tracer(tracer),
+    m_id(id),
+    m_name(name),
+    m_sampled(sampled),
+    m_thread(Tracer::threadId()),
+    m_start(std::chrono::steady_clock::now()),
+    m_lastSpanId(0) {
+}
+
+Trace::~Trace() {
+    m_tracer->finish(*this);
+}
+
+void Trace::addSpan(const char* name, uint32_t id, uint32_t parent, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end) {
+    Span span;
+    span.name = name;
+    span.id = id;
+    span.parent = parent;
+    span.thread = Tracer::threadId();
+    span.start = m_tracer->microsSinceEpoch(start);
+    span.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_spans.push_back(span);
+}
+
+// static
+Tracer& Tracer::global() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() :
+    m_epoch(std::chrono::steady_clock::now()),
+    m_sampleThreshold(0),
+    m_slowThreshold(0),
+    m_traceAll(false),
+    m_lastTraceId(0),
+    m_capacity(0),
+    m_next(0) {
+}
+
+void Tracer::configure(double sampleRate, size_t capacity, std::chrono::microseconds slowThreshold,
+        bool traceAllSlow) {
+    sampleRate = std::min(std::max(sampleRate, 0.0), 1.0);
+    m_sampleThreshold = static_cast<uint64_t>(std::ceil(sampleRate * 4294967296.0));
+    m_slowThreshold = slowThreshold;
+    m_traceAll = traceAllSlow && slowThreshold.count() > 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ring.clear();
+    m_ring.reserve(capacity);
+    m_capacity = capacity;
+    m_next = 0;
+}
+
+std::shared_ptr<Trace> Tracer::startTrace(const char* name) {
+    bool sampled = m_sampleThreshold != 0 && (nextRandom() & 0xffffffff) < m_sampleThreshold;
+    if (!sampled && !m_traceAll) {
+        return nullptr;
+    }
+    return std::make_shared<Trace>(this, ++m_lastTraceId, name, sampled);
+}
+
+std::string Tracer::chromeTraceJson() {
+    std::vector<FinishedTrace> traces;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Oldest first, starting from the slot to be overwritten next if the ring has wrapped.
+        traces.reserve(m_ring.size());
+        for (size_t i = 0; i < m_ring.size(); ++i) {
+            traces.push_back(m_ring[(m_next + i) % m_ring.size()]);
+        }
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (const auto& trace : traces) {
+        appendChromeEvent(out, trace.name, "request", trace.thread, trace.start, trace.duration, trace.id);
+        for (const auto& span : trace.spans) {
+            appendChromeEvent(out, span.name, "span", span.thread, span.start, span.duration, trace.id);
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+uint64_t Tracer::microsSinceEpoch(std::chrono::steady_clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - m_epoch).count();
+}
+
+// static
+uint32_t Tracer::threadId() {
+    static std::atomic<uint32_t> nextThreadId(0);
+    thread_local uint32_t threadId = ++nextThreadId;
+    return threadId;
+}
+
+void Tracer::finish(Trace& trace) {
+    uint64_t duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - trace.m_start).count();
+    bool slow = m_slowThreshold.count() > 0 && duration >= static_cast<uint64_t>(m_slowThreshold.count());
+    if (!trace.m_sampled && !slow) {
+        return;
+    }
+
+    FinishedTrace finished;
+    finished.id = trace.m_id;
+    finished.name = trace.m_name;
+    finished.thread = trace.m_thread;
+    finished.start = microsSinceEpoch(trace.m_start);
+    finished.duration = duration;
+    {
+        std::lock_guard<std::mutex> lock(trace.m_mutex);
+        finished.spans.swap(trace.m_spans);
+    }
+    std::sort(finished.spans.begin(), finished.spans.end(), [](const Trace::Span& a, const Trace::Span& b) {
+        // Ids are allocated as spans start, so break ties by id to keep parents ahead of their children.
+        return a.start < b.start || (a.start == b.start && a.id < b.id);
+    });
+
+    if (slow) {
+        LOG(WARNING) << "slow request " << formatTree(finished);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capacity == 0) {
+        return;
+    }
+    if (m_ring.size() < m_capacity) {
+        m_ring.push_back(std::move(finished));
+    } else {
+        m_ring[m_next] = std::move(finished);
+    }
+    m_next = (m_next + 1) % m_capacity;
+}
+
+// static
+std::string Tracer::formatTree(const FinishedTrace& trace) {
+    std::string out = std::string(trace.name) + " trace " + std::to_string(trace.id) + " took " +
+        std::to_string(trace.duration) + "us:";
+    std::unordered_map<uint32_t, size_t> depths;
+    for (const auto& span : trace.spans) {
+        auto parent = depths.find(span.parent);
+        size_t depth = parent == depths.end() ? 1 : parent->second + 1;
+        depths[span.id] = depth;
+        out += "\n" + std::string(depth * 2, ' ') + span.name + " +" + std::to_string(span.start - trace.start) +
+            "us " + std::to_string(span.duration) + "us";
+    }
+    return out;
+}
+
+TraceScope::TraceScope(const std::shared_ptr<Trace>& trace) :
+    m_previousTrace(t_currentTrace),
+    m_previousSpan(t_currentSpan) {
+    t_currentTrace = trace.get();
+    t_currentSpan = 0;
+}
+
+TraceScope::~TraceScope() {
+    t_currentTrace = m_previousTrace;
+    t_currentSpan = m_previousSpan;
+}
+
+Span::Span(const char* name) :
+    m_trace(t_currentTrace),
+    m_name(name),
+    m_id(0),
+    m_parent(0) {
+    if (!m_trace) {
+        return;
+    }
+    m_id = m_trace->newSpanId();
+    m_parent = t_currentSpan;
+    t_currentSpan = m_id;
+    m_start = std::chrono::steady_clock::now();
+}
+
+Span::~Span() {
+    if (!m_trace) {
+        return;
+    }
+    t_currentSpan = m_parent;
+    m_trace->addSpan(m_name, m_id, m_parent, m_start, std::chrono::steady_clock::now());
+}
+
+Trace* currentTrace() {
+    return t_currentTrace;
+}
+
+uint32_t currentSpanId() {
+    return t_currentSpan;
+}
+
+}  // namespace Confab
@@ -0,0 +1,225 @@
+#ifndef SRC_CONFAB_TRACER_HPP_
+#define SRC_CONFAB_TRACER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Confab {
+
+class Tracer;
+
+/*! The timings of one traced request, made up of named spans that may be recorded from several threads as the request
+ * moves between them. The trace is finished, and handed back to its Tracer, when the last reference to it is released.
+ */
+class Trace : public std::enable_shared_from_this<Trace> {
+public:
+    /*! One timed stage of a request.
+     */
+    struct Span {
+        /*! The name of the stage. Must be a string literal or otherwise outlive the Tracer. */
+        const char* name;
+        /*! Identifies this span within the trace, starting from 1. */
+        uint32_t id;
+        /*! The id of the span this one ran within, or 0 for a span directly under the request. */
+        uint32_t parent;
+        /*! Small integer identifying the thread the span ran on. */
+        uint32_t thread;
+        /*! Start time, in microseconds since the Tracer was created. */
+        uint64_t start;
+        /*! Duration in microseconds. */
+        uint64_t duration;
+    };
+
+    /*! Constructs a trace, normally done by Tracer::startTrace().
+     *
+     * \param tracer The tracer to return the finished trace to.
+     * \param id A number identifying the trace.
+     * \param name The name of the request being traced, must outlive the Tracer.
+     * \param sampled True if the request was sampled, so the trace is kept however long it takes. If false it is only
+     *                kept if the request turns out to be slow.
+     */
+    Trace(Tracer* tracer, uint64_t id, const char* name, bool sampled);
+
+    /*! Finishes the trace, handing it back to the Tracer.
+     */
+    ~Trace();
+
+    /*! \return A new span id, unique within this trace. */
+    uint32_t newSpanId() { return ++m_lastSpanId; }
+
+    /*! Adds a finished span to the trace. Thread safe.
+     *
+     * \param name The name of the stage, must outlive the Tracer.
+     * \param id The id of the span, from newSpanId().
+     * \param parent The id of the enclosing span, or 0 for none.
+     * \param start When the span started.
+     * \param end When the span ended.
+     */
+    void addSpan(const char* name, uint32_t id, uint32_t parent, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end);
+
+    /// @cond UNDOCUMENTED
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    friend class Tracer;
+
+    Tracer* m_tracer;
+    uint64_t m_id;
+    const char* m_name;
+    bool m_sampled;
+    uint32_t m_thread;
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<uint32_t> m_lastSpanId;
+
+    std::mutex m_mutex;
+    std::vector<Span> m_spans;
+};
+
+/*! Samples requests for span tracing, and keeps the most recently finished traces in a ring buffer for export as Chrome
+ * trace JSON. Finished traces that took longer than a threshold are also logged in full.
+ *
+ * Requests not sampled cost a single thread-local read per span. Whether a request is slow is only known once it has
+ * finished, so by default slow requests are only caught among those sampled. Tracing all requests for the slow log
+ * catches every one, and those neither sampled nor slow are discarded as they finish, before any sorting or locking of
+ * the ring.
+ */
+class Tracer {
+public:
+    /*! \return The process-wide tracer. Disabled until configured. */
+    static Tracer& global();
+
+    /*! Constructs a disabled Tracer.
+     */
+    Tracer();
+
+    /*! Sets the sampling parameters. Not thread safe, so should be called before serving requests.
+     *
+     * \param sampleRate The fraction of requests to trace, from 0 to disable tracing to 1 to trace every request.
+     * \param capacity The number of finished traces to keep.
+     * \param slowThreshold Traced requests taking at least this long are logged with all of their spans. Zero
+     *                      disables the log.
+     * \param traceAllSlow If true, and the slow log is enabled, every request is traced so that slow requests are
+     *                     logged and kept in the ring whether sampled or not. Costs a trace for every request.
+     */
+    void configure(double sampleRate, size_t capacity, std::chrono::microseconds slowThreshold, bool traceAllSlow);
+
+    /*! Decides whether to trace a request, and if so starts the trace.
+     *
+     * \param name The name of the request, such as its route, must outlive the Tracer.
+     * \return A new trace, or nullptr if this request was not sampled and not all requests are traced.
+     */
+    std::shared_ptr<Trace> startTrace(const char* name);
+
+    /*! Renders the retained traces as Chrome trace event JSON, for loading in chrome://tracing or Perfetto.
+     *
+     * \return The JSON document.
+     */
+    std::string chromeTraceJson();
+
+    /*! \return The time in microseconds since this Tracer was created. */
+    uint64_t microsSinceEpoch(std::chrono::steady_clock::time_point time) const;
+
+    /*! \return A small integer identifying the calling thread in traces. */
+    static uint32_t threadId();
+
+    /// @cond UNDOCUMENTED
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    friend class Trace;
+
+    struct FinishedTrace {
+        uint64_t id;
+        const char* name;
+        uint32_t thread;
+        uint64_t start;
+        uint64_t duration;
+        std::vector<Trace::Span> spans;
+    };
+
+    // Called when a trace is destroyed, to keep it if sampled or slow, and log it if slow.
+    void finish(Trace& trace);
+
+    static std::string formatTree(const FinishedTrace& trace);
+
+    const std::chrono::steady_clock::time_point m_epoch;
+    // Requests are sampled when a per-thread random number falls under this, out of 2^32. Zero disables tracing.
+    uint64_t m_sampleThreshold;
+    std::chrono::microseconds m_slowThreshold;
+    // True if every request is traced for the slow log, not only those sampled.
+    bool m_traceAll;
+    std::atomic<uint64_t> m_lastTraceId;
+
+    std::mutex m_mutex;
+    std::vector<FinishedTrace> m_ring;
+    size_t m_capacity;
+    size_t m_next;
+};
+
+/*! Makes a trace current on this thread for the life of the scope, so that Spans created on the thread are added to
+ * it. Restores the previously current trace when destroyed.
+ */
+class TraceScope {
+public:
+    /*! Makes a trace current.
+     *
+     * \param trace The trace to add spans to, or nullptr to record nothing in this scope.
+     */
+    explicit TraceScope(const std::shared_ptr<Trace>& trace);
+    ~TraceScope();
+
+    /// @cond UNDOCUMENTED
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    Trace* m_previousTrace;
+    uint32_t m_previousSpan;
+};
+
+/*! Times a stage of the request whose trace is current on this thread, if any, from construction to destruction.
+ * Spans nest, so a Span created within the life of another is recorded as its child.
+ */
+class Span {
+public:
+    /*! Starts the span.
+     *
+     * \param name The name of the stage, must be a string literal or otherwise outlive the Tracer.
+     */
+    explicit Span(const char* name);
+    ~Span();
+
+    /// @cond UNDOCUMENTED
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    Trace* m_trace;
+    const char* m_name;
+    uint32_t m_id;
+    uint32_t m_parent;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/*! \return The trace current on this thread, or nullptr if none. */
+Trace* currentTrace();
+
+/*! \return The id of the innermost open Span on this thread, or 0 if none. */
+uint32_t currentSpanId();
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_TRACER_HPP_
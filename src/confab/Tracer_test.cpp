@@ -0,0 +1,99 @@
+#include "Tracer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+TEST(TracerTest, DisabledTracerSamplesNothing) {
+    Confab::Tracer tracer;
+    EXPECT_EQ(nullptr, tracer.startTrace("request"));
+    {
+        // Spans with no current trace are no-ops.
+        Confab::Span span("stage");
+        EXPECT_EQ(0u, Confab::currentSpanId());
+    }
+    EXPECT_EQ(std::string::npos, tracer.chromeTraceJson().find("\"ph\""));
+}
+
+TEST(TracerTest, NestedSpansAcrossThreads) {
+    Confab::Tracer tracer;
+    tracer.configure(1.0, 4, std::chrono::microseconds(0), false);
+    {
+        std::shared_ptr<Confab::Trace> trace = tracer.startTrace("request");
+        ASSERT_NE(nullptr, trace);
+        Confab::TraceScope scope(trace);
+        EXPECT_EQ(trace.get(), Confab::currentTrace());
+        {
+            Confab::Span outer("outer");
+            uint32_t outerId = Confab::currentSpanId();
+            EXPECT_NE(0u, outerId);
+            {
+                Confab::Span inner("inner");
+                EXPECT_NE(outerId, Confab::currentSpanId());
+            }
+            EXPECT_EQ(outerId, Confab::currentSpanId());
+        }
+        std::thread worker([trace] {
+            Confab::TraceScope scope(trace);
+            Confab::Span span("worker");
+        });
+        worker.join();
+    }
+    EXPECT_EQ(nullptr, Confab::currentTrace());
+
+    std::string json = tracer.chromeTraceJson();
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"request\",\"cat\":\"request\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"outer\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"inner\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"worker\""));
+}
+
+TEST(TracerTest, RingKeepsMostRecentTraces) {
+    Confab::Tracer tracer;
+    tracer.configure(1.0, 2, std::chrono::microseconds(0), false);
+    const char* names[] = { "first", "second", "third" };
+    for (const char* name : names) {
+        tracer.startTrace(name);
+    }
+    std::string json = tracer.chromeTraceJson();
+    EXPECT_EQ(std::string::npos, json.find("\"first\""));
+    size_t second = json.find("\"second\"");
+    size_t third = json.find("\"third\"");
+    ASSERT_NE(std::string::npos, second);
+    ASSERT_NE(std::string::npos, third);
+    EXPECT_LT(second, third);
+}
+
+TEST(TracerTest, TracesOnlySampledRequestsForSlowLogByDefault) {
+    Confab::Tracer tracer;
+    tracer.configure(0.0, 4, std::chrono::milliseconds(20), false);
+    EXPECT_EQ(nullptr, tracer.startTrace("unsampled"));
+}
+
+TEST(TracerTest, KeepsSlowRequestsWhetherSampledOrNot) {
+    // Nothing is sampled, but with all requests traced for the slow log each is traced in case it turns out slow.
+    Confab::Tracer tracer;
+    tracer.configure(0.0, 4, std::chrono::milliseconds(20), true);
+    {
+        std::shared_ptr<Confab::Trace> trace = tracer.startTrace("fast");
+        ASSERT_NE(nullptr, trace);
+        Confab::TraceScope scope(trace);
+        Confab::Span span("quick");
+    }
+    {
+        std::shared_ptr<Confab::Trace> trace = tracer.startTrace("slow");
+        ASSERT_NE(nullptr, trace);
+        Confab::TraceScope scope(trace);
+        Confab::Span span("waiting");
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    }
+
+    // Only the slow one is kept, with its spans.
+    std::string json = tracer.chromeTraceJson();
+    EXPECT_EQ(std::string::npos, json.find("\"fast\""));
+    EXPECT_EQ(std::string::npos, json.find("\"quick\""));
+    EXPECT_NE(std::string::npos, json.find("\"slow\""));
+    EXPECT_NE(std::string::npos, json.find("\"waiting\""));
+}
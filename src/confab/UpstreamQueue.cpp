@@ -0,0 +1,380 @@
+#include "UpstreamQueue.hpp"
+
+#include "AssetDatabase.hpp"
+#include "ChunkLayout.hpp"
+#include "Constants.hpp"
+#include "ContentChunker.hpp"
+#include "HttpClient.hpp"
+#include "MappedFile.hpp"
+#include "Record.hpp"
+#include "schemas/FlatAsset_generated.h"
+#include "schemas/FlatAssetData_generated.h"
+
+#include "glog/logging.h"
+#include "xxhash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/*! The chunks of one Asset in flight to the server, shared with the POST callbacks, which run on HTTP client threads.
+ */
+struct ChunkWindow {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t inFlight = 0;
+    bool failed = false;
+    // Set along with failed if a chunk can never be sent, because the server refused it or it is missing locally.
+    bool rejected = false;
+    // Chunks the server has accepted since the window was opened.
+    std::vector<uint64_t> accepted;
+};
+
+}  // namespace
+
+namespace Confab {
+
+UpstreamQueue::UpstreamQueue(std::shared_ptr<AssetDatabase> assetDatabase, std::shared_ptr<HttpClient> httpClient,
+        size_t uploadWindow, bool contentDefinedChunks) :
+    m_assetDatabase(assetDatabase),
+    m_httpClient(httpClient),
+    m_uploadWindow(std::max(uploadWindow, static_cast<size_t>(1))),
+    m_contentDefinedChunks(contentDefinedChunks),
+    m_queued(false),
+    m_stopping(false) {
+}
+
+UpstreamQueue::~UpstreamQueue() {
+    shutdown();
+}
+
+uint64_t UpstreamQueue::addInlineAsset(Asset::Type type, const std::string& name, uint64_t author,
+        uint64_t deprecates, const std::string& listIds, uint64_t size, const uint8_t* inlineData) {
+    if (size > kSingleChunkDataSize) {
+        LOG(ERROR) << "attempt to add inline Asset of size " << size << " greater than max of "
+            << kSingleChunkDataSize;
+        return 0;
+    }
+
+    Asset asset(type);
+    asset.setName(name);
+    asset.setAuthor(author);
+    asset.setDeprecates(deprecates);
+    // For short assets we add some random salt to the hash, to help avoid hash collisions.
+    uint64_t salt = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        salt = m_distribution(m_randomDevice);
+    }
+    asset.setSalt(salt);
+    uint64_t key = XXH64(inlineData, size, asset.salt());
+    asset.setKey(key);
+    asset.parseListIds(listIds);
+    asset.setSize(size);
+    flatbuffers::FlatBufferBuilder builder(kPageSize);
+    asset.flatten(builder, inlineData);
+
+    if (!m_assetDatabase->storeAsset(key, SizedPointer(builder.GetBufferPointer(), builder.GetSize()))) {
+        LOG(ERROR) << "error storing new inline Asset " << Asset::keyToString(key) << " in local database.";
+        return 0;
+    }
+    LOG(INFO) << "stored new inline Asset " << Asset::keyToString(key) << " locally, queueing upload.";
+    return enqueue(key, 0) ? key : 0;
+}
+
+uint64_t UpstreamQueue::addFileAsset(Asset::Type type, const std::string& name, uint64_t author,
+        uint64_t deprecates, const std::string& listIds, const fs::path& assetFile) {
+    MappedFile file;
+    if (!file.open(assetFile)) {
+        LOG(ERROR) << "error opening file: " << assetFile << " to add.";
+        return 0;
+    }
+    size_t fileSize = file.size();
+    if (fileSize == 0 || fileSize > kMaxAssetSize) {
+        LOG(ERROR) << "rejecting addition of file at " << assetFile << " with size " << fileSize;
+        return 0;
+    }
+
+    // The server records the chunk size of each Asset, so any size up to the maximum will do, and using the default
+    // here means adding a file never has to wait on the network to ask the server for its configured size.
+    size_t chunkSize = kDefaultDataChunkSize;
+    std::vector<uint64_t> offsets;
+    if (m_contentDefinedChunks) {
+        ContentChunker chunker(chunkSize);
+        if (!chunker.split(file, offsets)) {
+            LOG(ERROR) << "error reading file " << assetFile << " to find its chunks.";
+            return 0;
+        }
+        // The Asset records every offset, so a file with more chunks than it can hold gets fixed size chunks instead.
+        if (offsets.size() > kMaxChunkOffsets) {
+            LOG(WARNING) << "file " << assetFile << " splits into " << offsets.size() << " chunks, more than the "
+                << "maximum of " << kMaxChunkOffsets << ", using fixed size chunks.";
+            offsets.clear();
+        }
+    }
+    uint64_t chunks = offsets.size() ? offsets.size() : (fileSize + chunkSize - 1) / chunkSize;
+    ChunkLayout layout(fileSize, chunks, chunkSize, offsets);
+    uint64_t uploadId = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_randomMutex);
+        uploadId = m_distribution(m_randomDevice);
+    }
+
+    // The key is the hash of the whole file, so chunks are staged in the local database until it is known, then
+    // committed under it, as the server does for single-pass uploads.
+    XXH64_state_t* hashState = XXH64_createState();
+    XXH64_reset(hashState, 0);
+    uint64_t key = 0;
+    bool ok = true;
+    for (uint64_t chunk = 0; ok && chunk < chunks; ++chunk) {
+        size_t offset = layout.offset(chunk);
+        size_t flatDataSize = layout.chunkSize(chunk);
+        SizedPointer chunkData = file.read(offset, flatDataSize);
+        if (!chunkData.data()) {
+            LOG(ERROR) << "error reading asset file " << assetFile << " expected " << flatDataSize
+                << " bytes at offset " << offset;
+            ok = false;
+            break;
+        }
+        file.prefetch(offset + flatDataSize, chunkSize);
+
+        flatbuffers::FlatBufferBuilder builder(flatDataSize + kPageSize);
+        uint8_t* flatData = nullptr;
+        auto flatAssetData = builder.CreateUninitializedVector(flatDataSize, &flatData);
+        std::memcpy(flatData, chunkData.data(), flatDataSize);
+        XXH64_update(hashState, flatData, flatDataSize);
+        key = XXH64_digest(hashState);
+        Data::FlatAssetDataBuilder assetDataBuilder(builder);
+        assetDataBuilder.add_data(flatAssetData);
+        assetDataBuilder.add_hash(key);
+        builder.Finish(assetDataBuilder.Finish());
+        ok = m_assetDatabase->storeStagedDataChunk(uploadId, chunk,
+            SizedPointer(builder.GetBufferPointer(), builder.GetSize()));
+    }
+    XXH64_freeState(hashState);
+    if (!ok) {
+        LOG(ERROR) << "error storing file " << assetFile << " in local database.";
+        return 0;
+    }
+
+    Asset asset(type);
+    asset.setKey(key);
+    asset.setName(name);
+    asset.setFileExtension(assetFile.extension());
+    asset.setAuthor(author);
+    asset.setDeprecates(deprecates);
+    asset.setSize(fileSize);
+    asset.setChunks(chunks);
+    asset.setChunkSize(chunkSize);
+    asset.setChunkOffsets(offsets);
+    asset.parseListIds(listIds);
+    flatbuffers::FlatBufferBuilder builder(kPageSize);
+    asset.flatten(builder);
+    if (!m_assetDatabase->commitUpload(uploadId, SizedPointer(builder.GetBufferPointer(), builder.GetSize()))) {
+        LOG(ERROR) << "error committing file " << assetFile << " to local database as Asset "
+            << Asset::keyToString(key);
+        return 0;
+    }
+    LOG(INFO) << "stored file " << assetFile << " locally as Asset " << Asset::keyToString(key) << ", " << chunks
+        << " chunks, queueing upload.";
+    return enqueue(key, chunks) ? key : 0;
+}
+
+void UpstreamQueue::start(ProgressCallback progress) {
+    m_progress = progress;
+    // Chunks staged by a local add that failed part way through are never committed, so are cleaned up here.
+    m_assetDatabase->expireUploads(kStagedChunkTimeout);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = false;
+        m_queued = true;
+    }
+    m_uploadThread = std::thread(&UpstreamQueue::uploadLoop, this);
+}
+
+void UpstreamQueue::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    if (m_uploadThread.joinable()) {
+        m_uploadThread.join();
+    }
+}
+
+bool UpstreamQueue::enqueue(uint64_t key, uint64_t chunks) {
+    if (m_assetDatabase->queueUpstream(key) == 0) {
+        return false;
+    }
+    report(key, kQueued, 0, chunks);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued = true;
+    }
+    m_condition.notify_all();
+    return true;
+}
+
+void UpstreamQueue::uploadLoop() {
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    std::chrono::milliseconds retryDelay = kMinRetryDelay;
+    // Chunks accepted by the upstream for the request at the head of the queue, kept across retries to that upstream.
+    uint64_t currentToken = 0;
+    size_t currentUpstream = UpstreamSet::kNone;
+    std::vector<bool> sent;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_queued || m_stopping; });
+            if (m_stopping) {
+                return;
+            }
+            m_queued = false;
+        }
+
+        while (!m_stopping && m_assetDatabase->getUpstreamQueue(1, entries) > 0) {
+            uint64_t token = entries[0].first;
+            uint64_t key = entries[0].second;
+            std::string keyString = Asset::keyToString(key);
+            RecordPtr record = m_assetDatabase->findAsset(key);
+            if (record->empty() || Data::GetFlatAsset(record->data().data())->key() != key) {
+                LOG(ERROR) << "Asset " << keyString << " queued for upload is missing from the local database, "
+                    << "dropping its upstream request.";
+                m_assetDatabase->removeUpstream(token);
+                report(key, kFailed, 0, 0);
+                continue;
+            }
+
+            uint64_t chunks = Data::GetFlatAsset(record->data().data())->chunks();
+            size_t upstream = m_httpClient->uploadUpstream();
+            if (token != currentToken || upstream != currentUpstream) {
+                currentToken = token;
+                currentUpstream = upstream;
+                sent.assign(chunks, false);
+            }
+
+            // The Asset goes last, so that the server never has the Asset without all of its data.
+            LOG(INFO) << "sending Asset " << keyString << " upstream, " << chunks << " chunks.";
+            HttpClient::PostResult result = sendChunks(key, upstream, sent);
+            if (result == HttpClient::kPosted) {
+                result = m_httpClient->postAsset(record->data(), upstream);
+            }
+            if (result == HttpClient::kPosted) {
+                LOG(INFO) << "Asset " << keyString << " is now upstream.";
+                m_assetDatabase->removeUpstream(token);
+                report(key, kDone, chunks, chunks);
+                retryDelay = kMinRetryDelay;
+                currentToken = 0;
+                continue;
+            }
+            uint64_t chunksSent = std::count(sent.begin(), sent.end(), true);
+            if (result == HttpClient::kRejected) {
+                // Sending it again would be refused again, and hold up every Asset queued behind it.
+                LOG(ERROR) << "Asset " << keyString << " was rejected upstream, dropping its upstream request.";
+                m_assetDatabase->removeUpstream(token);
+                report(key, kFailed, chunksSent, chunks);
+                retryDelay = kMinRetryDelay;
+                currentToken = 0;
+                continue;
+            }
+            if (m_stopping) {
+                break;
+            }
+
+            LOG(WARNING) << "failed to send Asset " << keyString << " upstream, " << chunksSent << " of " << chunks
+                << " chunks sent, retrying in " << retryDelay.count() << " ms.";
+            report(key, kRetrying, chunksSent, chunks);
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait_for(lock, retryDelay, [this] { return m_stopping.load(); });
+            }
+            retryDelay = std::min(retryDelay * 2, kMaxRetryDelay);
+        }
+    }
+}
+
+HttpClient::PostResult UpstreamQueue::sendChunks(uint64_t key, size_t upstream, std::vector<bool>& sent) {
+    auto window = std::make_shared<ChunkWindow>();
+    uint64_t chunks = sent.size();
+    uint64_t chunksSent = std::count(sent.begin(), sent.end(), true);
+    auto lastReport = std::chrono::steady_clock::time_point();
+
+    for (uint64_t chunk = 0; chunk < chunks && !m_stopping; ++chunk) {
+        if (sent[chunk]) {
+            continue;
+        }
+        std::vector<uint64_t> accepted;
+        {
+            std::unique_lock<std::mutex> lock(window->mutex);
+            window->changed.wait(lock, [this, &window] {
+                return window->inFlight < m_uploadWindow || window->failed;
+            });
+            if (window->failed) {
+                break;
+            }
+            ++window->inFlight;
+            accepted.swap(window->accepted);
+        }
+        for (auto acceptedChunk : accepted) {
+            sent[acceptedChunk] = true;
+        }
+        chunksSent += accepted.size();
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= kProgressInterval) {
+            report(key, kSending, chunksSent, chunks);
+            lastReport = now;
+        }
+
+        RecordPtr assetData = m_assetDatabase->loadAssetDataChunk(key, chunk);
+        if (assetData->empty()) {
+            LOG(ERROR) << "chunk " << chunk << " of Asset " << Asset::keyToString(key)
+                << " is missing from the local database.";
+            std::lock_guard<std::mutex> lock(window->mutex);
+            --window->inFlight;
+            window->failed = true;
+            window->rejected = true;
+            break;
+        }
+        m_httpClient->postAssetDataAsync(key, chunk, assetData->data(), [window, chunk](
+                HttpClient::PostResult result) {
+            {
+                std::lock_guard<std::mutex> lock(window->mutex);
+                --window->inFlight;
+                if (result == HttpClient::kPosted) {
+                    window->accepted.push_back(chunk);
+                } else {
+                    window->failed = true;
+                    window->rejected = window->rejected || result == HttpClient::kRejected;
+                }
+            }
+            window->changed.notify_all();
+        }, upstream);
+    }
+
+    // Wait for the window to drain, so every accepted chunk is counted for a retry to skip.
+    std::unique_lock<std::mutex> lock(window->mutex);
+    window->changed.wait(lock, [&window] { return window->inFlight == 0; });
+    for (auto acceptedChunk : window->accepted) {
+        sent[acceptedChunk] = true;
+    }
+    if (window->rejected) {
+        return HttpClient::kRejected;
+    }
+    if (window->failed || !std::all_of(sent.begin(), sent.end(), [](bool chunkSent) { return chunkSent; })) {
+        return HttpClient::kFailed;
+    }
+    return HttpClient::kPosted;
+}
+
+void UpstreamQueue::report(uint64_t key, State state, uint64_t chunksSent, uint64_t chunks) {
+    if (m_progress) {
+        m_progress(key, state, chunksSent, chunks);
+    }
+}
+
+}  // namespace Confab
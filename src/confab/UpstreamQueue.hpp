@@ -0,0 +1,175 @@
+#ifndef SRC_CONFAB_UPSTREAM_QUEUE_HPP_
+#define SRC_CONFAB_UPSTREAM_QUEUE_HPP_
+
+#include "Asset.hpp"
+#include "HttpClient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace Confab {
+
+class AssetDatabase;
+
+/*! Adds new Assets to the client's local AssetDatabase, then pushes them to the upstream server in the background.
+ *
+ * An add computes the Asset key, stores the Asset and any AssetData chunks in the local database, and records an
+ * upstream request there, all without touching the network, so it returns as soon as the data are stored. A
+ * background thread works through the requests oldest first. It POSTs each Asset's chunks and then the Asset itself,
+ * all to the same upstream, so other clients never find the Asset before its data. A request is only removed from the
+ * database once the server has accepted everything, so requests left when the client stops, or while the server is
+ * unreachable, are sent by a later run. Failed uploads are retried after a delay that doubles up to kMaxRetryDelay.
+ * An Asset the server rejects as invalid is dropped from the queue instead, as it would be rejected again, so it can't
+ * hold up the Assets queued after it. It stays in the local database.
+ */
+class UpstreamQueue {
+public:
+    /*! The stages of an Asset's trip upstream, reported to the progress callback.
+     */
+    enum State {
+        kQueued,    //!< Stored locally and waiting to be sent.
+        kSending,   //!< Chunks are being sent.
+        kRetrying,  //!< The last attempt failed, and it will be sent again after a delay.
+        kDone,      //!< The server has the Asset and all of its data.
+        kFailed     //!< The server rejected the Asset or its data, or they are missing locally. It won't be sent.
+    };
+
+    /*! Called as Assets make their way upstream, from the adding thread for kQueued and the upload thread otherwise.
+     *
+     * \param key The Asset key.
+     * \param state The new state of the Asset.
+     * \param chunksSent The number of AssetData chunks the server has accepted.
+     * \param chunks The number of AssetData chunks of the Asset, 0 for inline Assets.
+     */
+    using ProgressCallback = std::function<void(uint64_t key, State state, uint64_t chunksSent, uint64_t chunks)>;
+
+    /*! The delay before the first retry of a failed upload. */
+    static constexpr std::chrono::milliseconds kMinRetryDelay{1000};
+    /*! The longest delay between retries of a failed upload. */
+    static constexpr std::chrono::milliseconds kMaxRetryDelay{60000};
+    /*! The shortest time between kSending progress reports for one Asset. */
+    static constexpr std::chrono::milliseconds kProgressInterval{250};
+    /*! How long staged chunks of a local file add that failed part way through are kept before being deleted. */
+    static constexpr std::chrono::hours kStagedChunkTimeout{1};
+
+    /*! Constructs an UpstreamQueue. Call start() to begin sending queued Assets.
+     *
+     * \param assetDatabase The client's local database, which holds the Assets and the upstream requests.
+     * \param httpClient The client to send Assets upstream with.
+     * \param uploadWindow The maximum number of AssetData chunk POSTs to have in flight at once.
+     * \param contentDefinedChunks If true, files are split into chunks at boundaries found by a ContentChunker, so an
+     *                             edited file shares most of its chunks with the original. Files splitting into
+     *                             more than kMaxChunkOffsets chunks are stored with fixed size chunks.
+     */
+    UpstreamQueue(std::shared_ptr<AssetDatabase> assetDatabase, std::shared_ptr<HttpClient> httpClient,
+            size_t uploadWindow, bool contentDefinedChunks = false);
+
+    /*! Stops the upload thread, if running.
+     */
+    ~UpstreamQueue();
+
+    /*! Adds an Asset with inline data to the local database and queues it for upload.
+     *
+     * \param type The Asset type.
+     * \param name The Asset name, can be "".
+     * \param author An optional Asset key.
+     * \param deprecates An optional Asset key.
+     * \param listIds A comma-separated concatenated string of list ids to add this asset to.
+     * \param size The size of the data pointed to by inlineData, at most kSingleChunkDataSize.
+     * \param inlineData The inline Asset data to serialize.
+     * \return The computed key for this Asset, or zero on error.
+     */
+    uint64_t addInlineAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
+            const std::string& listIds, uint64_t size, const uint8_t* inlineData);
+
+    /*! Adds an Asset along with all AssetData chunks in the file to the local database, in a single read of the file,
+     * or two when finding content-defined chunk boundaries, and queues it for upload. The chunks are staged in the
+     * database while they are hashed, then committed under the final hash along with the Asset, so the Asset is never
+     * found without all of its data.
+     *
+     * \param type The Asset type.
+     * \param name The Asset name, can be "".
+     * \param author An optional Asset key.
+     * \param deprecates An optional Asset key.
+     * \param listIds A comma-separated concatenated string of list ids to add this asset to.
+     * \param assetFile The path of the file to ingest.
+     * \return The computed key for this Asset, or zero on error.
+     */
+    uint64_t addFileAsset(Asset::Type type, const std::string& name, uint64_t author, uint64_t deprecates,
+            const std::string& listIds, const fs::path& assetFile);
+
+    /*! Starts the thread that sends queued Assets upstream, beginning with any left by an earlier run.
+     *
+     * \param progress Called as each Asset makes its way upstream, can be empty.
+     */
+    void start(ProgressCallback progress);
+
+    /*! Stops the upload thread, at the end of the chunk window in flight. Unsent Assets stay queued in the database.
+     */
+    void shutdown();
+
+    /// @cond UNDOCUMENTED
+    UpstreamQueue(const UpstreamQueue&) = delete;
+    UpstreamQueue& operator=(const UpstreamQueue&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    /*! Records an upstream request for a stored Asset, and wakes the upload thread.
+     *
+     * \param key The Asset key.
+     * \param chunks The number of AssetData chunks of the Asset.
+     * \return true on success, false on error.
+     */
+    bool enqueue(uint64_t key, uint64_t chunks);
+
+    /*! Sends queued Assets upstream, oldest first, until shutdown() is called.
+     */
+    void uploadLoop();
+
+    /*! Sends the AssetData chunks of an Asset not yet marked sent, keeping up to the upload window in flight.
+     *
+     * \param key The Asset key.
+     * \param upstream The upstream to send the chunks to.
+     * \param sent Which chunks the server has accepted, updated as they are.
+     * \return kPosted if every chunk has now been accepted, kRejected if a chunk can never be sent, as the server
+     *         rejected it or it is missing locally, and kFailed otherwise.
+     */
+    HttpClient::PostResult sendChunks(uint64_t key, size_t upstream, std::vector<bool>& sent);
+
+    /*! Reports progress, if there is a callback to report to.
+     */
+    void report(uint64_t key, State state, uint64_t chunksSent, uint64_t chunks);
+
+    std::shared_ptr<AssetDatabase> m_assetDatabase;
+    std::shared_ptr<HttpClient> m_httpClient;
+    const size_t m_uploadWindow;
+    const bool m_contentDefinedChunks;
+    ProgressCallback m_progress;
+
+    std::mutex m_randomMutex;
+    std::random_device m_randomDevice;
+    std::uniform_int_distribution<uint64_t> m_distribution;
+
+    // Guards m_queued and m_stopping, and wakes the upload thread when either changes.
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_queued;
+    std::atomic<bool> m_stopping;
+    std::thread m_uploadThread;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_UPSTREAM_QUEUE_HPP_
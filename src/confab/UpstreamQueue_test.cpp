@@ -0,0 +1,226 @@
+#include "UpstreamQueue.hpp"
+
+#include "Asset.hpp"
+#include "AssetDatabase.hpp"
+#include "ChunkLayout.hpp"
+#include "Constants.hpp"
+#include "HttpClient.hpp"
+#include "TestServer.hpp"
+#include "schemas/FlatAsset_generated.h"
+#include "schemas/FlatAssetData_generated.h"
+
+#include <experimental/filesystem>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+// Loopback port for the test server.
+const int kServerPort = 19190;
+
+// Runs a confab-server in process, with its own database, and gives the client a separate local database.
+class UpstreamQueueTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = fs::temp_directory_path() / fs::path("confab-upstream-queue-test-" +
+            std::to_string(reinterpret_cast<uintptr_t>(this)));
+        fs::remove_all(m_path);
+        fs::create_directories(m_path / "client");
+        ASSERT_TRUE(m_server.start(m_path / "server", Confab::TestServer::options(kServerPort)));
+        m_serverDatabase = m_server.database();
+        m_clientDatabase.reset(new Confab::AssetDatabase);
+        ASSERT_TRUE(m_clientDatabase->open((m_path / "client").c_str(), true, 0));
+    }
+
+    void TearDown() override {
+        m_server.stop();
+        m_clientDatabase->close();
+        fs::remove_all(m_path);
+    }
+
+    // Records progress reports, so tests can wait for an Asset to reach a state.
+    Confab::UpstreamQueue::ProgressCallback recorder() {
+        return [this](uint64_t key, Confab::UpstreamQueue::State state, uint64_t, uint64_t) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_states.insert(std::make_pair(key, state));
+            }
+            m_changed.notify_all();
+        };
+    }
+
+    bool waitFor(uint64_t key, Confab::UpstreamQueue::State state) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_changed.wait_for(lock, std::chrono::seconds(10), [this, key, state] {
+            return m_states.count(std::make_pair(key, state)) > 0;
+        });
+    }
+
+    fs::path m_path;
+    Confab::TestServer m_server;
+    std::shared_ptr<Confab::AssetDatabase> m_serverDatabase;
+    std::shared_ptr<Confab::AssetDatabase> m_clientDatabase;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::set<std::pair<uint64_t, Confab::UpstreamQueue::State>> m_states;
+};
+
+}  // namespace
+
+TEST_F(UpstreamQueueTest, StoresLocallyThenSendsUpstream) {
+    fs::path filePath = m_path / "upload.wav";
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        for (int i = 0; i < 60000; ++i) {
+            file << "sample " << i << "\n";
+        }
+    }
+    uint64_t chunks = (fs::file_size(filePath) + Confab::kDefaultDataChunkSize - 1) / Confab::kDefaultDataChunkSize;
+    ASSERT_GT(chunks, 1u);
+
+    std::shared_ptr<Confab::HttpClient> client(new Confab::HttpClient(m_server.address()));
+    Confab::UpstreamQueue queue(m_clientDatabase, client, 4);
+    std::string contents = "local first";
+    uint64_t inlineKey = queue.addInlineAsset(Confab::Asset::kSnippet, "", 0, 0, "", contents.size(),
+        reinterpret_cast<const uint8_t*>(contents.data()));
+    uint64_t fileKey = queue.addFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+    ASSERT_NE(0u, inlineKey);
+    ASSERT_NE(0u, fileKey);
+
+    // Both are complete locally, and queued, before anything is sent.
+    EXPECT_FALSE(m_clientDatabase->findAsset(inlineKey)->empty());
+    EXPECT_FALSE(m_clientDatabase->findAsset(fileKey)->empty());
+    for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+        EXPECT_FALSE(m_clientDatabase->loadAssetDataChunk(fileKey, chunk)->empty());
+    }
+    EXPECT_TRUE(m_serverDatabase->findAsset(fileKey)->empty());
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    EXPECT_EQ(2u, m_clientDatabase->getUpstreamQueue(8, entries));
+
+    queue.start(recorder());
+    EXPECT_TRUE(waitFor(inlineKey, Confab::UpstreamQueue::kDone));
+    EXPECT_TRUE(waitFor(fileKey, Confab::UpstreamQueue::kDone));
+    queue.shutdown();
+    client->shutdown();
+
+    EXPECT_FALSE(m_serverDatabase->findAsset(inlineKey)->empty());
+    Confab::RecordPtr asset = m_serverDatabase->findAsset(fileKey);
+    ASSERT_FALSE(asset->empty());
+    EXPECT_EQ(chunks, Confab::Data::GetFlatAsset(asset->data().data())->chunks());
+    for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+        EXPECT_FALSE(m_serverDatabase->loadAssetDataChunk(fileKey, chunk)->empty()) << "chunk " << chunk;
+    }
+    EXPECT_EQ(0u, m_clientDatabase->getUpstreamQueue(8, entries));
+}
+
+TEST_F(UpstreamQueueTest, SendsContentDefinedChunks) {
+    fs::path filePath = m_path / "upload.wav";
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        for (int i = 0; i < 60000; ++i) {
+            file << "sample " << i << "\n";
+        }
+    }
+
+    std::shared_ptr<Confab::HttpClient> client(new Confab::HttpClient(m_server.address()));
+    Confab::UpstreamQueue queue(m_clientDatabase, client, 4, true);
+    uint64_t fileKey = queue.addFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+    ASSERT_NE(0u, fileKey);
+    queue.start(recorder());
+    EXPECT_TRUE(waitFor(fileKey, Confab::UpstreamQueue::kDone));
+    queue.shutdown();
+    client->shutdown();
+
+    // The server holds every chunk, each the size its recorded offsets say.
+    Confab::RecordPtr asset = m_serverDatabase->findAsset(fileKey);
+    ASSERT_FALSE(asset->empty());
+    Confab::ChunkLayout layout = Confab::ChunkLayout::fromFlatAsset(Confab::Data::GetFlatAsset(asset->data().data()));
+    ASSERT_TRUE(layout.valid());
+    EXPECT_TRUE(layout.contentDefined());
+    EXPECT_EQ(fs::file_size(filePath), layout.size());
+    EXPECT_GT(layout.chunks(), 1u);
+    for (uint64_t chunk = 0; chunk < layout.chunks(); ++chunk) {
+        Confab::RecordPtr data = m_serverDatabase->loadAssetDataChunk(fileKey, chunk);
+        ASSERT_FALSE(data->empty()) << "chunk " << chunk;
+        EXPECT_EQ(layout.chunkSize(chunk), Confab::Data::GetFlatAssetData(data->data().data())->data()->size());
+    }
+}
+
+TEST_F(UpstreamQueueTest, KeepsRequestsUntilServerReachable) {
+    std::string contents = "waiting for the network";
+    uint64_t key = 0;
+    {
+        std::shared_ptr<Confab::HttpClient> client(new Confab::HttpClient(
+            Confab::TestServer::address(Confab::TestServer::kDeadPort)));
+        Confab::UpstreamQueue queue(m_clientDatabase, client, 4);
+        queue.start(recorder());
+        key = queue.addInlineAsset(Confab::Asset::kSnippet, "", 0, 0, "", contents.size(),
+            reinterpret_cast<const uint8_t*>(contents.data()));
+        ASSERT_NE(0u, key);
+        EXPECT_TRUE(waitFor(key, Confab::UpstreamQueue::kRetrying));
+        queue.shutdown();
+        client->shutdown();
+    }
+
+    // The request outlasts the queue that failed to send it, and a later one picks it up.
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    ASSERT_EQ(1u, m_clientDatabase->getUpstreamQueue(8, entries));
+    EXPECT_EQ(key, entries[0].second);
+
+    std::shared_ptr<Confab::HttpClient> client(new Confab::HttpClient(m_server.address()));
+    Confab::UpstreamQueue queue(m_clientDatabase, client, 4);
+    queue.start(recorder());
+    EXPECT_TRUE(waitFor(key, Confab::UpstreamQueue::kDone));
+    queue.shutdown();
+    client->shutdown();
+    EXPECT_FALSE(m_serverDatabase->findAsset(key)->empty());
+    EXPECT_EQ(0u, m_clientDatabase->getUpstreamQueue(8, entries));
+}
+
+TEST_F(UpstreamQueueTest, DropsRejectedAssetsAndSendsTheRest) {
+    // An Asset the server refuses, with chunks larger than it allows, stored and queued locally ahead of a valid one.
+    uint64_t badKey = 0xbad;
+    Confab::Asset asset(Confab::Asset::kSample);
+    asset.setKey(badKey);
+    asset.setSize(0);
+    asset.setChunks(0);
+    asset.setChunkSize(Confab::kMaxDataChunkSize + 1);
+    flatbuffers::FlatBufferBuilder builder;
+    asset.flatten(builder);
+    ASSERT_TRUE(m_clientDatabase->storeAsset(badKey,
+        Confab::SizedPointer(builder.GetBufferPointer(), builder.GetSize())));
+    ASSERT_NE(0u, m_clientDatabase->queueUpstream(badKey));
+
+    std::shared_ptr<Confab::HttpClient> client(new Confab::HttpClient(m_server.address()));
+    Confab::UpstreamQueue queue(m_clientDatabase, client, 4);
+    std::string contents = "queued behind a bad one";
+    uint64_t goodKey = queue.addInlineAsset(Confab::Asset::kSnippet, "", 0, 0, "", contents.size(),
+        reinterpret_cast<const uint8_t*>(contents.data()));
+    ASSERT_NE(0u, goodKey);
+
+    queue.start(recorder());
+    EXPECT_TRUE(waitFor(badKey, Confab::UpstreamQueue::kFailed));
+    EXPECT_TRUE(waitFor(goodKey, Confab::UpstreamQueue::kDone));
+    queue.shutdown();
+    client->shutdown();
+
+    // The rejected Asset is no longer queued, but is still available locally.
+    EXPECT_TRUE(m_serverDatabase->findAsset(badKey)->empty());
+    EXPECT_FALSE(m_serverDatabase->findAsset(goodKey)->empty());
+    EXPECT_FALSE(m_clientDatabase->findAsset(badKey)->empty());
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    EXPECT_EQ(0u, m_clientDatabase->getUpstreamQueue(8, entries));
+    EXPECT_EQ(0u, m_states.count(std::make_pair(badKey, Confab::UpstreamQueue::kRetrying)));
+}
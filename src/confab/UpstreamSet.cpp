@@ -0,0 +1,171 @@
+#include "UpstreamSet.hpp"
+
+#include <algorithm>
+
+namespace Confab {
+
+// How much a full error rate multiplies the expected cost of an upstream, so that a flaky upstream is avoided well
+// before it fails enough requests in a row to be taken out of rotation.
+static const double kErrorPenalty = 10.0;
+
+UpstreamSet::UpstreamSet(const std::vector<std::string>& addresses, size_t initialLimit, size_t maxLimit) :
+    m_maxLimit(std::max(maxLimit, static_cast<size_t>(1))) {
+    size_t count = std::min(addresses.size(), kMaxUpstreams);
+    m_upstreams.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Upstream upstream;
+        upstream.address = addresses[i];
+        upstream.latency.fill(0.0);
+        upstream.errorRate = 0.0;
+        upstream.limit = static_cast<double>(std::min(std::max(initialLimit, static_cast<size_t>(1)), m_maxLimit));
+        upstream.inFlight = 0;
+        upstream.consecutiveFailures = 0;
+        upstream.requests = 0;
+        upstream.failures = 0;
+        upstream.rejections = 0;
+        m_upstreams.push_back(upstream);
+    }
+}
+
+size_t UpstreamSet::select(RequestClass requestClass, uint64_t excluded, std::chrono::steady_clock::time_point now,
+        size_t headroom) const {
+    size_t healthy = kNone;
+    double healthyCost = 0.0;
+    bool anyHealthy = false;
+    size_t probe = kNone;
+    std::chrono::steady_clock::time_point probeAt = std::chrono::steady_clock::time_point::max();
+
+    for (size_t i = 0; i < m_upstreams.size(); ++i) {
+        if (excluded & (1ull << i)) {
+            continue;
+        }
+        const Upstream& upstream = m_upstreams[i];
+        if (upstream.consecutiveFailures >= kMaxConsecutiveFailures) {
+            // Out of rotation, so only ever sent one request at a time, to find out if it has recovered.
+            if (upstream.inFlight == 0 && upstream.retryAt < probeAt) {
+                probe = i;
+                probeAt = upstream.retryAt;
+            }
+            continue;
+        }
+        anyHealthy = true;
+        if (upstream.inFlight >= static_cast<size_t>(upstream.limit) + headroom || now < upstream.busyUntil) {
+            continue;
+        }
+        // Untried upstreams have no latency yet, so cost the least and are tried first.
+        double cost = (latency(upstream, requestClass) + 1.0) * (upstream.inFlight + 1) *
+            (1.0 + kErrorPenalty * upstream.errorRate);
+        if (healthy == kNone || cost < healthyCost) {
+            healthy = i;
+            healthyCost = cost;
+        }
+    }
+
+    // An upstream due a probe gets it even when healthy ones are available, as otherwise it would never rejoin. Past
+    // that, only probe early if there is no healthy upstream to wait for.
+    if (probe != kNone && probeAt <= now) {
+        return probe;
+    }
+    if (healthy != kNone || anyHealthy) {
+        return healthy;
+    }
+    return probe;
+}
+
+size_t UpstreamSet::best(RequestClass requestClass, std::chrono::steady_clock::time_point now) const {
+    size_t best = kNone;
+    double bestLatency = 0.0;
+    size_t probe = kNone;
+    std::chrono::steady_clock::time_point probeAt = std::chrono::steady_clock::time_point::max();
+    for (size_t i = 0; i < m_upstreams.size(); ++i) {
+        const Upstream& upstream = m_upstreams[i];
+        if (upstream.consecutiveFailures >= kMaxConsecutiveFailures) {
+            if (upstream.retryAt < probeAt) {
+                probe = i;
+                probeAt = upstream.retryAt;
+            }
+            continue;
+        }
+        double cost = latency(upstream, requestClass) * (1.0 + kErrorPenalty * upstream.errorRate);
+        if (best == kNone || cost < bestLatency) {
+            best = i;
+            bestLatency = cost;
+        }
+    }
+    return best != kNone ? best : probe;
+}
+
+uint64_t UpstreamSet::all() const {
+    return m_upstreams.size() >= kMaxUpstreams ? ~0ull : (1ull << m_upstreams.size()) - 1;
+}
+
+void UpstreamSet::start(size_t upstream) {
+    ++m_upstreams[upstream].inFlight;
+    ++m_upstreams[upstream].requests;
+}
+
+void UpstreamSet::finish(size_t upstream, RequestClass requestClass, bool ok, std::chrono::microseconds latency,
+        std::chrono::steady_clock::time_point now) {
+    Upstream& state = m_upstreams[upstream];
+    if (state.inFlight > 0) {
+        --state.inFlight;
+    }
+
+    if (!ok) {
+        ++state.failures;
+        state.errorRate += kSampleWeight * (1.0 - state.errorRate);
+        state.limit = std::max(state.limit / 2.0, 1.0);
+        if (++state.consecutiveFailures >= kMaxConsecutiveFailures) {
+            int doublings = std::min(state.consecutiveFailures - kMaxConsecutiveFailures, 16);
+            state.retryAt = now + std::min(std::chrono::milliseconds(kMinRetryDelay * (1 << doublings)),
+                kMaxRetryDelay);
+        }
+        return;
+    }
+
+    state.consecutiveFailures = 0;
+    state.errorRate -= kSampleWeight * state.errorRate;
+    // Watches wait on the server for List updates, so their latency says nothing about the server's speed.
+    if (requestClass == kWatch) {
+        return;
+    }
+    double sample = static_cast<double>(latency.count());
+    double& average = state.latency[requestClass];
+    bool slow = average > 0.0 && sample > kSlowResponseRatio * average;
+    average = average > 0.0 ? average + kSampleWeight * (sample - average) : sample;
+    if (slow) {
+        state.limit = std::max(state.limit / 2.0, 1.0);
+    } else {
+        state.limit = std::min(state.limit + 1.0 / state.limit, static_cast<double>(m_maxLimit));
+    }
+}
+
+void UpstreamSet::reject(size_t upstream, std::chrono::steady_clock::time_point retryAt) {
+    Upstream& state = m_upstreams[upstream];
+    if (state.inFlight > 0) {
+        --state.inFlight;
+    }
+    ++state.rejections;
+    state.busyUntil = std::max(state.busyUntil, retryAt);
+}
+
+UpstreamSet::Status UpstreamSet::status(size_t upstream) const {
+    const Upstream& state = m_upstreams[upstream];
+    Status status;
+    status.address = state.address;
+    status.latency = state.latency;
+    status.errorRate = state.errorRate;
+    status.limit = state.limit;
+    status.inFlight = state.inFlight;
+    status.healthy = state.consecutiveFailures < kMaxConsecutiveFailures;
+    status.requests = state.requests;
+    status.failures = state.failures;
+    status.rejections = state.rejections;
+    return status;
+}
+
+double UpstreamSet::latency(const Upstream& upstream, RequestClass requestClass) const {
+    return upstream.latency[requestClass == kWatch ? kMetadata : requestClass];
+}
+
+}  // namespace Confab
@@ -0,0 +1,176 @@
+#ifndef SRC_CONFAB_UPSTREAM_SET_HPP_
+#define SRC_CONFAB_UPSTREAM_SET_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace Confab {
+
+/*! Tracks the health and speed of each of a client's upstream servers, and picks which one each request goes to.
+ *
+ * Every upstream keeps an exponentially weighted moving average (EWMA) of its response latency for each request class,
+ * and of its error rate. A request goes to the healthy upstream with the lowest expected cost, its latency scaled by
+ * the number of requests already waiting on it, so load spreads toward faster servers without starving slower ones of
+ * the samples that would show they have sped up. An upstream that fails kMaxConsecutiveFailures requests in a row is
+ * taken out of rotation, and probed with a single request after a delay that doubles with each further failure.
+ *
+ * Each upstream also has an adaptive limit on its requests in flight, which approximates the number of connections
+ * worth opening to it. The limit grows by one for every limit's worth of successful responses, and halves on an error
+ * or a response much slower than usual, so it settles near the concurrency the server can take.
+ *
+ * A server over capacity turns requests away with a time to wait before trying again. That is back-pressure rather
+ * than a failure, so it leaves the upstream's health and limit alone, and only keeps requests off it until then.
+ *
+ * Not thread safe, callers must serialize access.
+ */
+class UpstreamSet {
+public:
+    /*! Kinds of request, which have separate latency averages because their costs differ by orders of magnitude.
+     */
+    enum RequestClass : size_t {
+        kMetadata = 0,  //!< Asset, List, and config requests.
+        kBulk = 1,      //!< AssetData chunk transfers.
+        kWatch = 2,     //!< List watches, which wait on the server so are ranked by metadata latency.
+        kNumClasses = 3
+    };
+
+    /*! Returned by select() and best() when there is no upstream to use. */
+    static constexpr size_t kNone = std::numeric_limits<size_t>::max();
+    /*! Requests can be sent to at most this many upstreams, so that the ones tried fit in a bitmask. */
+    static constexpr size_t kMaxUpstreams = 64;
+    /*! The weight of each new sample in the latency and error rate averages. */
+    static constexpr double kSampleWeight = 0.2;
+    /*! Failures in a row after which an upstream is taken out of rotation. */
+    static constexpr int kMaxConsecutiveFailures = 3;
+    /*! How long an upstream first stays out of rotation, doubled for each further failure. */
+    static constexpr std::chrono::milliseconds kMinRetryDelay{500};
+    /*! The longest an upstream stays out of rotation before being probed again. */
+    static constexpr std::chrono::milliseconds kMaxRetryDelay{30000};
+    /*! Responses slower than this multiple of the average latency shrink the in-flight limit. */
+    static constexpr double kSlowResponseRatio = 4.0;
+
+    /*! A point-in-time copy of the state of one upstream.
+     */
+    struct Status {
+        std::string address;                       //!< The address part of URLs for this upstream.
+        std::array<double, kNumClasses> latency;   //!< Average latency in microseconds, or 0 if not yet sampled.
+        double errorRate;                          //!< Average fraction of requests that failed.
+        double limit;                              //!< The current limit on requests in flight.
+        size_t inFlight;                           //!< Requests in flight.
+        bool healthy;                              //!< False if out of rotation after repeated failures.
+        uint64_t requests;                         //!< Total requests sent.
+        uint64_t failures;                         //!< Total requests that failed.
+        uint64_t rejections;                       //!< Total requests turned away for being over capacity.
+    };
+
+    /*! Constructs a set of upstreams, all healthy and without latency samples.
+     *
+     * \param addresses The address part of the URLs for each upstream, such as "http://sclork-s01.local:9080", in order
+     *                  of preference when there is nothing else to choose between them. Only the first kMaxUpstreams
+     *                  are used.
+     * \param initialLimit The limit on requests in flight each upstream starts with.
+     * \param maxLimit The most the limit on requests in flight can grow to.
+     */
+    UpstreamSet(const std::vector<std::string>& addresses, size_t initialLimit, size_t maxLimit);
+
+    /*! \return The number of upstreams. */
+    size_t size() const { return m_upstreams.size(); }
+
+    /*! Returns the address of an upstream. Addresses never change, so this is safe to call without serializing.
+     *
+     * \param upstream The index of the upstream.
+     * \return The address part of URLs for the upstream.
+     */
+    const std::string& address(size_t upstream) const { return m_upstreams[upstream].address; }
+
+    /*! Picks the upstream to send a request to now.
+     *
+     * Prefers healthy upstreams with room under their limit, and not waiting out a reject(), by lowest expected cost.
+     * Failing that, an upstream out of rotation with nothing in flight can be probed, preferring those whose retry
+     * delay has passed, so requests still fail fast rather than wait if every upstream is down.
+     *
+     * \param requestClass The class of the request.
+     * \param excluded A bitmask of upstreams the request must not go to, such as those it has already failed on.
+     * \param now The current time.
+     * \param headroom How many requests beyond its limit an upstream may have in flight and still take this one.
+     * \return The index of the upstream, or kNone if every upstream not excluded is at its limit.
+     */
+    size_t select(RequestClass requestClass, uint64_t excluded, std::chrono::steady_clock::time_point now,
+            size_t headroom = 0) const;
+
+    /*! Picks the upstream a series of related requests should all go to, ignoring current load.
+     *
+     * \param requestClass The class of most of the requests.
+     * \param now The current time.
+     * \return The index of the healthy upstream with the lowest average latency, or of the upstream due to be probed
+     *         soonest if none are healthy.
+     */
+    size_t best(RequestClass requestClass, std::chrono::steady_clock::time_point now) const;
+
+    /*! \return A bitmask with a bit set for every upstream. */
+    uint64_t all() const;
+
+    /*! Counts a request as sent to an upstream.
+     *
+     * \param upstream The index of the upstream.
+     */
+    void start(size_t upstream);
+
+    /*! Records the outcome of a request sent with start().
+     *
+     * \param upstream The index of the upstream.
+     * \param requestClass The class of the request.
+     * \param ok False if the request got no response or a server error.
+     * \param latency The time from sending the request to its response.
+     * \param now The current time.
+     */
+    void finish(size_t upstream, RequestClass requestClass, bool ok, std::chrono::microseconds latency,
+            std::chrono::steady_clock::time_point now);
+
+    /*! Records that an upstream turned away a request sent with start() for being over capacity, in place of
+     * finish(). The upstream's health, error rate, latency and limit are unchanged, but select() doesn't pick it again
+     * until retryAt.
+     *
+     * \param upstream The index of the upstream.
+     * \param retryAt When the upstream asked to be sent requests again.
+     */
+    void reject(size_t upstream, std::chrono::steady_clock::time_point retryAt);
+
+    /*! Returns the state of an upstream.
+     *
+     * \param upstream The index of the upstream.
+     * \return A copy of the upstream's state.
+     */
+    Status status(size_t upstream) const;
+
+private:
+    struct Upstream {
+        std::string address;
+        std::array<double, kNumClasses> latency;
+        double errorRate;
+        double limit;
+        size_t inFlight;
+        int consecutiveFailures;
+        std::chrono::steady_clock::time_point retryAt;
+        // Set by reject(), the upstream takes no requests before this time.
+        std::chrono::steady_clock::time_point busyUntil;
+        uint64_t requests;
+        uint64_t failures;
+        uint64_t rejections;
+    };
+
+    /*! \return The average latency to rank an upstream by for a request class. */
+    double latency(const Upstream& upstream, RequestClass requestClass) const;
+
+    const size_t m_maxLimit;
+    std::vector<Upstream> m_upstreams;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_UPSTREAM_SET_HPP_
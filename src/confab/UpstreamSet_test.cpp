@@ -0,0 +1,166 @@
+#include "UpstreamSet.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Confab::UpstreamSet;
+
+const std::vector<std::string> kAddresses = { "http://a:9080", "http://b:9080", "http://c:9080" };
+
+// Sends and completes one request to an upstream.
+void complete(UpstreamSet& upstreams, size_t upstream, bool ok, int latencyMicroseconds,
+        std::chrono::steady_clock::time_point now, UpstreamSet::RequestClass requestClass = UpstreamSet::kMetadata) {
+    upstreams.start(upstream);
+    upstreams.finish(upstream, requestClass, ok, std::chrono::microseconds(latencyMicroseconds), now);
+}
+
+}  // namespace
+
+TEST(UpstreamSetTest, PrefersUntriedThenFasterUpstreams) {
+    UpstreamSet upstreams({ kAddresses[0], kAddresses[1] }, 4, 16);
+    auto now = std::chrono::steady_clock::now();
+    ASSERT_EQ(2u, upstreams.size());
+    EXPECT_EQ(kAddresses[1], upstreams.address(1));
+
+    // Ties go to the first upstream listed, and upstreams without samples go before those with them.
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    complete(upstreams, 0, true, 1000, now);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    complete(upstreams, 1, true, 20000, now);
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    EXPECT_EQ(0u, upstreams.best(UpstreamSet::kMetadata, now));
+
+    // Latency is tracked per class, so the slow metadata upstream may still be the one to use for bulk transfers.
+    complete(upstreams, 0, true, 50000, now, UpstreamSet::kBulk);
+    complete(upstreams, 1, true, 10000, now, UpstreamSet::kBulk);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kBulk, 0, now));
+
+    // Watches are ranked by metadata latency and don't update it.
+    complete(upstreams, 0, true, 30000000, now, UpstreamSet::kWatch);
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kWatch, 0, now));
+    EXPECT_DOUBLE_EQ(1000.0, upstreams.status(0).latency[UpstreamSet::kMetadata]);
+}
+
+TEST(UpstreamSetTest, SpreadsLoadWithinLimits) {
+    UpstreamSet upstreams({ kAddresses[0], kAddresses[1] }, 2, 16);
+    auto now = std::chrono::steady_clock::now();
+    complete(upstreams, 0, true, 1000, now);
+    complete(upstreams, 1, true, 1500, now);
+
+    // The faster upstream takes requests until its expected cost, scaled by its queue, is above the slower one.
+    upstreams.start(upstreams.select(UpstreamSet::kMetadata, 0, now));
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    upstreams.start(1);
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    upstreams.start(0);
+    upstreams.start(1);
+    EXPECT_EQ(2u, upstreams.status(0).inFlight);
+
+    // Both are at their limit, so the next request must wait.
+    EXPECT_EQ(UpstreamSet::kNone, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    // Unless the request may go over the limit, as interactive requests can.
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, now, 1));
+    upstreams.finish(1, UpstreamSet::kMetadata, true, std::chrono::microseconds(1500), now);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+
+    // Excluding every upstream leaves nothing to select.
+    EXPECT_EQ(UpstreamSet::kNone, upstreams.select(UpstreamSet::kMetadata, upstreams.all(), now));
+}
+
+TEST(UpstreamSetTest, AdaptsLimitToResponses) {
+    UpstreamSet upstreams({ kAddresses[0] }, 4, 6);
+    auto now = std::chrono::steady_clock::now();
+    EXPECT_DOUBLE_EQ(4.0, upstreams.status(0).limit);
+
+    // Grows by one for each limit's worth of successes, up to the maximum.
+    for (int i = 0; i < 4; ++i) {
+        complete(upstreams, 0, true, 1000, now);
+    }
+    EXPECT_NEAR(5.0, upstreams.status(0).limit, 0.1);
+    for (int i = 0; i < 100; ++i) {
+        complete(upstreams, 0, true, 1000, now);
+    }
+    EXPECT_DOUBLE_EQ(6.0, upstreams.status(0).limit);
+
+    // Halves on a response far slower than average, or on an error, but never goes below one.
+    complete(upstreams, 0, true, 100000, now);
+    EXPECT_DOUBLE_EQ(3.0, upstreams.status(0).limit);
+    complete(upstreams, 0, false, 0, now);
+    EXPECT_DOUBLE_EQ(1.5, upstreams.status(0).limit);
+    complete(upstreams, 0, false, 0, now);
+    EXPECT_DOUBLE_EQ(1.0, upstreams.status(0).limit);
+    EXPECT_GT(upstreams.status(0).errorRate, 0.3);
+    EXPECT_EQ(107u, upstreams.status(0).requests);
+    EXPECT_EQ(2u, upstreams.status(0).failures);
+}
+
+TEST(UpstreamSetTest, FailsOverAndProbesForRecovery) {
+    UpstreamSet upstreams(kAddresses, 4, 16);
+    auto now = std::chrono::steady_clock::now();
+    complete(upstreams, 0, true, 1000, now);
+    complete(upstreams, 1, true, 2000, now);
+    complete(upstreams, 2, true, 3000, now);
+
+    // An error makes an upstream less attractive before it is taken out of rotation.
+    complete(upstreams, 0, false, 0, now);
+    EXPECT_TRUE(upstreams.status(0).healthy);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+
+    complete(upstreams, 0, false, 0, now);
+    complete(upstreams, 0, false, 0, now);
+    EXPECT_FALSE(upstreams.status(0).healthy);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    EXPECT_EQ(1u, upstreams.best(UpstreamSet::kMetadata, now));
+
+    // Requests that failed on the healthy upstreams may go to the unhealthy one rather than fail outright.
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0x6, now));
+
+    // Once the retry delay has passed, one request at a time is sent to probe it.
+    auto later = now + UpstreamSet::kMinRetryDelay;
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, later));
+    upstreams.start(0);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, later));
+    EXPECT_EQ(UpstreamSet::kNone, upstreams.select(UpstreamSet::kMetadata, 0x6, later));
+
+    // A failed probe doubles the delay.
+    upstreams.finish(0, UpstreamSet::kMetadata, false, std::chrono::microseconds(0), later);
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, later + UpstreamSet::kMinRetryDelay));
+    auto muchLater = later + UpstreamSet::kMinRetryDelay * 2;
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, muchLater));
+
+    // A successful probe returns it to rotation.
+    complete(upstreams, 0, true, 1000, muchLater);
+    EXPECT_TRUE(upstreams.status(0).healthy);
+}
+
+TEST(UpstreamSetTest, RejectionHoldsOffWithoutCountingAsFailure) {
+    UpstreamSet upstreams({ kAddresses[0], kAddresses[1] }, 4, 16);
+    auto now = std::chrono::steady_clock::now();
+    complete(upstreams, 0, true, 1000, now);
+    complete(upstreams, 1, true, 2000, now);
+    double limit = upstreams.status(0).limit;
+
+    // Turned away more often than it would take failures to go out of rotation, the upstream stays healthy, with the
+    // same limit, but takes no requests until the time it asked for.
+    auto retryAt = now + std::chrono::seconds(1);
+    for (int i = 0; i < UpstreamSet::kMaxConsecutiveFailures + 1; ++i) {
+        upstreams.start(0);
+        upstreams.reject(0, retryAt);
+    }
+    UpstreamSet::Status status = upstreams.status(0);
+    EXPECT_TRUE(status.healthy);
+    EXPECT_EQ(0u, status.failures);
+    EXPECT_EQ(4u, status.rejections);
+    EXPECT_EQ(0u, status.inFlight);
+    EXPECT_DOUBLE_EQ(0.0, status.errorRate);
+    EXPECT_DOUBLE_EQ(limit, status.limit);
+
+    EXPECT_EQ(1u, upstreams.select(UpstreamSet::kMetadata, 0, now));
+    EXPECT_EQ(UpstreamSet::kNone, upstreams.select(UpstreamSet::kMetadata, 0x2, now));
+    EXPECT_EQ(0u, upstreams.select(UpstreamSet::kMetadata, 0, retryAt));
+}
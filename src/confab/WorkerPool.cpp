@@ -0,0 +1,92 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+namespace Confab {
+
+WorkerPool::WorkerPool(int metadataThreads, int bulkThreads) :
+    m_numThreads{ { std::max(metadataThreads, 1), std::max(bulkThreads, 1) } },
+    m_running(false) {
+}
+
+WorkerPool::~WorkerPool() {
+    shutdown();
+}
+
+void WorkerPool::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    for (size_t lane = 0; lane < kNumLanes; ++lane) {
+        for (int i = 0; i < m_numThreads[lane]; ++i) {
+            m_threads.emplace_back(&WorkerPool::workerLoop, this, static_cast<Lane>(lane));
+        }
+    }
+}
+
+void WorkerPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    for (auto& condition : m_conditions) {
+        condition.notify_all();
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+}
+
+bool WorkerPool::post(Lane lane, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return false;
+        }
+        m_queues[lane].push_back(std::move(task));
+    }
+    // Threads on lower priority lanes may also take this task, so wake one of those too in case this lane's threads
+    // are all busy.
+    for (size_t i = lane; i < kNumLanes; ++i) {
+        m_conditions[i].notify_one();
+    }
+    return true;
+}
+
+size_t WorkerPool::queueDepth(Lane lane) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queues[lane].size();
+}
+
+size_t WorkerPool::nextLane(Lane lane) {
+    for (size_t i = 0; i <= lane; ++i) {
+        if (!m_queues[i].empty()) {
+            return i;
+        }
+    }
+    return kNumLanes;
+}
+
+void WorkerPool::workerLoop(Lane lane) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_conditions[lane].wait(lock, [this, lane] { return !m_running || nextLane(lane) < kNumLanes; });
+        // Drain the queues before honoring shutdown, so every posted task is run and every response is sent.
+        size_t next = nextLane(lane);
+        if (next == kNumLanes) {
+            break;
+        }
+        std::function<void()> task = std::move(m_queues[next].front());
+        m_queues[next].pop_front();
+        lock.unlock();
+        task();
+        // Destroy the task, and anything it captured, before retaking the lock.
+        task = nullptr;
+        lock.lock();
+    }
+}
+
+}  // namespace Confab
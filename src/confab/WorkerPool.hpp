@@ -0,0 +1,91 @@
+#ifndef SRC_CONFAB_WORKER_POOL_HPP_
+#define SRC_CONFAB_WORKER_POOL_HPP_
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Confab {
+
+/*! A fixed pool of threads for running blocking work off of the threads receiving requests, the network reactor
+ * threads in confab-server, or the OSC listening thread in confab.
+ *
+ * Work is queued onto one of two lanes, each served by its own threads, so that a backlog of large AssetData chunk
+ * reads and writes can't delay the small metadata and list requests queued behind them. Lanes are in priority order,
+ * and threads serving a lower priority lane take work from higher priority lanes first, so idle bulk threads help
+ * drain a metadata backlog but metadata threads are never tied up with bulk work.
+ */
+class WorkerPool {
+public:
+    /*! Identifies the queue and threads a task runs on.
+     */
+    enum Lane : size_t {
+        kMetadata = 0,  //!< Small requests, Assets, names, and Lists. Highest priority.
+        kBulk = 1,      //!< AssetData chunks, and Asset file loads and additions.
+        kNumLanes = 2
+    };
+
+    /*! Constructs a stopped pool.
+     *
+     * \param metadataThreads The number of threads serving the metadata lane, at least one will be started.
+     * \param bulkThreads The number of threads serving the bulk lane, at least one will be started.
+     */
+    WorkerPool(int metadataThreads, int bulkThreads);
+
+    /*! Stops the pool, if running.
+     */
+    ~WorkerPool();
+
+    /*! Starts the worker threads.
+     */
+    void start();
+
+    /*! Runs all tasks already queued, then stops and joins the worker threads. Tasks posted after shutdown() are
+     * dropped.
+     */
+    void shutdown();
+
+    /*! Queues a task to run on one of the threads serving lane.
+     *
+     * \param lane The lane to run the task on.
+     * \param task The function to call. Must not throw.
+     * \return false if the pool is shut down and the task was dropped, true otherwise.
+     */
+    bool post(Lane lane, std::function<void()> task);
+
+    /*! The number of tasks waiting to run on a lane, not counting tasks currently running.
+     *
+     * \param lane The lane to report on.
+     * \return The queue depth.
+     */
+    size_t queueDepth(Lane lane);
+
+    /// @cond UNDOCUMENTED
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    /// @endcond UNDOCUMENTED
+
+private:
+    void workerLoop(Lane lane);
+
+    // Returns the highest priority lane with queued work that a thread serving lane may take from, or kNumLanes if
+    // there is none. Must be called with m_mutex held.
+    size_t nextLane(Lane lane);
+
+    std::array<int, kNumLanes> m_numThreads;
+
+    std::mutex m_mutex;
+    std::array<std::condition_variable, kNumLanes> m_conditions;
+    std::array<std::deque<std::function<void()>>, kNumLanes> m_queues;
+    bool m_running;
+    std::vector<std::thread> m_threads;
+};
+
+}  // namespace Confab
+
+#endif  // SRC_CONFAB_WORKER_POOL_HPP_
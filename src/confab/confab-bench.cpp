@@ -0,0 +1,190 @@
+#include "Asset.hpp"
+#include "AssetDatabase.hpp"
+#include "CacheManager.hpp"
+#include "ChunkLayout.hpp"
+#include "Constants.hpp"
+#include "HttpClient.hpp"
+#include "HttpEndpoint.hpp"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <experimental/filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+DEFINE_int32(file_size_mb, 100, "Size in megabytes of the random file to upload and download.");
+DEFINE_string(upload_windows, "1,2,4,8,16", "Comma-separated upload window sizes to time uploads with.");
+DEFINE_bool(single_pass_upload, true, "If true, time single-pass uploads that stage chunks on the server while "
+    "hashing, otherwise time uploads that read the file twice.");
+DEFINE_bool(content_defined_chunks, false, "If true, split the file into AssetData chunks at content-defined "
+    "boundaries rather than at multiples of the chunk size.");
+DEFINE_string(download_windows, "1,2,4,8,16", "Comma-separated download window sizes to time downloads with.");
+DEFINE_int32(repetitions, 3, "Number of times to transfer the file with each window size.");
+DEFINE_int32(port, 9082, "Loopback port for the in-process server to listen on.");
+DEFINE_int32(server_threads, 4, "Number of HTTP threads for the in-process server.");
+DEFINE_int32(data_chunk_size_kb, Confab::kDefaultDataChunkSize / 1024, "Size in kilobytes of the AssetData chunks "
+    "the in-process server advertises.");
+DEFINE_int32(max_requests_in_flight, Confab::HttpClient::kDefaultMaxInFlight, "Maximum number of requests the client "
+    "has in flight to the server at once.");
+DEFINE_string(work_directory, "", "Directory to hold the benchmark database, file, and cache, which is removed "
+    "afterwards. Defaults to a new directory in the system temporary directory.");
+
+namespace {
+
+/*! Writes a file of pseudorandom bytes, so the Asset data doesn't compress or deduplicate.
+ */
+bool writeRandomFile(const fs::path& path, size_t size) {
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    std::mt19937_64 random(size);
+    std::vector<uint64_t> block(64 * 1024);
+    while (file && size > 0) {
+        for (auto& word : block) {
+            word = random();
+        }
+        size_t blockSize = std::min(size, block.size() * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(block.data()), blockSize);
+        size -= blockSize;
+    }
+    return static_cast<bool>(file);
+}
+
+std::vector<size_t> parseWindows(const std::string& windows) {
+    std::vector<size_t> parsed;
+    std::stringstream stream(windows);
+    std::string window;
+    while (std::getline(stream, window, ',')) {
+        int value = std::atoi(window.c_str());
+        if (value > 0) {
+            parsed.push_back(static_cast<size_t>(value));
+        }
+    }
+    return parsed;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    gflags::SetUsageMessage("Times Asset file transfers against an in-process confab-server over loopback.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_minloglevel = 1;
+    google::InitGoogleLogging(argv[0]);
+
+    fs::path workPath = FLAGS_work_directory;
+    if (workPath.empty()) {
+        workPath = fs::temp_directory_path() / fs::path("confab-bench-" + std::to_string(getpid()));
+    }
+    fs::path databasePath = workPath / "db";
+    fs::path cachePath = workPath / "cache";
+    fs::path filePath = workPath / "bench.wav";
+    fs::create_directories(databasePath);
+    fs::create_directories(cachePath);
+
+    size_t fileSize = static_cast<size_t>(std::max(FLAGS_file_size_mb, 1)) * 1024 * 1024;
+    if (!writeRandomFile(filePath, fileSize)) {
+        LOG(ERROR) << "unable to write benchmark file " << filePath;
+        return -1;
+    }
+
+    std::shared_ptr<Confab::AssetDatabase> database(new Confab::AssetDatabase);
+    if (!database->open(databasePath.c_str(), true, 4 * 1024 * 1024)) {
+        return -1;
+    }
+    // The benchmark is the only peer, so give it the whole server.
+    Confab::HttpEndpoint::Options options;
+    options.listenPort = FLAGS_port;
+    options.numThreads = FLAGS_server_threads;
+    options.dataChunkSize = std::min(static_cast<size_t>(std::max(FLAGS_data_chunk_size_kb, 1)) * 1024,
+        Confab::kMaxDataChunkSize);
+    options.responseCacheSize = 0;
+    options.bulkThreads = 4;
+    options.limits.global = { { 256, 256, 256 } };
+    options.limits.perPeer = options.limits.global;
+    options.maxListWatchers = 16;
+    Confab::HttpEndpoint endpoint(options, database);
+    endpoint.startServerThread();
+
+    std::string serverUrl = "http://127.0.0.1:" + std::to_string(FLAGS_port);
+    size_t maxInFlight = static_cast<size_t>(std::max(FLAGS_max_requests_in_flight, 1));
+    double megabytes = fileSize / (1024.0 * 1024.0);
+    uint64_t key = 0;
+
+    // Uploading the same file again just overwrites the Asset and its chunks, so each repetition does the same work.
+    std::printf("%-16s %10s %10s\n", "upload window", "best s", "MB/s");
+    for (auto window : parseWindows(FLAGS_upload_windows)) {
+        Confab::HttpClient uploadClient(serverUrl, maxInFlight, window, FLAGS_single_pass_upload,
+            FLAGS_content_defined_chunks);
+        double best = 0;
+        for (int i = 0; i < std::max(FLAGS_repetitions, 1); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            key = uploadClient.postFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (key == 0) {
+                LOG(ERROR) << "upload failed with window " << window;
+                best = 0;
+                break;
+            }
+            best = best > 0 ? std::min(best, seconds) : seconds;
+        }
+        uploadClient.shutdown();
+        if (best > 0) {
+            std::printf("%-16zu %10.3f %10.1f\n", window, best, megabytes / best);
+        }
+    }
+
+    std::shared_ptr<Confab::HttpClient> httpClient(new Confab::HttpClient(serverUrl, maxInFlight));
+    if (key == 0) {
+        key = httpClient->postFileAsset(Confab::Asset::kSample, "", 0, 0, "", filePath);
+    }
+    Confab::ChunkLayout layout(0, 0, 0);
+    if (key != 0) {
+        httpClient->getAsset(key, [&layout](uint64_t assetKey, Confab::RecordPtr record) {
+            if (!record->empty()) {
+                layout = Confab::ChunkLayout::fromFlatAsset(Confab::Data::GetFlatAsset(record->data().data()));
+            }
+        });
+    }
+    if (key == 0 || !layout.valid()) {
+        LOG(ERROR) << "failed to upload or look up benchmark file " << filePath;
+    } else {
+        std::printf("\n%-16s %10s %10s\n", "download window", "best s", "MB/s");
+        for (auto window : parseWindows(FLAGS_download_windows)) {
+            Confab::CacheManager cacheManager(cachePath, fileSize * 2, httpClient, window);
+            double best = 0;
+            for (int i = 0; i < std::max(FLAGS_repetitions, 1); ++i) {
+                auto start = std::chrono::steady_clock::now();
+                fs::path downloaded = cacheManager.download(key, layout, ".wav");
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (downloaded.empty()) {
+                    LOG(ERROR) << "download failed with window " << window;
+                    best = 0;
+                    break;
+                }
+                fs::remove(downloaded);
+                best = best > 0 ? std::min(best, seconds) : seconds;
+            }
+            if (best > 0) {
+                std::printf("%-16zu %10.3f %10.1f\n", window, best, megabytes / best);
+            }
+        }
+    }
+
+    httpClient->shutdown();
+    endpoint.shutdown();
+    database->close();
+    fs::remove_all(workPath);
+    return key ? 0 : -1;
+}
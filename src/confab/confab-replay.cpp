@@ -0,0 +1,263 @@
+#include "AssetDatabase.hpp"
+#include "Constants.hpp"
+#include "HttpEndpoint.hpp"
+#include "Metrics.hpp"
+#include "RequestCapture.hpp"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "pistache/client.h"
+#include "pistache/http.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+DEFINE_string(capture_file, "", "Request capture file to replay, as recorded by confab-server --capture_file.");
+DEFINE_string(server_url, "http://localhost:9080", "Address of the confab-server to replay requests against. Note that "
+    "all replayed requests come from one peer, so the server's per-peer limits apply to all of them.");
+DEFINE_double(speed, 1.0, "Replay speed relative to the original arrival times, so 2 replays twice as fast. Zero "
+    "replays as fast as max_in_flight allows.");
+DEFINE_int32(max_in_flight, 64, "Maximum number of replayed requests awaiting a response at once.");
+DEFINE_int32(connections, 8, "Number of HTTP connections to open to the server.");
+DEFINE_int32(client_threads, 4, "Number of HTTP client threads.");
+DEFINE_int32(request_timeout_ms, 60000, "Replayed requests with no response after this many milliseconds count as "
+    "errors.");
+DEFINE_bool(in_process, false, "If true, replay against a server started in this process over the database at "
+    "database_path, instead of against server_url.");
+DEFINE_string(database_path, "../data/confab/db", "Database for the in-process server. Can't be the database of a "
+    "running confab-server, so replay against a copy.");
+DEFINE_int32(in_process_port, 9081, "Port for the in-process server to listen on.");
+DEFINE_int32(in_process_threads, 1, "Number of HTTP threads for the in-process server.");
+
+namespace {
+
+/*! Names the route a captured resource was sent to, from its first two path segments, such as "/asset/data".
+ */
+std::string routeOf(const std::string& resource) {
+    size_t end = resource.find('/', 1);
+    if (end != std::string::npos) {
+        end = resource.find('/', end + 1);
+    }
+    return resource.substr(0, end);
+}
+
+/*! Replays captured requests against a server, timing each from send to response.
+ */
+class Replayer {
+public:
+    Replayer(const std::string& serverUrl, size_t maxInFlight) :
+        m_serverUrl(serverUrl),
+        m_maxInFlight(std::max(maxInFlight, static_cast<size_t>(1))),
+        m_elapsed(0),
+        m_maxLag(0),
+        m_skipped(0),
+        m_inFlight(0),
+        m_errors(0),
+        m_bytesReceived(0) {
+        auto opts = Pistache::Http::Client::options()
+            .keepAlive(true)
+            .maxConnectionsPerHost(std::max(FLAGS_connections, 1))
+            .maxResponseSize(Confab::kMaxHttpMessageSize)
+            .threads(std::max(FLAGS_client_threads, 1));
+        m_client.init(opts);
+    }
+
+    ~Replayer() {
+        m_client.shutdown();
+    }
+
+    /*! Sends every request that can be replayed, paced by the captured arrival times, and waits for the responses.
+     *
+     * \param entries The captured requests.
+     * \param speed Replay speed relative to the capture, or 0 to replay as fast as possible.
+     */
+    void run(const std::vector<Confab::RequestCapture::Entry>& entries, double speed) {
+        // Create every histogram up front, so that response callbacks only ever read the map.
+        for (const auto& entry : entries) {
+            auto& histogram = m_routeLatency[routeOf(entry.resource)];
+            if (!histogram) {
+                histogram.reset(new Confab::Histogram);
+            }
+        }
+
+        m_start = std::chrono::steady_clock::now();
+        uint64_t firstTime = entries.empty() ? 0 : entries.front().time;
+        for (const auto& entry : entries) {
+            // Bodies too large to capture can't be replayed, and a GET body is only ever a name, so always captured.
+            if (!entry.hasBody) {
+                ++m_skipped;
+                continue;
+            }
+            if (speed > 0) {
+                auto due = m_start + std::chrono::microseconds(static_cast<uint64_t>((entry.time - firstTime) / speed));
+                auto now = std::chrono::steady_clock::now();
+                if (due > now) {
+                    std::this_thread::sleep_until(due);
+                } else {
+                    m_maxLag = std::max(m_maxLag, std::chrono::duration_cast<std::chrono::microseconds>(now - due));
+                }
+            }
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this] { return m_inFlight < m_maxInFlight; });
+                ++m_inFlight;
+            }
+            send(entry);
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_inFlight == 0; });
+        m_elapsed = std::chrono::steady_clock::now() - m_start;
+    }
+
+    /*! Prints throughput, response codes, and latency percentiles overall and by route.
+     */
+    void report() const {
+        double seconds = std::chrono::duration<double>(m_elapsed).count();
+        uint64_t responses = m_allLatency.count();
+        std::printf("replayed %llu requests in %.3f s: %.1f requests/s, %.2f MB/s received\n",
+            static_cast<unsigned long long>(responses + m_errors), seconds,
+            seconds > 0 ? (responses + m_errors) / seconds : 0.0,
+            seconds > 0 ? m_bytesReceived / seconds / (1024.0 * 1024.0) : 0.0);
+        if (m_skipped) {
+            std::printf("skipped %llu POST requests captured without their bodies\n",
+                static_cast<unsigned long long>(m_skipped));
+        }
+        if (m_errors) {
+            std::printf("%llu requests failed or timed out without a response\n",
+                static_cast<unsigned long long>(m_errors));
+        }
+        for (const auto& code : m_codes) {
+            std::printf("status %d: %llu\n", code.first, static_cast<unsigned long long>(code.second));
+        }
+        if (FLAGS_speed > 0) {
+            std::printf("fell at most %.3f ms behind the capture schedule\n", m_maxLag.count() / 1000.0);
+        }
+
+        std::printf("\n%-24s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "p50", "p90", "p99", "p99.9");
+        printLatency("all", m_allLatency);
+        for (const auto& route : m_routeLatency) {
+            printLatency(route.first, *route.second);
+        }
+    }
+
+private:
+    void send(const Confab::RequestCapture::Entry& entry) {
+        std::string url = m_serverUrl + entry.resource;
+        auto builder = entry.method == Confab::RequestCapture::kPost ? m_client.post(url) : m_client.get(url);
+        Confab::Histogram* routeLatency = m_routeLatency[routeOf(entry.resource)].get();
+        auto sent = std::chrono::steady_clock::now();
+        auto promise = builder
+            .body(entry.body)
+            .timeout(std::chrono::milliseconds(FLAGS_request_timeout_ms))
+            .send();
+        promise.then([this, routeLatency, sent](Pistache::Http::Response response) {
+            uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - sent).count();
+            m_allLatency.record(micros);
+            routeLatency->record(micros);
+            complete(static_cast<int>(response.code()), response.body().size());
+        }, [this](std::exception_ptr) {
+            complete(0, 0);
+        });
+    }
+
+    void complete(int code, size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (code) {
+                ++m_codes[code];
+                m_bytesReceived += bytes;
+            } else {
+                ++m_errors;
+            }
+            --m_inFlight;
+        }
+        m_condition.notify_all();
+    }
+
+    static void printLatency(const std::string& name, const Confab::Histogram& histogram) {
+        std::printf("%-24s %10llu %10llu %10llu %10llu %10llu\n", name.c_str(),
+            static_cast<unsigned long long>(histogram.count()),
+            static_cast<unsigned long long>(histogram.quantile(0.5)),
+            static_cast<unsigned long long>(histogram.quantile(0.9)),
+            static_cast<unsigned long long>(histogram.quantile(0.99)),
+            static_cast<unsigned long long>(histogram.quantile(0.999)));
+    }
+
+    const std::string m_serverUrl;
+    const size_t m_maxInFlight;
+    Pistache::Http::Client m_client;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_elapsed;
+    std::chrono::microseconds m_maxLag;
+    uint64_t m_skipped;
+
+    Confab::Histogram m_allLatency;
+    std::map<std::string, std::unique_ptr<Confab::Histogram>> m_routeLatency;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    size_t m_inFlight;
+    std::map<int, uint64_t> m_codes;
+    uint64_t m_errors;
+    uint64_t m_bytesReceived;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    gflags::SetUsageMessage("Replays a confab-server request capture, reporting latency percentiles and throughput.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    google::InitGoogleLogging(argv[0]);
+
+    std::vector<Confab::RequestCapture::Entry> entries;
+    if (FLAGS_capture_file.empty()) {
+        LOG(ERROR) << "no --capture_file given to replay.";
+        return -1;
+    }
+    if (!Confab::RequestCapture::load(FLAGS_capture_file, entries)) {
+        return -1;
+    }
+    LOG(INFO) << "loaded " << entries.size() << " requests from " << FLAGS_capture_file;
+
+    std::shared_ptr<Confab::AssetDatabase> database;
+    std::unique_ptr<Confab::HttpEndpoint> endpoint;
+    std::string serverUrl = FLAGS_server_url;
+    if (FLAGS_in_process) {
+        database.reset(new Confab::AssetDatabase);
+        if (!database->open(FLAGS_database_path.c_str(), false, 4 * 1024 * 1024)) {
+            return -1;
+        }
+        // Replayed requests all come from this one peer, so give it the whole server.
+        Confab::HttpEndpoint::Options options;
+        options.listenPort = FLAGS_in_process_port;
+        options.numThreads = FLAGS_in_process_threads;
+        options.limits.perPeer = options.limits.global;
+        endpoint.reset(new Confab::HttpEndpoint(options, database));
+        endpoint->startServerThread();
+        serverUrl = "http://127.0.0.1:" + std::to_string(FLAGS_in_process_port);
+        LOG(INFO) << "started in-process server over " << FLAGS_database_path << " on port " << FLAGS_in_process_port;
+    }
+
+    {
+        Replayer replayer(serverUrl, static_cast<size_t>(std::max(FLAGS_max_in_flight, 1)));
+        replayer.run(entries, std::max(FLAGS_speed, 0.0));
+        replayer.report();
+    }
+
+    if (endpoint) {
+        endpoint->shutdown();
+        database->close();
+    }
+    return 0;
+}
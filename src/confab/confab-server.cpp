@@ -1,14 +1,51 @@
 #include "ConfabCommon.hpp"
 #include "Constants.hpp"
 #include "HttpEndpoint.hpp"
+#include "Tracer.hpp"
 #include "common/Version.hpp"
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include <algorithm>
+#include <chrono>
+
 // Command line flags for the HTTP server.
 DEFINE_int32(http_listen_port, 9080, "HTTP port on localhost to listen to incoming HTTP requests from confab peers.");
 DEFINE_int32(http_listen_threads, 1, "Number of thread to use for listening to HTTP requests.");
+DEFINE_int32(data_chunk_size_kb, Confab::kDefaultDataChunkSize / 1024, "Size in kilobytes of the AssetData chunks "
+    "clients should split newly added file Assets into. Existing Assets keep the chunk size they were added with.");
+DEFINE_int32(db_metadata_threads, 2, "Number of database worker threads serving Asset, name, and List requests.");
+DEFINE_int32(db_bulk_threads, 2, "Number of database worker threads serving AssetData chunk requests, kept separate "
+    "so that large transfers don't delay metadata requests.");
+DEFINE_int32(max_metadata_requests, 256, "Maximum number of Asset and name requests to accept at once, beyond which "
+    "requests are rejected with 503 Service Unavailable.");
+DEFINE_int32(max_list_requests, 256, "Maximum number of List requests to accept at once.");
+DEFINE_int32(max_bulk_requests, 32, "Maximum number of AssetData chunk requests to accept at once.");
+DEFINE_int32(max_peer_requests, 64, "Maximum number of Asset, name, or List requests to accept at once from any one "
+    "peer, applied to each class separately.");
+DEFINE_int32(max_peer_bulk_requests, 8, "Maximum number of AssetData chunk requests to accept at once from any one "
+    "peer.");
+DEFINE_int32(list_watch_timeout_s, 30, "Number of seconds a /list/watch request waits for new List entries before "
+    "returning with none.");
+DEFINE_int32(upload_session_timeout_s, 86400, "Number of seconds an upload may go without a chunk being staged before "
+    "its staged chunks are deleted, or 0 to keep them until committed.");
+DEFINE_int32(max_list_watchers, 1024, "Maximum number of /list/watch requests to hold open at once.");
+DEFINE_int32(list_page_size, Confab::kDefaultListPageSize, "Maximum number of entries returned in each page of List "
+    "items.");
+DEFINE_int32(response_cache_size_mb, 64, "Size in megabytes of the in-memory cache of encoded Asset and AssetData "
+    "responses, for serving the same Assets to many clients at once.");
+DEFINE_double(trace_sample_rate, 0.01, "Fraction of requests to record span traces for, from 0 to 1. The most recent "
+    "traces can be downloaded as Chrome trace JSON from /trace.");
+DEFINE_int32(trace_buffer_size, 256, "Number of most recent sampled request traces to keep for /trace.");
+DEFINE_int32(slow_request_ms, 1000, "Sampled requests taking at least this many milliseconds are logged with their "
+    "full span tree. Zero disables the log.");
+DEFINE_bool(trace_all_slow_requests, false, "If set, every request is traced so that those taking at least "
+    "--slow_request_ms are logged, and kept for /trace, whether sampled or not. Adds a trace to every request.");
+DEFINE_string(capture_file, "", "If set, every Asset and List request received is recorded to this file, for replay "
+    "with confab-replay.");
+DEFINE_int32(capture_max_body_bytes, 4096, "Request bodies up to this many bytes are recorded in full in the capture "
+    "file, larger ones by size and hash only.");
 
 int main(int argc, char* argv[]) {
     Confab::ConfabCommon common;
@@ -18,8 +55,41 @@ int main(int argc, char* argv[]) {
 
     LOG(INFO) << "Starting confab-server v" << Confab::confabVersion.toString() << " on pid " << getpid();
 
+    size_t dataChunkSize = static_cast<size_t>(FLAGS_data_chunk_size_kb) * 1024;
+    if (dataChunkSize == 0 || dataChunkSize > Confab::kMaxDataChunkSize) {
+        LOG(ERROR) << "data chunk size " << dataChunkSize << " out of range, maximum is "
+            << Confab::kMaxDataChunkSize;
+        common.shutdown();
+        return -1;
+    }
+
+    Confab::Tracer::global().configure(FLAGS_trace_sample_rate,
+        static_cast<size_t>(std::max(FLAGS_trace_buffer_size, 0)),
+        std::chrono::milliseconds(std::max(FLAGS_slow_request_ms, 0)), FLAGS_trace_all_slow_requests);
+
     LOG(INFO) << "Starting HTTP on port " << FLAGS_http_listen_port << ".";
-    Confab::HttpEndpoint httpEndpoint(FLAGS_http_listen_port, FLAGS_http_listen_threads, common.assetDatabase());
+    Confab::HttpEndpoint::Options options;
+    options.listenPort = FLAGS_http_listen_port;
+    options.numThreads = FLAGS_http_listen_threads;
+    options.dataChunkSize = dataChunkSize;
+    options.responseCacheSize = static_cast<size_t>(std::max(FLAGS_response_cache_size_mb, 0)) * 1024 * 1024;
+    options.metadataThreads = FLAGS_db_metadata_threads;
+    options.bulkThreads = FLAGS_db_bulk_threads;
+    options.limits.global = { {
+        static_cast<size_t>(std::max(FLAGS_max_metadata_requests, 1)),
+        static_cast<size_t>(std::max(FLAGS_max_list_requests, 1)),
+        static_cast<size_t>(std::max(FLAGS_max_bulk_requests, 1)) } };
+    options.limits.perPeer = { {
+        static_cast<size_t>(std::max(FLAGS_max_peer_requests, 1)),
+        static_cast<size_t>(std::max(FLAGS_max_peer_requests, 1)),
+        static_cast<size_t>(std::max(FLAGS_max_peer_bulk_requests, 1)) } };
+    options.listWatchTimeout = std::chrono::seconds(std::max(FLAGS_list_watch_timeout_s, 1));
+    options.uploadSessionTimeout = std::chrono::seconds(std::max(FLAGS_upload_session_timeout_s, 0));
+    options.maxListWatchers = static_cast<size_t>(std::max(FLAGS_max_list_watchers, 0));
+    options.listPageSize = std::min(static_cast<size_t>(std::max(FLAGS_list_page_size, 1)), Confab::kMaxListPageSize);
+    options.capturePath = FLAGS_capture_file;
+    options.captureMaxBodySize = static_cast<size_t>(std::max(FLAGS_capture_max_body_bytes, 0));
+    Confab::HttpEndpoint httpEndpoint(options, common.assetDatabase());
 
     httpEndpoint.startServerThread();
 
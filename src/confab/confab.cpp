@@ -3,11 +3,13 @@
 #include "Constants.hpp"
 #include "HttpClient.hpp"
 #include "OscHandler.hpp"
+#include "UpstreamQueue.hpp"
 #include "common/Version.hpp"
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include <algorithm>
 #include <experimental/filesystem>
 #include <future>
 #include <memory>
@@ -19,7 +21,20 @@ DEFINE_int32(max_cache_size_gb, 4, "Maximum size of Asset file cache in gigabyte
 DEFINE_int32(osc_listen_port, 4248, "UDP port on localhost to listen for incoming OSC commands from SuperCollider.");
 DEFINE_int32(osc_respond_port, 4249, "UDP port on localhost to send response messages to SuperCollider.");
 
-DEFINE_string(server_url, "http://sclork-s01.local:9080", "Address for HTTP communication with Confab server.");
+DEFINE_string(server_url, "http://sclork-s01.local:9080", "Address for HTTP communication with Confab server, or a "
+    "comma-separated list of addresses of mirrored servers, each request going to the fastest healthy one.");
+DEFINE_int32(max_requests_in_flight, Confab::HttpClient::kDefaultMaxInFlight, "Maximum number of requests to have in "
+    "flight to the Confab servers at once, beyond which requests wait in a queue. A quarter of these are kept for "
+    "interactive lookups, and another quarter for them and prefetches, so bulk transfers can't take them all.");
+DEFINE_int32(upload_window, Confab::HttpClient::kDefaultUploadWindow, "Maximum number of AssetData chunk POSTs of "
+    "each file upload to have in flight at once.");
+DEFINE_bool(single_pass_add, true, "If true, file Assets uploaded directly to the server are read once, staging chunks "
+    "on the server until the key is computed. Set false for servers that predate upload staging.");
+DEFINE_bool(content_defined_chunks, false, "If true, added files are split into AssetData chunks at boundaries chosen "
+    "by their content, so a new version of a file shares most of its chunks with the old one. Servers must understand "
+    "chunk offsets in Assets.");
+DEFINE_int32(download_window, Confab::CacheManager::kDefaultDownloadWindow, "Maximum number of AssetData chunks of "
+    "each file download to request ahead of the last verified chunk.");
 
 int main(int argc, char* argv[]) {
     Confab::ConfabCommon common;
@@ -29,18 +44,23 @@ int main(int argc, char* argv[]) {
 
     LOG(INFO) << "Starting confab v" << Confab::confabVersion.toString() << " on pid " << getpid();
 
-    std::shared_ptr<Confab::HttpClient> httpClient(new Confab::HttpClient(FLAGS_server_url));
+    std::shared_ptr<Confab::HttpClient> httpClient(new Confab::HttpClient(FLAGS_server_url,
+        static_cast<size_t>(std::max(FLAGS_max_requests_in_flight, 1)),
+        static_cast<size_t>(std::max(FLAGS_upload_window, 1)), FLAGS_single_pass_add, FLAGS_content_defined_chunks));
     uint64_t maxCache = static_cast<uint64_t>(FLAGS_max_cache_size_gb) * 1024ULL * 1024ULL * 1024ULL;
     std::shared_ptr<Confab::CacheManager> cacheManager(new Confab::CacheManager(FLAGS_data_directory + "/cache",
-        maxCache, httpClient));
+        maxCache, httpClient, static_cast<size_t>(std::max(FLAGS_download_window, 1))));
     std::async(std::launch::async, [&cacheManager] {
         cacheManager->checkExistingEntries(FLAGS_validate_file_cache);
     });
 
     LOG(INFO) << "Opening up OSC ports for listen on " << FLAGS_osc_listen_port << " and respond on "
         << FLAGS_osc_respond_port;
+    // New Assets are stored locally first, and sent upstream in the background.
+    std::shared_ptr<Confab::UpstreamQueue> upstreamQueue(new Confab::UpstreamQueue(common.assetDatabase(), httpClient,
+        static_cast<size_t>(std::max(FLAGS_upload_window, 1)), FLAGS_content_defined_chunks));
     Confab::OscHandler osc(FLAGS_osc_listen_port, FLAGS_osc_respond_port, common.assetDatabase(), httpClient,
-        cacheManager);
+        cacheManager, upstreamQueue);
     osc.run();
 
     common.waitForTerminationSignal();